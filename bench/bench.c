@@ -0,0 +1,372 @@
+#include <getopt.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "version.h"
+#include "benchmarks.h"
+#include "parser.h"
+#include "prettyprint.h"
+#include "system.h"
+#include "memory.h"
+#include "error.h"
+#include "interpreter.h"
+#include "profiler.h"
+#include "jit.h"
+#include "quicken.h"
+#include "intern.h"
+#include "instrument.h"
+#include "compiler.h"
+#include "module.h"
+
+#ifndef SCHEMIN_INCLUDE_DIR
+#define SCHEMIN_INCLUDE_DIR "."
+#endif
+
+#define DEFAULT_RUNS 10
+#define DEFAULT_WARMUP 2
+#define DEFAULT_THRESHOLD_PERCENT 10.0
+#define MAX_BASELINE_ENTRIES 64
+#define MAX_NAME_LEN 64
+
+typedef struct bench_result_s {
+  const char *name;
+  uint64_t min_ns;
+  uint64_t median_ns;
+  uint64_t p95_ns;
+  uint64_t objects;
+  uint64_t conses;
+  uint64_t bytes;
+} bench_result_t;
+
+typedef struct baseline_entry_s {
+  char name[MAX_NAME_LEN];
+  uint64_t median_ns;
+} baseline_entry_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static object_t *parse_statement(const char *statement) {
+  size_t len = strlen(statement);
+  ASSERT_OR_ERROR(quick_verify_scheme(statement, len), "Invalid scheme in benchmark");
+  return valid_exp_into_object(statement, len);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint64_t percentile(const uint64_t *sorted, int count, int pct) {
+  int idx = (pct * count + 99) / 100 - 1;
+  if (idx < 0) idx = 0;
+  if (idx >= count) idx = count - 1;
+  return sorted[idx];
+}
+
+static void check_result(const benchmark_t *bench, object_t *result) {
+  if (result->type == SCHEME_NUMBER && result->number_or_index == bench->expected) {
+    return;
+  }
+
+  fprintf(stderr, "%s: expected %lld, got ", bench->name, (long long)bench->expected);
+  fflush(stdout);
+  print_object(result);
+  printf("\n");
+  fflush(stdout);
+  error("Benchmark produced the wrong result");
+}
+
+// Loads a check's setup from a module built by schemin-compile's compiler
+static void load_compiled_setup(const benchmark_t *check) {
+  size_t len = 0;
+  for (size_t i = 0; i < check->num_setup; i++) {
+    len += strlen(check->setup[i]) + 1;
+  }
+  char *source = (char*)malloc(len + 1);
+  ASSERT_OR_ERROR(source != NULL, "Could not allocate check source");
+  char *at = source;
+  for (size_t i = 0; i < check->num_setup; i++) {
+    size_t n = strlen(check->setup[i]);
+    memcpy(at, check->setup[i], n);
+    at[n] = '\n';
+    at += n + 1;
+  }
+  *at = '\0';
+
+  char dir[] = "/tmp/schemin-bench-XXXXXX";
+  ASSERT_OR_ERROR(mkdtemp(dir) != NULL, "Could not make a directory for the compiled check");
+  char c_path[sizeof(dir) + 16];
+  char module_path[sizeof(dir) + 16];
+  snprintf(c_path, sizeof(c_path), "%s/check.c", dir);
+  snprintf(module_path, sizeof(module_path), "%s/check.so", dir);
+
+  FILE *out = fopen(c_path, "w");
+  ASSERT_OR_ERROR(out != NULL, "Could not write the compiled check");
+  int result = compile_to_c(source, len, check->name, out, NULL);
+  ASSERT_OR_ERROR(fclose(out) == 0 && result == 0, "Could not write the compiled check");
+  ASSERT_OR_ERROR(build_module(SCHEMIN_INCLUDE_DIR, c_path, module_path) == 0, "Could not build the compiled check");
+  ASSERT_OR_ERROR(module_load(module_path) == 0, "Could not load the compiled check");
+
+  // A loaded module stays mapped after its file is gone
+  unlink(module_path);
+  unlink(c_path);
+  rmdir(dir);
+  free(source);
+}
+
+static void run_check(const benchmark_t *check, bool compiled) {
+  if (compiled) {
+    load_compiled_setup(check);
+  } else {
+    for (size_t i = 0; i < check->num_setup; i++) {
+      eval(parse_statement(check->setup[i]));
+    }
+  }
+  check_result(check, eval(parse_statement(check->run)));
+}
+
+static void run_benchmark(const benchmark_t *bench, int runs, int warmup, bench_result_t *outresult) {
+  for (size_t i = 0; i < bench->num_setup; i++) {
+    eval(parse_statement(bench->setup[i]));
+  }
+
+  object_t *run = parse_statement(bench->run);
+  for (int i = 0; i < warmup; i++) {
+    check_result(bench, eval(run));
+  }
+
+  uint64_t *samples = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)runs);
+  memory_stats_t before, after;
+  for (int i = 0; i < runs; i++) {
+    memory_get_stats(&before);
+    uint64_t start = now_ns();
+    object_t *result = eval(run);
+    samples[i] = now_ns() - start;
+    memory_get_stats(&after);
+    check_result(bench, result);
+  }
+
+  qsort(samples, (size_t)runs, sizeof(uint64_t), compare_u64);
+  outresult->name = bench->name;
+  outresult->min_ns = samples[0];
+  outresult->median_ns = percentile(samples, runs, 50);
+  outresult->p95_ns = percentile(samples, runs, 95);
+  outresult->objects = after.objects - before.objects;
+  outresult->conses = after.conses - before.conses;
+  outresult->bytes = after.bytes - before.bytes;
+  free(samples);
+}
+
+static void write_json(FILE *out, const bench_result_t *results, size_t count, int runs, int warmup) {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"version\": \"%d.%d\",\n", SCHEMIN_VERSION_MAJOR, SCHEMIN_VERSION_MINOR);
+  fprintf(out, "  \"runs\": %d,\n", runs);
+  fprintf(out, "  \"warmup\": %d,\n", warmup);
+  fprintf(out, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < count; i++) {
+    const bench_result_t *r = &results[i];
+    // One benchmark per line so that load_baseline can read it back without a JSON parser
+    fprintf(out, "    {\"name\": \"%s\", \"min_ns\": %llu, \"median_ns\": %llu, \"p95_ns\": %llu, "
+                 "\"objects\": %llu, \"conses\": %llu, \"bytes\": %llu}%s\n",
+            r->name, (unsigned long long)r->min_ns, (unsigned long long)r->median_ns,
+            (unsigned long long)r->p95_ns, (unsigned long long)r->objects,
+            (unsigned long long)r->conses, (unsigned long long)r->bytes,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+}
+
+static size_t load_baseline(const char *path, baseline_entry_t *entries, size_t max_entries) {
+  FILE *in = fopen(path, "r");
+  ASSERT_OR_ERROR(in != NULL, "Could not open baseline file");
+
+  size_t count = 0;
+  char line[1024];
+  while (count < max_entries && fgets(line, sizeof(line), in) != NULL) {
+    const char *name = strstr(line, "\"name\": \"");
+    const char *median = strstr(line, "\"median_ns\": ");
+    if (name == NULL || median == NULL) continue;
+
+    baseline_entry_t *entry = &entries[count];
+    if (sscanf(name, "\"name\": \"%63[^\"]\"", entry->name) != 1) continue;
+    unsigned long long value;
+    if (sscanf(median, "\"median_ns\": %llu", &value) != 1) continue;
+    entry->median_ns = value;
+    count++;
+  }
+
+  fclose(in);
+  return count;
+}
+
+static int compare_to_baseline(const bench_result_t *results, size_t count, const baseline_entry_t *baseline, size_t baseline_count, double threshold) {
+  int regressions = 0;
+  fprintf(stderr, "\n%-12s %14s %14s %9s\n", "benchmark", "baseline(us)", "current(us)", "change");
+  for (size_t i = 0; i < count; i++) {
+    const bench_result_t *r = &results[i];
+    const baseline_entry_t *base = NULL;
+    for (size_t j = 0; j < baseline_count; j++) {
+      if (strcmp(baseline[j].name, r->name) == 0) {
+        base = &baseline[j];
+        break;
+      }
+    }
+
+    if (base == NULL || base->median_ns == 0) {
+      fprintf(stderr, "%-12s %14s %14.1f %9s\n", r->name, "-", (double)r->median_ns / 1000.0, "new");
+      continue;
+    }
+
+    double change = ((double)r->median_ns - (double)base->median_ns) * 100.0 / (double)base->median_ns;
+    bool regressed = change > threshold;
+    if (regressed) regressions++;
+    fprintf(stderr, "%-12s %14.1f %14.1f %+8.1f%%%s\n", r->name, (double)base->median_ns / 1000.0,
+            (double)r->median_ns / 1000.0, change, regressed ? "  REGRESSION" : "");
+  }
+
+  return regressions;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--runs N] [--warmup N] [--filter NAME] [--output FILE]\n"
+          "          [--baseline FILE] [--threshold PERCENT] [--profile PREFIX] [--stats]\n"
+          "          [--jit-threshold N] [--no-quicken] [--intern-constants] [--list]\n"
+          "          [--compile-checks] [--checks-only]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  setlocale(LC_ALL, "");
+
+  int runs = DEFAULT_RUNS;
+  int warmup = DEFAULT_WARMUP;
+  double threshold = DEFAULT_THRESHOLD_PERCENT;
+  const char *filter = NULL;
+  const char *output = NULL;
+  const char *baseline_path = NULL;
+  const char *profile_prefix = NULL;
+  bool stats = false;
+  long jit_threshold = JIT_DEFAULT_THRESHOLD;
+  bool quicken = true;
+  bool intern_constants = false;
+  bool compile_checks = false;
+  bool checks_only = false;
+
+  static const struct option options[] = {
+    {"runs", required_argument, NULL, 'r'},
+    {"warmup", required_argument, NULL, 'w'},
+    {"filter", required_argument, NULL, 'f'},
+    {"output", required_argument, NULL, 'o'},
+    {"baseline", required_argument, NULL, 'b'},
+    {"threshold", required_argument, NULL, 't'},
+    {"profile", required_argument, NULL, 'p'},
+    {"stats", no_argument, NULL, 's'},
+    {"jit-threshold", required_argument, NULL, 'j'},
+    {"no-quicken", no_argument, NULL, 'q'},
+    {"intern-constants", no_argument, NULL, 'i'},
+    {"list", no_argument, NULL, 'l'},
+    {"compile-checks", no_argument, NULL, 'c'},
+    {"checks-only", no_argument, NULL, 'k'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "r:w:f:o:b:t:p:slh", options, NULL)) != -1) {
+    switch (opt) {
+      case 'r': runs = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'f': filter = optarg; break;
+      case 'o': output = optarg; break;
+      case 'b': baseline_path = optarg; break;
+      case 't': threshold = atof(optarg); break;
+      case 'p': profile_prefix = optarg; break;
+      case 's': stats = true; break;
+      case 'j': jit_threshold = atol(optarg); break;
+      case 'q': quicken = false; break;
+      case 'i': intern_constants = true; break;
+      case 'c': compile_checks = true; break;
+      case 'k': checks_only = true; break;
+      case 'l': {
+        for (size_t i = 0; i < g_num_benchmarks; i++) {
+          printf("%s\n", g_benchmarks[i].name);
+        }
+        return 0;
+      }
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  ASSERT_OR_ERROR(runs > 0, "--runs must be positive");
+  ASSERT_OR_ERROR(warmup >= 0, "--warmup must not be negative");
+  ASSERT_OR_ERROR(jit_threshold >= 0 && jit_threshold <= UINT32_MAX, "--jit-threshold out of range");
+  ASSERT_OR_ERROR(system_init() == 0, "Could not init system");
+  jit_set_threshold((uint32_t)jit_threshold);
+  quicken_set_enabled(quicken);
+  intern_set_enabled(intern_constants);
+  // Checked before the profiler and counters start, so they see only the benchmarks
+  for (size_t i = 0; i < g_num_checks; i++) {
+    run_check(&g_checks[i], compile_checks);
+  }
+  fprintf(stderr, "checks passed: %zu\n", g_num_checks);
+  if (checks_only) return 0;
+
+  if (profile_prefix != NULL) {
+    ASSERT_OR_ERROR(profiler_start(PROFILER_DEFAULT_HZ) == 0, "Could not start profiler");
+  }
+  if (stats) instrument_enable_counting();
+
+  bench_result_t *results = (bench_result_t*)calloc(g_num_benchmarks, sizeof(bench_result_t));
+  size_t count = 0;
+  for (size_t i = 0; i < g_num_benchmarks; i++) {
+    const benchmark_t *bench = &g_benchmarks[i];
+    if (filter != NULL && strstr(bench->name, filter) == NULL) continue;
+
+    bench_result_t *r = &results[count++];
+    run_benchmark(bench, runs, warmup, r);
+    fprintf(stderr, "%-12s min %10.1fus  median %10.1fus  p95 %10.1fus  objects %10llu  conses %10llu  bytes %10llu\n",
+            r->name, (double)r->min_ns / 1000.0, (double)r->median_ns / 1000.0, (double)r->p95_ns / 1000.0,
+            (unsigned long long)r->objects, (unsigned long long)r->conses, (unsigned long long)r->bytes);
+  }
+
+  if (profile_prefix != NULL) {
+    profiler_stop();
+    ASSERT_OR_ERROR(profiler_write_files(profile_prefix) == 0, "Could not write profile");
+  }
+  if (stats) {
+    instrument_write_report(stderr);
+    jit_write_report(stderr);
+    quicken_write_report(stderr);
+    intern_write_report(stderr);
+  }
+
+  FILE *out = stdout;
+  if (output != NULL) {
+    out = fopen(output, "w");
+    ASSERT_OR_ERROR(out != NULL, "Could not open output file");
+  }
+  write_json(out, results, count, runs, warmup);
+  if (out != stdout) fclose(out);
+
+  int status = 0;
+  if (baseline_path != NULL) {
+    baseline_entry_t baseline[MAX_BASELINE_ENTRIES];
+    size_t baseline_count = load_baseline(baseline_path, baseline, MAX_BASELINE_ENTRIES);
+    if (compare_to_baseline(results, count, baseline, baseline_count, threshold) > 0) {
+      status = 1;
+    }
+  }
+
+  free(results);
+  return status;
+}
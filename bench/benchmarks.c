@@ -0,0 +1,237 @@
+#include "benchmarks.h"
+
+/*
+ * Programs only use define, lambda, if, begin, quote and set!, so timings stay
+ * comparable with baselines taken before the evaluator handled let, let*,
+ * letrec, named let, cond, and, or and do natively. Variables are dynamically
+ * scoped and every call extends the caller's environment, so long loops are
+ * split recursively (see the *-rep helpers) to keep the environment chain
+ * shallow.
+ */
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+static const char *fib_setup[] = {
+  "(define fib\
+    (lambda (n)\
+     (if (< n 2)\
+      n\
+      (+ (fib (- n 1)) (fib (- n 2))))))"
+};
+
+static const char *tak_setup[] = {
+  "(define tak\
+    (lambda (x y z)\
+     (if (< y x)\
+      (tak (tak (- x 1) y z)\
+           (tak (- y 1) z x)\
+           (tak (- z 1) x y))\
+      z)))"
+};
+
+static const char *ack_setup[] = {
+  "(define ack\
+    (lambda (m n)\
+     (if (= m 0)\
+      (+ n 1)\
+      (if (= n 0)\
+       (ack (- m 1) 1)\
+       (ack (- m 1) (ack m (- n 1)))))))"
+};
+
+static const char *nqueens_setup[] = {
+  "(define nq-iota\
+    (lambda (n)\
+     (if (= n 0)\
+      (quote ())\
+      (cons n (nq-iota (- n 1))))))",
+  "(define nq-append\
+    (lambda (a b)\
+     (if (null? a)\
+      b\
+      (cons (car a) (nq-append (cdr a) b)))))",
+  "(define nq-ok\
+    (lambda (row dist placed)\
+     (if (null? placed)\
+      true\
+      (if (= (car placed) (+ row dist))\
+       false\
+       (if (= (car placed) (- row dist))\
+        false\
+        (nq-ok row (+ dist 1) (cdr placed)))))))",
+  "(define nq-try\
+    (lambda (x y z)\
+     (if (null? x)\
+      (if (null? y) 1 0)\
+      (+ (if (nq-ok (car x) 1 z)\
+          (nq-try (nq-append (cdr x) y) (quote ()) (cons (car x) z))\
+          0)\
+         (nq-try (cdr x) (cons (car x) y) z)))))",
+  "(define queens\
+    (lambda (n)\
+     (nq-try (nq-iota n) (quote ()) (quote ()))))"
+};
+
+static const char *deriv_setup[] = {
+  "(define deriv-map\
+    (lambda (l)\
+     (if (null? l)\
+      (quote ())\
+      (cons (deriv (car l)) (deriv-map (cdr l))))))",
+  "(define deriv-map-quotient\
+    (lambda (l)\
+     (if (null? l)\
+      (quote ())\
+      (cons (cons (quote /) (cons (deriv (car l)) (cons (car l) (quote ()))))\
+            (deriv-map-quotient (cdr l))))))",
+  "(define deriv\
+    (lambda (a)\
+     (if (pair? a)\
+      (if (eq? (car a) (quote +))\
+       (cons (quote +) (deriv-map (cdr a)))\
+       (if (eq? (car a) (quote -))\
+        (cons (quote -) (deriv-map (cdr a)))\
+        (if (eq? (car a) (quote *))\
+         (cons (quote *)\
+               (cons a (cons (cons (quote +) (deriv-map-quotient (cdr a))) (quote ()))))\
+         (quote error))))\
+      (if (eq? a (quote x)) 1 0))))",
+  "(define deriv-size\
+    (lambda (tree)\
+     (if (pair? tree)\
+      (+ (deriv-size (car tree)) (deriv-size (cdr tree)))\
+      1)))",
+  "(define deriv-rep\
+    (lambda (n)\
+     (if (= n 1)\
+      (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))\
+      (begin\
+       (deriv-rep (quotient n 2))\
+       (deriv-rep (- n (quotient n 2)))))))"
+};
+
+static const char *destruct_setup[] = {
+  "(define destruct-row\
+    (lambda (m)\
+     (if (= m 0)\
+      (quote ())\
+      (cons m (destruct-row (- m 1))))))",
+  "(define destruct-make\
+    (lambda (n m)\
+     (if (= n 0)\
+      (quote ())\
+      (cons (destruct-row m) (destruct-make (- n 1) m)))))",
+  "(define destruct-reverse!\
+    (lambda (l acc)\
+     (if (null? l)\
+      acc\
+      (destruct-link! l (cdr l) acc))))",
+  "(define destruct-link!\
+    (lambda (l next acc)\
+     (begin\
+      (set-cdr! l acc)\
+      (destruct-reverse! next l))))",
+  "(define destruct-all\
+    (lambda (rows)\
+     (if (null? rows)\
+      (quote ())\
+      (begin\
+       (set-car! rows (destruct-reverse! (car rows) (quote ())))\
+       (destruct-all (cdr rows))))))",
+  "(define destruct-table (quote ()))",
+  "(define destruct-rep\
+    (lambda (n)\
+     (if (= n 1)\
+      (destruct-all destruct-table)\
+      (begin\
+       (destruct-rep (quotient n 2))\
+       (destruct-rep (- n (quotient n 2)))))))"
+};
+
+static const char *primes_setup[] = {
+  "(define primes-iota\
+    (lambda (a b)\
+     (if (> a b)\
+      (quote ())\
+      (cons a (primes-iota (+ a 1) b)))))",
+  "(define primes-remove\
+    (lambda (p l)\
+     (if (null? l)\
+      l\
+      (if (= (remainder (car l) p) 0)\
+       (primes-remove p (cdr l))\
+       (cons (car l) (primes-remove p (cdr l)))))))",
+  "(define primes-sieve\
+    (lambda (l)\
+     (if (null? l)\
+      l\
+      (cons (car l) (primes-sieve (primes-remove (car l) (cdr l)))))))",
+  "(define primes-count\
+    (lambda (l)\
+     (if (null? l)\
+      0\
+      (+ 1 (primes-count (cdr l))))))"
+};
+
+static const char *strbuild_setup[] = {
+  "(define strbuild\
+    (lambda (n)\
+     (if (= n 0)\
+      \"\"\
+      (string-append (strbuild (- n 1)) \"abcdefgh\"))))",
+  "(define strbuild-rep\
+    (lambda (n)\
+     (if (= n 1)\
+      (string-length (strbuild 200))\
+      (+ (strbuild-rep (quotient n 2))\
+         (strbuild-rep (- n (quotient n 2)))))))"
+};
+
+const benchmark_t g_benchmarks[] = {
+  {"fib", fib_setup, COUNT_OF(fib_setup), "(fib 20)", 6765},
+  {"tak", tak_setup, COUNT_OF(tak_setup), "(tak 16 11 6)", 11},
+  {"ack", ack_setup, COUNT_OF(ack_setup), "(ack 3 4)", 125},
+  {"nqueens", nqueens_setup, COUNT_OF(nqueens_setup), "(queens 7)", 40},
+  {"deriv", deriv_setup, COUNT_OF(deriv_setup), "(deriv-size (deriv-rep 300))", 61},
+  {"destruct", destruct_setup, COUNT_OF(destruct_setup),
+   "(begin\
+     (set! destruct-table (destruct-make 25 20))\
+     (destruct-rep 10)\
+     (car (car destruct-table)))", 20},
+  {"primes", primes_setup, COUNT_OF(primes_setup), "(primes-count (primes-sieve (primes-iota 2 300)))", 62},
+  {"strbuild", strbuild_setup, COUNT_OF(strbuild_setup), "(strbuild-rep 20)", 32000}
+};
+
+const size_t g_num_benchmarks = COUNT_OF(g_benchmarks);
+
+// rebind-add runs with + bound to - by its caller, which folding must not undo
+static const char *rebind_setup[] = {
+  "(define rebind-add\
+    (lambda ()\
+     (+ 1 2)))",
+  "(define rebind-sub\
+    (lambda (+)\
+     (rebind-add)))",
+  "(define rebind-rep\
+    (lambda (n)\
+     (if (= n 0)\
+      0\
+      (- (rebind-rep (- n 1)) (rebind-sub -)))))"
+};
+
+// dyn-peek reads dyn-depth from whichever caller bound it
+static const char *dynamic_free_setup[] = {
+  "(define dyn-peek\
+    (lambda ()\
+     dyn-depth))",
+  "(define dyn-with-depth\
+    (lambda (dyn-depth)\
+     (dyn-peek)))"
+};
+
+const benchmark_t g_checks[] = {
+  {"rebind", rebind_setup, COUNT_OF(rebind_setup), "(rebind-rep 200)", 200},
+  {"dynamic-free", dynamic_free_setup, COUNT_OF(dynamic_free_setup), "(dyn-with-depth 42)", 42}
+};
+
+const size_t g_num_checks = COUNT_OF(g_checks);
@@ -0,0 +1,23 @@
+#ifndef SCHEMIN_BENCHMARKS_H
+#define SCHEMIN_BENCHMARKS_H
+SCHEMIN_BENCHMARKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct benchmark_s {
+  const char *name;
+  const char **setup;
+  size_t num_setup;
+  const char *run;
+  int64_t expected;
+} benchmark_t;
+
+extern const benchmark_t g_benchmarks[];
+extern const size_t g_num_benchmarks;
+
+// Programs run once for their result before anything is timed, and never timed
+extern const benchmark_t g_checks[];
+extern const size_t g_num_checks;
+
+#endif
@@ -0,0 +1,568 @@
+#include <getopt.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "version.h"
+#include "allocator.h"
+#include "hash.h"
+#include "parser.h"
+#include "strindex.h"
+#include "system.h"
+#include "error.h"
+
+#define DEFAULT_RUNS 7
+#define SYSTEM_PAGE_SIZE 4096
+#define MAX_KEY_LEN 32
+
+/*
+ * Each kernel performs a fixed amount of work and reports how many operations
+ * (and, where meaningful, how many input bytes) it processed. The harness
+ * times whole kernel invocations and derives ns/op and MB/s from the median.
+ */
+typedef uint64_t (*kernel_func)(const void *param, uint64_t *outbytes);
+
+typedef struct microbench_s {
+  const char *name;
+  kernel_func kernel;
+  const void *param;
+} microbench_t;
+
+typedef struct microbench_result_s {
+  const char *name;
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t median_ns;
+  uint64_t min_ns;
+} microbench_result_t;
+
+typedef struct allocator_param_s {
+  size_t element_size;
+  size_t page_size;
+  uint64_t count;
+} allocator_param_t;
+
+typedef struct byte_allocator_param_s {
+  size_t size;
+  size_t page_size;
+  uint64_t count;
+} byte_allocator_param_t;
+
+typedef struct hash_param_s {
+  uintmax_t num_buckets;
+  uint64_t num_keys;
+  uint64_t lookups;
+} hash_param_t;
+
+typedef enum {
+  READER_INPUT_DEEP,
+  READER_INPUT_WIDE,
+  READER_INPUT_STRINGS,
+  READER_INPUT_NUMBERS,
+  READER_INPUT_FORMS
+} reader_input_kind_t;
+
+typedef struct reader_param_s {
+  reader_input_kind_t kind;
+  size_t size;
+  // Bytes per reader_feed call, for the push reader kernels
+  size_t chunk;
+  // For the parallel reader kernels
+  int threads;
+} reader_param_t;
+
+typedef struct string_param_s {
+  bool ascii;
+  bool sequential;
+  size_t chars;
+  uint64_t lookups;
+} string_param_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static volatile uint64_t lg_sink;
+
+static uint64_t allocator_allocate_kernel(const void *param, uint64_t *outbytes) {
+  const allocator_param_t *p = (const allocator_param_t*)param;
+  allocator_t *allocator = make_allocator(p->element_size, p->page_size);
+  for (uint64_t i = 0; i < p->count; i++) {
+    char *item = (char*)allocator_allocate(allocator, NULL);
+    item[0] = (char)i;
+  }
+  destroy_allocator(allocator);
+
+  *outbytes = p->count * p->element_size;
+  return p->count;
+}
+
+static uint64_t allocator_index_kernel(const void *param, uint64_t *outbytes) {
+  const allocator_param_t *p = (const allocator_param_t*)param;
+  allocator_t *allocator = make_allocator(p->element_size, p->page_size);
+  for (uint64_t i = 0; i < p->count; i++) {
+    char *item = (char*)allocator_allocate(allocator, NULL);
+    item[0] = (char)i;
+  }
+
+  // Stride through the pool so consecutive lookups land on different pages
+  uint64_t sum = 0;
+  uint64_t idx = 0;
+  for (uint64_t i = 0; i < p->count; i++) {
+    idx = (idx + 7919) % p->count;
+    sum += (uint64_t)*(char*)allocator_get_item_at_index(allocator, idx);
+  }
+  lg_sink = sum;
+  destroy_allocator(allocator);
+
+  *outbytes = 0;
+  return p->count;
+}
+
+static uint64_t byte_allocator_kernel(const void *param, uint64_t *outbytes) {
+  const byte_allocator_param_t *p = (const byte_allocator_param_t*)param;
+  byte_allocator_t *allocator = make_byte_allocator(p->page_size);
+  for (uint64_t i = 0; i < p->count; i++) {
+    allocator_byte_t *mem = byte_allocator_allocate(allocator, p->size);
+    mem[0] = (char)i;
+  }
+  destroy_byte_allocator(allocator);
+
+  *outbytes = p->count * p->size;
+  return p->count;
+}
+
+static size_t make_key(char *buf, uint64_t i) {
+  int len = snprintf(buf, MAX_KEY_LEN, "symbol-%llu", (unsigned long long)i);
+  return (size_t)len;
+}
+
+static uint64_t hash_set_kernel(const void *param, uint64_t *outbytes) {
+  const hash_param_t *p = (const hash_param_t*)param;
+  hash_t *hash = make_hash(p->num_buckets);
+  char key[MAX_KEY_LEN];
+  for (uint64_t i = 0; i < p->num_keys; i++) {
+    size_t len = make_key(key, i);
+    hash_set(hash, key, len, (void*)(uintptr_t)(i + 1));
+  }
+  destroy_hash(hash);
+
+  *outbytes = 0;
+  return p->num_keys;
+}
+
+static uint64_t hash_get_kernel(const void *param, uint64_t *outbytes) {
+  const hash_param_t *p = (const hash_param_t*)param;
+  hash_t *hash = make_hash(p->num_buckets);
+  char key[MAX_KEY_LEN];
+  for (uint64_t i = 0; i < p->num_keys; i++) {
+    size_t len = make_key(key, i);
+    hash_set(hash, key, len, (void*)(uintptr_t)(i + 1));
+  }
+
+  uint64_t found = 0;
+  for (uint64_t i = 0; i < p->lookups; i++) {
+    size_t len = make_key(key, (i * 31) % p->num_keys);
+    found += hash_get(hash, key, len) != NULL;
+  }
+  ASSERT_OR_ERROR(found == p->lookups, "hash_get missed a key");
+  destroy_hash(hash);
+
+  *outbytes = 0;
+  return p->lookups;
+}
+
+// Symbols are never freed, so each call interns names no earlier call has seen
+static uint64_t symboln_new_kernel(const void *param, uint64_t *outbytes) {
+  const hash_param_t *p = (const hash_param_t*)param;
+  static uint64_t next = 0;
+  char key[MAX_KEY_LEN];
+  for (uint64_t i = 0; i < p->num_keys; i++) {
+    size_t len = make_key(key, next++);
+    symboln(key, len);
+  }
+
+  *outbytes = 0;
+  return p->num_keys;
+}
+
+static uint64_t symboln_existing_kernel(const void *param, uint64_t *outbytes) {
+  const hash_param_t *p = (const hash_param_t*)param;
+  char key[MAX_KEY_LEN];
+  for (uint64_t i = 0; i < p->num_keys; i++) {
+    size_t len = make_key(key, i);
+    symboln(key, len);
+  }
+
+  uint64_t found = 0;
+  for (uint64_t i = 0; i < p->lookups; i++) {
+    size_t len = make_key(key, (i * 31) % p->num_keys);
+    found += get_symbol_entry(symboln(key, len))->len == len;
+  }
+  ASSERT_OR_ERROR(found == p->lookups, "symboln returned the wrong symbol");
+
+  *outbytes = 0;
+  return p->lookups;
+}
+
+/*
+ * Synthetic reader inputs. The reader only treats Unicode whitespace as
+ * separators, so everything is space separated on a single line, except the
+ * forms input, which is only read by the parallel reader.
+ */
+static char *make_reader_input(reader_input_kind_t kind, size_t size, size_t *outlen) {
+  char *buf = (char*)malloc(size + 64);
+  size_t len = 0;
+  switch (kind) {
+    case READER_INPUT_DEEP: {
+      // (a (b (c ... ))) nested until half the budget is spent on openers
+      size_t depth = 0;
+      while (len + 4 < size / 2) {
+        buf[len++] = '(';
+        buf[len++] = (char)('a' + (depth % 26));
+        buf[len++] = ' ';
+        depth++;
+      }
+      buf[len++] = 'z';
+      for (size_t i = 0; i < depth; i++) {
+        buf[len++] = ')';
+      }
+      break;
+    }
+    case READER_INPUT_WIDE: {
+      buf[len++] = '(';
+      for (uint64_t i = 0; len + 24 < size; i++) {
+        if (i % 3 == 0) {
+          len += (size_t)sprintf(&buf[len], "%llu ", (unsigned long long)(i * 7919));
+        } else if (i % 3 == 1) {
+          len += (size_t)sprintf(&buf[len], "sym%llu ", (unsigned long long)(i % 512));
+        } else {
+          len += (size_t)sprintf(&buf[len], "%llu.25 ", (unsigned long long)i);
+        }
+      }
+      buf[len++] = ')';
+      break;
+    }
+    case READER_INPUT_STRINGS: {
+      buf[len++] = '(';
+      while (len + 72 < size) {
+        buf[len++] = '"';
+        for (int i = 0; i < 60; i++) {
+          buf[len++] = (char)('a' + (i % 26));
+        }
+        buf[len++] = '\\';
+        buf[len++] = '"';
+        buf[len++] = '"';
+        buf[len++] = ' ';
+      }
+      buf[len++] = ')';
+      break;
+    }
+    case READER_INPUT_NUMBERS: {
+      // Integers, decimals and exponents in equal parts, as in numeric data files
+      buf[len++] = '(';
+      for (uint64_t i = 0; len + 32 < size; i++) {
+        if (i % 3 == 0) {
+          len += (size_t)sprintf(&buf[len], "%lld ", (long long)(i * 104729) - 50000000);
+        } else if (i % 3 == 1) {
+          len += (size_t)sprintf(&buf[len], "%llu.%03llu ", (unsigned long long)(i % 100000), (unsigned long long)(i % 997));
+        } else {
+          len += (size_t)sprintf(&buf[len], "%llu.5e%d ", (unsigned long long)(i % 1000), (int)(i % 41) - 20);
+        }
+      }
+      buf[len++] = ')';
+      break;
+    }
+    case READER_INPUT_FORMS: {
+      // Many small top-level forms, as in a data file of records
+      for (uint64_t i = 0; len + 96 < size; i++) {
+        len += (size_t)sprintf(&buf[len], "(define rec%llu (quote (%llu %llu.5 \"name%llu\" sym%llu)))\n",
+                               (unsigned long long)i, (unsigned long long)(i * 7919), (unsigned long long)(i % 1000),
+                               (unsigned long long)i, (unsigned long long)(i % 512));
+      }
+      break;
+    }
+  }
+
+  buf[len] = '\0';
+  *outlen = len;
+  return buf;
+}
+
+static const char *get_reader_input(const reader_param_t *p, size_t *outlen) {
+  static char *inputs[5] = {NULL, NULL, NULL, NULL, NULL};
+  static size_t input_lens[5];
+  if (inputs[p->kind] == NULL) {
+    inputs[p->kind] = make_reader_input(p->kind, p->size, &input_lens[p->kind]);
+    ASSERT_OR_ERROR(quick_verify_scheme(inputs[p->kind], input_lens[p->kind]), "Bad synthetic input");
+  }
+  *outlen = input_lens[p->kind];
+  return inputs[p->kind];
+}
+
+static uint64_t reader_kernel(const void *param, uint64_t *outbytes) {
+  const reader_param_t *p = (const reader_param_t*)param;
+  size_t len;
+  const char *input = get_reader_input(p, &len);
+
+  object_t *obj = valid_exp_into_object(input, len);
+  ASSERT_OR_ERROR(obj != NULL, "Reader returned nothing");
+
+  *outbytes = len;
+  return 1;
+}
+
+static uint64_t reader_feed_kernel(const void *param, uint64_t *outbytes) {
+  const reader_param_t *p = (const reader_param_t*)param;
+  size_t len;
+  const char *input = get_reader_input(p, &len);
+
+  reader_t *reader = make_reader();
+  for (size_t offset = 0; offset < len; offset += p->chunk) {
+    reader_feed(reader, &input[offset], len - offset < p->chunk ? len - offset : p->chunk);
+  }
+  ASSERT_OR_ERROR(reader_finish(reader), "Reader stopped inside a datum");
+  ASSERT_OR_ERROR(reader_next(reader) != NULL, "Reader returned nothing");
+  destroy_reader(reader);
+
+  *outbytes = len;
+  return 1;
+}
+
+static uint64_t read_parallel_kernel(const void *param, uint64_t *outbytes) {
+  const reader_param_t *p = (const reader_param_t*)param;
+  read_source_t source;
+  source.text = get_reader_input(p, &source.len);
+  source.name = NULL;
+
+  size_t count;
+  object_t **forms = read_sources_parallel(&source, 1, p->threads, &count);
+  ASSERT_OR_ERROR(count > 0, "Reader returned nothing");
+  free(forms);
+
+  *outbytes = source.len;
+  return 1;
+}
+
+// Mixes one- to four-byte characters unless the string is ASCII
+static object_t *make_string_input(const string_param_t *p) {
+  static const char *pieces[] = {"a", "\xc3\xa9", "\xe2\x88\x80", "\xf0\x9f\x98\x80"};
+  size_t len = 0;
+  for (size_t i = 0; i < p->chars; i++) len += p->ascii ? 1 : strlen(pieces[i % 4]);
+
+  string_entry_t *entry;
+  object_t *string = allocate_string(len, &entry);
+  size_t offset = 0;
+  for (size_t i = 0; i < p->chars; i++) {
+    const char *piece = p->ascii ? "a" : pieces[i % 4];
+    memcpy(&entry->str[offset], piece, strlen(piece));
+    offset += strlen(piece);
+  }
+  entry->str[len] = '\0';
+  return string;
+}
+
+static uint64_t string_byte_offset_kernel(const void *param, uint64_t *outbytes) {
+  const string_param_t *p = (const string_param_t*)param;
+  string_entry_t *entry = get_string_entry(make_string_input(p));
+
+  uint64_t sum = 0;
+  size_t k = 0;
+  for (uint64_t i = 0; i < p->lookups; i++) {
+    k = p->sequential ? (k + 1) % p->chars : (k + 7919) % p->chars;
+    sum += (uint64_t)(uint8_t)entry->str[string_byte_offset(entry, k)];
+  }
+  lg_sink = sum;
+
+  *outbytes = 0;
+  return p->lookups;
+}
+
+static const allocator_param_t allocator_4k = {16, SYSTEM_PAGE_SIZE, 1 << 20};
+static const allocator_param_t allocator_64k = {16, 1 << 16, 1 << 20};
+static const allocator_param_t allocator_1m = {16, 1 << 20, 1 << 20};
+static const allocator_param_t allocator_24b_1m = {24, 1 << 20, 1 << 20};
+
+static const byte_allocator_param_t bytes_8 = {8, 1 << 21, 1 << 20};
+static const byte_allocator_param_t bytes_64 = {64, 1 << 21, 1 << 18};
+static const byte_allocator_param_t bytes_1k = {1024, 1 << 21, 1 << 14};
+static const byte_allocator_param_t bytes_large = {(1 << 21) / 8, 1 << 21, 1 << 8};
+
+static const hash_param_t hash_load_quarter = {1 << 14, 1 << 12, 1 << 20};
+static const hash_param_t hash_load_one = {1 << 14, 1 << 14, 1 << 20};
+static const hash_param_t hash_load_four = {1 << 14, 1 << 16, 1 << 20};
+static const hash_param_t hash_load_sixteen = {1 << 12, 1 << 16, 1 << 18};
+
+static const reader_param_t reader_deep = {READER_INPUT_DEEP, 1 << 12, 0, 0};
+static const reader_param_t reader_wide = {READER_INPUT_WIDE, 1 << 18, 0, 0};
+static const reader_param_t reader_strings = {READER_INPUT_STRINGS, 1 << 18, 0, 0};
+static const reader_param_t reader_numbers = {READER_INPUT_NUMBERS, 1 << 18, 0, 0};
+static const reader_param_t reader_feed_wide = {READER_INPUT_WIDE, 1 << 18, 1 << 12, 0};
+static const reader_param_t reader_feed_strings = {READER_INPUT_STRINGS, 1 << 18, 1 << 12, 0};
+static const reader_param_t reader_feed_numbers = {READER_INPUT_NUMBERS, 1 << 18, 1 << 12, 0};
+static const reader_param_t reader_forms_1 = {READER_INPUT_FORMS, 1 << 22, 0, 1};
+static const reader_param_t reader_forms_4 = {READER_INPUT_FORMS, 1 << 22, 0, 4};
+
+static const string_param_t string_ascii_random = {true, false, 1 << 16, 1 << 20};
+static const string_param_t string_utf8_sequential = {false, true, 1 << 16, 1 << 20};
+static const string_param_t string_utf8_random = {false, false, 1 << 16, 1 << 20};
+
+static const microbench_t microbenchmarks[] = {
+  {"allocator_allocate/16b/4k", allocator_allocate_kernel, &allocator_4k},
+  {"allocator_allocate/16b/64k", allocator_allocate_kernel, &allocator_64k},
+  {"allocator_allocate/16b/1m", allocator_allocate_kernel, &allocator_1m},
+  {"allocator_allocate/24b/1m", allocator_allocate_kernel, &allocator_24b_1m},
+  {"allocator_get_item_at_index/16b/4k", allocator_index_kernel, &allocator_4k},
+  {"allocator_get_item_at_index/16b/1m", allocator_index_kernel, &allocator_1m},
+  {"allocator_get_item_at_index/24b/1m", allocator_index_kernel, &allocator_24b_1m},
+  {"byte_allocator_allocate/8", byte_allocator_kernel, &bytes_8},
+  {"byte_allocator_allocate/64", byte_allocator_kernel, &bytes_64},
+  {"byte_allocator_allocate/1k", byte_allocator_kernel, &bytes_1k},
+  {"byte_allocator_allocate/large", byte_allocator_kernel, &bytes_large},
+  {"hash_set/load-0.25", hash_set_kernel, &hash_load_quarter},
+  {"hash_set/load-1", hash_set_kernel, &hash_load_one},
+  {"hash_set/load-4", hash_set_kernel, &hash_load_four},
+  {"hash_get/load-0.25", hash_get_kernel, &hash_load_quarter},
+  {"hash_get/load-1", hash_get_kernel, &hash_load_one},
+  {"hash_get/load-4", hash_get_kernel, &hash_load_four},
+  {"hash_get/load-16", hash_get_kernel, &hash_load_sixteen},
+  {"symboln/new", symboln_new_kernel, &hash_load_four},
+  {"symboln/existing", symboln_existing_kernel, &hash_load_four},
+  {"valid_exp_into_object/deep", reader_kernel, &reader_deep},
+  {"valid_exp_into_object/wide", reader_kernel, &reader_wide},
+  {"valid_exp_into_object/strings", reader_kernel, &reader_strings},
+  {"valid_exp_into_object/numbers", reader_kernel, &reader_numbers},
+  {"reader_feed/wide/4k", reader_feed_kernel, &reader_feed_wide},
+  {"reader_feed/strings/4k", reader_feed_kernel, &reader_feed_strings},
+  {"reader_feed/numbers/4k", reader_feed_kernel, &reader_feed_numbers},
+  {"read_sources_parallel/forms/1", read_parallel_kernel, &reader_forms_1},
+  {"read_sources_parallel/forms/4", read_parallel_kernel, &reader_forms_4},
+  {"string_byte_offset/ascii/random", string_byte_offset_kernel, &string_ascii_random},
+  {"string_byte_offset/utf8/sequential", string_byte_offset_kernel, &string_utf8_sequential},
+  {"string_byte_offset/utf8/random", string_byte_offset_kernel, &string_utf8_random}
+};
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void run_microbench(const microbench_t *bench, int runs, microbench_result_t *outresult) {
+  uint64_t *samples = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)runs);
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+
+  // One untimed run to fault in pages and build any cached inputs
+  bench->kernel(bench->param, &bytes);
+  for (int i = 0; i < runs; i++) {
+    uint64_t start = now_ns();
+    ops = bench->kernel(bench->param, &bytes);
+    samples[i] = now_ns() - start;
+  }
+
+  qsort(samples, (size_t)runs, sizeof(uint64_t), compare_u64);
+  outresult->name = bench->name;
+  outresult->ops = ops;
+  outresult->bytes = bytes;
+  outresult->min_ns = samples[0];
+  outresult->median_ns = samples[runs / 2];
+  free(samples);
+}
+
+static double ns_per_op(const microbench_result_t *r) {
+  return (double)r->median_ns / (double)r->ops;
+}
+
+static double mb_per_second(const microbench_result_t *r) {
+  if (r->bytes == 0 || r->median_ns == 0) return 0.0;
+  return ((double)r->bytes / (1024.0 * 1024.0)) / ((double)r->median_ns / 1e9);
+}
+
+static void write_json(FILE *out, const microbench_result_t *results, size_t count, int runs) {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"version\": \"%d.%d\",\n", SCHEMIN_VERSION_MAJOR, SCHEMIN_VERSION_MINOR);
+  fprintf(out, "  \"runs\": %d,\n", runs);
+  fprintf(out, "  \"microbenchmarks\": [\n");
+  for (size_t i = 0; i < count; i++) {
+    const microbench_result_t *r = &results[i];
+    fprintf(out, "    {\"name\": \"%s\", \"ops\": %llu, \"min_ns\": %llu, \"median_ns\": %llu, "
+                 "\"ns_per_op\": %.3f, \"mb_per_s\": %.1f}%s\n",
+            r->name, (unsigned long long)r->ops, (unsigned long long)r->min_ns,
+            (unsigned long long)r->median_ns, ns_per_op(r), mb_per_second(r),
+            i + 1 < count ? "," : "");
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [--runs N] [--filter NAME] [--output FILE] [--list]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  setlocale(LC_ALL, "");
+
+  int runs = DEFAULT_RUNS;
+  const char *filter = NULL;
+  const char *output = NULL;
+  size_t num_microbenchmarks = sizeof(microbenchmarks) / sizeof(microbench_t);
+
+  static const struct option options[] = {
+    {"runs", required_argument, NULL, 'r'},
+    {"filter", required_argument, NULL, 'f'},
+    {"output", required_argument, NULL, 'o'},
+    {"list", no_argument, NULL, 'l'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "r:f:o:lh", options, NULL)) != -1) {
+    switch (opt) {
+      case 'r': runs = atoi(optarg); break;
+      case 'f': filter = optarg; break;
+      case 'o': output = optarg; break;
+      case 'l': {
+        for (size_t i = 0; i < num_microbenchmarks; i++) {
+          printf("%s\n", microbenchmarks[i].name);
+        }
+        return 0;
+      }
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  ASSERT_OR_ERROR(runs > 0, "--runs must be positive");
+  ASSERT_OR_ERROR(system_init() == 0, "Could not init system");
+
+  microbench_result_t *results = (microbench_result_t*)calloc(num_microbenchmarks, sizeof(microbench_result_t));
+  size_t count = 0;
+  for (size_t i = 0; i < num_microbenchmarks; i++) {
+    const microbench_t *bench = &microbenchmarks[i];
+    if (filter != NULL && strstr(bench->name, filter) == NULL) continue;
+
+    microbench_result_t *r = &results[count++];
+    run_microbench(bench, runs, r);
+    fprintf(stderr, "%-38s %12.2f ns/op", r->name, ns_per_op(r));
+    if (r->bytes > 0) {
+      fprintf(stderr, " %10.1f MB/s", mb_per_second(r));
+    }
+    fprintf(stderr, "\n");
+  }
+
+  FILE *out = stdout;
+  if (output != NULL) {
+    out = fopen(output, "w");
+    ASSERT_OR_ERROR(out != NULL, "Could not open output file");
+  }
+  write_json(out, results, count, runs);
+  if (out != stdout) fclose(out);
+
+  free(results);
+  return 0;
+}
@@ -15,6 +15,7 @@ struct allocator_s {
   uint64_t current_index;
   uint64_t total_elements;
   uint64_t remaining_elements_in_page;
+  uint64_t elements_per_page;
   size_t element_size;
   size_t page_size;
 };
@@ -27,7 +28,7 @@ static inline allocator_byte_t *make_page(size_t page_size) {
 }
 
 allocator_t *make_allocator(size_t element_size, size_t page_size) {
-  assert(page_size % element_size == 0 && "Page size must be a multiple of element size");
+  assert(page_size >= element_size && "Page size must hold at least one element");
   assert(page_size % (uint64_t)getpagesize() == 0 && "Page size must be a multiple of system page size");
   assert(ALLOCATOR_PAGES_REALLOC_COUNT > 0);
   allocator_t *allocator = (allocator_t*)malloc(sizeof(allocator_t));
@@ -38,7 +39,8 @@ allocator_t *make_allocator(size_t element_size, size_t page_size) {
   allocator->max_pages = ALLOCATOR_PAGES_REALLOC_COUNT;
   allocator->current_index = 0;
   allocator->total_elements = 0;
-  allocator->remaining_elements_in_page = page_size / element_size;
+  allocator->elements_per_page = page_size / element_size;
+  allocator->remaining_elements_in_page = allocator->elements_per_page;
   allocator->element_size = element_size;
   allocator->page_size = page_size;
 
@@ -77,7 +79,7 @@ void *allocator_allocate(allocator_t *allocator, uint64_t *outidx) {
   assert(allocator->current_page < allocator->max_pages);
   allocator_byte_t *page = make_page(allocator->page_size);
   allocator->pages[allocator->current_page] = page;
-  allocator->remaining_elements_in_page = allocator->page_size / allocator->element_size - allocator->element_size;
+  allocator->remaining_elements_in_page = allocator->elements_per_page - 1;
   allocator->current_index = 1;
   if (outidx != NULL) *outidx = allocator->total_elements;
   allocator->total_elements++;
@@ -86,11 +88,9 @@ void *allocator_allocate(allocator_t *allocator, uint64_t *outidx) {
 
 void *allocator_get_item_at_index(allocator_t *allocator, uint64_t idx) {
   assert(idx < allocator->total_elements && "Indexed beyond allocated elements");
-  ASSERT_OR_ERROR(idx < ((uint64_t)1<<63), "index too large"); // @TODO implement unsigned lldiv
-  lldiv_t div = lldiv((int64_t)idx * (int64_t)allocator->element_size, (int64_t)allocator->page_size);
-  uint64_t page_idx = (uint64_t)div.quot;
-  uint64_t idx_in_page = (uint64_t)div.rem;
-  return &(allocator->pages)[page_idx][idx_in_page];
+  uint64_t page_idx = idx / allocator->elements_per_page;
+  uint64_t idx_in_page = idx % allocator->elements_per_page;
+  return &(allocator->pages)[page_idx][idx_in_page * allocator->element_size];
 }
 
 typedef struct byte_allocator_large_entry_s byte_allocator_large_entry_t;
@@ -152,6 +152,14 @@ void destroy_byte_allocator(byte_allocator_t *allocator) {
   free(allocator);
 }
 
+uint64_t allocator_total_elements(allocator_t *allocator) {
+  return allocator->total_elements;
+}
+
+size_t byte_allocator_total_bytes(byte_allocator_t *allocator) {
+  return allocator->total_bytes;
+}
+
 allocator_byte_t *byte_allocator_allocate(byte_allocator_t *allocator, size_t size) {
   if (size < allocator->remaining_bytes_in_page) {
     allocator->remaining_bytes_in_page -= size;
@@ -168,6 +176,7 @@ allocator_byte_t *byte_allocator_allocate(byte_allocator_t *allocator, size_t si
     entry->len = size;
     entry->next = allocator->large_entries;
     allocator->large_entries = entry;
+    allocator->total_bytes += size;
     return entry->mem;
   }
 
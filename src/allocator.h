@@ -12,10 +12,12 @@ allocator_t *make_allocator(size_t element_size, size_t page_size);
 void destroy_allocator(allocator_t *allocator);
 void *allocator_allocate(allocator_t *allocator, uint64_t *outidx);
 void *allocator_get_item_at_index(allocator_t *allocator, uint64_t idx);
+uint64_t allocator_total_elements(allocator_t *allocator);
 
 byte_allocator_t *make_byte_allocator(size_t page_size);
 void destroy_byte_allocator(byte_allocator_t *allocator);
 allocator_byte_t *byte_allocator_allocate(byte_allocator_t *allocator, size_t size);
+size_t byte_allocator_total_bytes(byte_allocator_t *allocator);
 
 #endif
 
@@ -0,0 +1,1325 @@
+#include "compiler.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "memory.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "expander.h"
+#include "error.h"
+
+#define COMPILER_MAX_LOCALS 256
+#define COMPILER_MAX_LOOPS 32
+#define COMPILER_MAX_ARGUMENTS 32
+#define COMPILER_BUFFER_INITIAL_SIZE 4096
+#define COMPILER_VECTOR_REALLOC_COUNT 64
+// Positions that are not in tail position of any loop
+#define NOT_TAIL INT32_MAX
+
+typedef struct buffer_s {
+  char *data;
+  size_t len;
+  size_t cap;
+} buffer_t;
+
+typedef struct vector_s {
+  object_t **items;
+  size_t len;
+  size_t cap;
+} vector_t;
+
+typedef struct function_s {
+  object_t *name;
+  object_t *parameters;
+  object_t *body;
+  int arity;
+  bool compiled;
+  const char *failure;
+  buffer_t code;
+} function_t;
+
+typedef struct form_s {
+  const char *text;
+  size_t len;
+  // Index into the unit's functions, or -1 for a form left to the interpreter
+  int function;
+} form_t;
+
+typedef struct unit_s {
+  form_t *forms;
+  size_t num_forms;
+  function_t *functions;
+  size_t num_functions;
+  // Names defined at top level by forms left to the interpreter
+  vector_t defined;
+  // Names bound by a parameter, let, named let, do or internal define anywhere in the source
+  vector_t bound;
+  // Names referenced outside every binding of them anywhere in the source
+  vector_t free;
+  // Global variables referenced by name at run time
+  vector_t symbols;
+  // Builtin primitives captured when the module is loaded
+  vector_t builtins;
+  vector_t constants;
+} unit_t;
+
+typedef struct local_s {
+  object_t *name;
+  int var;
+} local_t;
+
+/*
+ * The function body and every named let are loops: a call to one in tail
+ * position reassigns its vars and jumps back to its label.
+ */
+typedef struct loop_s {
+  object_t *name;
+  int label;
+  int num_vars;
+  int vars[COMPILER_MAX_ARGUMENTS];
+  // Locals pushed after the loop shadow its name
+  int locals_mark;
+  bool used;
+} loop_t;
+
+typedef struct context_s {
+  unit_t *unit;
+  function_t *function;
+  buffer_t *out;
+  local_t locals[COMPILER_MAX_LOCALS];
+  int num_locals;
+  loop_t loops[COMPILER_MAX_LOOPS];
+  int num_loops;
+  int next_var;
+  int next_label;
+  int indent;
+  const char *failure;
+} context_t;
+
+typedef enum {
+  INLINE_NONE,
+  INLINE_CAR,
+  INLINE_CDR,
+  INLINE_CONS,
+  INLINE_NULLP,
+  INLINE_PAIRP,
+  INLINE_EQP,
+  INLINE_ADD,
+  INLINE_SUB,
+  INLINE_MUL,
+  INLINE_NUM_EQ,
+  INLINE_LT,
+  INLINE_GT
+} inline_kind_t;
+
+static object_t *lg_sym_quote;
+static object_t *lg_sym_if;
+static object_t *lg_sym_define;
+static object_t *lg_sym_set;
+static object_t *lg_sym_lambda;
+static object_t *lg_sym_begin;
+static object_t *lg_sym_let;
+static object_t *lg_sym_let_star;
+static object_t *lg_sym_letrec;
+static object_t *lg_sym_cond;
+static object_t *lg_sym_else;
+static object_t *lg_sym_arrow;
+static object_t *lg_sym_and;
+static object_t *lg_sym_or;
+static object_t *lg_sym_do;
+static object_t *lg_sym_define_syntax;
+static object_t *lg_sym_ok;
+
+static int compile_expression(context_t *ctx, object_t *exp, int tail);
+
+static void buffer_reserve(buffer_t *b, size_t extra) {
+  if (b->len + extra + 1 <= b->cap) return;
+  size_t cap = b->cap == 0 ? COMPILER_BUFFER_INITIAL_SIZE : b->cap;
+  while (cap < b->len + extra + 1) cap *= 2;
+  b->data = (char*)realloc(b->data, cap);
+  ASSERT_OR_ERROR(b->data != NULL, "Could not grow compiler buffer");
+  b->cap = cap;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void buffer_printf(buffer_t *b, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int needed = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  ASSERT_OR_ERROR(needed >= 0, "Bad compiler format");
+
+  buffer_reserve(b, (size_t)needed);
+  va_start(args, fmt);
+  vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+  va_end(args);
+  b->len += (size_t)needed;
+}
+
+static void buffer_c_string(buffer_t *b, const char *s, size_t len) {
+  buffer_printf(b, "\"");
+  for (size_t i = 0; i < len; i++) {
+    unsigned char ch = (unsigned char)s[i];
+    if (ch == '"' || ch == '\\') {
+      buffer_printf(b, "\\%c", ch);
+    } else if (ch == '\n') {
+      buffer_printf(b, "\\n");
+    } else if (ch < 0x20 || ch >= 0x7f) {
+      buffer_printf(b, "\\%03o", ch);
+    } else {
+      buffer_printf(b, "%c", ch);
+    }
+  }
+  buffer_printf(b, "\"");
+}
+
+static size_t vector_index(vector_t *v, object_t *obj) {
+  for (size_t i = 0; i < v->len; i++) {
+    if (v->items[i] == obj) return i;
+  }
+  if (v->len == v->cap) {
+    v->cap += COMPILER_VECTOR_REALLOC_COUNT;
+    v->items = (object_t**)realloc(v->items, v->cap * sizeof(object_t*));
+    ASSERT_OR_ERROR(v->items != NULL, "Could not grow compiler table");
+  }
+  v->items[v->len] = obj;
+  return v->len++;
+}
+
+// Numbers are not interned, so constants are shared by value
+static size_t constant_index(vector_t *v, object_t *value) {
+  for (size_t i = 0; i < v->len; i++) {
+    object_t *item = v->items[i];
+    if (item->type != value->type) continue;
+    if (value->type == SCHEME_NUMBER && item->number_or_index == value->number_or_index) return i;
+    if (value->type == SCHEME_DOUBLE) {
+      double a = get_double(item);
+      double b = get_double(value);
+      if (memcmp(&a, &b, sizeof(double)) == 0) return i;
+    }
+  }
+  return vector_index(v, value);
+}
+
+static bool vector_contains(vector_t *v, object_t *obj) {
+  for (size_t i = 0; i < v->len; i++) {
+    if (v->items[i] == obj) return true;
+  }
+  return false;
+}
+
+static const char *symbol_name(object_t *sym) {
+  return get_symbol_entry(sym)->sym;
+}
+
+static void emit_line(context_t *ctx, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit_line(context_t *ctx, const char *fmt, ...) {
+  buffer_t *b = ctx->out;
+  for (int i = 0; i < ctx->indent; i++) buffer_printf(b, "  ");
+
+  va_list args;
+  va_start(args, fmt);
+  int needed = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+  ASSERT_OR_ERROR(needed >= 0, "Bad compiler format");
+  buffer_reserve(b, (size_t)needed);
+  va_start(args, fmt);
+  vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+  va_end(args);
+  b->len += (size_t)needed;
+  buffer_printf(b, "\n");
+}
+
+static int fail(context_t *ctx, const char *reason) {
+  if (ctx->failure == NULL) ctx->failure = reason;
+  return -1;
+}
+
+static int new_var(context_t *ctx, const char *init) {
+  int var = ctx->next_var++;
+  emit_line(ctx, "object_t *v%d = %s;", var, init);
+  return var;
+}
+
+static int constant_var(context_t *ctx, object_t *value) {
+  if (value == g_scheme_null) return new_var(ctx, "g_scheme_null");
+  int var = ctx->next_var++;
+  emit_line(ctx, "object_t *v%d = lg_constants[%zu];", var, constant_index(&ctx->unit->constants, value));
+  return var;
+}
+
+static bool push_local(context_t *ctx, object_t *name, int var) {
+  if (ctx->num_locals == COMPILER_MAX_LOCALS) return false;
+  ctx->locals[ctx->num_locals].name = name;
+  ctx->locals[ctx->num_locals].var = var;
+  ctx->num_locals++;
+  return true;
+}
+
+static int find_local(context_t *ctx, object_t *name) {
+  for (int i = ctx->num_locals - 1; i >= 0; i--) {
+    if (ctx->locals[i].name == name) return i;
+  }
+  return -1;
+}
+
+// The loop a call to name refers to, or -1 when name is a local or not a loop
+static int find_loop(context_t *ctx, object_t *name) {
+  int local = find_local(ctx, name);
+  for (int i = ctx->num_loops - 1; i >= 0; i--) {
+    if (ctx->loops[i].name != name) continue;
+    return local >= ctx->loops[i].locals_mark ? -1 : i;
+  }
+  return -1;
+}
+
+static int find_function(unit_t *unit, object_t *name) {
+  for (size_t i = 0; i < unit->num_functions; i++) {
+    if (unit->functions[i].name == name && unit->functions[i].compiled) return (int)i;
+  }
+  return -1;
+}
+
+static bool is_module_defined(unit_t *unit, object_t *name) {
+  if (vector_contains(&unit->defined, name)) return true;
+  for (size_t i = 0; i < unit->num_functions; i++) {
+    if (unit->functions[i].name == name) return true;
+  }
+  return false;
+}
+
+/*
+ * Scope is dynamic, so a free name means whatever the caller has bound it to.
+ * Compiled code resolves free names globally or when it is compiled, which is
+ * only right if nothing in the module binds the name and the name exists.
+ */
+static int check_free_name(context_t *ctx, object_t *name) {
+  if (vector_contains(&ctx->unit->bound, name)) return fail(ctx, "free name bound elsewhere in the module");
+  if (!is_module_defined(ctx->unit, name) && lookup_global(name) == NULL) return fail(ctx, "free name not defined");
+  return 0;
+}
+
+// Compiled bindings are C locals, which code the callee runs cannot see
+static int check_binding(context_t *ctx, object_t *name) {
+  if (vector_contains(&ctx->unit->free, name)) return fail(ctx, "binds a name used free elsewhere in the module");
+  return 0;
+}
+
+static bool is_builtin(unit_t *unit, object_t *name) {
+  if (vector_contains(&unit->defined, name)) return false;
+  for (size_t i = 0; i < unit->num_functions; i++) {
+    if (unit->functions[i].name == name) return false;
+  }
+  object_t *value = lookup_global(name);
+  return value != NULL && value->type == SCHEME_PRIMITIVE;
+}
+
+static inline_kind_t inline_kind_for(object_t *name, int argc) {
+  const char *s = symbol_name(name);
+  if (argc == 1) {
+    if (strcmp(s, "car") == 0) return INLINE_CAR;
+    if (strcmp(s, "cdr") == 0) return INLINE_CDR;
+    if (strcmp(s, "null?") == 0) return INLINE_NULLP;
+    if (strcmp(s, "pair?") == 0) return INLINE_PAIRP;
+  } else if (argc == 2) {
+    if (strcmp(s, "cons") == 0) return INLINE_CONS;
+    if (strcmp(s, "eq?") == 0) return INLINE_EQP;
+    if (strcmp(s, "+") == 0) return INLINE_ADD;
+    if (strcmp(s, "-") == 0) return INLINE_SUB;
+    if (strcmp(s, "*") == 0) return INLINE_MUL;
+    if (strcmp(s, "=") == 0) return INLINE_NUM_EQ;
+    if (strcmp(s, "<") == 0) return INLINE_LT;
+    if (strcmp(s, ">") == 0) return INLINE_GT;
+  }
+  return INLINE_NONE;
+}
+
+static int compile_sequence(context_t *ctx, object_t *seq, int tail) {
+  if (list_length(seq) < 1) return fail(ctx, "empty body");
+  int var = -1;
+  for (; seq != g_scheme_null; seq = cdr(seq)) {
+    var = compile_expression(ctx, car(seq), cdr(seq) == g_scheme_null ? tail : NOT_TAIL);
+    if (var < 0) return -1;
+  }
+  return var;
+}
+
+static int compile_variable(context_t *ctx, object_t *sym) {
+  int local = find_local(ctx, sym);
+  int loop = find_loop(ctx, sym);
+  if (loop > 0) return fail(ctx, "named let procedure used as a value");
+  if (local >= 0) {
+    char init[32];
+    snprintf(init, sizeof(init), "v%d", ctx->locals[local].var);
+    // Copied so later assignments to the local cannot change an already evaluated operand
+    return new_var(ctx, init);
+  }
+
+  if (check_free_name(ctx, sym) < 0) return -1;
+  int var = ctx->next_var++;
+  emit_line(ctx, "object_t *v%d = scm_lookup(lg_symbols[%zu]);", var, vector_index(&ctx->unit->symbols, sym));
+  return var;
+}
+
+static int compile_if(context_t *ctx, object_t *exp, int tail) {
+  if (list_length(exp) != 4) return fail(ctx, "if without an alternative");
+  int predicate = compile_expression(ctx, cadr(exp), NOT_TAIL);
+  if (predicate < 0) return -1;
+
+  int result = new_var(ctx, "NULL");
+  emit_line(ctx, "if (v%d != g_false) {", predicate);
+  ctx->indent++;
+  int consequent = compile_expression(ctx, caddr(exp), tail);
+  if (consequent < 0) return -1;
+  emit_line(ctx, "v%d = v%d;", result, consequent);
+  ctx->indent--;
+  emit_line(ctx, "} else {");
+  ctx->indent++;
+  int alternative = compile_expression(ctx, cadddr(exp), tail);
+  if (alternative < 0) return -1;
+  emit_line(ctx, "v%d = v%d;", result, alternative);
+  ctx->indent--;
+  emit_line(ctx, "}");
+  return result;
+}
+
+// and/or: each operand but the last can end the form early with its value
+static int compile_and_or(context_t *ctx, object_t *exp, int tail, bool is_and) {
+  if (cdr(exp) == g_scheme_null) return new_var(ctx, is_and ? "g_true" : "g_false");
+
+  int result = new_var(ctx, "NULL");
+  int depth = 0;
+  for (object_t *rest = cdr(exp); rest != g_scheme_null; rest = cdr(rest)) {
+    bool last = cdr(rest) == g_scheme_null;
+    int value = compile_expression(ctx, car(rest), last ? tail : NOT_TAIL);
+    if (value < 0) return -1;
+    emit_line(ctx, "v%d = v%d;", result, value);
+    if (last) break;
+    emit_line(ctx, "if (v%d %s g_false) {", result, is_and ? "!=" : "==");
+    ctx->indent++;
+    depth++;
+  }
+  for (; depth > 0; depth--) {
+    ctx->indent--;
+    emit_line(ctx, "}");
+  }
+  return result;
+}
+
+static int compile_cond(context_t *ctx, object_t *exp, int tail) {
+  int result = constant_var(ctx, lg_sym_ok);
+  int depth = 0;
+  for (object_t *clauses = cdr(exp); clauses != g_scheme_null; clauses = cdr(clauses)) {
+    object_t *clause = car(clauses);
+    if (list_length(clause) < 1) return fail(ctx, "malformed cond clause");
+
+    if (car(clause) == lg_sym_else) {
+      int value = compile_sequence(ctx, cdr(clause), tail);
+      if (value < 0) return -1;
+      emit_line(ctx, "v%d = v%d;", result, value);
+      break;
+    }
+
+    int test = compile_expression(ctx, car(clause), NOT_TAIL);
+    if (test < 0) return -1;
+    emit_line(ctx, "if (v%d != g_false) {", test);
+    ctx->indent++;
+    if (cdr(clause) == g_scheme_null) {
+      emit_line(ctx, "v%d = v%d;", result, test);
+    } else if (cadr(clause) == lg_sym_arrow) {
+      if (list_length(clause) != 3) return fail(ctx, "malformed cond clause");
+      int proc = compile_expression(ctx, caddr(clause), NOT_TAIL);
+      if (proc < 0) return -1;
+      emit_line(ctx, "v%d = scm_apply(v%d, 1, &v%d);", result, proc, test);
+    } else {
+      int value = compile_sequence(ctx, cdr(clause), tail);
+      if (value < 0) return -1;
+      emit_line(ctx, "v%d = v%d;", result, value);
+    }
+    ctx->indent--;
+    emit_line(ctx, "} else {");
+    ctx->indent++;
+    depth++;
+  }
+  for (; depth > 0; depth--) {
+    ctx->indent--;
+    emit_line(ctx, "}");
+  }
+  return result;
+}
+
+static bool binding_parts(object_t *binding, object_t **outname, object_t **outinit) {
+  if (list_length(binding) < 2 || car(binding)->type != SCHEME_SYMBOL) return false;
+  *outname = car(binding);
+  *outinit = cadr(binding);
+  return true;
+}
+
+// let evaluates every init before binding any var; let* binds each var before the next init
+static int compile_let(context_t *ctx, object_t *exp, int tail, bool sequential) {
+  object_t *bindings = cadr(exp);
+  int count = list_length(bindings);
+  if (count < 0 || count > COMPILER_MAX_ARGUMENTS) return fail(ctx, "malformed let bindings");
+
+  int mark = ctx->num_locals;
+  int values[COMPILER_MAX_ARGUMENTS];
+  object_t *names[COMPILER_MAX_ARGUMENTS];
+  int i = 0;
+  for (; bindings != g_scheme_null; bindings = cdr(bindings), i++) {
+    object_t *init;
+    if (!binding_parts(car(bindings), &names[i], &init)) return fail(ctx, "malformed let binding");
+    if (check_binding(ctx, names[i]) < 0) return -1;
+    values[i] = compile_expression(ctx, init, NOT_TAIL);
+    if (values[i] < 0) return -1;
+    if (sequential && !push_local(ctx, names[i], values[i])) return fail(ctx, "too many locals");
+  }
+  for (i = 0; !sequential && i < count; i++) {
+    if (!push_local(ctx, names[i], values[i])) return fail(ctx, "too many locals");
+  }
+
+  int result = compile_sequence(ctx, cddr(exp), tail);
+  ctx->num_locals = mark;
+  return result;
+}
+
+static bool push_loop(context_t *ctx, object_t *name, int num_vars, const int *vars) {
+  if (ctx->num_loops == COMPILER_MAX_LOOPS) return false;
+  loop_t *loop = &ctx->loops[ctx->num_loops++];
+  loop->name = name;
+  loop->label = ctx->next_label++;
+  loop->num_vars = num_vars;
+  memcpy(loop->vars, vars, (size_t)num_vars * sizeof(int));
+  loop->locals_mark = ctx->num_locals;
+  loop->used = false;
+  return true;
+}
+
+/*
+ * Named let becomes a labelled block. Only calls in tail position are
+ * supported, since those are the ones that can jump back to the label.
+ */
+static int compile_named_let(context_t *ctx, object_t *exp, int tail) {
+  object_t *name = cadr(exp);
+  object_t *bindings = caddr(exp);
+  int count = list_length(bindings);
+  if (count < 0 || count > COMPILER_MAX_ARGUMENTS) return fail(ctx, "malformed named let bindings");
+  if (check_binding(ctx, name) < 0) return -1;
+
+  int mark = ctx->num_locals;
+  int vars[COMPILER_MAX_ARGUMENTS];
+  object_t *names[COMPILER_MAX_ARGUMENTS];
+  int i = 0;
+  for (; bindings != g_scheme_null; bindings = cdr(bindings), i++) {
+    object_t *init;
+    if (!binding_parts(car(bindings), &names[i], &init)) return fail(ctx, "malformed named let binding");
+    if (check_binding(ctx, names[i]) < 0) return -1;
+    vars[i] = compile_expression(ctx, init, NOT_TAIL);
+    if (vars[i] < 0) return -1;
+  }
+
+  int result = new_var(ctx, "NULL");
+  if (!push_loop(ctx, name, count, vars)) return fail(ctx, "loops nested too deeply");
+  int loop = ctx->num_loops - 1;
+  for (i = 0; i < count; i++) {
+    if (!push_local(ctx, names[i], vars[i])) return fail(ctx, "too many locals");
+  }
+
+  emit_line(ctx, "loop%d: {", ctx->loops[loop].label);
+  ctx->indent++;
+  int value = compile_sequence(ctx, cdddr(exp), tail < loop ? tail : loop);
+  if (value < 0) return -1;
+  emit_line(ctx, "v%d = v%d;", result, value);
+  ctx->indent--;
+  emit_line(ctx, "}");
+
+  ctx->num_loops--;
+  ctx->num_locals = mark;
+  return result;
+}
+
+static int compile_do(context_t *ctx, object_t *exp, int tail) {
+  if (list_length(exp) < 3) return fail(ctx, "malformed do");
+  object_t *specs = cadr(exp);
+  object_t *exit_clause = caddr(exp);
+  int count = list_length(specs);
+  if (count < 0 || count > COMPILER_MAX_ARGUMENTS || list_length(exit_clause) < 1) return fail(ctx, "malformed do");
+
+  int mark = ctx->num_locals;
+  int vars[COMPILER_MAX_ARGUMENTS];
+  object_t *names[COMPILER_MAX_ARGUMENTS];
+  int i = 0;
+  for (object_t *spec = specs; spec != g_scheme_null; spec = cdr(spec), i++) {
+    object_t *init;
+    int len = list_length(car(spec));
+    if ((len != 2 && len != 3) || !binding_parts(car(spec), &names[i], &init)) return fail(ctx, "malformed do variable");
+    if (check_binding(ctx, names[i]) < 0) return -1;
+    vars[i] = compile_expression(ctx, init, NOT_TAIL);
+    if (vars[i] < 0) return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if (!push_local(ctx, names[i], vars[i])) return fail(ctx, "too many locals");
+  }
+
+  int result = constant_var(ctx, lg_sym_ok);
+  emit_line(ctx, "for (;;) {");
+  ctx->indent++;
+  int test = compile_expression(ctx, car(exit_clause), NOT_TAIL);
+  if (test < 0) return -1;
+  emit_line(ctx, "if (v%d != g_false) {", test);
+  ctx->indent++;
+  if (cdr(exit_clause) != g_scheme_null) {
+    int value = compile_sequence(ctx, cdr(exit_clause), tail);
+    if (value < 0) return -1;
+    emit_line(ctx, "v%d = v%d;", result, value);
+  }
+  emit_line(ctx, "break;");
+  ctx->indent--;
+  emit_line(ctx, "}");
+
+  for (object_t *command = cdddr(exp); command != g_scheme_null; command = cdr(command)) {
+    if (compile_expression(ctx, car(command), NOT_TAIL) < 0) return -1;
+  }
+
+  // Every step is evaluated before any var changes
+  int steps[COMPILER_MAX_ARGUMENTS];
+  i = 0;
+  for (object_t *spec = specs; spec != g_scheme_null; spec = cdr(spec), i++) {
+    steps[i] = -1;
+    if (cddr(car(spec)) == g_scheme_null) continue;
+    steps[i] = compile_expression(ctx, caddr(car(spec)), NOT_TAIL);
+    if (steps[i] < 0) return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if (steps[i] >= 0) emit_line(ctx, "v%d = v%d;", vars[i], steps[i]);
+  }
+  ctx->indent--;
+  emit_line(ctx, "}");
+
+  ctx->num_locals = mark;
+  return result;
+}
+
+static int compile_set(context_t *ctx, object_t *exp) {
+  if (list_length(exp) != 3 || cadr(exp)->type != SCHEME_SYMBOL) return fail(ctx, "malformed set!");
+  int local = find_local(ctx, cadr(exp));
+  if (local < 0) return fail(ctx, "set! of a global");
+  int value = compile_expression(ctx, caddr(exp), NOT_TAIL);
+  if (value < 0) return -1;
+  emit_line(ctx, "v%d = v%d;", ctx->locals[local].var, value);
+  return constant_var(ctx, lg_sym_ok);
+}
+
+static int compile_operands(context_t *ctx, object_t *operands, int *outargs) {
+  int argc = 0;
+  for (; operands != g_scheme_null; operands = cdr(operands)) {
+    if (argc == COMPILER_MAX_ARGUMENTS) return fail(ctx, "too many arguments");
+    outargs[argc] = compile_expression(ctx, car(operands), NOT_TAIL);
+    if (outargs[argc] < 0) return -1;
+    argc++;
+  }
+  return argc;
+}
+
+// Collects the operands into an argv array named a<var> and returns var
+static int emit_argv(context_t *ctx, int argc, const int *args) {
+  int var = ctx->next_var++;
+  if (argc == 0) {
+    emit_line(ctx, "object_t **a%d = NULL;", var);
+    return var;
+  }
+
+  buffer_t list = {NULL, 0, 0};
+  for (int i = 0; i < argc; i++) {
+    buffer_printf(&list, "%sv%d", i == 0 ? "" : ", ", args[i]);
+  }
+  emit_line(ctx, "object_t *a%d[] = {%s};", var, list.data);
+  free(list.data);
+  return var;
+}
+
+static int compile_loop_call(context_t *ctx, int loop_index, int argc, const int *args) {
+  loop_t *loop = &ctx->loops[loop_index];
+  if (argc != loop->num_vars) return fail(ctx, "wrong number of arguments to a loop");
+  for (int i = 0; i < argc; i++) {
+    emit_line(ctx, "v%d = v%d;", loop->vars[i], args[i]);
+  }
+  emit_line(ctx, "goto loop%d;", loop->label);
+  loop->used = true;
+  // Never read: control does not come back here
+  return new_var(ctx, "NULL");
+}
+
+static int compile_inline(context_t *ctx, inline_kind_t kind, size_t builtin, const int *args) {
+  int var = ctx->next_var++;
+  switch (kind) {
+    case INLINE_CAR: emit_line(ctx, "object_t *v%d = scm_car(v%d);", var, args[0]); break;
+    case INLINE_CDR: emit_line(ctx, "object_t *v%d = scm_cdr(v%d);", var, args[0]); break;
+    case INLINE_CONS: emit_line(ctx, "object_t *v%d = cons(v%d, v%d);", var, args[0], args[1]); break;
+    case INLINE_NULLP: emit_line(ctx, "object_t *v%d = scm_bool(v%d == g_scheme_null);", var, args[0]); break;
+    case INLINE_PAIRP: emit_line(ctx, "object_t *v%d = scm_bool(v%d->type == SCHEME_CONS);", var, args[0]); break;
+    case INLINE_EQP: emit_line(ctx, "object_t *v%d = scm_bool(v%d == v%d);", var, args[0], args[1]); break;
+    case INLINE_ADD: emit_line(ctx, "object_t *v%d = scm_add(%zu, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_SUB: emit_line(ctx, "object_t *v%d = scm_sub(%zu, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_MUL: emit_line(ctx, "object_t *v%d = scm_mul(%zu, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_NUM_EQ: emit_line(ctx, "object_t *v%d = scm_compare(%zu, 0, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_LT: emit_line(ctx, "object_t *v%d = scm_compare(%zu, -1, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_GT: emit_line(ctx, "object_t *v%d = scm_compare(%zu, 1, v%d, v%d);", var, builtin, args[0], args[1]); break;
+    case INLINE_NONE: error("No inline template");
+  }
+  return var;
+}
+
+static int compile_application(context_t *ctx, object_t *exp, int tail) {
+  if (list_length(exp) < 1) return fail(ctx, "improper application");
+  object_t *head = car(exp);
+  unit_t *unit = ctx->unit;
+
+  // A local or computed operator is evaluated before the operands, as the interpreter does
+  int op = -1;
+  bool is_local = head->type == SCHEME_SYMBOL && find_local(ctx, head) >= 0 && find_loop(ctx, head) < 0;
+  // Named lets other than the function itself are bound locally
+  if (head->type == SCHEME_SYMBOL && !is_local && find_loop(ctx, head) <= 0 && check_free_name(ctx, head) < 0) return -1;
+  if (head->type != SCHEME_SYMBOL || is_local) {
+    op = compile_expression(ctx, head, NOT_TAIL);
+    if (op < 0) return -1;
+  }
+
+  int args[COMPILER_MAX_ARGUMENTS];
+  int argc = compile_operands(ctx, cdr(exp), args);
+  if (argc < 0) return -1;
+
+  if (op >= 0) {
+    int argv_var = emit_argv(ctx, argc, args);
+    int var = ctx->next_var++;
+    emit_line(ctx, "object_t *v%d = scm_apply(v%d, %d, a%d);", var, op, argc, argv_var);
+    return var;
+  }
+
+  int loop = find_loop(ctx, head);
+  if (loop >= 0 && tail <= loop) return compile_loop_call(ctx, loop, argc, args);
+  if (loop > 0) return fail(ctx, "named let called outside tail position");
+
+  // Calls with the wrong number of arguments go through apply, which reports the error
+  int function = find_function(unit, head);
+  if (function >= 0 && unit->functions[function].arity == argc) {
+    int argv_var = emit_argv(ctx, argc, args);
+    int var = ctx->next_var++;
+    emit_line(ctx, "object_t *v%d = scm_fn_%d(%d, a%d);", var, function, argc, argv_var);
+    return var;
+  }
+
+  if (is_builtin(unit, head) && primitive_accepts(get_primitive_entry(lookup_global(head)), argc)) {
+    size_t builtin = vector_index(&unit->builtins, head);
+    inline_kind_t kind = inline_kind_for(head, argc);
+    if (kind != INLINE_NONE) return compile_inline(ctx, kind, builtin, args);
+    int argv_var = emit_argv(ctx, argc, args);
+    int var = ctx->next_var++;
+    emit_line(ctx, "object_t *v%d = scm_call_primitive(lg_builtins[%zu], %d, a%d);", var, builtin, argc, argv_var);
+    return var;
+  }
+
+  int argv_var = emit_argv(ctx, argc, args);
+  int var = ctx->next_var++;
+  emit_line(ctx, "object_t *v%d = scm_call_global(lg_symbols[%zu], %d, a%d);",
+            var, vector_index(&unit->symbols, head), argc, argv_var);
+  return var;
+}
+
+static int compile_expression(context_t *ctx, object_t *exp, int tail) {
+  switch (object_type(exp)) {
+    case SCHEME_NUMBER:
+    case SCHEME_STRING:
+    case SCHEME_NULL:
+    case SCHEME_DOUBLE: {
+      return constant_var(ctx, exp);
+    }
+    case SCHEME_SYMBOL: {
+      return compile_variable(ctx, exp);
+    }
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      return fail(ctx, "procedure object in code");
+    }
+    case SCHEME_CONS: {
+      break;
+    }
+  }
+
+  object_t *head = car(exp);
+  int len = list_length(exp);
+  if (len < 0) return fail(ctx, "improper form");
+
+  // Special form names only count when no local shadows them
+  if (head->type == SCHEME_SYMBOL && find_local(ctx, head) < 0) {
+    if (head == lg_sym_quote) {
+      if (len != 2) return fail(ctx, "malformed quote");
+      return constant_var(ctx, cadr(exp));
+    }
+    if (head == lg_sym_if) return compile_if(ctx, exp, tail);
+    if (head == lg_sym_begin) return compile_sequence(ctx, cdr(exp), tail);
+    if (head == lg_sym_and) return compile_and_or(ctx, exp, tail, true);
+    if (head == lg_sym_or) return compile_and_or(ctx, exp, tail, false);
+    if (head == lg_sym_cond) return compile_cond(ctx, exp, tail);
+    if (head == lg_sym_let) {
+      if (len < 3) return fail(ctx, "malformed let");
+      if (cadr(exp)->type == SCHEME_SYMBOL) {
+        if (len < 4) return fail(ctx, "malformed named let");
+        return compile_named_let(ctx, exp, tail);
+      }
+      return compile_let(ctx, exp, tail, false);
+    }
+    if (head == lg_sym_let_star) {
+      if (len < 3) return fail(ctx, "malformed let*");
+      return compile_let(ctx, exp, tail, true);
+    }
+    if (head == lg_sym_do) return compile_do(ctx, exp, tail);
+    if (head == lg_sym_set) return compile_set(ctx, exp);
+    if (head == lg_sym_lambda) return fail(ctx, "nested lambda");
+    if (head == lg_sym_define) return fail(ctx, "internal define");
+    if (head == lg_sym_letrec) return fail(ctx, "letrec");
+    if (head == lg_sym_define_syntax) return fail(ctx, "internal define-syntax");
+  }
+
+  return compile_application(ctx, exp, tail);
+}
+
+static bool compile_function(unit_t *unit, size_t index) {
+  function_t *function = &unit->functions[index];
+  context_t *ctx = (context_t*)calloc(1, sizeof(context_t));
+  ASSERT_OR_ERROR(ctx != NULL, "Could not allocate compiler context");
+  buffer_t body = {NULL, 0, 0};
+  ctx->unit = unit;
+  ctx->function = function;
+  ctx->out = &body;
+  ctx->indent = 1;
+
+  int vars[COMPILER_MAX_ARGUMENTS];
+  int i = 0;
+  for (object_t *p = function->parameters; p != g_scheme_null; p = cdr(p), i++) {
+    vars[i] = ctx->next_var++;
+    push_local(ctx, car(p), vars[i]);
+    check_binding(ctx, car(p));
+  }
+  push_loop(ctx, function->name, function->arity, vars);
+  ctx->loops[0].locals_mark = 0;
+
+  int result = ctx->failure == NULL ? compile_sequence(ctx, function->body, 0) : -1;
+  if (result >= 0) emit_line(ctx, "return v%d;", result);
+
+  function->failure = ctx->failure;
+  free(function->code.data);
+  memset(&function->code, 0, sizeof(buffer_t));
+  if (result >= 0) {
+    buffer_t *code = &function->code;
+    buffer_printf(code, "// %s\n", symbol_name(function->name));
+    buffer_printf(code, "static object_t *scm_fn_%zu(int argc, object_t *argv[]) {\n", index);
+    buffer_printf(code, "  (void)argc;\n");
+    for (i = 0; i < function->arity; i++) {
+      buffer_printf(code, "  object_t *v%d = argv[%d];\n", vars[i], i);
+    }
+    if (function->arity == 0) buffer_printf(code, "  (void)argv;\n");
+    if (ctx->loops[0].used) buffer_printf(code, "loop%d:;\n", ctx->loops[0].label);
+    buffer_printf(code, "%s}\n\n", body.data);
+  }
+
+  free(body.data);
+  free(ctx);
+  return result >= 0;
+}
+
+static bool is_function_definition(object_t *exp) {
+  if (list_length(exp) != 3 || car(exp) != lg_sym_define || cadr(exp)->type != SCHEME_SYMBOL) return false;
+  object_t *value = caddr(exp);
+  if (list_length(value) < 3 || car(value) != lg_sym_lambda) return false;
+  int arity = list_length(cadr(value));
+  if (arity < 0 || arity > COMPILER_MAX_ARGUMENTS) return false;
+  for (object_t *p = cadr(value); p != g_scheme_null; p = cdr(p)) {
+    if (car(p)->type != SCHEME_SYMBOL) return false;
+  }
+  return true;
+}
+
+static void note_names(unit_t *unit, object_t *exp, vector_t *scope);
+
+static void note_binding(unit_t *unit, object_t *name, vector_t *scope) {
+  if (name->type != SCHEME_SYMBOL) return;
+  vector_index(&unit->bound, name);
+  vector_index(scope, name);
+}
+
+static void note_sequence(unit_t *unit, object_t *seq, vector_t *scope) {
+  for (; seq->type == SCHEME_CONS; seq = cdr(seq)) note_names(unit, car(seq), scope);
+  note_names(unit, seq, scope);
+}
+
+// The init of a let binding or do variable, or NULL when it is malformed
+static object_t *binding_init(object_t *binding) {
+  return list_length(binding) >= 2 ? cadr(binding) : NULL;
+}
+
+// let inits see none of the let's own vars, let* inits see the ones before them
+static void note_bindings(unit_t *unit, object_t *bindings, vector_t *scope, bool sequential) {
+  for (object_t *b = bindings; b->type == SCHEME_CONS; b = cdr(b)) {
+    object_t *init = binding_init(car(b));
+    if (init == NULL) continue;
+    note_names(unit, init, scope);
+    if (sequential) note_binding(unit, car(car(b)), scope);
+  }
+  for (object_t *b = bindings; !sequential && b->type == SCHEME_CONS; b = cdr(b)) {
+    if (binding_init(car(b)) != NULL) note_binding(unit, car(car(b)), scope);
+  }
+}
+
+/*
+ * Collects the names each form binds and the names it uses free into the
+ * unit's bound and free tables, which decide what can be compiled. Keywords
+ * are collected as free names too, which only makes the tables larger.
+ */
+static void note_names(unit_t *unit, object_t *exp, vector_t *scope) {
+  if (exp->type == SCHEME_SYMBOL) {
+    if (!vector_contains(scope, exp)) vector_index(&unit->free, exp);
+    return;
+  }
+  if (exp->type != SCHEME_CONS) return;
+
+  object_t *head = car(exp);
+  int len = list_length(exp);
+  size_t mark = scope->len;
+  if (head == lg_sym_quote || head == lg_sym_define_syntax) return;
+  if (head == lg_sym_lambda && len >= 2) {
+    object_t *p = cadr(exp);
+    for (; p->type == SCHEME_CONS; p = cdr(p)) note_binding(unit, car(p), scope);
+    note_binding(unit, p, scope);
+    note_sequence(unit, cddr(exp), scope);
+  } else if (head == lg_sym_define && len == 3) {
+    note_binding(unit, cadr(exp), scope);
+    note_names(unit, caddr(exp), scope);
+  } else if ((head == lg_sym_let || head == lg_sym_let_star || head == lg_sym_letrec) && len >= 3) {
+    object_t *bindings = cadr(exp);
+    object_t *body = cddr(exp);
+    if (bindings->type == SCHEME_SYMBOL && len >= 4) {
+      // Named let: the inits are outside the loop, the body sees its name and vars
+      note_bindings(unit, caddr(exp), scope, false);
+      note_binding(unit, bindings, scope);
+      body = cdddr(exp);
+    } else if (head == lg_sym_letrec) {
+      for (object_t *b = bindings; b->type == SCHEME_CONS; b = cdr(b)) {
+        if (binding_init(car(b)) != NULL) note_binding(unit, car(car(b)), scope);
+      }
+      note_bindings(unit, bindings, scope, true);
+    } else {
+      note_bindings(unit, bindings, scope, head == lg_sym_let_star);
+    }
+    note_sequence(unit, body, scope);
+  } else if (head == lg_sym_do && len >= 3) {
+    note_bindings(unit, cadr(exp), scope, false);
+    for (object_t *spec = cadr(exp); spec->type == SCHEME_CONS; spec = cdr(spec)) {
+      if (list_length(car(spec)) == 3) note_names(unit, caddr(car(spec)), scope);
+    }
+    note_sequence(unit, cddr(exp), scope);
+  } else {
+    note_sequence(unit, exp, scope);
+  }
+  scope->len = mark;
+}
+
+static void add_form(unit_t *unit, const char *text, size_t len) {
+  unit->forms = (form_t*)realloc(unit->forms, (unit->num_forms + 1) * sizeof(form_t));
+  ASSERT_OR_ERROR(unit->forms != NULL, "Could not grow form table");
+  form_t *form = &unit->forms[unit->num_forms++];
+  form->text = text;
+  form->len = len;
+  form->function = -1;
+
+  object_t *exp = optimize(expand(valid_exp_into_object(text, len)));
+  // A top-level define names a global, not a binding
+  vector_t scope = {NULL, 0, 0};
+  bool is_define = list_length(exp) == 3 && car(exp) == lg_sym_define && cadr(exp)->type == SCHEME_SYMBOL;
+  note_names(unit, is_define ? caddr(exp) : exp, &scope);
+  free(scope.items);
+
+  if (is_function_definition(exp)) {
+    unit->functions = (function_t*)realloc(unit->functions, (unit->num_functions + 1) * sizeof(function_t));
+    ASSERT_OR_ERROR(unit->functions != NULL, "Could not grow function table");
+    function_t *function = &unit->functions[unit->num_functions];
+    memset(function, 0, sizeof(function_t));
+    function->name = cadr(exp);
+    function->parameters = cadr(caddr(exp));
+    function->body = cddr(caddr(exp));
+    function->arity = list_length(function->parameters);
+    function->compiled = true;
+    form->function = (int)unit->num_functions++;
+  } else if (list_length(exp) >= 2 && car(exp) == lg_sym_define && cadr(exp)->type == SCHEME_SYMBOL) {
+    vector_index(&unit->defined, cadr(exp));
+  }
+}
+
+/*
+ * Splits the source into top-level forms. The reader knows neither ; comments
+ * nor line breaks and tabs as whitespace, so those are blanked out first.
+ */
+static char *split_forms(unit_t *unit, const char *source, size_t len) {
+  char *text = (char*)malloc(len + 1);
+  ASSERT_OR_ERROR(text != NULL, "Could not copy source");
+  memcpy(text, source, len);
+  text[len] = '\0';
+
+  bool in_string = false;
+  for (size_t i = 0; i < len; i++) {
+    if (in_string) {
+      if (text[i] == '\\' && i + 1 < len) i++;
+      else if (text[i] == '"') in_string = false;
+    } else if (text[i] == '"') {
+      in_string = true;
+    } else if (text[i] == ';') {
+      for (; i < len && text[i] != '\n'; i++) text[i] = ' ';
+      if (i < len) text[i] = ' ';
+    } else if (text[i] == '\n' || text[i] == '\t' || text[i] == '\r') {
+      text[i] = ' ';
+    }
+  }
+
+  size_t i = 0;
+  while (i < len) {
+    if (text[i] == ' ') {
+      i++;
+      continue;
+    }
+
+    size_t start = i;
+    if (text[i] == '(') {
+      int depth = 0;
+      in_string = false;
+      for (; i < len; i++) {
+        if (in_string) {
+          if (text[i] == '\\' && i + 1 < len) i++;
+          else if (text[i] == '"') in_string = false;
+        } else if (text[i] == '"') {
+          in_string = true;
+        } else if (text[i] == '(') {
+          depth++;
+        } else if (text[i] == ')' && --depth == 0) {
+          i++;
+          break;
+        }
+      }
+      ASSERT_OR_ERROR(depth == 0, "Unbalanced parentheses in source");
+    } else {
+      while (i < len && text[i] != ' ') i++;
+    }
+    add_form(unit, &text[start], i - start);
+  }
+
+  return text;
+}
+
+static void emit_constant(buffer_t *b, object_t *value) {
+  switch (object_type(value)) {
+    case SCHEME_NUMBER: {
+      buffer_printf(b, "allocate_number(INT64_C(%" PRId64 "))", (int64_t)value->number_or_index);
+      return;
+    }
+    case SCHEME_DOUBLE: {
+      buffer_printf(b, "allocate_double(%.17g)", get_double(value));
+      return;
+    }
+    case SCHEME_STRING: {
+      string_entry_t *entry = get_string_entry(value);
+      buffer_printf(b, "scm_string(");
+      buffer_c_string(b, entry->str, entry->len);
+      buffer_printf(b, ", %zu)", entry->len);
+      return;
+    }
+    case SCHEME_SYMBOL: {
+      symbol_entry_t *entry = get_symbol_entry(value);
+      buffer_printf(b, "symboln(");
+      buffer_c_string(b, entry->sym, entry->len);
+      buffer_printf(b, ", %zu)", entry->len);
+      return;
+    }
+    case SCHEME_NULL: {
+      buffer_printf(b, "g_scheme_null");
+      return;
+    }
+    case SCHEME_CONS: {
+      buffer_printf(b, "cons(");
+      emit_constant(b, car(value));
+      buffer_printf(b, ", ");
+      emit_constant(b, cdr(value));
+      buffer_printf(b, ")");
+      return;
+    }
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      error("Procedure in quoted constant");
+    }
+  }
+}
+
+static const char lg_module_prelude[] =
+  "static inline object_t *scm_bool(bool value) {\n"
+  "  return value ? g_true : g_false;\n"
+  "}\n"
+  "\n"
+  "static object_t *scm_string(const char *text, size_t len) {\n"
+  "  string_entry_t *entry;\n"
+  "  object_t *string = allocate_string(len, &entry);\n"
+  "  memcpy(entry->str, text, len);\n"
+  "  entry->str[len] = '\\0';\n"
+  "  return string;\n"
+  "}\n"
+  "\n"
+  "static object_t *scm_lookup(object_t *name) {\n"
+  "  object_t *value = lookup_global(name);\n"
+  "  ASSERT_OR_ERROR(value != NULL, \"Unbound variable\");\n"
+  "  return value;\n"
+  "}\n"
+  "\n"
+  "static object_t *scm_apply(object_t *op, int argc, object_t *argv[]) {\n"
+  "  return apply(op, argc, argv);\n"
+  "}\n"
+  "\n"
+  "static object_t *scm_call_global(object_t *name, int argc, object_t *argv[]) {\n"
+  "  return apply(scm_lookup(name), argc, argv);\n"
+  "}\n"
+  "\n"
+  "static void scm_define_function(const char *name, primitive_func func, int arity) {\n"
+  "  primitive_entry_t *entry;\n"
+  "  allocate_primitive(name, func, &entry);\n"
+  "  entry->min_args = (int16_t)arity;\n"
+  "  entry->max_args = (int16_t)arity;\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_call_primitive(object_t *primitive, int argc, object_t *argv[]) {\n"
+  "  return get_primitive_entry(primitive)->func(argc, argv);\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_car(object_t *pair) {\n"
+  "  ASSERT_OR_ERROR(pair->type == SCHEME_CONS, \"Expected cons\");\n"
+  "  return car(pair);\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_cdr(object_t *pair) {\n"
+  "  ASSERT_OR_ERROR(pair->type == SCHEME_CONS, \"Expected cons\");\n"
+  "  return cdr(pair);\n"
+  "}\n"
+  "\n"
+  "// Anything off the fixnum fast paths goes to the builtin itself\n"
+  "static object_t *scm_call_builtin2(size_t builtin, object_t *a, object_t *b) {\n"
+  "  object_t *args[] = {a, b};\n"
+  "  return scm_call_primitive(lg_builtins[builtin], 2, args);\n"
+  "}\n"
+  "\n"
+  "static inline bool scm_fixnums(object_t *a, object_t *b) {\n"
+  "  return a->type == SCHEME_NUMBER && b->type == SCHEME_NUMBER;\n"
+  "}\n"
+  "\n"
+  "static inline bool scm_fits(int64_t value) {\n"
+  "  return value >= SCHEME_INT_MIN && value <= SCHEME_INT_MAX;\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_add(size_t builtin, object_t *a, object_t *b) {\n"
+  "  int64_t result;\n"
+  "  if (scm_fixnums(a, b) && !__builtin_add_overflow((int64_t)a->number_or_index, (int64_t)b->number_or_index, &result)\n"
+  "      && scm_fits(result)) return allocate_number(result);\n"
+  "  return scm_call_builtin2(builtin, a, b);\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_sub(size_t builtin, object_t *a, object_t *b) {\n"
+  "  int64_t result;\n"
+  "  if (scm_fixnums(a, b) && !__builtin_sub_overflow((int64_t)a->number_or_index, (int64_t)b->number_or_index, &result)\n"
+  "      && scm_fits(result)) return allocate_number(result);\n"
+  "  return scm_call_builtin2(builtin, a, b);\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_mul(size_t builtin, object_t *a, object_t *b) {\n"
+  "  int64_t result;\n"
+  "  if (scm_fixnums(a, b) && !__builtin_mul_overflow((int64_t)a->number_or_index, (int64_t)b->number_or_index, &result)\n"
+  "      && scm_fits(result)) return allocate_number(result);\n"
+  "  return scm_call_builtin2(builtin, a, b);\n"
+  "}\n"
+  "\n"
+  "static inline object_t *scm_compare(size_t builtin, int sign, object_t *a, object_t *b) {\n"
+  "  if (!scm_fixnums(a, b)) return scm_call_builtin2(builtin, a, b);\n"
+  "  int64_t x = a->number_or_index;\n"
+  "  int64_t y = b->number_or_index;\n"
+  "  return scm_bool(sign == 0 ? x == y : sign < 0 ? x < y : x > y);\n"
+  "}\n"
+  "\n"
+  "static void scm_eval_source(const char *text, size_t len) {\n"
+  "  eval(valid_exp_into_object(text, len));\n"
+  "}\n"
+  "\n";
+
+static void init_keywords(void) {
+  lg_sym_quote = symbol("quote");
+  lg_sym_if = symbol("if");
+  lg_sym_define = symbol("define");
+  lg_sym_set = symbol("set!");
+  lg_sym_lambda = symbol("lambda");
+  lg_sym_begin = symbol("begin");
+  lg_sym_let = symbol("let");
+  lg_sym_let_star = symbol("let*");
+  lg_sym_letrec = symbol("letrec");
+  lg_sym_cond = symbol("cond");
+  lg_sym_else = symbol("else");
+  lg_sym_arrow = symbol("=>");
+  lg_sym_and = symbol("and");
+  lg_sym_or = symbol("or");
+  lg_sym_do = symbol("do");
+  lg_sym_define_syntax = symbol("define-syntax");
+  lg_sym_ok = symbol("ok");
+}
+
+/*
+ * Direct calls are only emitted to functions that compile, so a function that
+ * falls back to the interpreter forces its callers to be compiled again.
+ */
+static void compile_functions(unit_t *unit) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < unit->num_functions; i++) {
+      function_t *function = &unit->functions[i];
+      if (!function->compiled) continue;
+      if (!compile_function(unit, i)) {
+        function->compiled = false;
+        changed = true;
+      }
+    }
+  }
+}
+
+static void write_object_table(FILE *out, const char *name, size_t count) {
+  fprintf(out, "static object_t *%s[%zu];\n", name, count > 0 ? count : 1);
+}
+
+static void write_module(unit_t *unit, const char *source_name, FILE *out) {
+  fprintf(out, "// Generated by schemin-compile from %s. Do not edit.\n\n", source_name);
+  fprintf(out, "#include <stdbool.h>\n#include <stdint.h>\n#include <string.h>\n");
+  fprintf(out, "#include \"memory.h\"\n#include \"interpreter.h\"\n#include \"parser.h\"\n");
+  fprintf(out, "#include \"module.h\"\n#include \"error.h\"\n\n");
+  fprintf(out, "const int schemin_module_abi = SCHEMIN_MODULE_ABI_VERSION;\n");
+  fprintf(out, "int schemin_module_init(void);\n\n");
+  write_object_table(out, "lg_symbols", unit->symbols.len);
+  write_object_table(out, "lg_builtins", unit->builtins.len);
+  write_object_table(out, "lg_constants", unit->constants.len);
+  fprintf(out, "\n%s", lg_module_prelude);
+
+  for (size_t i = 0; i < unit->num_functions; i++) {
+    if (unit->functions[i].compiled) fprintf(out, "static object_t *scm_fn_%zu(int argc, object_t *argv[]);\n", i);
+  }
+  fprintf(out, "\n");
+  for (size_t i = 0; i < unit->num_functions; i++) {
+    if (unit->functions[i].compiled) fputs(unit->functions[i].code.data, out);
+  }
+
+  buffer_t init = {NULL, 0, 0};
+  buffer_printf(&init, "int schemin_module_init(void) {\n");
+  for (size_t i = 0; i < unit->symbols.len; i++) {
+    buffer_printf(&init, "  lg_symbols[%zu] = ", i);
+    emit_constant(&init, unit->symbols.items[i]);
+    buffer_printf(&init, ";\n");
+  }
+  for (size_t i = 0; i < unit->builtins.len; i++) {
+    buffer_printf(&init, "  lg_builtins[%zu] = lookup_global(", i);
+    emit_constant(&init, unit->builtins.items[i]);
+    buffer_printf(&init, ");\n  if (lg_builtins[%zu] == NULL || lg_builtins[%zu]->type != SCHEME_PRIMITIVE) return -1;\n", i, i);
+  }
+  for (size_t i = 0; i < unit->constants.len; i++) {
+    buffer_printf(&init, "  lg_constants[%zu] = ", i);
+    emit_constant(&init, unit->constants.items[i]);
+    buffer_printf(&init, ";\n");
+  }
+  for (size_t i = 0; i < unit->num_forms; i++) {
+    form_t *form = &unit->forms[i];
+    if (form->function >= 0 && unit->functions[form->function].compiled) {
+      function_t *function = &unit->functions[form->function];
+      buffer_printf(&init, "  scm_define_function(");
+      buffer_c_string(&init, symbol_name(function->name), strlen(symbol_name(function->name)));
+      buffer_printf(&init, ", &scm_fn_%d, %d);\n", form->function, function->arity);
+    } else {
+      buffer_printf(&init, "  scm_eval_source(");
+      buffer_c_string(&init, form->text, form->len);
+      buffer_printf(&init, ", %zu);\n", form->len);
+    }
+  }
+  buffer_printf(&init, "  return 0;\n}\n");
+  fputs(init.data, out);
+  free(init.data);
+}
+
+int compile_to_c(const char *source, size_t len, const char *source_name, FILE *out, compiler_stats_t *outstats) {
+  init_keywords();
+  unit_t unit;
+  memset(&unit, 0, sizeof(unit));
+
+  char *text = split_forms(&unit, source, len);
+  compile_functions(&unit);
+  write_module(&unit, source_name, out);
+
+  compiler_stats_t stats = {0, 0};
+  for (size_t i = 0; i < unit.num_functions; i++) {
+    function_t *function = &unit.functions[i];
+    if (function->compiled) {
+      stats.compiled++;
+    } else {
+      stats.interpreted++;
+      fprintf(stderr, "%s: %s left to the interpreter: %s\n", source_name, symbol_name(function->name),
+              function->failure != NULL ? function->failure : "unsupported");
+    }
+    free(function->code.data);
+  }
+  if (outstats != NULL) *outstats = stats;
+
+  free(unit.forms);
+  free(unit.functions);
+  free(unit.defined.items);
+  free(unit.bound.items);
+  free(unit.free.items);
+  free(unit.symbols.items);
+  free(unit.builtins.items);
+  free(unit.constants.items);
+  free(text);
+  return ferror(out) ? -1 : 0;
+}
+
+int build_module(const char *include_dir, const char *c_path, const char *output) {
+  const char *cc = getenv("CC");
+  if (cc == NULL || *cc == '\0') cc = "cc";
+
+  size_t include_len = strlen(include_dir) + 3;
+  char *include = (char*)malloc(include_len);
+  ASSERT_OR_ERROR(include != NULL, "Could not allocate include flag");
+  snprintf(include, include_len, "-I%s", include_dir);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp(cc, cc, "-std=gnu11", "-shared", "-fPIC", "-O2", include, "-o", output, c_path, (char*)NULL);
+    perror(cc);
+    _exit(127);
+  }
+  free(include);
+  if (pid < 0) return -1;
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0) return -1;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef SCHEMIN_COMPILER_H
+#define SCHEMIN_COMPILER_H
+SCHEMIN_COMPILER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "scheme_types.h"
+
+/*
+ * Ahead-of-time translation of a Scheme source file to a C module. Each
+ * top-level (define name (lambda (params ...) body ...)) whose body only uses
+ * forms the compiler understands becomes a C function, which the module
+ * registers as a primitive when it is loaded. Every other top-level form is
+ * embedded as source text and evaluated by the interpreter at the same point
+ * in load order.
+ *
+ * Compiled functions keep their own parameters and local bindings in C
+ * variables and see everything else through the global environment. Builtin
+ * primitives and calls between functions of the same module are bound when
+ * the module is compiled, and macros used by compiled functions must be
+ * defined earlier in the same file. Since scope is dynamic, a function is left
+ * to the interpreter if it uses a name free that the module binds anywhere,
+ * binds a name the module uses free, or uses a name that is neither defined in
+ * the module nor global at compile time.
+ *
+ * Requires system_init().
+ */
+
+typedef struct compiler_stats_s {
+  size_t compiled;
+  size_t interpreted;
+} compiler_stats_t;
+
+int compile_to_c(const char *source, size_t len, const char *source_name, FILE *out, compiler_stats_t *outstats);
+// Builds C written by compile_to_c into a module with $CC; returns 0 on success
+int build_module(const char *include_dir, const char *c_path, const char *output);
+
+#endif
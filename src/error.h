@@ -9,8 +9,12 @@ SCHEMIN_ERROR_H
 #pragma clang diagnostic ignored "-Wunused-function"
 #pragma clang diagnostic ignored "-Wunused-macros"
 
+// Set while some subsystem can say what was running when an error happened
+extern void (*g_error_context_func)(FILE *out);
+
 _Noreturn static inline void error(const char *msg) {
     fprintf(stderr, "%s\n", msg);
+    if (g_error_context_func != NULL) g_error_context_func(stderr);
     abort();
     __builtin_unreachable();
 }
@@ -0,0 +1,705 @@
+#include "expander.h"
+#include <stdbool.h>
+#include "memory.h"
+#include "error.h"
+
+typedef struct macro_s macro_t;
+struct macro_s {
+  object_t *keyword;
+  object_t *literals;
+  // List of (pattern template) rules, tried in order
+  object_t *rules;
+  object_t *ellipsis;
+  macro_t *next;
+};
+
+static macro_t *lg_macros = NULL;
+// Special form names, which templates never rename
+static object_t *lg_core_keywords;
+// (renamed . original) for every identifier renamed while expanding the current form
+static object_t *lg_aliases;
+
+static object_t *lg_sym_quote;
+static object_t *lg_sym_lambda;
+static object_t *lg_sym_define_syntax;
+static object_t *lg_sym_syntax_rules;
+static object_t *lg_sym_ellipsis;
+static object_t *lg_sym_underscore;
+static object_t *lg_sym_begin;
+static object_t *lg_sym_ok;
+static object_t *lg_sym_define;
+static object_t *lg_sym_let;
+static object_t *lg_sym_let_star;
+static object_t *lg_sym_letrec;
+static object_t *lg_sym_do;
+static object_t *lg_sym_cond;
+static object_t *lg_sym_define_memoized;
+static object_t *lg_sym_memoize;
+static object_t *lg_sym_define_record_type;
+static object_t *lg_sym_make_record_type;
+static object_t *lg_sym_record_constructor;
+static object_t *lg_sym_record_predicate;
+static object_t *lg_sym_record_accessor;
+static object_t *lg_sym_record_modifier;
+
+static object_t *expand_expression(object_t *exp);
+
+static bool list_contains(object_t *list, object_t *obj) {
+  for (; list->type == SCHEME_CONS; list = cdr(list)) {
+    if (is_eq(car(list), obj)) return true;
+  }
+  return false;
+}
+
+static macro_t *find_macro(object_t *sym) {
+  if (sym->type != SCHEME_SYMBOL) return NULL;
+  if ((get_symbol_entry(sym)->flags & SYMBOL_MACRO) == 0) return NULL;
+
+  for (macro_t *macro = lg_macros; macro != NULL; macro = macro->next) {
+    if (is_eq(macro->keyword, sym)) return macro;
+  }
+  return NULL;
+}
+
+/*
+ * (define-syntax keyword (syntax-rules (literal ...) (pattern template) ...)),
+ * optionally with a custom ellipsis symbol before the literals.
+ */
+static void define_syntax(object_t *exp) {
+  ASSERT_OR_ERROR(list_length(exp) == 3, "define-syntax expects a keyword and syntax-rules");
+  object_t *keyword = cadr(exp);
+  object_t *spec = caddr(exp);
+  ASSERT_OR_ERROR(keyword->type == SCHEME_SYMBOL, "define-syntax keyword must be a symbol");
+  ASSERT_OR_ERROR(list_length(spec) >= 2 && is_eq(car(spec), lg_sym_syntax_rules), "Expected syntax-rules");
+
+  object_t *ellipsis = lg_sym_ellipsis;
+  object_t *rest = cdr(spec);
+  if (car(rest)->type == SCHEME_SYMBOL) {
+    ellipsis = car(rest);
+    rest = cdr(rest);
+    ASSERT_OR_ERROR(rest != g_scheme_null, "syntax-rules expects a literals list");
+  }
+  ASSERT_OR_ERROR(list_length(car(rest)) >= 0, "syntax-rules literals must be a list");
+  for (object_t *rules = cdr(rest); rules != g_scheme_null; rules = cdr(rules)) {
+    object_t *rule = car(rules);
+    ASSERT_OR_ERROR(list_length(rule) == 2 && car(rule)->type == SCHEME_CONS, "Malformed syntax-rules rule");
+  }
+
+  macro_t *macro = (macro_t*)malloc(sizeof(macro_t));
+  ASSERT_OR_ERROR(macro != NULL, "Could not allocate macro");
+  macro->keyword = keyword;
+  macro->literals = car(rest);
+  macro->rules = cdr(rest);
+  macro->ellipsis = ellipsis;
+  macro->next = lg_macros;
+  lg_macros = macro;
+  get_symbol_entry(keyword)->flags |= SYMBOL_MACRO;
+}
+
+/*
+ * Pattern variable bindings are an association list of (var depth . value),
+ * where a variable under n ellipses has depth n and its value is a list of
+ * depth n - 1 values.
+ */
+
+static object_t *make_binding(object_t *var, int64_t depth, object_t *value) {
+  return cons(var, cons(allocate_number(depth), value));
+}
+
+static object_t *find_binding(object_t *bindings, object_t *var) {
+  for (; bindings != g_scheme_null; bindings = cdr(bindings)) {
+    object_t *binding = car(bindings);
+    if (is_eq(car(binding), var)) return binding;
+  }
+  return NULL;
+}
+
+static inline int64_t binding_depth(object_t *binding) {
+  return cadr(binding)->number_or_index;
+}
+
+static inline object_t *binding_value(object_t *binding) {
+  return cddr(binding);
+}
+
+static bool is_pattern_variable(macro_t *macro, object_t *sym) {
+  return sym->type == SCHEME_SYMBOL && !is_eq(sym, macro->ellipsis) && !is_eq(sym, lg_sym_underscore)
+      && !list_contains(macro->literals, sym);
+}
+
+static object_t *pattern_variables(macro_t *macro, object_t *pattern, object_t *vars) {
+  if (is_pattern_variable(macro, pattern)) return cons(pattern, vars);
+  while (pattern->type == SCHEME_CONS) {
+    vars = pattern_variables(macro, car(pattern), vars);
+    pattern = cdr(pattern);
+  }
+  return is_pattern_variable(macro, pattern) ? cons(pattern, vars) : vars;
+}
+
+static bool constant_equal(object_t *a, object_t *b) {
+  if (a->type != b->type) return false;
+  switch (object_type(a)) {
+    case SCHEME_NUMBER: {
+      return a->number_or_index == b->number_or_index;
+    }
+    case SCHEME_STRING: {
+      string_entry_t *x = get_string_entry(a);
+      string_entry_t *y = get_string_entry(b);
+      return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+    }
+    case SCHEME_DOUBLE: {
+      return get_double(a) == get_double(b);
+    }
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_NULL:
+    case SCHEME_SYMBOL:
+    case SCHEME_CONS:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      return a == b;
+    }
+  }
+  return false;
+}
+
+// Number of ellipses var sits under within pattern, or -1 when it does not occur
+static int64_t pattern_depth(macro_t *macro, object_t *pattern, object_t *var) {
+  while (pattern->type == SCHEME_CONS) {
+    object_t *next = cdr(pattern);
+    bool repeated = next->type == SCHEME_CONS && is_eq(car(next), macro->ellipsis);
+    int64_t depth = pattern_depth(macro, car(pattern), var);
+    if (depth >= 0) return repeated ? depth + 1 : depth;
+    pattern = repeated ? cdr(next) : next;
+  }
+  return is_eq(pattern, var) ? 0 : -1;
+}
+
+static bool match(macro_t *macro, object_t *pattern, object_t *form, object_t **bindings);
+static object_t *original_name(object_t *sym);
+
+// Matches 'pattern ...' against the first 'count' elements of form
+static bool match_repeated(macro_t *macro, object_t *pattern, object_t *form, int count, object_t **bindings) {
+  object_t *items = g_scheme_null;
+  for (int i = 0; i < count; i++, form = cdr(form)) {
+    object_t *item_bindings = g_scheme_null;
+    if (!match(macro, pattern, car(form), &item_bindings)) return false;
+    items = cons(item_bindings, items);
+  }
+
+  object_t *vars = pattern_variables(macro, pattern, g_scheme_null);
+  for (; vars != g_scheme_null; vars = cdr(vars)) {
+    object_t *var = car(vars);
+    object_t *values = g_scheme_null;
+    // items is in reverse order, so consing restores the original order
+    for (object_t *item = items; item != g_scheme_null; item = cdr(item)) {
+      values = cons(binding_value(find_binding(car(item), var)), values);
+    }
+    int64_t depth = pattern_depth(macro, pattern, var);
+    *bindings = cons(make_binding(var, depth + 1, values), *bindings);
+  }
+  return true;
+}
+
+static bool match(macro_t *macro, object_t *pattern, object_t *form, object_t **bindings) {
+  if (pattern->type == SCHEME_SYMBOL) {
+    if (list_contains(macro->literals, pattern)) return is_eq(pattern, original_name(form));
+    if (is_eq(pattern, lg_sym_underscore)) return true;
+    *bindings = cons(make_binding(pattern, 0, form), *bindings);
+    return true;
+  }
+
+  if (pattern->type != SCHEME_CONS) return constant_equal(pattern, form);
+
+  while (pattern->type == SCHEME_CONS) {
+    object_t *next = cdr(pattern);
+    if (next->type == SCHEME_CONS && is_eq(car(next), macro->ellipsis)) {
+      object_t *after = cdr(next);
+      int min_after = 0;
+      for (object_t *p = after; p->type == SCHEME_CONS; p = cdr(p)) min_after++;
+      int available = 0;
+      for (object_t *f = form; f->type == SCHEME_CONS; f = cdr(f)) available++;
+      int count = available - min_after;
+      if (count < 0) return false;
+      if (!match_repeated(macro, car(pattern), form, count, bindings)) return false;
+      for (int i = 0; i < count; i++) form = cdr(form);
+      return match(macro, after, form, bindings);
+    }
+
+    if (form->type != SCHEME_CONS) return false;
+    if (!match(macro, car(pattern), car(form), bindings)) return false;
+    pattern = next;
+    form = cdr(form);
+  }
+
+  return match(macro, pattern, form, bindings);
+}
+
+static object_t *template_variables(object_t *tmpl, object_t *bindings, object_t *vars) {
+  if (tmpl->type == SCHEME_SYMBOL) {
+    object_t *binding = find_binding(bindings, tmpl);
+    if (binding != NULL && binding_depth(binding) > 0 && !list_contains(vars, tmpl)) return cons(tmpl, vars);
+    return vars;
+  }
+  while (tmpl->type == SCHEME_CONS) {
+    vars = template_variables(car(tmpl), bindings, vars);
+    tmpl = cdr(tmpl);
+  }
+  return tmpl->type == SCHEME_SYMBOL ? template_variables(tmpl, bindings, vars) : vars;
+}
+
+static void append_to_list(object_t **head, object_t **tail, object_t *obj) {
+  object_t *cell = cons(obj, g_scheme_null);
+  if (*head == g_scheme_null) {
+    *head = cell;
+  } else {
+    get_cons_entry(*tail)->cdr = cell;
+  }
+  *tail = cell;
+}
+
+static object_t *instantiate(macro_t *macro, object_t *tmpl, object_t *bindings, object_t **renames, bool ellipsis_active);
+
+static bool is_keyword(object_t *sym) {
+  return list_contains(lg_core_keywords, sym) || (get_symbol_entry(sym)->flags & SYMBOL_MACRO) != 0;
+}
+
+/*
+ * A symbol the template introduces gets one fresh symbol per expansion.
+ * Keywords keep their names so the result can still be recognised.
+ */
+static object_t *rename_introduced(object_t *sym, object_t **renames) {
+  if (is_keyword(sym)) return sym;
+
+  object_t *rename = find_binding(*renames, sym);
+  if (rename != NULL) return cdr(rename);
+
+  object_t *fresh = gensym(sym);
+  get_symbol_entry(fresh)->flags |= SYMBOL_RENAMED;
+  *renames = cons(cons(sym, fresh), *renames);
+  lg_aliases = cons(cons(fresh, sym), lg_aliases);
+  return fresh;
+}
+
+// The symbol a renamed identifier was introduced as, for literal matching and free references
+static object_t *original_name(object_t *sym) {
+  if (sym->type != SCHEME_SYMBOL || (get_symbol_entry(sym)->flags & SYMBOL_RENAMED) == 0) return sym;
+  object_t *alias = find_binding(lg_aliases, sym);
+  return alias != NULL ? cdr(alias) : sym;
+}
+
+// Instantiates 'tmpl ...' once per value of the repeating variables it uses
+static object_t *instantiate_repeated(macro_t *macro, object_t *tmpl, object_t *bindings, object_t **renames) {
+  object_t *vars = template_variables(tmpl, bindings, g_scheme_null);
+  ASSERT_OR_ERROR(vars != g_scheme_null, "Ellipsis follows a template without pattern variables");
+
+  // One cursor per variable, advanced in step
+  object_t *cursors = g_scheme_null;
+  object_t *cursors_tail = g_scheme_null;
+  int count = -1;
+  for (object_t *v = vars; v != g_scheme_null; v = cdr(v)) {
+    object_t *values = binding_value(find_binding(bindings, car(v)));
+    int len = list_length(values);
+    ASSERT_OR_ERROR(count < 0 || len == count, "Pattern variables under one ellipsis differ in length");
+    count = len;
+    append_to_list(&cursors, &cursors_tail, values);
+  }
+
+  object_t *results = g_scheme_null;
+  for (int i = 0; i < count; i++) {
+    object_t *iteration = bindings;
+    object_t *c = cursors;
+    for (object_t *v = vars; v != g_scheme_null; v = cdr(v), c = cdr(c)) {
+      object_t *var = car(v);
+      int64_t depth = binding_depth(find_binding(bindings, var));
+      cons_entry_t *cursor = get_cons_entry(c);
+      iteration = cons(make_binding(var, depth - 1, car(cursor->car)), iteration);
+      cursor->car = cdr(cursor->car);
+    }
+    results = cons(instantiate(macro, tmpl, iteration, renames, true), results);
+  }
+
+  object_t *ordered = g_scheme_null;
+  for (; results != g_scheme_null; results = cdr(results)) {
+    ordered = cons(car(results), ordered);
+  }
+  return ordered;
+}
+
+static object_t *instantiate(macro_t *macro, object_t *tmpl, object_t *bindings, object_t **renames, bool ellipsis_active) {
+  if (tmpl->type == SCHEME_SYMBOL) {
+    object_t *binding = find_binding(bindings, tmpl);
+    if (binding != NULL) {
+      ASSERT_OR_ERROR(binding_depth(binding) == 0, "Pattern variable used without ellipsis");
+      return binding_value(binding);
+    }
+    return rename_introduced(tmpl, renames);
+  }
+
+  if (tmpl->type != SCHEME_CONS) return tmpl;
+
+  // (... template) escapes the ellipsis inside template
+  if (ellipsis_active && is_eq(car(tmpl), macro->ellipsis) && list_length(tmpl) == 2) {
+    return instantiate(macro, cadr(tmpl), bindings, renames, false);
+  }
+
+  object_t *head = g_scheme_null;
+  object_t *tail = g_scheme_null;
+  while (tmpl->type == SCHEME_CONS) {
+    object_t *elem = car(tmpl);
+    object_t *next = cdr(tmpl);
+    if (ellipsis_active && next->type == SCHEME_CONS && is_eq(car(next), macro->ellipsis)) {
+      object_t *results = instantiate_repeated(macro, elem, bindings, renames);
+      for (; results != g_scheme_null; results = cdr(results)) {
+        append_to_list(&head, &tail, car(results));
+      }
+      tmpl = cdr(next);
+      ASSERT_OR_ERROR(tmpl->type != SCHEME_CONS || !is_eq(car(tmpl), macro->ellipsis),
+                      "Consecutive ellipses are not supported");
+      continue;
+    }
+
+    append_to_list(&head, &tail, instantiate(macro, elem, bindings, renames, ellipsis_active));
+    tmpl = next;
+  }
+
+  if (tmpl != g_scheme_null) {
+    object_t *rest = instantiate(macro, tmpl, bindings, renames, ellipsis_active);
+    if (head == g_scheme_null) return rest;
+    get_cons_entry(tail)->cdr = rest;
+  }
+  return head;
+}
+
+static object_t *apply_macro(macro_t *macro, object_t *form) {
+  for (object_t *rules = macro->rules; rules != g_scheme_null; rules = cdr(rules)) {
+    object_t *rule = car(rules);
+    object_t *pattern = car(rule);
+    object_t *tmpl = cadr(rule);
+
+    // The keyword position of the pattern is ignored
+    object_t *bindings = g_scheme_null;
+    if (!match(macro, cdr(pattern), cdr(form), &bindings)) continue;
+
+    object_t *renames = g_scheme_null;
+    return instantiate(macro, tmpl, bindings, &renames, true);
+  }
+
+  error("No syntax-rules pattern matches the macro use");
+}
+
+// Overwrites the use with its expansion so later walks and evaluations see the result
+static void replace_form(object_t *form, object_t *expansion) {
+  cons_entry_t *entry = get_cons_entry(form);
+  if (expansion->type == SCHEME_CONS) {
+    entry->car = car(expansion);
+    entry->cdr = cdr(expansion);
+  } else {
+    entry->car = lg_sym_begin;
+    entry->cdr = cons(expansion, g_scheme_null);
+  }
+}
+
+/*
+ * (define-memoized (name param ...) body ...) is
+ * (define name (memoize (lambda (param ...) body ...))), and
+ * (define-memoized name exp) is (define name (memoize exp)).
+ */
+static object_t *expand_define_memoized(object_t *exp) {
+  ASSERT_OR_ERROR(list_length(exp) >= 3, "define-memoized expects a name and a body");
+  object_t *target = cadr(exp);
+  object_t *value;
+  if (target->type == SCHEME_CONS) {
+    ASSERT_OR_ERROR(car(target)->type == SCHEME_SYMBOL, "define-memoized name must be a symbol");
+    value = cons(lg_sym_lambda, cons(cdr(target), cddr(exp)));
+    target = car(target);
+  } else {
+    ASSERT_OR_ERROR(target->type == SCHEME_SYMBOL && list_length(exp) == 3, "define-memoized expects a name and one expression");
+    value = caddr(exp);
+  }
+
+  object_t *memoized = cons(lg_sym_memoize, cons(value, g_scheme_null));
+  return cons(lg_sym_define, cons(target, cons(memoized, g_scheme_null)));
+}
+
+static object_t *reverse_list(object_t *list) {
+  object_t *reversed = g_scheme_null;
+  for (; list != g_scheme_null; list = cdr(list)) {
+    reversed = cons(car(list), reversed);
+  }
+  return reversed;
+}
+
+static object_t *quoted(object_t *datum) {
+  return cons(lg_sym_quote, cons(datum, g_scheme_null));
+}
+
+static object_t *define_record_procedure(object_t *name, object_t *maker, object_t *type, object_t *field) {
+  object_t *args = field != NULL ? cons(quoted(field), g_scheme_null) : g_scheme_null;
+  object_t *value = cons(maker, cons(type, args));
+  return cons(lg_sym_define, cons(name, cons(value, g_scheme_null)));
+}
+
+/*
+ * (define-record-type type (constructor field ...) predicate (field accessor [modifier]) ...) is
+ * (begin (define type (make-record-type 'type '(field ...)))
+ *        (define constructor (record-constructor type '(field ...)))
+ *        (define predicate (record-predicate type))
+ *        (define accessor (record-accessor type 'field))
+ *        (define modifier (record-modifier type 'field)) ...)
+ */
+static object_t *expand_define_record_type(object_t *exp) {
+  ASSERT_OR_ERROR(list_length(exp) >= 3, "define-record-type expects a type, a constructor and a predicate");
+  object_t *type = cadr(exp);
+  object_t *constructor = caddr(exp);
+  object_t *specs = cdddr(exp);
+  ASSERT_OR_ERROR(type->type == SCHEME_SYMBOL, "record type name must be a symbol");
+  ASSERT_OR_ERROR(constructor->type == SCHEME_CONS && car(constructor)->type == SCHEME_SYMBOL, "record constructor must be (name field ...)");
+  ASSERT_OR_ERROR(specs != g_scheme_null && car(specs)->type == SCHEME_SYMBOL, "record predicate name must be a symbol");
+  object_t *predicate = car(specs);
+
+  object_t *fields = g_scheme_null;
+  object_t *defines = g_scheme_null;
+  for (object_t *rest = cdr(specs); rest != g_scheme_null; rest = cdr(rest)) {
+    object_t *spec = car(rest);
+    int len = list_length(spec);
+    ASSERT_OR_ERROR((len == 2 || len == 3) && car(spec)->type == SCHEME_SYMBOL && cadr(spec)->type == SCHEME_SYMBOL,
+                    "record field must be (field accessor [modifier])");
+    fields = cons(car(spec), fields);
+    defines = cons(define_record_procedure(cadr(spec), lg_sym_record_accessor, type, car(spec)), defines);
+    if (len == 3) defines = cons(define_record_procedure(caddr(spec), lg_sym_record_modifier, type, car(spec)), defines);
+  }
+  fields = reverse_list(fields);
+
+  defines = cons(define_record_procedure(predicate, lg_sym_record_predicate, type, NULL), reverse_list(defines));
+  object_t *make_constructor = cons(lg_sym_record_constructor, cons(type, cons(quoted(cdr(constructor)), g_scheme_null)));
+  defines = cons(cons(lg_sym_define, cons(car(constructor), cons(make_constructor, g_scheme_null))), defines);
+  object_t *make_type = cons(lg_sym_make_record_type, cons(quoted(type), cons(quoted(fields), g_scheme_null)));
+  defines = cons(cons(lg_sym_define, cons(type, cons(make_type, g_scheme_null))), defines);
+  return cons(lg_sym_begin, defines);
+}
+
+static void expand_each(object_t *list) {
+  for (; list->type == SCHEME_CONS; list = cdr(list)) {
+    update_car(list, expand_expression(car(list)));
+  }
+}
+
+static bool is_binding_form(object_t *head) {
+  return is_eq(head, lg_sym_let) || is_eq(head, lg_sym_let_star) || is_eq(head, lg_sym_letrec) || is_eq(head, lg_sym_do);
+}
+
+static inline bool is_named_let(object_t *exp) {
+  return is_eq(car(exp), lg_sym_let) && cdr(exp) != g_scheme_null && cadr(exp)->type == SCHEME_SYMBOL;
+}
+
+// In let, let*, letrec, named let and do only the inits, steps and bodies are expressions
+static void expand_binding_form(object_t *exp) {
+  object_t *rest = is_named_let(exp) ? cddr(exp) : cdr(exp);
+  if (rest == g_scheme_null) return;
+  for (object_t *specs = car(rest); specs->type == SCHEME_CONS; specs = cdr(specs)) {
+    if (car(specs)->type == SCHEME_CONS) expand_each(cdr(car(specs)));
+  }
+  rest = cdr(rest);
+  if (is_eq(car(exp), lg_sym_do) && rest != g_scheme_null) {
+    expand_each(car(rest));
+    rest = cdr(rest);
+  }
+  expand_each(rest);
+}
+
+static object_t *expand_expression(object_t *exp) {
+  while (exp->type == SCHEME_CONS && list_length(exp) >= 0) {
+    object_t *head = car(exp);
+    if (is_eq(head, lg_sym_quote)) return exp;
+
+    if (is_eq(head, lg_sym_define_syntax)) {
+      define_syntax(exp);
+      return cons(lg_sym_quote, cons(lg_sym_ok, g_scheme_null));
+    }
+
+    if (is_eq(head, lg_sym_define_memoized)) {
+      replace_form(exp, expand_define_memoized(exp));
+      continue;
+    }
+
+    if (is_eq(head, lg_sym_define_record_type)) {
+      replace_form(exp, expand_define_record_type(exp));
+      continue;
+    }
+
+    macro_t *macro = find_macro(head);
+    if (macro != NULL) {
+      replace_form(exp, apply_macro(macro, exp));
+      continue;
+    }
+
+    if (is_binding_form(head)) {
+      expand_binding_form(exp);
+      return exp;
+    }
+
+    if (is_eq(head, lg_sym_cond)) {
+      for (object_t *clauses = cdr(exp); clauses->type == SCHEME_CONS; clauses = cdr(clauses)) {
+        expand_each(car(clauses));
+      }
+      return exp;
+    }
+
+    // Lambda parameters are not expressions
+    object_t *rest = is_eq(head, lg_sym_lambda) && cdr(exp) != g_scheme_null ? cddr(exp) : exp;
+    for (; rest != g_scheme_null; rest = cdr(rest)) {
+      update_car(rest, expand_expression(car(rest)));
+    }
+    return exp;
+  }
+
+  return exp;
+}
+
+static object_t *resolve_renames(object_t *exp, object_t *bound);
+
+static object_t *strip_renames(object_t *datum) {
+  if (datum->type == SCHEME_SYMBOL) return original_name(datum);
+  for (object_t *rest = datum; rest->type == SCHEME_CONS; rest = cdr(rest)) {
+    update_car(rest, strip_renames(car(rest)));
+    if (cdr(rest)->type == SCHEME_SYMBOL) update_cdr(rest, original_name(cdr(rest)));
+  }
+  return datum;
+}
+
+static object_t *bind_renamed(object_t *sym, object_t *bound) {
+  if (sym->type != SCHEME_SYMBOL || (get_symbol_entry(sym)->flags & SYMBOL_RENAMED) == 0) return bound;
+  return cons(sym, bound);
+}
+
+static object_t *bind_internal_defines(object_t *body, object_t *bound) {
+  for (; body->type == SCHEME_CONS; body = cdr(body)) {
+    object_t *form = car(body);
+    if (list_length(form) >= 2 && is_eq(car(form), lg_sym_define)) bound = bind_renamed(cadr(form), bound);
+  }
+  return bound;
+}
+
+static void resolve_each(object_t *list, object_t *bound) {
+  for (; list->type == SCHEME_CONS; list = cdr(list)) {
+    update_car(list, resolve_renames(car(list), bound));
+  }
+}
+
+/*
+ * Scoping follows the form: let and do inits see only the outer bindings,
+ * each let* init also sees the vars before it and letrec inits see them all.
+ */
+static object_t *resolve_binding_form(object_t *exp, object_t *bound) {
+  object_t *head = car(exp);
+  object_t *rest = cdr(exp);
+  object_t *inner = bound;
+  if (is_named_let(exp)) {
+    inner = bind_renamed(car(rest), inner);
+    rest = cdr(rest);
+  }
+  if (rest == g_scheme_null) return exp;
+
+  object_t *specs = car(rest);
+  for (object_t *spec = specs; spec->type == SCHEME_CONS; spec = cdr(spec)) {
+    object_t *var = car(spec)->type == SCHEME_CONS ? car(car(spec)) : car(spec);
+    inner = bind_renamed(var, inner);
+  }
+
+  object_t *scope = is_eq(head, lg_sym_letrec) ? inner : bound;
+  for (; specs->type == SCHEME_CONS; specs = cdr(specs)) {
+    object_t *spec = car(specs);
+    if (spec->type != SCHEME_CONS || list_length(spec) < 2) continue;
+    object_t *init = cdr(spec);
+    update_car(init, resolve_renames(car(init), scope));
+    if (is_eq(head, lg_sym_let_star)) scope = bind_renamed(car(spec), scope);
+    if (cdr(init) != g_scheme_null) resolve_each(cdr(init), inner);
+  }
+
+  object_t *body = cdr(rest);
+  if (is_eq(head, lg_sym_do) && body != g_scheme_null) {
+    resolve_each(car(body), inner);
+    body = cdr(body);
+  }
+  resolve_each(body, bind_internal_defines(body, inner));
+  return exp;
+}
+
+/*
+ * Renamed identifiers stay renamed only where an introduced binder captures
+ * them; every other occurrence, free references and quoted data included,
+ * goes back to the original name.
+ */
+static object_t *resolve_renames(object_t *exp, object_t *bound) {
+  if (exp->type == SCHEME_SYMBOL) {
+    return list_contains(bound, exp) ? exp : original_name(exp);
+  }
+  if (exp->type != SCHEME_CONS || list_length(exp) < 0) return exp;
+
+  object_t *head = car(exp);
+  if (is_eq(head, lg_sym_quote)) return strip_renames(exp);
+  if (is_binding_form(head)) return resolve_binding_form(exp, bound);
+
+  object_t *rest = exp;
+  if (is_eq(head, lg_sym_lambda) && cdr(exp) != g_scheme_null) {
+    object_t *params = cadr(exp);
+    for (; params->type == SCHEME_CONS; params = cdr(params)) {
+      bound = bind_renamed(car(params), bound);
+    }
+    bound = bind_renamed(params, bound);
+    // Internal defines bind for the whole body
+    bound = bind_internal_defines(cddr(exp), bound);
+    rest = cddr(exp);
+  }
+
+  for (; rest != g_scheme_null; rest = cdr(rest)) {
+    update_car(rest, resolve_renames(car(rest), bound));
+  }
+  return exp;
+}
+
+int expander_init(void) {
+  lg_sym_quote = symbol("quote");
+  lg_sym_lambda = symbol("lambda");
+  lg_sym_define_syntax = symbol("define-syntax");
+  lg_sym_syntax_rules = symbol("syntax-rules");
+  lg_sym_ellipsis = symbol("...");
+  lg_sym_underscore = symbol("_");
+  lg_sym_begin = symbol("begin");
+  lg_sym_ok = symbol("ok");
+  lg_sym_define = symbol("define");
+  lg_sym_let = symbol("let");
+  lg_sym_let_star = symbol("let*");
+  lg_sym_letrec = symbol("letrec");
+  lg_sym_do = symbol("do");
+  lg_sym_cond = symbol("cond");
+  lg_sym_define_memoized = symbol("define-memoized");
+  lg_sym_memoize = symbol("memoize");
+  lg_sym_define_record_type = symbol("define-record-type");
+  lg_sym_make_record_type = symbol("make-record-type");
+  lg_sym_record_constructor = symbol("record-constructor");
+  lg_sym_record_predicate = symbol("record-predicate");
+  lg_sym_record_accessor = symbol("record-accessor");
+  lg_sym_record_modifier = symbol("record-modifier");
+
+  const char *core_keywords[] = {"quote", "lambda", "define", "set!", "if", "begin", "define-syntax", "syntax-rules",
+                                 "let", "let*", "letrec", "cond", "else", "=>", "and", "or", "do",
+                                 "define-memoized", "define-record-type"};
+  lg_core_keywords = g_scheme_null;
+  for (size_t i = 0; i < sizeof(core_keywords) / sizeof(char*); i++) {
+    lg_core_keywords = cons(symbol(core_keywords[i]), lg_core_keywords);
+  }
+
+  return 0;
+}
+
+object_t *expand(object_t *exp) {
+  lg_aliases = g_scheme_null;
+  exp = expand_expression(exp);
+  if (lg_aliases != g_scheme_null) exp = resolve_renames(exp, g_scheme_null);
+  return exp;
+}
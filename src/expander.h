@@ -0,0 +1,20 @@
+#ifndef SCHEMIN_EXPANDER_H
+#define SCHEMIN_EXPANDER_H
+SCHEMIN_EXPANDER_H
+
+#include "scheme_types.h"
+
+/*
+ * syntax-rules macro expander. expand() walks a top-level form before it is
+ * evaluated, registers define-syntax forms and rewrites every macro use in
+ * place with its expansion, so each use is expanded exactly once however often
+ * the surrounding code later runs.
+ *
+ * Macros are global and must be defined before the forms that use them.
+ * Identifiers a template introduces in binding position are renamed to fresh
+ * symbols at each expansion so they cannot capture the user's variables.
+ */
+int expander_init(void);
+object_t *expand(object_t *exp);
+
+#endif
@@ -1,92 +1,191 @@
 #include "hash.h"
 #include <stdlib.h>
 #include <string.h>
+#include "error.h"
 
-typedef struct bucket_s bucket_t;
-struct bucket_s {
-  const char *key;
+#define HASH_MIN_CAPACITY 8
+
+typedef struct slot_s {
+  uint64_t code;
+  // NULL when the slot is empty
+  const void *key;
   void *data;
-  bucket_t *next;
-};
+} slot_t;
+
+// How hash_get and hash_set hold their keys
+typedef struct byte_key_s {
+  size_t len;
+  char bytes[];
+} byte_key_t;
+
+// How hash_get and hash_set look their keys up
+typedef struct byte_probe_s {
+  const char *bytes;
+  size_t len;
+} byte_probe_t;
 
 struct hash_s {
-  bucket_t **buckets;
-  uintmax_t num_buckets;
+  slot_t *slots;
+  uintmax_t capacity;
+  uintmax_t count;
+  hash_equal_func equal;
+  // Set for byte-string tables, which free their copies of the keys
+  bool owns_keys;
 };
 
-hash_t *make_hash(uintmax_t num_buckets) {
+static bool byte_key_equal(const void *stored, const void *key) {
+  const byte_key_t *a = (const byte_key_t*)stored;
+  const byte_probe_t *b = (const byte_probe_t*)key;
+  return a->len == b->len && memcmp(a->bytes, b->bytes, b->len) == 0;
+}
+
+hash_t *make_hash_with_equal(uintmax_t capacity_hint, hash_equal_func equal) {
   hash_t *hash = (hash_t*)malloc(sizeof(hash_t));
-  hash->buckets = (bucket_t**)calloc(num_buckets, sizeof(bucket_t*));
-  hash->num_buckets = num_buckets;
+  ASSERT_OR_ERROR(hash != NULL, "Could not allocate hash");
+  // Room for the hinted count without growing, at three quarters full
+  uintmax_t capacity = HASH_MIN_CAPACITY;
+  while (capacity * 3 < capacity_hint * 4) capacity <<= 1;
+  hash->slots = (slot_t*)calloc(capacity, sizeof(slot_t));
+  ASSERT_OR_ERROR(hash->slots != NULL, "Could not allocate hash slots");
+  hash->capacity = capacity;
+  hash->count = 0;
+  hash->equal = equal;
+  hash->owns_keys = false;
+
+  return hash;
+}
 
+hash_t *make_hash(uintmax_t capacity_hint) {
+  hash_t *hash = make_hash_with_equal(capacity_hint, byte_key_equal);
+  hash->owns_keys = true;
   return hash;
 }
 
 void destroy_hash(hash_t *hash) {
-  for (uintmax_t i = 0; i < hash->num_buckets; i++) {
-    bucket_t *bucket = hash->buckets[i];
-    while (bucket != NULL) {
-      free(bucket);
-      bucket = bucket->next;
+  if (hash->owns_keys) {
+    for (uintmax_t i = 0; i < hash->capacity; i++) {
+      free((void*)hash->slots[i].key);
     }
   }
 
-  free(hash->buckets);
+  free(hash->slots);
   free(hash);
 }
 
-static uint64_t strhash64(const char *str, size_t len) {
-  uint64_t g;
-  uint64_t h = 0;
+uintmax_t hash_count(hash_t *hash) {
+  return hash->count;
+}
 
+uint64_t hash_bytes(const char *bytes, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
   for (size_t i = 0; i < len; i++) {
-    char c = str[i];
-    h = (h << 4) + (uint64_t)c;
-    g = h & 0xF000000000000000LL;
-    if (g != 0) {
-      h = h ^ (g >> 56);
-    }
-    h = h & ~g;
+    h = (h ^ (uint8_t)bytes[i]) * 0x100000001b3ULL;
   }
-  return h;
+  return hash_mix(h);
 }
 
-static inline bucket_t *find_bucket_with_key(bucket_t *buckets, const char *key, size_t len) {
-  for (bucket_t *bucket = buckets; bucket != NULL; bucket = bucket->next) {
-    if (strncmp(key, bucket->key, len) == 0) {
-      return bucket;
-    }
+// The key's slot, or the empty slot where it belongs
+static inline uintmax_t find_slot(hash_t *hash, const void *key, uint64_t code) {
+  uintmax_t mask = hash->capacity - 1;
+  uintmax_t slot = code & mask;
+  for (; hash->slots[slot].key != NULL; slot = (slot + 1) & mask) {
+    if (hash->slots[slot].code == code && hash->equal(hash->slots[slot].key, key)) break;
   }
+  return slot;
+}
 
-  return NULL;
+static void grow(hash_t *hash) {
+  uintmax_t capacity = hash->capacity * 2;
+  slot_t *slots = (slot_t*)calloc(capacity, sizeof(slot_t));
+  ASSERT_OR_ERROR(slots != NULL, "Could not grow hash");
+  for (uintmax_t i = 0; i < hash->capacity; i++) {
+    if (hash->slots[i].key == NULL) continue;
+    uintmax_t slot = hash->slots[i].code & (capacity - 1);
+    while (slots[slot].key != NULL) slot = (slot + 1) & (capacity - 1);
+    slots[slot] = hash->slots[i];
+  }
+  free(hash->slots);
+  hash->slots = slots;
+  hash->capacity = capacity;
 }
 
-void hash_set(hash_t *hash, const char *key, size_t len, void *data) {
-  uint64_t code = strhash64(key, len);
-  uintmax_t bucket_num = code % hash->num_buckets;
-  bucket_t *buckets = hash->buckets[bucket_num];
-  bucket_t *bucket = find_bucket_with_key(buckets, key, len);
-  if (bucket != NULL) {
-    bucket->data = data;
+void **hash_find(hash_t *hash, const void *key, uint64_t code) {
+  uintmax_t slot = find_slot(hash, key, code);
+  if (hash->slots[slot].key == NULL) return NULL;
+  return &hash->slots[slot].data;
+}
+
+// Stores a new key in its empty slot, or sets the data of the equal key there
+static void put_slot(hash_t *hash, uintmax_t slot, const void *key, uint64_t code, void *data) {
+  if (hash->slots[slot].key != NULL) {
+    hash->slots[slot].data = data;
     return;
   }
 
-  bucket_t *new_bucket = (bucket_t*)malloc(sizeof(bucket_t));
-  new_bucket->next = buckets;
-  new_bucket->data = data;
-  new_bucket->key = strndup(key, len);
-  hash->buckets[bucket_num] = new_bucket;
+  hash->slots[slot].code = code;
+  hash->slots[slot].key = key;
+  hash->slots[slot].data = data;
+  hash->count++;
+  if (hash->count * 4 >= hash->capacity * 3) grow(hash);
 }
 
-void *hash_get(hash_t *hash, const char *key, size_t len) {
-  uint64_t code = strhash64(key, len);
-  uintmax_t bucket_num = code % hash->num_buckets;
-  bucket_t *buckets = hash->buckets[bucket_num];
-  bucket_t *found = find_bucket_with_key(buckets, key, len);
-  if (found != NULL) {
-    return found->data;
+void hash_put(hash_t *hash, const void *key, uint64_t code, void *data) {
+  ASSERT_OR_ERROR(key != NULL, "NULL hash key");
+  put_slot(hash, find_slot(hash, key, code), key, code, data);
+}
+
+// Backward-shift deletion, so probes never need tombstones
+bool hash_remove(hash_t *hash, const void *key, uint64_t code) {
+  uintmax_t mask = hash->capacity - 1;
+  uintmax_t hole = find_slot(hash, key, code);
+  if (hash->slots[hole].key == NULL) return false;
+
+  if (hash->owns_keys) free((void*)hash->slots[hole].key);
+  for (uintmax_t next = (hole + 1) & mask; hash->slots[next].key != NULL; next = (next + 1) & mask) {
+    uintmax_t home = hash->slots[next].code & mask;
+    // Move the entry back unless its home lies cyclically in (hole, next]
+    bool stays = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+    if (stays) continue;
+    hash->slots[hole] = hash->slots[next];
+    hole = next;
   }
+  hash->slots[hole].key = NULL;
+  hash->count--;
+  return true;
+}
 
-  return NULL;
+bool hash_next(hash_t *hash, uintmax_t *pos, const void **outkey, void **outdata) {
+  for (; *pos < hash->capacity; (*pos)++) {
+    slot_t *slot = &hash->slots[*pos];
+    if (slot->key == NULL) continue;
+    if (outkey != NULL) *outkey = slot->key;
+    if (outdata != NULL) *outdata = slot->data;
+    (*pos)++;
+    return true;
+  }
+  return false;
 }
 
+void hash_set(hash_t *hash, const char *key, size_t len, void *data) {
+  ASSERT_OR_ERROR(hash->owns_keys, "Not a byte-string hash");
+  byte_probe_t probe = {key, len};
+  uint64_t code = hash_bytes(key, len);
+  uintmax_t slot = find_slot(hash, &probe, code);
+  if (hash->slots[slot].key != NULL) {
+    hash->slots[slot].data = data;
+    return;
+  }
+
+  byte_key_t *copy = (byte_key_t*)malloc(sizeof(byte_key_t) + len);
+  ASSERT_OR_ERROR(copy != NULL, "Could not allocate hash key");
+  copy->len = len;
+  memcpy(copy->bytes, key, len);
+  put_slot(hash, slot, copy, code, data);
+}
+
+void *hash_get(hash_t *hash, const char *key, size_t len) {
+  ASSERT_OR_ERROR(hash->owns_keys, "Not a byte-string hash");
+  byte_probe_t probe = {key, len};
+  void **data = hash_find(hash, &probe, hash_bytes(key, len));
+  return data != NULL ? *data : NULL;
+}
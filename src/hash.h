@@ -2,15 +2,50 @@
 #define SCHEMIN_HASH_H
 SCHEMIN_HASH_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * An open-addressed table from keys to data pointers. Every slot keeps its
+ * key's hash, so a probe passes over other keys without comparing them, and
+ * growing the table never hashes a key again. hash_get and hash_set take
+ * byte-string keys, which the table copies. Other tables get their keys'
+ * hashes from the caller and compare keys with their equal function, and
+ * hold the keys without copying them.
+ */
 typedef struct hash_s hash_t;
 
-hash_t *make_hash(uintmax_t num_buckets);
+// Compares a key held by the table with one being looked up
+typedef bool (*hash_equal_func)(const void *stored, const void *key);
+
+hash_t *make_hash(uintmax_t capacity_hint);
+hash_t *make_hash_with_equal(uintmax_t capacity_hint, hash_equal_func equal);
 void destroy_hash(hash_t *hash);
+uintmax_t hash_count(hash_t *hash);
 
 void *hash_get(hash_t *hash, const char *key, size_t len);
 void hash_set(hash_t *hash, const char *key, size_t len, void *data);
 
+// The slot holding the key's data, or NULL; valid until the table next changes
+void **hash_find(hash_t *hash, const void *key, uint64_t code);
+// Adds the key, or keeps the equal key already there, and sets its data
+void hash_put(hash_t *hash, const void *key, uint64_t code, void *data);
+bool hash_remove(hash_t *hash, const void *key, uint64_t code);
+// Steps through the entries from *pos, which starts at 0; false once there are no more
+bool hash_next(hash_t *hash, uintmax_t *pos, const void **outkey, void **outdata);
+
+// FNV-1a, mixed so the low bits that pick a slot depend on every byte
+uint64_t hash_bytes(const char *bytes, size_t len);
+
+// Spreads every bit of x over the result; for combining hashes of parts
+static inline uint64_t hash_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
 #endif
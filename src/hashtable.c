@@ -0,0 +1,354 @@
+#include "hashtable.h"
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "hash.h"
+#include "interpreter.h"
+#include "error.h"
+
+// Pairs and atoms of a key that equal? hashes; the rest of a larger key is ignored
+#define EQUAL_HASH_BUDGET 16
+
+static object_t *lg_sym_ok;
+
+static inline uint64_t double_bits(object_t *doub) {
+  double value = get_double(doub);
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// By allocation index, which stays with an object wherever it lives; fixnums have only their value
+static uint64_t identity_hash(object_t *key) {
+  uint64_t id = key->type == SCHEME_CONS ? cons_index(key) : (uint64_t)key->number_or_index;
+  return hash_mix(hash_mix((uint64_t)object_type(key) + 1) ^ id);
+}
+
+static uint64_t eqv_hash(object_t *key) {
+  if (key->type == SCHEME_DOUBLE) return hash_mix(hash_mix(SCHEME_DOUBLE + 1) ^ double_bits(key));
+  return identity_hash(key);
+}
+
+static uint64_t equal_hash(object_t *key, int *budget) {
+  (*budget)--;
+  if (key->type == SCHEME_STRING) {
+    string_entry_t *entry = get_string_entry(key);
+    return hash_bytes(entry->str, entry->len);
+  }
+  if (key->type != SCHEME_CONS) return eqv_hash(key);
+
+  uint64_t h = hash_mix(SCHEME_CONS + 1);
+  for (; key->type == SCHEME_CONS && *budget > 0; key = cdr(key)) {
+    h = hash_mix(h ^ equal_hash(car(key), budget));
+  }
+  if (key->type != SCHEME_CONS && *budget > 0) h = hash_mix(h ^ equal_hash(key, budget));
+  return h;
+}
+
+uint64_t hash_table_key_hash(hash_table_kind_t kind, object_t *key) {
+  switch (kind) {
+    case HASH_TABLE_EQ: return identity_hash(key);
+    case HASH_TABLE_EQV: return eqv_hash(key);
+    case HASH_TABLE_EQUAL: {
+      int budget = EQUAL_HASH_BUDGET;
+      return equal_hash(key, &budget);
+    }
+    case HASH_TABLE_STRING: {
+      ASSERT_OR_ERROR(key->type == SCHEME_STRING, "String hash table key must be a string");
+      string_entry_t *entry = get_string_entry(key);
+      return hash_bytes(entry->str, entry->len);
+    }
+  }
+  error("Unknown hash table kind");
+}
+
+static bool is_eqv(object_t *a, object_t *b) {
+  if (a == b) return true;
+  if (a->type != b->type) return false;
+  if (a->type == SCHEME_NUMBER) return a->number_or_index == b->number_or_index;
+  if (a->type == SCHEME_DOUBLE) return double_bits(a) == double_bits(b);
+  return false;
+}
+
+static bool is_string_equal(object_t *a, object_t *b) {
+  string_entry_t *x = get_string_entry(a);
+  string_entry_t *y = get_string_entry(b);
+  return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+}
+
+static bool is_equal(object_t *a, object_t *b) {
+  for (;;) {
+    if (is_eqv(a, b)) return true;
+    if (a->type != b->type) return false;
+    if (a->type == SCHEME_STRING) return is_string_equal(a, b);
+    if (a->type != SCHEME_CONS) return false;
+    if (!is_equal(car(a), car(b))) return false;
+    a = cdr(a);
+    b = cdr(b);
+  }
+}
+
+bool hash_table_key_equal(hash_table_kind_t kind, object_t *a, object_t *b) {
+  switch (kind) {
+    case HASH_TABLE_EQ: return a == b;
+    case HASH_TABLE_EQV: return is_eqv(a, b);
+    case HASH_TABLE_EQUAL: return is_equal(a, b);
+    case HASH_TABLE_STRING: return is_string_equal(a, b);
+  }
+  return false;
+}
+
+// hash.c compares keys without knowing the table, so each kind has its own function
+static bool eq_key_equal(const void *stored, const void *key) {
+  return stored == key;
+}
+
+static bool eqv_key_equal(const void *stored, const void *key) {
+  return is_eqv((object_t*)stored, (object_t*)key);
+}
+
+static bool equal_key_equal(const void *stored, const void *key) {
+  return is_equal((object_t*)stored, (object_t*)key);
+}
+
+static bool string_key_equal(const void *stored, const void *key) {
+  return is_string_equal((object_t*)stored, (object_t*)key);
+}
+
+static hash_table_entry_t *table_arg(object_t *arg) {
+  ASSERT_OR_ERROR(object_type(arg) == SCHEME_HASH_TABLE, "not a hash table");
+  return get_hash_table_entry(arg);
+}
+
+static object_t **find_value(hash_table_entry_t *table, object_t *key) {
+  uint64_t code = hash_table_key_hash((hash_table_kind_t)table->kind, key);
+  return (object_t**)hash_find(table->table, key, code);
+}
+
+static void store_value(hash_table_entry_t *table, object_t *key, object_t *value) {
+  uint64_t code = hash_table_key_hash((hash_table_kind_t)table->kind, key);
+  if (table->iterating > 0) {
+    ASSERT_OR_ERROR(hash_find(table->table, key, code) != NULL, "Hash table gained a key during iteration");
+  }
+  hash_put(table->table, key, code, value);
+}
+
+// (make-hash-table [equiv] [capacity])
+static object_t *make_hash_table_primitive(int argc, object_t *argv[]) {
+  hash_table_kind_t kind = HASH_TABLE_EQUAL;
+  int64_t capacity = 0;
+  for (int i = 0; i < argc; i++) {
+    if (argv[i]->type == SCHEME_NUMBER) {
+      ASSERT_OR_ERROR(argv[i]->number_or_index >= 0, "hash table capacity must not be negative");
+      capacity = argv[i]->number_or_index;
+      continue;
+    }
+    ASSERT_OR_ERROR(argv[i]->type == SCHEME_PRIMITIVE, "hash table equivalence must be eq?, eqv?, equal? or string=?");
+    const char *name = get_primitive_entry(argv[i])->name;
+    if (strcmp(name, "eq?") == 0) {
+      kind = HASH_TABLE_EQ;
+    } else if (strcmp(name, "eqv?") == 0) {
+      kind = HASH_TABLE_EQV;
+    } else if (strcmp(name, "equal?") == 0) {
+      kind = HASH_TABLE_EQUAL;
+    } else if (strcmp(name, "string=?") == 0) {
+      kind = HASH_TABLE_STRING;
+    } else {
+      error("hash table equivalence must be eq?, eqv?, equal? or string=?");
+    }
+  }
+
+  static const hash_equal_func equal_funcs[] = {eq_key_equal, eqv_key_equal, equal_key_equal, string_key_equal};
+  hash_table_entry_t *entry;
+  object_t *table = allocate_hash_table(&entry);
+  entry->kind = kind;
+  entry->table = make_hash_with_equal((uintmax_t)capacity, equal_funcs[kind]);
+  return table;
+}
+
+static object_t *is_hash_table_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return object_type(argv[0]) == SCHEME_HASH_TABLE ? g_true : g_false;
+}
+
+// (hash-table-ref table key [failure]), where failure is a thunk
+static object_t *hash_table_ref_primitive(int argc, object_t *argv[]) {
+  object_t **value = find_value(table_arg(argv[0]), argv[1]);
+  if (value != NULL) return *value;
+  ASSERT_OR_ERROR(argc > 2, "Key not in hash table");
+  return apply(argv[2], 0, NULL);
+}
+
+static object_t *hash_table_ref_default_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  object_t **value = find_value(table_arg(argv[0]), argv[1]);
+  return value != NULL ? *value : argv[2];
+}
+
+static object_t *hash_table_set_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  store_value(table_arg(argv[0]), argv[1], argv[2]);
+  return lg_sym_ok;
+}
+
+static object_t *hash_table_delete_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  hash_table_entry_t *table = table_arg(argv[0]);
+  ASSERT_OR_ERROR(table->iterating == 0, "Hash table lost a key during iteration");
+  hash_remove(table->table, argv[1], hash_table_key_hash((hash_table_kind_t)table->kind, argv[1]));
+  return lg_sym_ok;
+}
+
+static object_t *hash_table_contains_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return find_value(table_arg(argv[0]), argv[1]) != NULL ? g_true : g_false;
+}
+
+// Applies proc to the key's value, or to the default when the key is missing, and stores the result
+static object_t *update(object_t *table_object, object_t *key, object_t *proc, object_t *current) {
+  object_t *value = apply(proc, 1, &current);
+  // proc may have changed the table, so the key is looked up again
+  store_value(table_arg(table_object), key, value);
+  return lg_sym_ok;
+}
+
+// (hash-table-update! table key proc [failure])
+static object_t *hash_table_update_primitive(int argc, object_t *argv[]) {
+  object_t **value = find_value(table_arg(argv[0]), argv[1]);
+  object_t *current;
+  if (value != NULL) {
+    current = *value;
+  } else {
+    ASSERT_OR_ERROR(argc > 3, "Key not in hash table");
+    current = apply(argv[3], 0, NULL);
+  }
+  return update(argv[0], argv[1], argv[2], current);
+}
+
+static object_t *hash_table_update_default_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  object_t **value = find_value(table_arg(argv[0]), argv[1]);
+  return update(argv[0], argv[1], argv[2], value != NULL ? *value : argv[3]);
+}
+
+static object_t *hash_table_count_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return allocate_number((int64_t)hash_count(table_arg(argv[0])->table));
+}
+
+// (hash-table-fold table kons knil), calling (kons key value acc) for each entry
+static object_t *hash_table_fold_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  hash_table_entry_t *table = table_arg(argv[0]);
+  object_t *acc = argv[2];
+  uintmax_t pos = 0;
+  const void *key;
+  void *value;
+  table->iterating++;
+  while (hash_next(table->table, &pos, &key, &value)) {
+    object_t *args[3] = {(object_t*)key, (object_t*)value, acc};
+    acc = apply(argv[1], 3, args);
+  }
+  table->iterating--;
+  return acc;
+}
+
+// (hash-table-walk table proc), calling (proc key value) for each entry
+static object_t *hash_table_walk_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  hash_table_entry_t *table = table_arg(argv[0]);
+  uintmax_t pos = 0;
+  const void *key;
+  void *value;
+  table->iterating++;
+  while (hash_next(table->table, &pos, &key, &value)) {
+    object_t *args[2] = {(object_t*)key, (object_t*)value};
+    apply(argv[1], 2, args);
+  }
+  table->iterating--;
+  return lg_sym_ok;
+}
+
+typedef enum table_list_kind_e {
+  TABLE_LIST_KEYS,
+  TABLE_LIST_VALUES,
+  TABLE_LIST_ALIST
+} table_list_kind_t;
+
+static object_t *table_list(object_t *arg, table_list_kind_t kind) {
+  hash_table_entry_t *table = table_arg(arg);
+  object_t *list = g_scheme_null;
+  uintmax_t pos = 0;
+  const void *key;
+  void *value;
+  while (hash_next(table->table, &pos, &key, &value)) {
+    object_t *item;
+    switch (kind) {
+      case TABLE_LIST_KEYS: item = (object_t*)key; break;
+      case TABLE_LIST_VALUES: item = (object_t*)value; break;
+      case TABLE_LIST_ALIST: item = cons((object_t*)key, (object_t*)value); break;
+    }
+    list = cons(item, list);
+  }
+  return list;
+}
+
+static object_t *hash_table_keys_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return table_list(argv[0], TABLE_LIST_KEYS);
+}
+
+static object_t *hash_table_values_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return table_list(argv[0], TABLE_LIST_VALUES);
+}
+
+static object_t *hash_table_to_alist_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return table_list(argv[0], TABLE_LIST_ALIST);
+}
+
+static object_t *eqv_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return is_eqv(argv[0], argv[1]) ? g_true : g_false;
+}
+
+static object_t *equal_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return is_equal(argv[0], argv[1]) ? g_true : g_false;
+}
+
+static object_t *string_equal_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_STRING && argv[1]->type == SCHEME_STRING, "not a string");
+  return is_string_equal(argv[0], argv[1]) ? g_true : g_false;
+}
+
+static const primitive_mapping_t primitives[] = {
+  {"eqv?", eqv_primitive, 2, 2, 0},
+  {"equal?", equal_primitive, 2, 2, 0},
+  {"string=?", string_equal_primitive, 2, 2, 0},
+  {"make-hash-table", make_hash_table_primitive, 0, 2, 0},
+  {"hash-table?", is_hash_table_primitive, 1, 1, 0},
+  {"hash-table-ref", hash_table_ref_primitive, 2, 3, 0},
+  {"hash-table-ref/default", hash_table_ref_default_primitive, 3, 3, 0},
+  {"hash-table-set!", hash_table_set_primitive, 3, 3, 0},
+  {"hash-table-delete!", hash_table_delete_primitive, 2, 2, 0},
+  {"hash-table-contains?", hash_table_contains_primitive, 2, 2, 0},
+  {"hash-table-exists?", hash_table_contains_primitive, 2, 2, 0},
+  {"hash-table-update!", hash_table_update_primitive, 3, 4, 0},
+  {"hash-table-update!/default", hash_table_update_default_primitive, 4, 4, 0},
+  {"hash-table-count", hash_table_count_primitive, 1, 1, 0},
+  {"hash-table-size", hash_table_count_primitive, 1, 1, 0},
+  {"hash-table-fold", hash_table_fold_primitive, 3, 3, 0},
+  {"hash-table-walk", hash_table_walk_primitive, 2, 2, 0},
+  {"hash-table-keys", hash_table_keys_primitive, 1, 1, 0},
+  {"hash-table-values", hash_table_values_primitive, 1, 1, 0},
+  {"hash-table->alist", hash_table_to_alist_primitive, 1, 1, 0}
+};
+
+int hashtable_init(void) {
+  lg_sym_ok = symbol("ok");
+  install_primitives(primitives, sizeof(primitives) / sizeof(primitive_mapping_t));
+  return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef SCHEMIN_HASHTABLE_H
+#define SCHEMIN_HASHTABLE_H
+SCHEMIN_HASHTABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scheme_types.h"
+
+/*
+ * SRFI-69 hash tables, built on hash.c. (make-hash-table [equiv] [capacity])
+ * takes one of eq?, eqv?, equal? (the default) or string=? as the
+ * equivalence, and the table hashes its keys to match. Identity hashes come
+ * from an object's allocation index, or its value for a fixnum, never from
+ * its address, so a table stays valid if objects move. equal? hashes strings
+ * by content and lists by their first few elements.
+ *
+ * A table must not gain or lose keys while hash-table-fold or hash-table-walk
+ * is going through it.
+ */
+
+typedef enum hash_table_kind_e {
+  HASH_TABLE_EQ,
+  HASH_TABLE_EQV,
+  HASH_TABLE_EQUAL,
+  HASH_TABLE_STRING
+} hash_table_kind_t;
+
+int hashtable_init(void);
+// Keys equivalent under the kind have the same hash
+uint64_t hash_table_key_hash(hash_table_kind_t kind, object_t *key);
+bool hash_table_key_equal(hash_table_kind_t kind, object_t *a, object_t *b);
+
+#endif
@@ -0,0 +1,228 @@
+#include "instrument.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "memory.h"
+#include "prettyprint.h"
+#include "srcloc.h"
+#include "error.h"
+
+#define FORM_LABEL_LEN 128
+// Room for the head and name of "(head name ...)" within FORM_LABEL_LEN, each with its NUL
+#define FORM_LABEL_PART_LEN ((FORM_LABEL_LEN - 6) / 2)
+#define FORM_RECORDS_REALLOC_COUNT 64
+
+typedef struct form_record_s {
+  char label[FORM_LABEL_LEN];
+  uint64_t duration_ns;
+  memory_stats_t allocated;
+} form_record_t;
+
+bool g_instrument_counting = false;
+bool g_instrument_tracing = false;
+instrument_counters_t g_instrument_counters;
+
+static form_record_t *lg_forms = NULL;
+static size_t lg_num_forms = 0;
+static size_t lg_max_forms = 0;
+static memory_stats_t lg_form_start_stats;
+
+static FILE *lg_trace_file = NULL;
+static uint64_t lg_trace_threshold_ns = 0;
+static uint64_t lg_trace_origin_ns = 0;
+static bool lg_trace_first_event = true;
+
+static const char *eval_kind_names[EVAL_KIND_COUNT] = {
+  "self-evaluating",
+  "variable",
+  "define",
+  "quote",
+  "set!",
+  "if",
+  "lambda",
+  "begin",
+  "let",
+  "named let",
+  "cond",
+  "and/or",
+  "do",
+  "application"
+};
+
+uint64_t instrument_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void instrument_enable_counting(void) {
+  memset(&g_instrument_counters, 0, sizeof(g_instrument_counters));
+  g_instrument_counting = true;
+}
+
+int instrument_start_trace(const char *path, uint64_t threshold_us) {
+  lg_trace_file = fopen(path, "w");
+  if (lg_trace_file == NULL) return -1;
+
+  lg_trace_threshold_ns = threshold_us * 1000;
+  lg_trace_origin_ns = instrument_now_ns();
+  lg_trace_first_event = true;
+  fprintf(lg_trace_file, "{\"traceEvents\": [\n");
+  g_instrument_tracing = true;
+  return 0;
+}
+
+void instrument_stop_trace(void) {
+  if (lg_trace_file == NULL) return;
+
+  g_instrument_tracing = false;
+  fprintf(lg_trace_file, "\n], \"displayTimeUnit\": \"ns\"}\n");
+  fclose(lg_trace_file);
+  lg_trace_file = NULL;
+}
+
+static void write_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (const char *c = str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', out);
+      fputc(*c, out);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(out, "\\u%04x", (unsigned)*c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void write_trace_event(const char *name, const char *category, uint64_t start_ns, uint64_t duration_ns) {
+  if (!lg_trace_first_event) fprintf(lg_trace_file, ",\n");
+  lg_trace_first_event = false;
+
+  fprintf(lg_trace_file, "{\"name\": ");
+  write_json_string(lg_trace_file, name);
+  fprintf(lg_trace_file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1}",
+          category, (double)(start_ns - lg_trace_origin_ns) / 1000.0, (double)duration_ns / 1000.0);
+}
+
+static void describe_symbol(object_t *sym, char *buf, size_t len) {
+  symbol_entry_t *entry = get_symbol_entry(sym);
+  snprintf(buf, len, "%.*s", (int)entry->len, entry->sym);
+}
+
+static void describe_form(object_t *form, char *buf, size_t len) {
+  if (form->type == SCHEME_SYMBOL) {
+    describe_symbol(form, buf, len);
+    return;
+  }
+
+  if (form->type != SCHEME_CONS || car(form)->type != SCHEME_SYMBOL) {
+    snprintf(buf, len, "<%s>", form->type == SCHEME_CONS ? "application" : "constant");
+    return;
+  }
+
+  char head[FORM_LABEL_PART_LEN];
+  describe_symbol(car(form), head, sizeof(head));
+  object_t *rest = cdr(form);
+  if (rest != g_scheme_null && car(rest)->type == SCHEME_SYMBOL) {
+    char name[FORM_LABEL_PART_LEN];
+    describe_symbol(car(rest), name, sizeof(name));
+    snprintf(buf, len, "(%s %s ...)", head, name);
+    return;
+  }
+
+  snprintf(buf, len, "(%s ...)", head);
+}
+
+void instrument_begin_form(object_t *form) {
+  if (lg_num_forms >= lg_max_forms) {
+    lg_max_forms += FORM_RECORDS_REALLOC_COUNT;
+    lg_forms = (form_record_t*)realloc(lg_forms, lg_max_forms * sizeof(form_record_t));
+    ASSERT_OR_ERROR(lg_forms != NULL, "Could not grow form records");
+  }
+
+  form_record_t *record = &lg_forms[lg_num_forms];
+  describe_form(form, record->label, sizeof(record->label));
+  if (g_srcloc_enabled && form->type == SCHEME_CONS) {
+    size_t n = strlen(record->label);
+    char loc[FORM_LABEL_LEN];
+    if (srcloc_format(form, loc, sizeof(loc)) > 0) {
+      snprintf(&record->label[n], sizeof(record->label) - n, " %s", loc);
+    }
+  }
+  memory_get_stats(&lg_form_start_stats);
+}
+
+void instrument_end_form(uint64_t start_ns) {
+  uint64_t end_ns = instrument_now_ns();
+  memory_stats_t end_stats;
+  memory_get_stats(&end_stats);
+
+  form_record_t *record = &lg_forms[lg_num_forms++];
+  record->duration_ns = end_ns - start_ns;
+  record->allocated.objects = end_stats.objects - lg_form_start_stats.objects;
+  record->allocated.conses = end_stats.conses - lg_form_start_stats.conses;
+  record->allocated.strings = end_stats.strings - lg_form_start_stats.strings;
+  record->allocated.symbols = end_stats.symbols - lg_form_start_stats.symbols;
+  record->allocated.lambdas = end_stats.lambdas - lg_form_start_stats.lambdas;
+  record->allocated.primitives = end_stats.primitives - lg_form_start_stats.primitives;
+  record->allocated.doubles = end_stats.doubles - lg_form_start_stats.doubles;
+  record->allocated.bytes = end_stats.bytes - lg_form_start_stats.bytes;
+
+  if (g_instrument_tracing) {
+    write_trace_event(record->label, "toplevel", start_ns, record->duration_ns);
+  }
+}
+
+void instrument_trace_lambda(object_t *lambda, uint64_t start_ns) {
+  uint64_t duration_ns = instrument_now_ns() - start_ns;
+  if (duration_ns < lg_trace_threshold_ns) return;
+
+  char name[FORM_LABEL_LEN];
+  format_lambda_name(lambda, name, sizeof(name));
+  write_trace_event(name, "lambda", start_ns, duration_ns);
+}
+
+void instrument_write_report(FILE *out) {
+  instrument_counters_t *c = &g_instrument_counters;
+
+  fprintf(out, "evaluations\n");
+  for (int i = 0; i < EVAL_KIND_COUNT; i++) {
+    fprintf(out, "  %-16s %12llu\n", eval_kind_names[i], (unsigned long long)c->evals[i]);
+  }
+
+  fprintf(out, "applications\n");
+  fprintf(out, "  %-16s %12llu\n", "lambda", (unsigned long long)c->lambda_applications);
+  fprintf(out, "  %-16s %12llu\n", "primitive", (unsigned long long)c->primitive_applications);
+  fprintf(out, "frames created     %12llu\n", (unsigned long long)c->frames_created);
+
+  fprintf(out, "variable lookups   %12llu\n", (unsigned long long)c->lookups);
+  fprintf(out, "  %-16s %12s\n", "frames scanned", "lookups");
+  for (int i = 0; i < INSTRUMENT_LOOKUP_BUCKETS; i++) {
+    if (c->lookup_frames[i] == 0) continue;
+    char range[32];
+    if (i <= 1) {
+      snprintf(range, sizeof(range), "%d", i);
+    } else if (i == INSTRUMENT_LOOKUP_BUCKETS - 1) {
+      snprintf(range, sizeof(range), "%llu+", 1ULL << (i - 1));
+    } else {
+      snprintf(range, sizeof(range), "%llu-%llu", 1ULL << (i - 1), (1ULL << i) - 1);
+    }
+    fprintf(out, "  %-16s %12llu\n", range, (unsigned long long)c->lookup_frames[i]);
+  }
+
+  if (lg_num_forms == 0) return;
+
+  fprintf(out, "top-level forms\n");
+  fprintf(out, "  %-4s %-32s %10s %9s %9s %8s %8s %8s %8s %10s\n", "#", "form", "time(us)",
+          "objects", "conses", "strings", "symbols", "lambdas", "doubles", "bytes");
+  for (size_t i = 0; i < lg_num_forms; i++) {
+    form_record_t *r = &lg_forms[i];
+    fprintf(out, "  %-4zu %-32s %10.1f %9llu %9llu %8llu %8llu %8llu %8llu %10llu\n", i, r->label,
+            (double)r->duration_ns / 1000.0, (unsigned long long)r->allocated.objects,
+            (unsigned long long)r->allocated.conses, (unsigned long long)r->allocated.strings,
+            (unsigned long long)r->allocated.symbols, (unsigned long long)r->allocated.lambdas,
+            (unsigned long long)r->allocated.doubles, (unsigned long long)r->allocated.bytes);
+  }
+}
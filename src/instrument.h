@@ -0,0 +1,81 @@
+#ifndef SCHEMIN_INSTRUMENT_H
+#define SCHEMIN_INSTRUMENT_H
+SCHEMIN_INSTRUMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "scheme_types.h"
+
+/*
+ * Opt-in evaluator instrumentation. Counters are only touched while
+ * g_instrument_counting is set and trace spans only while g_instrument_tracing
+ * is set; both are checked with a predicted-false branch at each site.
+ */
+
+typedef enum {
+  EVAL_KIND_SELF_EVALUATING,
+  EVAL_KIND_VARIABLE,
+  EVAL_KIND_DEFINE,
+  EVAL_KIND_QUOTE,
+  EVAL_KIND_SET,
+  EVAL_KIND_IF,
+  EVAL_KIND_LAMBDA,
+  EVAL_KIND_BEGIN,
+  EVAL_KIND_LET,
+  EVAL_KIND_NAMED_LET,
+  EVAL_KIND_COND,
+  EVAL_KIND_AND_OR,
+  EVAL_KIND_DO,
+  EVAL_KIND_APPLICATION,
+  EVAL_KIND_COUNT
+} eval_kind_t;
+
+// Bucket i holds lookups that scanned [2^(i-1), 2^i) frames; bucket 0 holds zero
+#define INSTRUMENT_LOOKUP_BUCKETS 16
+
+typedef struct instrument_counters_s {
+  uint64_t evals[EVAL_KIND_COUNT];
+  uint64_t lambda_applications;
+  uint64_t primitive_applications;
+  uint64_t frames_created;
+  uint64_t lookups;
+  uint64_t lookup_frames[INSTRUMENT_LOOKUP_BUCKETS];
+} instrument_counters_t;
+
+extern bool g_instrument_counting;
+extern bool g_instrument_tracing;
+extern instrument_counters_t g_instrument_counters;
+
+void instrument_enable_counting(void);
+int instrument_start_trace(const char *path, uint64_t threshold_us);
+void instrument_stop_trace(void);
+void instrument_write_report(FILE *out);
+
+uint64_t instrument_now_ns(void);
+void instrument_begin_form(object_t *form);
+void instrument_end_form(uint64_t start_ns);
+void instrument_trace_lambda(object_t *lambda, uint64_t start_ns);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+
+static inline void instrument_count_eval(eval_kind_t kind) {
+  if (__builtin_expect(g_instrument_counting, 0)) {
+    g_instrument_counters.evals[kind]++;
+  }
+}
+
+static inline void instrument_count_lookup(uint64_t frames_scanned) {
+  int bucket = 0;
+  while (frames_scanned > 0 && bucket < INSTRUMENT_LOOKUP_BUCKETS - 1) {
+    frames_scanned >>= 1;
+    bucket++;
+  }
+  g_instrument_counters.lookups++;
+  g_instrument_counters.lookup_frames[bucket]++;
+}
+
+#pragma clang diagnostic pop
+
+#endif
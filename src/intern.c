@@ -0,0 +1,225 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "hash.h"
+#include "strindex.h"
+#include "error.h"
+
+#define INTERN_CAPACITY_HINT 1024
+#define INTERN_ITEMS_INLINE_COUNT 16
+
+// What a lookup compares against, so values can be found before they are allocated
+typedef struct constant_key_s {
+  type_t type;
+  int64_t number;
+  uint64_t bits;
+  const char *text;
+  size_t len;
+  object_t **items;
+  size_t count;
+} constant_key_t;
+
+bool g_intern_enabled = false;
+
+// Keyed on the shared constants themselves, and probed with a constant_key_t
+static hash_t *lg_constants = NULL;
+static intern_stats_t lg_intern_stats;
+static object_t *lg_sym_quote;
+
+static bool constant_equal(const void *stored, const void *key);
+
+int intern_init(void) {
+  lg_constants = make_hash_with_equal(INTERN_CAPACITY_HINT, constant_equal);
+  memset(&lg_intern_stats, 0, sizeof(lg_intern_stats));
+  lg_sym_quote = symbol("quote");
+  return 0;
+}
+
+void intern_set_enabled(bool enabled) {
+  g_intern_enabled = enabled;
+}
+
+static uint64_t key_hash(constant_key_t *key) {
+  uint64_t h = hash_mix((uint64_t)key->type + 1);
+  switch (key->type) {
+    case SCHEME_NUMBER: return hash_mix(h ^ (uint64_t)key->number);
+    case SCHEME_DOUBLE: return hash_mix(h ^ key->bits);
+    case SCHEME_STRING: {
+      return hash_mix(h ^ hash_bytes(key->text, key->len));
+    }
+    case SCHEME_CONS: {
+      // Items are already shared, so their addresses stand for their contents
+      for (size_t i = 0; i < key->count; i++) {
+        h = hash_mix(h ^ (uint64_t)(uintptr_t)key->items[i]);
+      }
+      return h;
+    }
+    case SCHEME_SYMBOL:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE:
+    case SCHEME_NULL: {
+      break;
+    }
+  }
+  error("Not an internable constant");
+}
+
+static bool key_matches(constant_key_t *key, object_t *object) {
+  if (object->type != key->type) return false;
+  switch (key->type) {
+    case SCHEME_NUMBER: return object->number_or_index == key->number;
+    case SCHEME_DOUBLE: {
+      double value = get_double(object);
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      return bits == key->bits;
+    }
+    case SCHEME_STRING: {
+      string_entry_t *entry = get_string_entry(object);
+      return entry->len == key->len && memcmp(entry->str, key->text, key->len) == 0;
+    }
+    case SCHEME_CONS: {
+      size_t i = 0;
+      for (; i < key->count && object->type == SCHEME_CONS; i++, object = cdr(object)) {
+        if (car(object) != key->items[i]) return false;
+      }
+      return i == key->count && object == g_scheme_null;
+    }
+    case SCHEME_SYMBOL:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE:
+    case SCHEME_NULL: {
+      break;
+    }
+  }
+  return false;
+}
+
+static bool constant_equal(const void *stored, const void *key) {
+  return key_matches((constant_key_t*)key, (object_t*)stored);
+}
+
+// Returns the matching constant, or NULL
+static object_t *find_constant(constant_key_t *key, uint64_t hash) {
+  void **found = hash_find(lg_constants, key, hash);
+  if (found == NULL) return NULL;
+  lg_intern_stats.shared++;
+  return (object_t*)*found;
+}
+
+static object_t *add_constant(uint64_t hash, object_t *object) {
+  hash_put(lg_constants, object, hash, object);
+  lg_intern_stats.interned++;
+  return object;
+}
+
+object_t *intern_number(int64_t number) {
+  constant_key_t key = {.type = SCHEME_NUMBER, .number = number};
+  uint64_t hash = key_hash(&key);
+  object_t *found = find_constant(&key, hash);
+  if (found != NULL) return found;
+  return add_constant(hash, allocate_number(number));
+}
+
+object_t *intern_double(double number) {
+  constant_key_t key = {.type = SCHEME_DOUBLE};
+  memcpy(&key.bits, &number, sizeof(key.bits));
+  uint64_t hash = key_hash(&key);
+  object_t *found = find_constant(&key, hash);
+  if (found != NULL) return found;
+  return add_constant(hash, allocate_double(number));
+}
+
+object_t *intern_string(const char *text, size_t len) {
+  constant_key_t key = {.type = SCHEME_STRING, .text = text, .len = len};
+  uint64_t hash = key_hash(&key);
+  object_t *found = find_constant(&key, hash);
+  if (found != NULL) return found;
+
+  string_entry_t *entry;
+  object_t *string = allocate_string(len, &entry);
+  memcpy(entry->str, text, len);
+  entry->str[len] = '\0';
+  string_note_contents(entry);
+  return add_constant(hash, string);
+}
+
+static object_t *intern_list(object_t *list) {
+  size_t count = 0;
+  object_t *rest = list;
+  for (; rest->type == SCHEME_CONS; rest = cdr(rest)) count++;
+  // Only proper lists are shared
+  if (rest != g_scheme_null) return list;
+
+  object_t *inline_items[INTERN_ITEMS_INLINE_COUNT];
+  object_t **items = inline_items;
+  if (count > INTERN_ITEMS_INLINE_COUNT) {
+    items = (object_t**)malloc(count * sizeof(object_t*));
+    ASSERT_OR_ERROR(items != NULL, "Could not allocate list items");
+  }
+  bool changed = false;
+  size_t i = 0;
+  for (rest = list; rest != g_scheme_null; rest = cdr(rest), i++) {
+    items[i] = intern_constant(car(rest));
+    changed = changed || items[i] != car(rest);
+  }
+
+  constant_key_t key = {.type = SCHEME_CONS, .items = items, .count = count};
+  uint64_t hash = key_hash(&key);
+  object_t *result = find_constant(&key, hash);
+  if (result == NULL) {
+    result = add_constant(hash, changed ? allocate_compact_list(items, count) : list);
+  }
+
+  if (items != inline_items) free(items);
+  return result;
+}
+
+object_t *intern_constant(object_t *datum) {
+  switch (object_type(datum)) {
+    case SCHEME_NUMBER: return intern_number(datum->number_or_index);
+    case SCHEME_DOUBLE: return intern_double(get_double(datum));
+    case SCHEME_STRING: {
+      string_entry_t *entry = get_string_entry(datum);
+      return intern_string(entry->str, entry->len);
+    }
+    case SCHEME_CONS: return intern_list(datum);
+    case SCHEME_SYMBOL:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE:
+    case SCHEME_NULL: {
+      return datum;
+    }
+  }
+  return datum;
+}
+
+void intern_quotation(object_t **items, size_t count) {
+  if (count == 2 && items[0] == lg_sym_quote) items[1] = intern_constant(items[1]);
+}
+
+void intern_get_stats(intern_stats_t *outstats) {
+  *outstats = lg_intern_stats;
+}
+
+void intern_write_report(FILE *out) {
+  fprintf(out, "constants\n");
+  fprintf(out, "  %-16s %12llu\n", "interned", (unsigned long long)lg_intern_stats.interned);
+  fprintf(out, "  %-16s %12llu\n", "shared", (unsigned long long)lg_intern_stats.shared);
+}
@@ -0,0 +1,43 @@
+#ifndef SCHEMIN_INTERN_H
+#define SCHEMIN_INTERN_H
+SCHEMIN_INTERN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "scheme_types.h"
+
+/*
+ * Optional sharing of reader constants. While enabled, every number, double
+ * and string the reader produces is looked up by value and the datum of each
+ * (quote datum) is hash-consed, so structurally identical literals are one
+ * object. Source lists other than quoted data are never shared, since the
+ * expander and optimizer rewrite them in place.
+ *
+ * Shared literals must be treated as immutable: set-car! on one quoted list
+ * changes every quotation of an identical list. Nothing is ever freed, so the
+ * table holds its constants for the life of the process.
+ */
+
+typedef struct intern_stats_s {
+  // Constants entered into the table
+  uint64_t interned;
+  // Reads that reused a constant already in the table
+  uint64_t shared;
+} intern_stats_t;
+
+extern bool g_intern_enabled;
+
+int intern_init(void);
+void intern_set_enabled(bool enabled);
+object_t *intern_number(int64_t number);
+object_t *intern_double(double number);
+object_t *intern_string(const char *text, size_t len);
+// Returns the shared copy of a datum, entering it and its sublists as needed
+object_t *intern_constant(object_t *datum);
+// If items spell (quote datum), replaces the datum with its shared copy
+void intern_quotation(object_t **items, size_t count);
+void intern_get_stats(intern_stats_t *outstats);
+void intern_write_report(FILE *out);
+
+#endif
@@ -5,15 +5,58 @@
 #include "scheme_types.h"
 #include "memory.h"
 #include "error.h"
+#include "profiler.h"
+#include "instrument.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "expander.h"
+#include "quicken.h"
+#include "srcloc.h"
+#include "records.h"
 
 static object_t *lg_the_empty_env;
 static object_t *lg_global_env;
 
+// Special form keywords, compared by pointer since symbols are interned
+static object_t *lg_sym_define;
+static object_t *lg_sym_quote;
+static object_t *lg_sym_set;
+static object_t *lg_sym_if;
+static object_t *lg_sym_lambda;
+static object_t *lg_sym_begin;
+static object_t *lg_sym_let;
+static object_t *lg_sym_let_star;
+static object_t *lg_sym_letrec;
+static object_t *lg_sym_cond;
+static object_t *lg_sym_else;
+static object_t *lg_sym_arrow;
+static object_t *lg_sym_and;
+static object_t *lg_sym_or;
+static object_t *lg_sym_do;
+static object_t *lg_sym_ok;
+
 static object_t *setup_env(void);
 static void did_install_primitive(object_t *primitive, primitive_entry_t *entry);
 static object_t *eval_with_env(object_t *obj, object_t *env);
 
 int interpreter_init(void) {
+  lg_sym_define = symbol("define");
+  lg_sym_quote = symbol("quote");
+  lg_sym_set = symbol("set!");
+  lg_sym_if = symbol("if");
+  lg_sym_lambda = symbol("lambda");
+  lg_sym_begin = symbol("begin");
+  lg_sym_let = symbol("let");
+  lg_sym_let_star = symbol("let*");
+  lg_sym_letrec = symbol("letrec");
+  lg_sym_cond = symbol("cond");
+  lg_sym_else = symbol("else");
+  lg_sym_arrow = symbol("=>");
+  lg_sym_and = symbol("and");
+  lg_sym_or = symbol("or");
+  lg_sym_do = symbol("do");
+  lg_sym_ok = symbol("ok");
+
   lg_the_empty_env = g_scheme_null;
   lg_global_env = setup_env();
   add_did_install_primitive_hook(&did_install_primitive);
@@ -29,13 +72,13 @@ static int internal_length(object_t *cons) {
   int i = 0;
   while (true) {
     i++;
-    cons_entry_t *entry = get_cons_entry(cons);
-    if (entry->cdr == g_scheme_null) {
+    object_t *rest = cdr(cons);
+    if (rest == g_scheme_null) {
       break;
     }
 
-    ASSERT_OR_ERROR(entry->cdr->type == SCHEME_CONS, "Length on something not a null-terminated list");
-    cons = entry->cdr;
+    ASSERT_OR_ERROR(rest->type == SCHEME_CONS, "Length on something not a null-terminated list");
+    cons = rest;
   }
 
   return i;
@@ -44,32 +87,27 @@ static int internal_length(object_t *cons) {
 static inline object_t *make_frame(object_t *vars, object_t *vals) {
   if (vars == g_scheme_null) {
     assert(vals == g_scheme_null);
-    return cons(g_scheme_null, g_scheme_null);
+    return frame_cons(g_scheme_null, g_scheme_null);
   }
   assert(vars->type == SCHEME_CONS);
   assert(vals->type == SCHEME_CONS);
   assert(internal_length(vars) == internal_length(vals));
-  return cons(vars, vals);
+  return frame_cons(vars, vals);
 }
 
 static object_t *extend_environment(object_t *vars, object_t *vals, object_t *base_env) {
   ASSERT_OR_ERROR(internal_length(vars) == internal_length(vals), "Vars and vals do not align");
-  return cons(make_frame(vars, vals), base_env);
+  if (__builtin_expect(g_instrument_counting, 0)) g_instrument_counters.frames_created++;
+  return frame_cons(make_frame(vars, vals), base_env);
 }
 
-static inline bool is_tagged_list(object_t *exp, const char *tag) {
+static inline bool is_tagged_list(object_t *exp, object_t *tag) {
   if (exp->type != SCHEME_CONS) return false;
-
-  cons_entry_t *entry = get_cons_entry(exp);
-  if (entry->car->type != SCHEME_SYMBOL) return false;
-  symbol_entry_t *sym_entry = get_symbol_entry(entry->car);
-  size_t len = strlen(tag);
-  if (len != sym_entry->len) return false;
-  return strncmp(tag, sym_entry->sym, len) == 0;
+  return is_eq(car(exp), tag);
 }
 
 static inline bool is_definition(object_t *exp) {
-  return is_tagged_list(exp, "define");
+  return is_tagged_list(exp, lg_sym_define);
 }
 
 static inline object_t *definition_variable(object_t *exp) {
@@ -81,7 +119,7 @@ static inline object_t *definition_value(object_t *exp) {
 }
 
 static inline bool is_quoted(object_t *exp) {
-  return is_tagged_list(exp, "quote");
+  return is_tagged_list(exp, lg_sym_quote);
 }
 
 static inline object_t *text_of_quotation(object_t *exp) {
@@ -89,7 +127,7 @@ static inline object_t *text_of_quotation(object_t *exp) {
 }
 
 static inline bool is_assignment(object_t *exp) {
-  return is_tagged_list(exp, "set!");
+  return is_tagged_list(exp, lg_sym_set);
 }
 
 static inline object_t *assignment_variable(object_t *exp) {
@@ -101,7 +139,7 @@ static inline object_t *assignment_value(object_t *exp) {
 }
 
 static inline bool is_if(object_t *exp) {
-  return is_tagged_list(exp, "if");
+  return is_tagged_list(exp, lg_sym_if);
 }
 
 static inline object_t *if_predicate(object_t *exp) {
@@ -117,7 +155,7 @@ static inline object_t *if_alternative(object_t *exp) {
 }
 
 static inline bool is_lambda(object_t *exp) {
-  return is_tagged_list(exp, "lambda");
+  return is_tagged_list(exp, lg_sym_lambda);
 }
 
 static inline object_t *lambda_parameters(object_t *exp) {
@@ -136,65 +174,91 @@ static void add_binding_to_frame(object_t *var, object_t *val, object_t *frame)
 }
 
 static inline object_t *first_frame(object_t *env) {
-  return get_cons_entry(env)->car;
+  return car(env);
 }
 
 static object_t *scan_frame(object_t *var, object_t *frame, object_t **outvars, object_t **outvals) {
-  symbol_entry_t *sentry = get_symbol_entry(var);
-  cons_entry_t *centry = get_cons_entry(frame);
-
-  object_t *vars = centry->car;
-  object_t *vals = centry->cdr;
+  object_t *vars = car(frame);
+  object_t *vals = cdr(frame);
   assert(internal_length(vars) == internal_length(vals));
 
-  while (vars != g_scheme_null) {
-    cons_entry_t *var_entry = get_cons_entry(vars);
-    cons_entry_t *val_entry = get_cons_entry(vals);
-    symbol_entry_t *var_sym_entry = get_symbol_entry(var_entry->car);
-    if (strncmp(sentry->sym, var_sym_entry->sym, sentry->len) == 0) {
-      if (outvars != NULL) *outvars = vars;
-      if (outvals != NULL) *outvals = vals;
-      return val_entry->car;
-    }
-
-    vars = var_entry->cdr;
-    vals = val_entry->cdr;
+  // Most frames do not bind var, so the vals are only walked once it is found
+  int position = 0;
+  for (; vars != g_scheme_null; vars = cdr(vars), position++) {
+    if (is_eq(var, car(vars))) break;
   }
+  if (vars == g_scheme_null) return NULL;
 
-  return NULL;
+  for (; position > 0; position--) vals = cdr(vals);
+  if (outvars != NULL) *outvars = vars;
+  if (outvals != NULL) *outvals = vals;
+  return car(vals);
+}
+
+static inline bool is_global_frame_of(object_t *env) {
+  return cdr(env) == lg_the_empty_env;
+}
+
+/*
+ * Compiled code inlines primitives by name, guarded on the symbol's binding
+ * version, so every define and set! has to invalidate those guards.
+ */
+static inline void note_binding_change(object_t *var, bool local) {
+  symbol_entry_t *entry = get_symbol_entry(var);
+  entry->binding_version++;
+  if (local) entry->flags |= SYMBOL_LOCALLY_BOUND;
+}
+
+static void note_parameters(object_t *parameters) {
+  for (object_t *p = parameters; p->type == SCHEME_CONS; p = cdr(p)) {
+    note_local_binding(car(p));
+  }
 }
 
 static object_t *define_variable(object_t *var, object_t *val, object_t *env) {
+  bool global = is_global_frame_of(env);
+  note_binding_change(var, !global);
   object_t *frame = first_frame(env);
-  object_t *outvals;
-  object_t *existing = scan_frame(var, frame, NULL, &outvals);
-  if (existing != NULL) {
-    cons_entry_t *entry = get_cons_entry(outvals);
-    entry->car = val;
-    return symbol("ok");
+  // A first global definition needs no scan, which keeps installing builtins linear
+  symbol_entry_t *sym_entry = get_symbol_entry(var);
+  if (!global || (sym_entry->flags & SYMBOL_GLOBALLY_BOUND)) {
+    object_t *outvals;
+    object_t *existing = scan_frame(var, frame, NULL, &outvals);
+    if (existing != NULL) {
+      cons_entry_t *entry = get_cons_entry(outvals);
+      entry->car = val;
+      return lg_sym_ok;
+    }
   }
 
+  if (global) sym_entry->flags |= SYMBOL_GLOBALLY_BOUND;
   add_binding_to_frame(var, val, frame);
-  return symbol("ok");
+  return lg_sym_ok;
 }
 
 static object_t *scan_environment(object_t *var, object_t *env, object_t **outvars, object_t **outvals) {
+  uint64_t frames_scanned = 0;
   while (env != lg_the_empty_env) {
-    cons_entry_t *entry = get_cons_entry(env);
-    object_t *frame = entry->car;
+    object_t *frame = car(env);
+    frames_scanned++;
     object_t *result = scan_frame(var, frame, outvars, outvals);
-    if (result != NULL) return result;
+    if (result != NULL) {
+      if (__builtin_expect(g_instrument_counting, 0)) instrument_count_lookup(frames_scanned);
+      return result;
+    }
 
-    env = entry->cdr;
+    env = cdr(env);
   }
 
+  if (__builtin_expect(g_instrument_counting, 0)) instrument_count_lookup(frames_scanned);
   return NULL;
 }
 
 static object_t *lookup_variable_value(object_t *name, object_t *env);
 
 static object_t *setup_env(void) {
-  object_t *env = extend_environment(g_scheme_null, g_scheme_null, lg_the_empty_env);
+  // The global frame outlives every evaluation, so it is the one frame on the heap
+  object_t *env = cons(cons(g_scheme_null, g_scheme_null), lg_the_empty_env);
   define_variable(symbol("false"), g_false, env);
   define_variable(symbol("true"), g_true, env);
 
@@ -204,11 +268,16 @@ static object_t *setup_env(void) {
 static bool is_equal(object_t *obj1, object_t *obj2) {
   if (obj1->type != obj2->type) return false;
 
-  switch (obj1->type) {
+  switch (object_type(obj1)) {
     case SCHEME_SYMBOL: {
       return is_eq(obj1, obj2);
     }
     case SCHEME_CONS:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
     case SCHEME_NULL:
     case SCHEME_NUMBER:
     case SCHEME_STRING:
@@ -218,6 +287,7 @@ static bool is_equal(object_t *obj1, object_t *obj2) {
       error("not implemented");
     }
   }
+  return false;
 }
 
 static void did_install_primitive(object_t *primitive, primitive_entry_t *entry) {
@@ -235,13 +305,14 @@ static object_t *set_variable_value(object_t *var, object_t *val, object_t *env)
     error("set variable value on non-existent variable");
   }
 
+  note_binding_change(var, false);
   cons_entry_t *entry = get_cons_entry(vals);
   entry->car = val;
-  return symbol("ok");
+  return lg_sym_ok;
 }
 
 static inline bool is_self_evaluating(object_t *obj) {
-  return obj->type == SCHEME_NULL
+  return obj == g_scheme_null
       || obj->type == SCHEME_NUMBER
       || obj->type == SCHEME_STRING
       || obj->type == SCHEME_DOUBLE;
@@ -257,7 +328,7 @@ static object_t *lookup_variable_value(object_t *name, object_t *env) {
 }
 
 static bool is_begin(object_t *exp) {
-  return is_tagged_list(exp, "begin");
+  return is_tagged_list(exp, lg_sym_begin);
 }
 
 static object_t *begin_actions(object_t *exp) {
@@ -265,7 +336,7 @@ static object_t *begin_actions(object_t *exp) {
 }
 
 static bool is_last_exp(object_t *seq) {
-  return get_cons_entry(seq)->cdr == g_scheme_null;
+  return cdr(seq) == g_scheme_null;
 }
 
 static object_t *first_exp(object_t *seq) {
@@ -288,20 +359,12 @@ static object_t *application_operands(object_t *exp) {
   return cdr(exp);
 }
 
-static inline object_t *array_to_cons(object_t **objects, size_t num_objects) {
-  assert(num_objects > 0);
-  object_t *object;
-  cons_entry_t *entry;
-  object_t *result = allocate_cons(&entry);
-  entry->car = objects[0];
-  for (size_t i = 1; i < num_objects; i++) {
-    cons_entry_t *next_entry;
-    object_t *next = allocate_cons(&next_entry);
-    entry->cdr = next;
-    next_entry->car = objects[i];
-    entry = next_entry;
-  }
-  entry->cdr = g_scheme_null;
+// Builds the vals of a frame in the frame region
+static inline object_t *array_to_frame_list(object_t **objects, size_t num_objects) {
+  object_t *result = g_scheme_null;
+  for (size_t i = num_objects; i > 0; i--) {
+    result = frame_cons(objects[i - 1], result);
+  }
   return result;
 }
 
@@ -309,31 +372,105 @@ static inline object_t *eval_sequence(object_t *seq, object_t *env);
 
 #define MAX_OPERANDS 32
 
+/*
+ * Keeps the profiler's shadow stack in step with lambda applications and times
+ * them for the trace. Only reached while profiling or tracing, since doing work
+ * after the body gives up the tail call that eval_application otherwise makes
+ * into eval_sequence.
+ */
+static __attribute__((noinline)) object_t *eval_hooked_sequence(object_t *op, object_t *body, object_t *env) {
+  bool profiling = g_profiler_active;
+  bool tracing = g_instrument_tracing;
+  uint64_t start_ns = tracing ? instrument_now_ns() : 0;
+  if (profiling) profiler_push(op);
+  object_t *result = eval_sequence(body, env);
+  if (profiling) profiler_pop();
+  if (tracing) instrument_trace_lambda(op, start_ns);
+  return result;
+}
+
+static inline bool is_applicable(object_t *op) {
+  return op->type == SCHEME_LAMBDA || op->type == SCHEME_PRIMITIVE || object_type(op) == SCHEME_RECORD_PROCEDURE;
+}
+
+static inline object_t *apply_operator(object_t *op, object_t **operands, uint64_t num_operands, object_t *env) {
+  if (op->type == SCHEME_LAMBDA) {
+    if (__builtin_expect(g_instrument_counting, 0)) g_instrument_counters.lambda_applications++;
+    lambda_entry_t *entry = get_lambda_entry(op);
+    object_t *vals = array_to_frame_list(operands, num_operands);
+    object_t *extended = extend_environment(entry->parameters, vals, env);
+    if (__builtin_expect(g_profiler_active || g_instrument_tracing, 0)) {
+      return eval_hooked_sequence(op, entry->body, extended);
+    }
+    if (__builtin_expect(++entry->calls == g_jit_threshold, 0)) jit_compile(op);
+    if (entry->jit_code != NULL && jit_can_enter()) {
+      return jit_invoke(entry, vals, extended);
+    }
+    return eval_sequence(entry->body, extended);
+  }
+
+  if (__builtin_expect(op->type == SCHEME_EXTENDED, 0)) return apply_record_procedure(op, (int)num_operands, operands);
+
+  if (__builtin_expect(g_instrument_counting, 0)) g_instrument_counters.primitive_applications++;
+  primitive_entry_t *entry = get_primitive_entry(op);
+  assert(entry->func != NULL);
+  ASSERT_OR_ERROR(primitive_accepts(entry, (int)num_operands), "Wrong number of arguments");
+  return entry->func((int)num_operands, operands);
+}
+
+// A fixnum site evaluates its two operands and only calls the primitive when the guard fails
+static inline object_t *eval_fixnum_application(call_site_t *site, object_t *exp, object_t *env) {
+  object_t *operands = application_operands(exp);
+  object_t *args[2];
+  cons_object_t *mark = frame_region_mark();
+  args[0] = eval_with_env(car(operands), env);
+  args[1] = eval_with_env(cadr(operands), env);
+  frame_region_release(mark);
+  object_t *result = quicken_fixnum((quick_kind_t)site->kind, args[0], args[1]);
+  if (__builtin_expect(result != NULL, 1)) {
+    if (__builtin_expect(g_instrument_counting, 0)) g_instrument_counters.primitive_applications++;
+    return result;
+  }
+
+  if (args[0]->type != SCHEME_NUMBER || args[1]->type != SCHEME_NUMBER) quicken_demote(site);
+  return apply_operator(site->op, args, 2, env);
+}
+
 static inline object_t *eval_application(object_t *exp, object_t *env) {
   object_t *operands_evaled[MAX_OPERANDS];
-  object_t *op = eval_with_env(application_operator(exp), env);
-  assert(op->type == SCHEME_LAMBDA || op->type == SCHEME_PRIMITIVE);
+  object_t *op = NULL;
+  call_site_t *site = NULL;
+  if (g_quicken_enabled) {
+    site = quicken_site(exp);
+    if (site->kind >= QUICK_GLOBAL) {
+      if (__builtin_expect(*site->binding_version != site->version, 0)) {
+        quicken_deoptimize(site);
+      } else if (site->kind >= QUICK_FIXNUM_ADD) {
+        return eval_fixnum_application(site, exp, env);
+      } else {
+        op = site->op;
+      }
+    }
+  }
+
+  if (op == NULL) {
+    op = eval_with_env(application_operator(exp), env);
+    if (site != NULL && site->kind == QUICK_NONE) quicken_record(site, exp, op);
+  }
+  assert(is_applicable(op));
   object_t *operands = application_operands(exp);
 
   uint64_t num_operands = 0;
+  cons_object_t *mark = frame_region_mark();
   for (object_t *remaining = operands; remaining != g_scheme_null; remaining = cdr(remaining)) {
+    ASSERT_OR_ERROR(num_operands < MAX_OPERANDS, "Too many operands");
     object_t *unevaled = car(remaining);
     object_t *evaled = eval_with_env(unevaled, env);
     operands_evaled[num_operands++] = evaled;
   }
+  frame_region_release(mark);
 
-  object_t *vals = array_to_cons(operands_evaled, num_operands);
-  object_t *vars;
-  if (op->type == SCHEME_LAMBDA) {
-    lambda_entry_t *entry = get_lambda_entry(op);
-    vars = entry->parameters;
-    object_t *extended = extend_environment(vars, vals, env);
-    return eval_sequence(entry->body, extended);
-  }
-
-  primitive_entry_t *entry = get_primitive_entry(op);
-  assert(entry->func != NULL);
-  return entry->func((int)num_operands, operands_evaled);
+  return apply_operator(op, operands_evaled, num_operands, env);
 }
 
 /*
@@ -349,7 +486,9 @@ static inline object_t *eval_application(object_t *exp, object_t *env) {
 static inline object_t *eval_sequence(object_t *seq, object_t *env) {
   object_t *exp = first_exp(seq);
   while (!is_last_exp(seq)) {
+    cons_object_t *mark = frame_region_mark();
     eval_with_env(exp, env);
+    frame_region_release(mark);
     seq = rest_exps(seq);
     exp = first_exp(seq);
   }
@@ -358,32 +497,370 @@ static inline object_t *eval_sequence(object_t *seq, object_t *env) {
   return eval_with_env(exp, env);
 }
 
+static inline bool is_let(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_let);
+}
+
+static inline bool is_named_let(object_t *exp) {
+  return cadr(exp)->type == SCHEME_SYMBOL;
+}
+
+static inline bool is_let_star(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_let_star);
+}
+
+static inline bool is_letrec(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_letrec);
+}
+
+static inline bool is_cond(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_cond);
+}
+
+static inline bool is_and(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_and);
+}
+
+static inline bool is_or(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_or);
+}
+
+static inline bool is_do(object_t *exp) {
+  return is_tagged_list(exp, lg_sym_do);
+}
+
+static inline object_t *binding_variable(object_t *binding) {
+  return car(binding);
+}
+
+static inline object_t *binding_init(object_t *binding) {
+  return cadr(binding);
+}
+
+/*
+ * Builds the vars and vals lists for a frame from ((var init) ...), evaluating
+ * each init in env. A var of the form (var) or a bare var is bound to #f, which
+ * letrec relies on to create its frame before any init runs.
+ */
+static void make_bindings(object_t *bindings, object_t *env, bool evaluate, object_t **outvars, object_t **outvals) {
+  object_t *vars = g_scheme_null;
+  object_t *vals = g_scheme_null;
+  cons_entry_t *vars_tail = NULL;
+  cons_entry_t *vals_tail = NULL;
+
+  for (; bindings != g_scheme_null; bindings = cdr(bindings)) {
+    object_t *binding = car(bindings);
+    object_t *var = binding->type == SCHEME_CONS ? binding_variable(binding) : binding;
+    ASSERT_OR_ERROR(var->type == SCHEME_SYMBOL, "Binding name is not a symbol");
+    object_t *val = g_false;
+    if (evaluate) {
+      ASSERT_OR_ERROR(binding->type == SCHEME_CONS && cdr(binding) != g_scheme_null, "Binding has no value");
+      val = eval_with_env(binding_init(binding), env);
+    }
+    note_local_binding(var);
+
+    cons_entry_t *var_entry;
+    cons_entry_t *val_entry;
+    object_t *var_cell = allocate_cons(&var_entry);
+    object_t *val_cell = allocate_cons(&val_entry);
+    var_entry->car = var;
+    var_entry->cdr = g_scheme_null;
+    val_entry->car = val;
+    val_entry->cdr = g_scheme_null;
+    if (vars_tail == NULL) {
+      vars = var_cell;
+      vals = val_cell;
+    } else {
+      vars_tail->cdr = var_cell;
+      vals_tail->cdr = val_cell;
+    }
+    vars_tail = var_entry;
+    vals_tail = val_entry;
+  }
+
+  *outvars = vars;
+  *outvals = vals;
+}
+
+// (let ((var init) ...) body ...) binds all vars in a single new frame
+static inline object_t *eval_let(object_t *exp, object_t *env) {
+  object_t *vars;
+  object_t *vals;
+  make_bindings(cadr(exp), env, true, &vars, &vals);
+  return eval_sequence(cddr(exp), extend_environment(vars, vals, env));
+}
+
+// Each init sees the bindings before it; they all share one frame
+static inline object_t *eval_let_star(object_t *exp, object_t *env) {
+  object_t *extended = extend_environment(g_scheme_null, g_scheme_null, env);
+  object_t *frame = first_frame(extended);
+  for (object_t *bindings = cadr(exp); bindings != g_scheme_null; bindings = cdr(bindings)) {
+    object_t *binding = car(bindings);
+    object_t *var = binding_variable(binding);
+    ASSERT_OR_ERROR(var->type == SCHEME_SYMBOL, "Binding name is not a symbol");
+    object_t *val = eval_with_env(binding_init(binding), extended);
+    note_local_binding(var);
+    add_binding_to_frame(var, val, frame);
+  }
+  return eval_sequence(cddr(exp), extended);
+}
+
+static inline object_t *eval_letrec(object_t *exp, object_t *env) {
+  object_t *vars;
+  object_t *vals;
+  make_bindings(cadr(exp), env, false, &vars, &vals);
+  object_t *extended = extend_environment(vars, vals, env);
+
+  object_t *cell = vals;
+  for (object_t *bindings = cadr(exp); bindings != g_scheme_null; bindings = cdr(bindings)) {
+    object_t *value = eval_with_env(binding_init(car(bindings)), extended);
+    if (value->type == SCHEME_LAMBDA) {
+      lambda_entry_t *entry = get_lambda_entry(value);
+      if (entry->name == NULL) entry->name = binding_variable(car(bindings));
+    }
+    get_cons_entry(cell)->car = value;
+    cell = cdr(cell);
+  }
+  return eval_sequence(cddr(exp), extended);
+}
+
+/*
+ * Runs the tests of a cond up to the clause that is taken. Returns that
+ * clause's body for the caller to evaluate, or NULL with *outvalue set when
+ * the form's value is already known: a test with no body, a => clause, or no
+ * clause taken.
+ */
+static object_t *select_cond_clause(object_t *exp, object_t *env, object_t **outvalue) {
+  for (object_t *clauses = cdr(exp); clauses != g_scheme_null; clauses = cdr(clauses)) {
+    object_t *clause = car(clauses);
+    if (is_eq(car(clause), lg_sym_else)) return cdr(clause);
+    object_t *test = eval_with_env(car(clause), env);
+    if (!is_true(test)) continue;
+    if (cdr(clause) == g_scheme_null) {
+      *outvalue = test;
+      return NULL;
+    }
+    if (is_eq(cadr(clause), lg_sym_arrow)) {
+      object_t *proc = eval_with_env(caddr(clause), env);
+      *outvalue = apply_operator(proc, &test, 1, env);
+      return NULL;
+    }
+    return cdr(clause);
+  }
+  *outvalue = lg_sym_ok;
+  return NULL;
+}
+
+static object_t *eval_loop_tail(object_t *exp, object_t *env, object_t *loop, object_t **next, int *num_next);
+
+static object_t *eval_loop_sequence(object_t *seq, object_t *env, object_t *loop, object_t **next, int *num_next) {
+  while (!is_last_exp(seq)) {
+    eval_with_env(first_exp(seq), env);
+    seq = rest_exps(seq);
+  }
+  return eval_loop_tail(first_exp(seq), env, loop, next, num_next);
+}
+
+/*
+ * Evaluates an expression in tail position of a named let body. A call back to
+ * the loop's own procedure is not applied: its arguments are stored in next and
+ * NULL is returned so the caller can rebind the loop frame and go around again.
+ * Calls the walk does not recognise as being in tail position, or made through
+ * another name, recurse through eval_application as usual.
+ */
+static object_t *eval_loop_tail(object_t *exp, object_t *env, object_t *loop, object_t **next, int *num_next) {
+  if (is_if(exp)) {
+    instrument_count_eval(EVAL_KIND_IF);
+    if (is_true(eval_with_env(if_predicate(exp), env))) {
+      return eval_loop_tail(if_consequent(exp), env, loop, next, num_next);
+    }
+    return eval_loop_tail(if_alternative(exp), env, loop, next, num_next);
+  }
+
+  if (is_begin(exp)) {
+    instrument_count_eval(EVAL_KIND_BEGIN);
+    return eval_loop_sequence(begin_actions(exp), env, loop, next, num_next);
+  }
+
+  if (is_cond(exp)) {
+    instrument_count_eval(EVAL_KIND_COND);
+    object_t *value;
+    object_t *body = select_cond_clause(exp, env, &value);
+    return body == NULL ? value : eval_loop_sequence(body, env, loop, next, num_next);
+  }
+
+  if (is_application(exp) && car(exp)->type == SCHEME_SYMBOL && lookup_variable_value(car(exp), env) == loop) {
+    instrument_count_eval(EVAL_KIND_APPLICATION);
+    int num = 0;
+    for (object_t *operands = cdr(exp); operands != g_scheme_null; operands = cdr(operands)) {
+      ASSERT_OR_ERROR(num < MAX_OPERANDS, "Too many operands");
+      next[num++] = eval_with_env(car(operands), env);
+    }
+    *num_next = num;
+    return NULL;
+  }
+
+  return eval_with_env(exp, env);
+}
+
+static void rebind_frame(object_t *env, object_t **vals, int num_vals) {
+  object_t *cell = cdr(first_frame(env));
+  for (int i = 0; i < num_vals; i++) {
+    ASSERT_OR_ERROR(cell != g_scheme_null, "Too many arguments to named let");
+    cons_entry_t *entry = get_cons_entry(cell);
+    entry->car = vals[i];
+    cell = entry->cdr;
+  }
+  ASSERT_OR_ERROR(cell == g_scheme_null, "Too few arguments to named let");
+}
+
+/*
+ * (let name ((var init) ...) body ...) binds name to a procedure over the vars
+ * so it can be called or passed around as usual, but runs the body as a loop:
+ * self calls in tail position overwrite the vars in one frame in place instead
+ * of extending the environment with a new frame per iteration.
+ */
+static object_t *eval_named_let(object_t *exp, object_t *env) {
+  object_t *name = cadr(exp);
+  object_t *body = cdddr(exp);
+  object_t *vars;
+  object_t *vals;
+  make_bindings(caddr(exp), env, true, &vars, &vals);
+
+  object_t *loop = lambda(vars, body);
+  get_lambda_entry(loop)->name = name;
+  note_local_binding(name);
+  object_t *loop_env = extend_environment(cons(name, g_scheme_null), cons(loop, g_scheme_null), env);
+  object_t *extended = extend_environment(vars, vals, loop_env);
+
+  object_t *next[MAX_OPERANDS];
+  while (true) {
+    // Frames made during an iteration are gone by the next one
+    cons_object_t *mark = frame_region_mark();
+    int num_next = 0;
+    object_t *result = eval_loop_sequence(body, extended, loop, next, &num_next);
+    frame_region_release(mark);
+    if (result != NULL) return result;
+    rebind_frame(extended, next, num_next);
+  }
+}
+
+/*
+ * (do ((var init step) ...) (test result ...) command ...) runs as a C loop
+ * over a single frame whose vars are stepped in place.
+ */
+static object_t *eval_do(object_t *exp, object_t *env) {
+  object_t *specs = cadr(exp);
+  object_t *exit_clause = caddr(exp);
+  object_t *commands = cdddr(exp);
+  object_t *vars;
+  object_t *vals;
+  make_bindings(specs, env, true, &vars, &vals);
+  object_t *extended = extend_environment(vars, vals, env);
+
+  object_t *steps[MAX_OPERANDS];
+  while (true) {
+    // Frames made during an iteration are gone by the next one
+    cons_object_t *mark = frame_region_mark();
+    if (is_true(eval_with_env(car(exit_clause), extended))) {
+      frame_region_release(mark);
+      if (cdr(exit_clause) == g_scheme_null) return lg_sym_ok;
+      return eval_sequence(cdr(exit_clause), extended);
+    }
+
+    for (object_t *rest = commands; rest != g_scheme_null; rest = cdr(rest)) {
+      eval_with_env(car(rest), extended);
+    }
+
+    // All steps are computed before any var is updated
+    int num_steps = 0;
+    for (object_t *spec = specs; spec != g_scheme_null; spec = cdr(spec)) {
+      object_t *step = cddr(car(spec));
+      if (step == g_scheme_null) continue;
+      ASSERT_OR_ERROR(num_steps < MAX_OPERANDS, "Too many do variables");
+      steps[num_steps++] = eval_with_env(car(step), extended);
+    }
+    frame_region_release(mark);
+
+    object_t *cell = vals;
+    int i = 0;
+    for (object_t *spec = specs; spec != g_scheme_null; spec = cdr(spec)) {
+      cons_entry_t *entry = get_cons_entry(cell);
+      if (cddr(car(spec)) != g_scheme_null) entry->car = steps[i++];
+      cell = entry->cdr;
+    }
+  }
+}
+
+static inline object_t *eval_cond(object_t *exp, object_t *env) {
+  object_t *value;
+  object_t *body = select_cond_clause(exp, env, &value);
+  return body == NULL ? value : eval_sequence(body, env);
+}
+
+// and returns the first false value or the last value, or returns from the last operand as a tail call
+static inline object_t *eval_and(object_t *exp, object_t *env) {
+  object_t *rest = cdr(exp);
+  if (rest == g_scheme_null) return g_true;
+  while (!is_last_exp(rest)) {
+    object_t *value = eval_with_env(first_exp(rest), env);
+    if (!is_true(value)) return value;
+    rest = rest_exps(rest);
+  }
+  return eval_with_env(first_exp(rest), env);
+}
+
+static inline object_t *eval_or(object_t *exp, object_t *env) {
+  object_t *rest = cdr(exp);
+  if (rest == g_scheme_null) return g_false;
+  while (!is_last_exp(rest)) {
+    object_t *value = eval_with_env(first_exp(rest), env);
+    if (is_true(value)) return value;
+    rest = rest_exps(rest);
+  }
+  return eval_with_env(first_exp(rest), env);
+}
+
 static object_t *eval_with_env(object_t *obj, object_t *env) {
-  if (is_self_evaluating(obj)) return obj;
+  if (is_self_evaluating(obj)) {
+    instrument_count_eval(EVAL_KIND_SELF_EVALUATING);
+    return obj;
+  }
   if (is_variable(obj)) {
+    instrument_count_eval(EVAL_KIND_VARIABLE);
     object_t *value = lookup_variable_value(obj, env);
     ASSERT_OR_ERROR(value != NULL, "Unbound variable");
     return value;
   }
   if (is_definition(obj)) {
+    instrument_count_eval(EVAL_KIND_DEFINE);
     object_t *variable = definition_variable(obj);
     object_t *value = eval_with_env(definition_value(obj), env);
+    if (value->type == SCHEME_LAMBDA) {
+      lambda_entry_t *entry = get_lambda_entry(value);
+      if (entry->name == NULL) entry->name = variable;
+    }
     return define_variable(variable, value, env);
   }
 
   if (is_quoted(obj)) {
+    instrument_count_eval(EVAL_KIND_QUOTE);
     return text_of_quotation(obj);
   }
 
   if (is_assignment(obj)) {
+    instrument_count_eval(EVAL_KIND_SET);
     object_t *variable = assignment_variable(obj);
     object_t *value = eval_with_env(assignment_value(obj), env);
     return set_variable_value(variable, value, env);
   }
 
   if (is_if(obj)) {
+    instrument_count_eval(EVAL_KIND_IF);
     object_t *predicate = if_predicate(obj);
+    cons_object_t *mark = frame_region_mark();
     object_t *predicate_result = eval_with_env(predicate, env);
+    frame_region_release(mark);
     if (is_true(predicate_result)) {
       object_t *consequent = if_consequent(obj);
       return eval_with_env(consequent, env);
@@ -394,22 +871,111 @@ static object_t *eval_with_env(object_t *obj, object_t *env) {
   }
 
   if (is_lambda(obj)) {
+    instrument_count_eval(EVAL_KIND_LAMBDA);
     object_t *parameters = lambda_parameters(obj);
     object_t *body = lambda_body(obj);
+    note_parameters(parameters);
     return lambda(parameters, body);
   }
 
   if (is_begin(obj)) {
+    instrument_count_eval(EVAL_KIND_BEGIN);
     return eval_sequence(begin_actions(obj), env);
   }
 
+  if (is_let(obj)) {
+    if (is_named_let(obj)) {
+      instrument_count_eval(EVAL_KIND_NAMED_LET);
+      return eval_named_let(obj, env);
+    }
+    instrument_count_eval(EVAL_KIND_LET);
+    return eval_let(obj, env);
+  }
+
+  if (is_let_star(obj)) {
+    instrument_count_eval(EVAL_KIND_LET);
+    return eval_let_star(obj, env);
+  }
+
+  if (is_letrec(obj)) {
+    instrument_count_eval(EVAL_KIND_LET);
+    return eval_letrec(obj, env);
+  }
+
+  if (is_cond(obj)) {
+    instrument_count_eval(EVAL_KIND_COND);
+    return eval_cond(obj, env);
+  }
+
+  if (is_and(obj)) {
+    instrument_count_eval(EVAL_KIND_AND_OR);
+    return eval_and(obj, env);
+  }
+
+  if (is_or(obj)) {
+    instrument_count_eval(EVAL_KIND_AND_OR);
+    return eval_or(obj, env);
+  }
+
+  if (is_do(obj)) {
+    instrument_count_eval(EVAL_KIND_DO);
+    return eval_do(obj, env);
+  }
+
   if (is_application(obj)) {
+    instrument_count_eval(EVAL_KIND_APPLICATION);
     return eval_application(obj, env);
   }
 
   error("Unable to evaluate expression");
 }
 
+static __attribute__((noinline)) object_t *eval_instrumented(object_t *obj) {
+  uint64_t start_ns = instrument_now_ns();
+  instrument_begin_form(obj);
+  object_t *result = eval_with_env(obj, lg_global_env);
+  instrument_end_form(start_ns);
+  return result;
+}
+
 object_t *eval(object_t *obj) {
-  return eval_with_env(obj, lg_global_env);
+  if (__builtin_expect(g_srcloc_enabled, 0)) srcloc_set_current_form(obj);
+  obj = optimize(expand(obj));
+  cons_object_t *mark = frame_region_mark();
+  object_t *result;
+  if (__builtin_expect(g_instrument_counting || g_instrument_tracing, 0)) {
+    result = eval_instrumented(obj);
+  } else {
+    result = eval_with_env(obj, lg_global_env);
+  }
+  frame_region_release(mark);
+  return result;
+}
+
+object_t *eval_in_env(object_t *exp, object_t *env) {
+  cons_object_t *mark = frame_region_mark();
+  object_t *result = eval_with_env(exp, env);
+  frame_region_release(mark);
+  return result;
+}
+
+object_t *apply_in_env(object_t *op, int argc, object_t *argv[], object_t *env) {
+  ASSERT_OR_ERROR(is_applicable(op), "Not applicable");
+  ASSERT_OR_ERROR(argc >= 0 && argc <= MAX_OPERANDS, "Too many operands");
+  cons_object_t *mark = frame_region_mark();
+  object_t *result = apply_operator(op, argv, (uint64_t)argc, env);
+  frame_region_release(mark);
+  return result;
+}
+
+object_t *apply(object_t *op, int argc, object_t *argv[]) {
+  return apply_in_env(op, argc, argv, lg_global_env);
+}
+
+object_t *lookup_in_env(object_t *name, object_t *env) {
+  return lookup_variable_value(name, env);
+}
+
+object_t *lookup_global(object_t *name) {
+  return lookup_variable_value(name, lg_global_env);
 }
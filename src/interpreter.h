@@ -6,5 +6,15 @@ SCHEMIN_INTERPRETER_H
 
 int interpreter_init(void);
 object_t *eval(object_t *obj);
+// Evaluate an already expanded form in env
+object_t *eval_in_env(object_t *exp, object_t *env);
+
+// Apply an already evaluated operator to evaluated arguments
+object_t *apply(object_t *op, int argc, object_t *argv[]);
+object_t *apply_in_env(object_t *op, int argc, object_t *argv[], object_t *env);
+
+// Return the value bound to a symbol, or NULL when it is unbound
+object_t *lookup_in_env(object_t *name, object_t *env);
+object_t *lookup_global(object_t *name);
 
 #endif
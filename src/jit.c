@@ -0,0 +1,793 @@
+#include "jit.h"
+#include <string.h>
+#include "memory.h"
+#include "interpreter.h"
+#include "records.h"
+#include "error.h"
+
+uint32_t g_jit_threshold = JIT_DEFAULT_THRESHOLD;
+uint32_t g_jit_nesting = 0;
+
+static bool lg_jit_available = false;
+static jit_stats_t lg_jit_stats;
+
+typedef object_t *(*jit_code_t)(object_t ***slots, object_t *env);
+
+void jit_set_threshold(uint32_t threshold) {
+  g_jit_threshold = threshold;
+}
+
+void jit_get_stats(jit_stats_t *outstats) {
+  *outstats = lg_jit_stats;
+}
+
+void jit_write_report(FILE *out) {
+  fprintf(out, "jit\n");
+  fprintf(out, "  %-16s %12llu\n", "compiled", (unsigned long long)lg_jit_stats.compiled);
+  fprintf(out, "  %-16s %12llu\n", "rejected", (unsigned long long)lg_jit_stats.rejected);
+  fprintf(out, "  %-16s %12zu\n", "code bytes", lg_jit_stats.code_bytes);
+}
+
+object_t *jit_invoke(lambda_entry_t *entry, object_t *vals, object_t *env) {
+  // Parameters are read through the frame's cells so set! from a callee is seen
+  object_t **slots[JIT_MAX_PARAMETERS];
+  size_t num_slots = 0;
+  while (vals != g_scheme_null) {
+    cons_entry_t *cell = get_cons_entry(vals);
+    slots[num_slots++] = &cell->car;
+    vals = cell->cdr;
+  }
+
+  g_jit_nesting++;
+  object_t *result = ((jit_code_t)entry->jit_code)(slots, env);
+  g_jit_nesting--;
+  return result;
+}
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_BUFFER_INITIAL_SIZE 1024
+#define JIT_MAX_ARGUMENTS 32
+
+/*
+ * Runtime entry points called from compiled code. They use the normal C
+ * calling convention, so templates only have to load arguments and call.
+ */
+
+static object_t *jit_rt_lookup(object_t *name, object_t *env) {
+  object_t *value = lookup_in_env(name, env);
+  ASSERT_OR_ERROR(value != NULL, "Unbound variable");
+  return value;
+}
+
+static object_t *jit_rt_apply(object_t *op, int argc, object_t *argv[], object_t *env) {
+  return apply_in_env(op, argc, argv, env);
+}
+
+static object_t *jit_rt_eval(object_t *exp, object_t *env) {
+  return eval_in_env(exp, env);
+}
+
+static object_t *jit_rt_make_number(int64_t number) {
+  return allocate_number(number);
+}
+
+typedef enum {
+  REG_RAX = 0,
+  REG_RCX = 1,
+  REG_RDX = 2,
+  REG_RBX = 3,
+  REG_RSP = 4,
+  REG_RBP = 5,
+  REG_RSI = 6,
+  REG_RDI = 7,
+  REG_R8 = 8,
+  REG_R9 = 9,
+  REG_R10 = 10,
+  REG_R12 = 12
+} reg_t;
+
+typedef enum {
+  CC_O = 0x0,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_L = 0xc,
+  CC_GE = 0xd,
+  CC_LE = 0xe,
+  CC_G = 0xf
+} cond_t;
+
+enum {
+  OP_ADD = 0x01,
+  OP_OR = 0x09,
+  OP_SUB = 0x29,
+  OP_CMP = 0x39
+};
+
+enum {
+  SHIFT_SHL = 4,
+  SHIFT_SHR = 5,
+  SHIFT_SAR = 7
+};
+
+typedef enum {
+  FIXNUM_NONE,
+  FIXNUM_EQ,
+  FIXNUM_LT,
+  FIXNUM_GT,
+  FIXNUM_ADD,
+  FIXNUM_SUB,
+  FIXNUM_MUL
+} fixnum_op_t;
+
+typedef struct jit_buffer_s {
+  uint8_t *bytes;
+  size_t len;
+  size_t cap;
+} jit_buffer_t;
+
+typedef struct jit_compiler_s {
+  jit_buffer_t buf;
+  object_t *parameters;
+  int max_temps;
+} jit_compiler_t;
+
+static object_t *lg_sym_if;
+static object_t *lg_sym_quote;
+static object_t *lg_sym_begin;
+static object_t *lg_sym_define;
+static object_t *lg_sym_set;
+static object_t *lg_sym_lambda;
+static object_t *lg_sym_let;
+static object_t *lg_sym_let_star;
+static object_t *lg_sym_letrec;
+static object_t *lg_sym_do;
+static object_t *lg_sym_cond;
+static object_t *lg_sym_else;
+static object_t *lg_sym_arrow;
+static object_t *lg_sym_and;
+static object_t *lg_sym_or;
+static object_t *lg_sym_ok;
+
+static void emit_u8(jit_buffer_t *b, uint8_t byte) {
+  if (b->len == b->cap) {
+    b->cap = b->cap == 0 ? JIT_BUFFER_INITIAL_SIZE : b->cap * 2;
+    b->bytes = (uint8_t*)realloc(b->bytes, b->cap);
+    ASSERT_OR_ERROR(b->bytes != NULL, "Could not grow jit buffer");
+  }
+  b->bytes[b->len++] = byte;
+}
+
+static void emit_u32(jit_buffer_t *b, uint32_t value) {
+  for (int i = 0; i < 4; i++) emit_u8(b, (uint8_t)(value >> (8 * i)));
+}
+
+static void emit_u64(jit_buffer_t *b, uint64_t value) {
+  for (int i = 0; i < 8; i++) emit_u8(b, (uint8_t)(value >> (8 * i)));
+}
+
+static void emit_rex_w(jit_buffer_t *b, int reg, int rm) {
+  emit_u8(b, (uint8_t)(0x48 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1)));
+}
+
+static void emit_modrm_reg(jit_buffer_t *b, int reg, int rm) {
+  emit_u8(b, (uint8_t)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+// Always uses a 32-bit displacement, which sidesteps the rbp/r13 special case
+static void emit_modrm_disp(jit_buffer_t *b, int reg, int base, int32_t disp) {
+  emit_u8(b, (uint8_t)(0x80 | (reg & 7) << 3 | (base & 7)));
+  if ((base & 7) == REG_RSP) emit_u8(b, 0x24);
+  emit_u32(b, (uint32_t)disp);
+}
+
+static void emit_mov_imm(jit_buffer_t *b, reg_t dst, uint64_t imm) {
+  emit_u8(b, (uint8_t)(0x48 | (dst >> 3)));
+  emit_u8(b, (uint8_t)(0xb8 + (dst & 7)));
+  emit_u64(b, imm);
+}
+
+static void emit_mov_imm32(jit_buffer_t *b, reg_t dst, uint32_t imm) {
+  if (dst >= REG_R8) emit_u8(b, 0x41);
+  emit_u8(b, (uint8_t)(0xb8 + (dst & 7)));
+  emit_u32(b, imm);
+}
+
+static void emit_mov_reg(jit_buffer_t *b, reg_t dst, reg_t src) {
+  emit_rex_w(b, src, dst);
+  emit_u8(b, 0x89);
+  emit_modrm_reg(b, src, dst);
+}
+
+static void emit_load(jit_buffer_t *b, reg_t dst, reg_t base, int32_t disp) {
+  emit_rex_w(b, dst, base);
+  emit_u8(b, 0x8b);
+  emit_modrm_disp(b, dst, base, disp);
+}
+
+static void emit_store(jit_buffer_t *b, reg_t base, int32_t disp, reg_t src) {
+  emit_rex_w(b, src, base);
+  emit_u8(b, 0x89);
+  emit_modrm_disp(b, src, base, disp);
+}
+
+static void emit_lea(jit_buffer_t *b, reg_t dst, reg_t base, int32_t disp) {
+  emit_rex_w(b, dst, base);
+  emit_u8(b, 0x8d);
+  emit_modrm_disp(b, dst, base, disp);
+}
+
+static void emit_alu(jit_buffer_t *b, uint8_t opcode, reg_t dst, reg_t src) {
+  emit_rex_w(b, src, dst);
+  emit_u8(b, opcode);
+  emit_modrm_reg(b, src, dst);
+}
+
+static void emit_imul(jit_buffer_t *b, reg_t dst, reg_t src) {
+  emit_rex_w(b, dst, src);
+  emit_u8(b, 0x0f);
+  emit_u8(b, 0xaf);
+  emit_modrm_reg(b, dst, src);
+}
+
+static void emit_cmov(jit_buffer_t *b, cond_t cc, reg_t dst, reg_t src) {
+  emit_rex_w(b, dst, src);
+  emit_u8(b, 0x0f);
+  emit_u8(b, (uint8_t)(0x40 + cc));
+  emit_modrm_reg(b, dst, src);
+}
+
+static void emit_shift(jit_buffer_t *b, int kind, reg_t reg, uint8_t amount) {
+  emit_rex_w(b, 0, reg);
+  emit_u8(b, 0xc1);
+  emit_modrm_reg(b, kind, reg);
+  emit_u8(b, amount);
+}
+
+static void emit_call(jit_buffer_t *b, const void *func) {
+  emit_mov_imm(b, REG_RAX, (uint64_t)(uintptr_t)func);
+  emit_u8(b, 0xff);
+  emit_u8(b, 0xd0);
+}
+
+// Returns the offset of the rel32 so the caller can patch it once the target is known
+static size_t emit_jcc(jit_buffer_t *b, cond_t cc) {
+  emit_u8(b, 0x0f);
+  emit_u8(b, (uint8_t)(0x80 + cc));
+  size_t at = b->len;
+  emit_u32(b, 0);
+  return at;
+}
+
+static size_t emit_jmp(jit_buffer_t *b) {
+  emit_u8(b, 0xe9);
+  size_t at = b->len;
+  emit_u32(b, 0);
+  return at;
+}
+
+static void patch_to_here(jit_buffer_t *b, size_t at) {
+  int32_t rel = (int32_t)(b->len - (at + 4));
+  memcpy(&b->bytes[at], &rel, sizeof(rel));
+}
+
+/*
+ * Register use in compiled bodies: rbx holds the parameter slot array, r12
+ * the environment, rax the value of the expression just compiled. Temporaries
+ * live at fixed offsets from rsp, which stays 16-byte aligned for calls.
+ */
+
+static inline int32_t temp_offset(int idx) {
+  return 8 * idx;
+}
+
+static void use_temps(jit_compiler_t *c, int count) {
+  if (count > c->max_temps) c->max_temps = count;
+}
+
+static int parameter_index(jit_compiler_t *c, object_t *sym) {
+  int i = 0;
+  for (object_t *p = c->parameters; p != g_scheme_null; p = cdr(p), i++) {
+    if (is_eq(car(p), sym)) return i;
+  }
+  return -1;
+}
+
+static fixnum_op_t fixnum_op_for(primitive_entry_t *entry, int argc) {
+  if (argc != 2) return FIXNUM_NONE;
+  if (strcmp(entry->name, "=") == 0) return FIXNUM_EQ;
+  if (strcmp(entry->name, "<") == 0) return FIXNUM_LT;
+  if (strcmp(entry->name, ">") == 0) return FIXNUM_GT;
+  if (strcmp(entry->name, "+") == 0) return FIXNUM_ADD;
+  if (strcmp(entry->name, "-") == 0) return FIXNUM_SUB;
+  if (strcmp(entry->name, "*") == 0) return FIXNUM_MUL;
+  return FIXNUM_NONE;
+}
+
+static bool compile_expression(jit_compiler_t *c, object_t *exp, int depth);
+
+static bool compile_sequence(jit_compiler_t *c, object_t *seq, int depth) {
+  if (list_length(seq) < 1) return false;
+  for (; seq != g_scheme_null; seq = cdr(seq)) {
+    if (!compile_expression(c, car(seq), depth)) return false;
+  }
+  return true;
+}
+
+static bool compile_variable(jit_compiler_t *c, object_t *sym) {
+  jit_buffer_t *b = &c->buf;
+  int idx = parameter_index(c, sym);
+  if (idx >= 0) {
+    emit_load(b, REG_RAX, REG_RBX, 8 * idx);
+    emit_load(b, REG_RAX, REG_RAX, 0);
+    return true;
+  }
+
+  emit_mov_imm(b, REG_RDI, (uint64_t)(uintptr_t)sym);
+  emit_mov_reg(b, REG_RSI, REG_R12);
+  emit_call(b, (const void*)&jit_rt_lookup);
+  return true;
+}
+
+static bool compile_if(jit_compiler_t *c, object_t *exp, int depth) {
+  jit_buffer_t *b = &c->buf;
+  if (list_length(exp) != 4) return false;
+
+  if (!compile_expression(c, cadr(exp), depth)) return false;
+  emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)g_false);
+  emit_alu(b, OP_CMP, REG_RAX, REG_RCX);
+  size_t to_alternative = emit_jcc(b, CC_E);
+  if (!compile_expression(c, caddr(exp), depth)) return false;
+  size_t to_end = emit_jmp(b);
+  patch_to_here(b, to_alternative);
+  if (!compile_expression(c, cadddr(exp), depth)) return false;
+  patch_to_here(b, to_end);
+  return true;
+}
+
+// Compares rax with #f, leaving it untouched
+static void emit_test_false(jit_buffer_t *b) {
+  emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)g_false);
+  emit_alu(b, OP_CMP, REG_RAX, REG_RCX);
+}
+
+// and stops at the first #f and or at the first other value, which is left in rax
+static bool compile_and_or(jit_compiler_t *c, object_t *exp, int depth, bool is_and) {
+  jit_buffer_t *b = &c->buf;
+  int count = list_length(exp) - 1;
+  if (count < 0 || count > JIT_MAX_ARGUMENTS) return false;
+  if (count == 0) {
+    emit_mov_imm(b, REG_RAX, (uint64_t)(uintptr_t)(is_and ? g_true : g_false));
+    return true;
+  }
+
+  size_t to_end[JIT_MAX_ARGUMENTS];
+  int num_jumps = 0;
+  for (object_t *rest = cdr(exp); rest != g_scheme_null; rest = cdr(rest)) {
+    if (!compile_expression(c, car(rest), depth)) return false;
+    if (cdr(rest) == g_scheme_null) break;
+    emit_test_false(b);
+    to_end[num_jumps++] = emit_jcc(b, is_and ? CC_E : CC_NE);
+  }
+  for (int i = 0; i < num_jumps; i++) {
+    patch_to_here(b, to_end[i]);
+  }
+  return true;
+}
+
+// Clauses using => are left to the interpreter
+static bool compile_cond(jit_compiler_t *c, object_t *exp, int depth) {
+  jit_buffer_t *b = &c->buf;
+  int count = list_length(exp) - 1;
+  if (count < 0 || count > JIT_MAX_ARGUMENTS) return false;
+
+  size_t to_end[JIT_MAX_ARGUMENTS];
+  int num_jumps = 0;
+  bool has_else = false;
+  for (object_t *clauses = cdr(exp); clauses != g_scheme_null; clauses = cdr(clauses)) {
+    object_t *clause = car(clauses);
+    if (list_length(clause) < 1) return false;
+    if (is_eq(car(clause), lg_sym_else)) {
+      if (!compile_sequence(c, cdr(clause), depth)) return false;
+      has_else = true;
+      break;
+    }
+
+    if (!compile_expression(c, car(clause), depth)) return false;
+    emit_test_false(b);
+    if (cdr(clause) == g_scheme_null) {
+      to_end[num_jumps++] = emit_jcc(b, CC_NE);
+      continue;
+    }
+    if (is_eq(cadr(clause), lg_sym_arrow)) return false;
+    size_t to_next = emit_jcc(b, CC_E);
+    if (!compile_sequence(c, cdr(clause), depth)) return false;
+    to_end[num_jumps++] = emit_jmp(b);
+    patch_to_here(b, to_next);
+  }
+
+  if (!has_else) emit_mov_imm(b, REG_RAX, (uint64_t)(uintptr_t)lg_sym_ok);
+  for (int i = 0; i < num_jumps; i++) {
+    patch_to_here(b, to_end[i]);
+  }
+  return true;
+}
+
+/*
+ * Forms that bind new variables are handed to the interpreter with the
+ * current environment, so their frames are built exactly as when interpreted.
+ */
+static void compile_interpreted(jit_compiler_t *c, object_t *exp) {
+  jit_buffer_t *b = &c->buf;
+  emit_mov_imm(b, REG_RDI, (uint64_t)(uintptr_t)exp);
+  emit_mov_reg(b, REG_RSI, REG_R12);
+  emit_call(b, (const void*)&jit_rt_eval);
+}
+
+// Generic call through the runtime with the operator in temp 'op' and the arguments after it
+static void emit_runtime_apply(jit_compiler_t *c, int argc, int args) {
+  jit_buffer_t *b = &c->buf;
+  emit_mov_reg(b, REG_RDI, REG_RAX);
+  emit_mov_imm32(b, REG_RSI, (uint32_t)argc);
+  emit_lea(b, REG_RDX, REG_RSP, temp_offset(args));
+  emit_mov_reg(b, REG_RCX, REG_R12);
+  emit_call(b, (const void*)&jit_rt_apply);
+}
+
+/*
+ * Both operands are in temps. The fast path requires two fixnums and a result
+ * that still fits; everything else, including a rebound operator, takes the
+ * slow path, which calls whatever the symbol names now.
+ */
+static void emit_fixnum_op(jit_compiler_t *c, fixnum_op_t op, int args, size_t *to_slow) {
+  jit_buffer_t *b = &c->buf;
+  emit_load(b, REG_R8, REG_RSP, temp_offset(args));
+  emit_load(b, REG_R9, REG_RSP, temp_offset(args + 1));
+  emit_load(b, REG_R8, REG_R8, 0);
+  emit_load(b, REG_R9, REG_R9, 0);
+
+  // SCHEME_NUMBER is zero, so both type fields are clear iff their union is
+  emit_mov_reg(b, REG_R10, REG_R8);
+  emit_alu(b, OP_OR, REG_R10, REG_R9);
+  emit_shift(b, SHIFT_SHR, REG_R10, 61);
+  to_slow[0] = emit_jcc(b, CC_NE);
+
+  emit_shift(b, SHIFT_SHL, REG_R8, 3);
+  emit_shift(b, SHIFT_SAR, REG_R8, 3);
+  emit_shift(b, SHIFT_SHL, REG_R9, 3);
+  emit_shift(b, SHIFT_SAR, REG_R9, 3);
+
+  if (op == FIXNUM_EQ || op == FIXNUM_LT || op == FIXNUM_GT) {
+    emit_alu(b, OP_CMP, REG_R8, REG_R9);
+    emit_mov_imm(b, REG_RAX, (uint64_t)(uintptr_t)g_true);
+    emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)g_false);
+    cond_t unless = op == FIXNUM_EQ ? CC_NE : op == FIXNUM_LT ? CC_GE : CC_LE;
+    emit_cmov(b, unless, REG_RAX, REG_RCX);
+    to_slow[1] = to_slow[2] = SIZE_MAX;
+    return;
+  }
+
+  to_slow[1] = SIZE_MAX;
+  if (op == FIXNUM_ADD) {
+    emit_alu(b, OP_ADD, REG_R8, REG_R9);
+  } else if (op == FIXNUM_SUB) {
+    emit_alu(b, OP_SUB, REG_R8, REG_R9);
+  } else {
+    emit_imul(b, REG_R8, REG_R9);
+    to_slow[1] = emit_jcc(b, CC_O);
+  }
+
+  // The result must survive truncation to the 61-bit number field
+  emit_mov_reg(b, REG_R10, REG_R8);
+  emit_shift(b, SHIFT_SHL, REG_R10, 3);
+  emit_shift(b, SHIFT_SAR, REG_R10, 3);
+  emit_alu(b, OP_CMP, REG_R10, REG_R8);
+  to_slow[2] = emit_jcc(b, CC_NE);
+
+  emit_mov_reg(b, REG_RDI, REG_R8);
+  emit_call(b, (const void*)&jit_rt_make_number);
+}
+
+static bool compile_primitive_call(jit_compiler_t *c, object_t *exp, object_t *sym, object_t *primitive, int depth) {
+  jit_buffer_t *b = &c->buf;
+  primitive_entry_t *entry = get_primitive_entry(primitive);
+  symbol_entry_t *sym_entry = get_symbol_entry(sym);
+
+  int argc = 0;
+  for (object_t *operands = cdr(exp); operands != g_scheme_null; operands = cdr(operands), argc++) {
+    if (!compile_expression(c, car(operands), depth + argc)) return false;
+    emit_store(b, REG_RSP, temp_offset(depth + argc), REG_RAX);
+  }
+  use_temps(c, depth + argc);
+
+  // Guard: the symbol has not been defined, assigned or bound since compilation
+  emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)&sym_entry->binding_version);
+  emit_u8(b, 0x81);
+  emit_u8(b, 0x39);
+  emit_u32(b, sym_entry->binding_version);
+  size_t to_slow[4];
+  to_slow[0] = emit_jcc(b, CC_NE);
+
+  fixnum_op_t op = fixnum_op_for(entry, argc);
+  if (op != FIXNUM_NONE) {
+    emit_fixnum_op(c, op, depth, &to_slow[1]);
+  } else if (!primitive_accepts(entry, argc)) {
+    // The generic apply reports the arity error
+    to_slow[1] = emit_jmp(b);
+    to_slow[2] = to_slow[3] = SIZE_MAX;
+  } else {
+    to_slow[1] = to_slow[2] = to_slow[3] = SIZE_MAX;
+    emit_mov_imm32(b, REG_RDI, (uint32_t)argc);
+    emit_lea(b, REG_RSI, REG_RSP, temp_offset(depth));
+    emit_call(b, (const void*)entry->func);
+  }
+  size_t to_end = emit_jmp(b);
+
+  for (int i = 0; i < 4; i++) {
+    if (to_slow[i] != SIZE_MAX) patch_to_here(b, to_slow[i]);
+  }
+  emit_mov_imm(b, REG_RDI, (uint64_t)(uintptr_t)sym);
+  emit_mov_reg(b, REG_RSI, REG_R12);
+  emit_call(b, (const void*)&jit_rt_lookup);
+  emit_runtime_apply(c, argc, depth);
+
+  patch_to_here(b, to_end);
+  return true;
+}
+
+// Procedures generated for record types are called directly under the same guard as primitives
+static bool compile_record_call(jit_compiler_t *c, object_t *exp, object_t *sym, object_t *procedure, int depth) {
+  jit_buffer_t *b = &c->buf;
+  symbol_entry_t *sym_entry = get_symbol_entry(sym);
+
+  int argc = 0;
+  for (object_t *operands = cdr(exp); operands != g_scheme_null; operands = cdr(operands), argc++) {
+    if (!compile_expression(c, car(operands), depth + argc)) return false;
+    emit_store(b, REG_RSP, temp_offset(depth + argc), REG_RAX);
+  }
+  use_temps(c, depth + argc);
+
+  emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)&sym_entry->binding_version);
+  emit_u8(b, 0x81);
+  emit_u8(b, 0x39);
+  emit_u32(b, sym_entry->binding_version);
+  size_t to_slow = emit_jcc(b, CC_NE);
+  emit_mov_imm(b, REG_RDI, (uint64_t)(uintptr_t)procedure);
+  emit_mov_imm32(b, REG_RSI, (uint32_t)argc);
+  emit_lea(b, REG_RDX, REG_RSP, temp_offset(depth));
+  emit_call(b, (const void*)&apply_record_procedure);
+  size_t to_end = emit_jmp(b);
+
+  patch_to_here(b, to_slow);
+  emit_mov_imm(b, REG_RDI, (uint64_t)(uintptr_t)sym);
+  emit_mov_reg(b, REG_RSI, REG_R12);
+  emit_call(b, (const void*)&jit_rt_lookup);
+  emit_runtime_apply(c, argc, depth);
+
+  patch_to_here(b, to_end);
+  return true;
+}
+
+// Global lambda operators are embedded under the same version guard as primitives
+static void compile_global_operator(jit_compiler_t *c, object_t *sym, object_t *value) {
+  jit_buffer_t *b = &c->buf;
+  symbol_entry_t *sym_entry = get_symbol_entry(sym);
+  emit_mov_imm(b, REG_RCX, (uint64_t)(uintptr_t)&sym_entry->binding_version);
+  emit_u8(b, 0x81);
+  emit_u8(b, 0x39);
+  emit_u32(b, sym_entry->binding_version);
+  size_t to_slow = emit_jcc(b, CC_NE);
+  emit_mov_imm(b, REG_RAX, (uint64_t)(uintptr_t)value);
+  size_t to_end = emit_jmp(b);
+  patch_to_here(b, to_slow);
+  compile_variable(c, sym);
+  patch_to_here(b, to_end);
+}
+
+static bool compile_application(jit_compiler_t *c, object_t *exp, int depth) {
+  jit_buffer_t *b = &c->buf;
+  int argc = list_length(exp) - 1;
+  if (argc < 0 || argc > JIT_MAX_ARGUMENTS) return false;
+
+  object_t *head = car(exp);
+  object_t *global = NULL;
+  if (head->type == SCHEME_SYMBOL && parameter_index(c, head) < 0
+      && (get_symbol_entry(head)->flags & SYMBOL_LOCALLY_BOUND) == 0) {
+    global = lookup_global(head);
+    if (global != NULL && global->type == SCHEME_PRIMITIVE) {
+      return compile_primitive_call(c, exp, head, global, depth);
+    }
+    if (global != NULL && object_type(global) == SCHEME_RECORD_PROCEDURE) {
+      return compile_record_call(c, exp, head, global, depth);
+    }
+  }
+
+  // Operator in temp 'depth', arguments in the temps after it
+  if (global != NULL && global->type == SCHEME_LAMBDA) {
+    compile_global_operator(c, head, global);
+  } else if (!compile_expression(c, head, depth)) {
+    return false;
+  }
+  emit_store(b, REG_RSP, temp_offset(depth), REG_RAX);
+  int i = 0;
+  for (object_t *operands = cdr(exp); operands != g_scheme_null; operands = cdr(operands), i++) {
+    if (!compile_expression(c, car(operands), depth + 1 + i)) return false;
+    emit_store(b, REG_RSP, temp_offset(depth + 1 + i), REG_RAX);
+  }
+  use_temps(c, depth + 1 + argc);
+
+  emit_load(b, REG_RAX, REG_RSP, temp_offset(depth));
+  emit_runtime_apply(c, argc, depth + 1);
+  return true;
+}
+
+static bool compile_expression(jit_compiler_t *c, object_t *exp, int depth) {
+  switch (object_type(exp)) {
+    case SCHEME_NUMBER:
+    case SCHEME_STRING:
+    case SCHEME_NULL:
+    case SCHEME_DOUBLE: {
+      emit_mov_imm(&c->buf, REG_RAX, (uint64_t)(uintptr_t)exp);
+      return true;
+    }
+    case SCHEME_SYMBOL: {
+      return compile_variable(c, exp);
+    }
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      return false;
+    }
+    case SCHEME_CONS: {
+      break;
+    }
+  }
+
+  object_t *head = car(exp);
+  if (is_eq(head, lg_sym_quote)) {
+    if (list_length(exp) != 2) return false;
+    emit_mov_imm(&c->buf, REG_RAX, (uint64_t)(uintptr_t)cadr(exp));
+    return true;
+  }
+  if (is_eq(head, lg_sym_if)) return compile_if(c, exp, depth);
+  if (is_eq(head, lg_sym_begin)) return compile_sequence(c, cdr(exp), depth);
+  if (is_eq(head, lg_sym_and)) return compile_and_or(c, exp, depth, true);
+  if (is_eq(head, lg_sym_or)) return compile_and_or(c, exp, depth, false);
+  if (is_eq(head, lg_sym_cond)) return compile_cond(c, exp, depth);
+  if (is_eq(head, lg_sym_let) || is_eq(head, lg_sym_let_star) || is_eq(head, lg_sym_letrec) || is_eq(head, lg_sym_do)) {
+    compile_interpreted(c, exp);
+    return true;
+  }
+  if (is_eq(head, lg_sym_define) || is_eq(head, lg_sym_set) || is_eq(head, lg_sym_lambda)) return false;
+
+  return compile_application(c, exp, depth);
+}
+
+static bool compile_lambda(jit_compiler_t *c, lambda_entry_t *entry) {
+  jit_buffer_t *b = &c->buf;
+  int num_parameters = list_length(entry->parameters);
+  if (num_parameters < 0 || num_parameters > JIT_MAX_PARAMETERS) return false;
+  for (object_t *p = entry->parameters; p != g_scheme_null; p = cdr(p)) {
+    if (car(p)->type != SCHEME_SYMBOL) return false;
+  }
+  c->parameters = entry->parameters;
+
+  // push rbp; mov rbp, rsp; push rbx; push r12; sub rsp, frame
+  emit_u8(b, 0x55);
+  emit_mov_reg(b, REG_RBP, REG_RSP);
+  emit_u8(b, 0x53);
+  emit_u8(b, 0x41);
+  emit_u8(b, 0x54);
+  emit_u8(b, 0x48);
+  emit_u8(b, 0x81);
+  emit_u8(b, 0xec);
+  size_t frame_size_at = b->len;
+  emit_u32(b, 0);
+  emit_mov_reg(b, REG_RBX, REG_RDI);
+  emit_mov_reg(b, REG_R12, REG_RSI);
+
+  if (!compile_sequence(c, entry->body, 0)) return false;
+
+  // lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret
+  emit_lea(b, REG_RSP, REG_RBP, -16);
+  emit_u8(b, 0x41);
+  emit_u8(b, 0x5c);
+  emit_u8(b, 0x5b);
+  emit_u8(b, 0x5d);
+  emit_u8(b, 0xc3);
+
+  uint32_t frame_size = (uint32_t)((8 * c->max_temps + 15) & ~15);
+  memcpy(&b->bytes[frame_size_at], &frame_size, sizeof(frame_size));
+  return true;
+}
+
+// Code is written while the mapping is writable and then flipped to executable
+static void *install_code(jit_buffer_t *b) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (b->len + page_size - 1) & ~(page_size - 1);
+  void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) return NULL;
+
+  memcpy(code, b->bytes, b->len);
+  if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, size);
+    return NULL;
+  }
+
+  lg_jit_stats.code_bytes += b->len;
+  return code;
+}
+
+bool jit_compile(object_t *lambda) {
+  lambda_entry_t *entry = get_lambda_entry(lambda);
+  if (!lg_jit_available || g_jit_threshold == 0) return false;
+  if (entry->jit_state != JIT_STATE_INTERPRETED) return entry->jit_state == JIT_STATE_COMPILED;
+
+  jit_compiler_t compiler;
+  memset(&compiler, 0, sizeof(compiler));
+  void *code = NULL;
+  if (compile_lambda(&compiler, entry)) {
+    code = install_code(&compiler.buf);
+  }
+  free(compiler.buf.bytes);
+
+  if (code == NULL) {
+    entry->jit_state = JIT_STATE_REJECTED;
+    lg_jit_stats.rejected++;
+    return false;
+  }
+
+  entry->jit_code = code;
+  entry->jit_state = JIT_STATE_COMPILED;
+  lg_jit_stats.compiled++;
+  return true;
+}
+
+int jit_init(void) {
+  lg_sym_if = symbol("if");
+  lg_sym_quote = symbol("quote");
+  lg_sym_begin = symbol("begin");
+  lg_sym_define = symbol("define");
+  lg_sym_set = symbol("set!");
+  lg_sym_lambda = symbol("lambda");
+  lg_sym_let = symbol("let");
+  lg_sym_let_star = symbol("let*");
+  lg_sym_letrec = symbol("letrec");
+  lg_sym_do = symbol("do");
+  lg_sym_cond = symbol("cond");
+  lg_sym_else = symbol("else");
+  lg_sym_arrow = symbol("=>");
+  lg_sym_and = symbol("and");
+  lg_sym_or = symbol("or");
+  lg_sym_ok = symbol("ok");
+
+  // The fixnum templates assume the number sits in the low 61 bits and the type above it
+  object_t *probe = allocate_number(-5);
+  uint64_t word;
+  memcpy(&word, probe, sizeof(word));
+  lg_jit_available = SCHEME_NUMBER == 0 && (word >> 61) == 0 && ((int64_t)(word << 3) >> 3) == -5;
+
+  return 0;
+}
+
+#else
+
+bool jit_compile(object_t *lambda) {
+  get_lambda_entry(lambda)->jit_state = JIT_STATE_REJECTED;
+  lg_jit_stats.rejected++;
+  return false;
+}
+
+int jit_init(void) {
+  lg_jit_available = false;
+  return 0;
+}
+
+#endif
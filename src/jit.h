@@ -0,0 +1,55 @@
+#ifndef SCHEMIN_JIT_H
+#define SCHEMIN_JIT_H
+SCHEMIN_JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "scheme_types.h"
+#include "memory.h"
+
+/*
+ * Baseline template JIT. A lambda applied g_jit_threshold times has its body
+ * translated to x86-64 machine code, one template per special form, with
+ * calls back into the runtime for lookup, allocation and general application.
+ * Anything the templates do not cover leaves the lambda interpreted.
+ */
+
+#define JIT_DEFAULT_THRESHOLD 50
+#define JIT_MAX_PARAMETERS 16
+// Nested entries into compiled code before falling back to the interpreter,
+// whose tail calls do not grow the C stack
+#define JIT_MAX_NESTING 2048
+
+enum {
+  JIT_STATE_INTERPRETED = 0,
+  JIT_STATE_COMPILED,
+  JIT_STATE_REJECTED
+};
+
+typedef struct jit_stats_s {
+  uint64_t compiled;
+  uint64_t rejected;
+  size_t code_bytes;
+} jit_stats_t;
+
+extern uint32_t g_jit_threshold;
+extern uint32_t g_jit_nesting;
+
+int jit_init(void);
+void jit_set_threshold(uint32_t threshold);
+bool jit_compile(object_t *lambda);
+object_t *jit_invoke(lambda_entry_t *entry, object_t *vals, object_t *env);
+void jit_get_stats(jit_stats_t *outstats);
+void jit_write_report(FILE *out);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+
+static inline bool jit_can_enter(void) {
+  return g_jit_nesting < JIT_MAX_NESTING;
+}
+
+#pragma clang diagnostic pop
+
+#endif
@@ -0,0 +1,345 @@
+#include "memo.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "hash.h"
+#include "interpreter.h"
+#include "error.h"
+
+#define MEMO_INLINE_KEY_SIZE 256
+#define MEMO_CACHES_REALLOC_COUNT 16
+
+// Key encoding tags, each followed by the value's bytes
+typedef enum memo_tag_e {
+  MEMO_TAG_FIXNUM = 1,
+  MEMO_TAG_DOUBLE,
+  MEMO_TAG_SYMBOL,
+  MEMO_TAG_STRING,
+  MEMO_TAG_NULL,
+  // Followed by the item count and then the items
+  MEMO_TAG_LIST
+} memo_tag_t;
+
+typedef struct memo_entry_s {
+  uint64_t hash;
+  char *key;
+  size_t key_len;
+  object_t *value;
+  // The clock's second-chance bit, set on every hit
+  bool referenced;
+} memo_entry_t;
+
+typedef struct memo_cache_s {
+  object_t *func;
+  object_t *wrapper;
+  memo_entry_t *entries;
+  size_t capacity;
+  size_t count;
+  size_t hand;
+  // Keyed on the entries in use, and probed with a memo_probe_t
+  hash_t *index;
+  memo_stats_t stats;
+} memo_cache_t;
+
+// A key being looked up in a cache's index
+typedef struct memo_probe_s {
+  const char *key;
+  size_t len;
+} memo_probe_t;
+
+static memo_cache_t *lg_caches = NULL;
+static size_t lg_num_caches = 0;
+static size_t lg_caches_capacity = 0;
+static object_t *lg_call_primitive;
+static object_t *lg_sym_quote;
+
+// Returns the encoded size of an atom, or 0 if it cannot be part of a key
+static size_t atom_key_size(object_t *arg) {
+  switch (object_type(arg)) {
+    case SCHEME_NUMBER: return 1 + sizeof(int64_t);
+    case SCHEME_DOUBLE: return 1 + sizeof(double);
+    case SCHEME_SYMBOL: return 1 + sizeof(object_t*);
+    case SCHEME_STRING: return 1 + sizeof(size_t) + get_string_entry(arg)->len;
+    case SCHEME_NULL: return 1;
+    case SCHEME_CONS:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      break;
+    }
+  }
+  return 0;
+}
+
+static size_t arg_key_size(object_t *arg) {
+  if (arg->type != SCHEME_CONS) return atom_key_size(arg);
+
+  size_t size = 1 + sizeof(size_t);
+  object_t *rest = arg;
+  for (; rest->type == SCHEME_CONS; rest = cdr(rest)) {
+    size_t item_size = atom_key_size(car(rest));
+    if (item_size == 0) return 0;
+    size += item_size;
+  }
+  return rest == g_scheme_null ? size : 0;
+}
+
+static char *write_atom_key(char *at, object_t *arg) {
+  switch (object_type(arg)) {
+    case SCHEME_NUMBER: {
+      *at++ = MEMO_TAG_FIXNUM;
+      int64_t value = arg->number_or_index;
+      memcpy(at, &value, sizeof(value));
+      return at + sizeof(value);
+    }
+    case SCHEME_DOUBLE: {
+      *at++ = MEMO_TAG_DOUBLE;
+      double value = get_double(arg);
+      memcpy(at, &value, sizeof(value));
+      return at + sizeof(value);
+    }
+    case SCHEME_SYMBOL: {
+      // Symbols are interned, so the pointer is the identity
+      *at++ = MEMO_TAG_SYMBOL;
+      memcpy(at, &arg, sizeof(arg));
+      return at + sizeof(arg);
+    }
+    case SCHEME_STRING: {
+      *at++ = MEMO_TAG_STRING;
+      string_entry_t *entry = get_string_entry(arg);
+      memcpy(at, &entry->len, sizeof(entry->len));
+      memcpy(at + sizeof(entry->len), entry->str, entry->len);
+      return at + sizeof(entry->len) + entry->len;
+    }
+    case SCHEME_NULL: {
+      *at++ = MEMO_TAG_NULL;
+      return at;
+    }
+    case SCHEME_CONS:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      break;
+    }
+  }
+  error("Not a memoizable argument");
+}
+
+static char *write_arg_key(char *at, object_t *arg) {
+  if (arg->type != SCHEME_CONS) return write_atom_key(at, arg);
+
+  *at++ = MEMO_TAG_LIST;
+  size_t count = 0;
+  for (object_t *rest = arg; rest->type == SCHEME_CONS; rest = cdr(rest)) count++;
+  memcpy(at, &count, sizeof(count));
+  at += sizeof(count);
+  for (object_t *rest = arg; rest->type == SCHEME_CONS; rest = cdr(rest)) {
+    at = write_atom_key(at, car(rest));
+  }
+  return at;
+}
+
+static bool entry_key_equal(const void *stored, const void *key) {
+  const memo_entry_t *entry = (const memo_entry_t*)stored;
+  const memo_probe_t *probe = (const memo_probe_t*)key;
+  return entry->key_len == probe->len && memcmp(entry->key, probe->key, probe->len) == 0;
+}
+
+// The entry holding the key, or NULL
+static memo_entry_t *find_entry(memo_cache_t *cache, uint64_t hash, const char *key, size_t len) {
+  memo_probe_t probe = {key, len};
+  void **found = hash_find(cache->index, &probe, hash);
+  return found != NULL ? (memo_entry_t*)*found : NULL;
+}
+
+// Frees an entry for a new key, evicting the first one the clock finds unreferenced
+static memo_entry_t *take_entry(memo_cache_t *cache) {
+  if (cache->count < cache->capacity) return &cache->entries[cache->count++];
+
+  for (;;) {
+    memo_entry_t *entry = &cache->entries[cache->hand];
+    cache->hand = (cache->hand + 1) % cache->capacity;
+    if (entry->referenced) {
+      entry->referenced = false;
+      continue;
+    }
+
+    memo_probe_t probe = {entry->key, entry->key_len};
+    hash_remove(cache->index, &probe, entry->hash);
+    free(entry->key);
+    cache->stats.evictions++;
+    return entry;
+  }
+}
+
+static void store(memo_cache_t *cache, uint64_t hash, const char *key, size_t len, object_t *value) {
+  memo_entry_t *found = find_entry(cache, hash, key, len);
+  if (found != NULL) {
+    // A recursive call with the same arguments got there first
+    found->value = value;
+    return;
+  }
+
+  memo_entry_t *entry = take_entry(cache);
+  entry->hash = hash;
+  entry->key = (char*)malloc(len);
+  ASSERT_OR_ERROR(entry->key != NULL, "Could not allocate memo key");
+  memcpy(entry->key, key, len);
+  entry->key_len = len;
+  entry->value = value;
+  entry->referenced = false;
+  hash_put(cache->index, entry, hash, entry);
+}
+
+// (%memoized-call cache-id f arg ...), the body of every memoized wrapper
+static object_t *memoized_call_primitive(int argc, object_t *argv[]) {
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER && (size_t)argv[0]->number_or_index < lg_num_caches, "Not a memo cache");
+  size_t id = (size_t)argv[0]->number_or_index;
+  memo_cache_t *cache = &lg_caches[id];
+  object_t **args = &argv[2];
+  int num_args = argc - 2;
+
+  size_t len = 0;
+  for (int i = 0; i < num_args; i++) {
+    size_t size = arg_key_size(args[i]);
+    if (size == 0) {
+      cache->stats.bypassed++;
+      return apply(cache->func, num_args, args);
+    }
+    len += size;
+  }
+
+  char inline_key[MEMO_INLINE_KEY_SIZE];
+  char *key = len <= MEMO_INLINE_KEY_SIZE ? inline_key : (char*)malloc(len);
+  ASSERT_OR_ERROR(key != NULL, "Could not allocate memo key");
+  char *at = key;
+  for (int i = 0; i < num_args; i++) {
+    at = write_arg_key(at, args[i]);
+  }
+  assert((size_t)(at - key) == len);
+
+  uint64_t hash = hash_bytes(key, len);
+  memo_entry_t *entry = find_entry(cache, hash, key, len);
+  object_t *value;
+  if (entry != NULL) {
+    entry->referenced = true;
+    cache->stats.hits++;
+    value = entry->value;
+  } else {
+    cache->stats.misses++;
+    // The call may reenter this cache or make new ones, so nothing found above is kept across it
+    value = apply(cache->func, num_args, args);
+    store(&lg_caches[id], hash, key, len, value);
+  }
+
+  if (key != inline_key) free(key);
+  return value;
+}
+
+static object_t *quoted(object_t *datum) {
+  return cons(lg_sym_quote, cons(datum, g_scheme_null));
+}
+
+static object_t *memoize_primitive(int argc, object_t *argv[]) {
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_LAMBDA, "memoize expects a lambda");
+  int64_t capacity = MEMO_DEFAULT_CAPACITY;
+  if (argc > 1) {
+    ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER && argv[1]->number_or_index > 0, "memoize capacity must be positive");
+    capacity = argv[1]->number_or_index;
+    ASSERT_OR_ERROR(capacity <= UINT32_MAX / 2, "memoize capacity too large");
+  }
+
+  object_t *parameters = get_lambda_entry(argv[0])->parameters;
+  object_t *rest = parameters;
+  for (; rest->type == SCHEME_CONS; rest = cdr(rest)) {
+    ASSERT_OR_ERROR(car(rest)->type == SCHEME_SYMBOL, "memoize expects symbol parameters");
+  }
+  ASSERT_OR_ERROR(rest == g_scheme_null, "memoize expects a fixed parameter list");
+
+  if (lg_num_caches == lg_caches_capacity) {
+    lg_caches_capacity += MEMO_CACHES_REALLOC_COUNT;
+    lg_caches = (memo_cache_t*)realloc(lg_caches, lg_caches_capacity * sizeof(memo_cache_t));
+    ASSERT_OR_ERROR(lg_caches != NULL, "Could not grow memo caches");
+  }
+  size_t id = lg_num_caches++;
+  memo_cache_t *cache = &lg_caches[id];
+  memset(cache, 0, sizeof(*cache));
+  cache->func = argv[0];
+  cache->capacity = (size_t)capacity;
+  cache->entries = (memo_entry_t*)calloc(cache->capacity, sizeof(memo_entry_t));
+  ASSERT_OR_ERROR(cache->entries != NULL, "Could not allocate memo cache");
+  // Sized for a full cache
+  cache->index = make_hash_with_equal(cache->capacity, entry_key_equal);
+
+  // (lambda (param ...) ('%memoized-call id 'f param ...))
+  object_t *call = cons(quoted(lg_call_primitive), cons(allocate_number((int64_t)id), cons(quoted(argv[0]), parameters)));
+  cache->wrapper = lambda(parameters, cons(call, g_scheme_null));
+  return cache->wrapper;
+}
+
+static memo_cache_t *find_cache(object_t *wrapper) {
+  for (size_t i = 0; i < lg_num_caches; i++) {
+    if (lg_caches[i].wrapper == wrapper) return &lg_caches[i];
+  }
+  return NULL;
+}
+
+static object_t *stat_pair(const char *name, uint64_t value) {
+  return cons(symbol(name), allocate_number((int64_t)value));
+}
+
+// ((hits . n) (misses . n) (evictions . n) (bypassed . n) (size . n))
+static object_t *memoize_stats_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  memo_cache_t *cache = find_cache(argv[0]);
+  ASSERT_OR_ERROR(cache != NULL, "Not a memoized procedure");
+  object_t *stats = cons(stat_pair("size", cache->count), g_scheme_null);
+  stats = cons(stat_pair("bypassed", cache->stats.bypassed), stats);
+  stats = cons(stat_pair("evictions", cache->stats.evictions), stats);
+  stats = cons(stat_pair("misses", cache->stats.misses), stats);
+  return cons(stat_pair("hits", cache->stats.hits), stats);
+}
+
+static const primitive_mapping_t primitives[] = {
+  {"%memoized-call", memoized_call_primitive, 2, PRIMITIVE_VARIADIC, 0},
+  {"memoize", memoize_primitive, 1, 2, 0},
+  {"memoize-stats", memoize_stats_primitive, 1, 1, 0}
+};
+
+int memo_init(void) {
+  lg_sym_quote = symbol("quote");
+  install_primitives(primitives, sizeof(primitives) / sizeof(primitive_mapping_t));
+  lg_call_primitive = lookup_global(symbol("%memoized-call"));
+  return 0;
+}
+
+void memo_get_stats(memo_stats_t *outstats) {
+  memset(outstats, 0, sizeof(*outstats));
+  for (size_t i = 0; i < lg_num_caches; i++) {
+    outstats->hits += lg_caches[i].stats.hits;
+    outstats->misses += lg_caches[i].stats.misses;
+    outstats->evictions += lg_caches[i].stats.evictions;
+    outstats->bypassed += lg_caches[i].stats.bypassed;
+  }
+}
+
+void memo_write_report(FILE *out) {
+  memo_stats_t stats;
+  memo_get_stats(&stats);
+  fprintf(out, "memoization\n");
+  fprintf(out, "  %-16s %12llu\n", "caches", (unsigned long long)lg_num_caches);
+  fprintf(out, "  %-16s %12llu\n", "hits", (unsigned long long)stats.hits);
+  fprintf(out, "  %-16s %12llu\n", "misses", (unsigned long long)stats.misses);
+  fprintf(out, "  %-16s %12llu\n", "evictions", (unsigned long long)stats.evictions);
+  fprintf(out, "  %-16s %12llu\n", "bypassed", (unsigned long long)stats.bypassed);
+}
@@ -0,0 +1,37 @@
+#ifndef SCHEMIN_MEMO_H
+#define SCHEMIN_MEMO_H
+SCHEMIN_MEMO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "scheme_types.h"
+
+/*
+ * Native memoization. (memoize f [capacity]) returns a lambda with f's
+ * parameters that looks its arguments up in a cache of its own before calling
+ * f, and (define-memoized (name param ...) body ...) defines name that way.
+ * Arguments are keyed by value: fixnums, doubles, symbols, strings and lists
+ * of those, encoded into a flat byte key, so later mutation of an argument
+ * does not disturb the cache. Calls with any other argument go straight to f.
+ *
+ * Each cache holds at most capacity results and evicts with the clock
+ * algorithm. f is applied in the global environment and should be pure; a
+ * cached result is returned as the same object every time.
+ */
+
+#define MEMO_DEFAULT_CAPACITY 4096
+
+typedef struct memo_stats_s {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  // Calls whose arguments could not be used as a key
+  uint64_t bypassed;
+} memo_stats_t;
+
+int memo_init(void);
+// Totals over every cache
+void memo_get_stats(memo_stats_t *outstats);
+void memo_write_report(FILE *out);
+
+#endif
@@ -1,7 +1,7 @@
 #include "memory.h"
 #include "allocator.h"
-#include "error.h"
 #include "hash.h"
+#include "error.h"
 
 typedef struct did_install_primitive_hooks_s did_install_primitive_hooks_t;
 struct did_install_primitive_hooks_s {
@@ -15,40 +15,113 @@ object_t *g_true;
 
 static did_install_primitive_hooks_t *lg_did_install_primitive_hooks = NULL;
 
+// A name being looked up in the symbol table, which is keyed on the symbols themselves
+typedef struct symbol_probe_s {
+  const char *text;
+  size_t len;
+} symbol_probe_t;
+
 static hash_t *lg_symbol_table;
 
-static allocator_t *lg_object_allocator;
+static extended_object_t lg_scheme_null;
+
+static allocator_t *lg_the_numbers;
 static byte_allocator_t *lg_byte_allocator;
 static allocator_t *lg_the_conses;
+static byte_allocator_t *lg_the_compact_lists;
+static uint64_t lg_num_compact_cells = 0;
+// Shared by ordinary conses and compact cells so cons_index() is unique
+static uint64_t lg_next_cons_index = 0;
 static allocator_t *lg_the_strings;
 static allocator_t *lg_the_symbols;
 static allocator_t *lg_the_lambdas;
 static allocator_t *lg_the_primitives;
 static allocator_t *lg_the_doubles;
+static allocator_t *lg_the_hash_tables;
+static allocator_t *lg_the_record_types;
+static allocator_t *lg_the_record_procedures;
+// Records vary in size with their type, so they are carved from pages like compact lists
+static byte_allocator_t *lg_the_records;
+static uint64_t lg_num_records = 0;
+
+typedef struct frame_chunk_s frame_chunk_t;
+struct frame_chunk_s {
+  frame_chunk_t *prev;
+  frame_chunk_t *next;
+  cons_object_t *limit;
+  cons_object_t cells[];
+};
 
-#define OBJECT_PAGE_SIZE (1 << 20)
+// Chunks are kept once allocated and reused as the region grows again
+static frame_chunk_t *lg_frame_chunk;
+static cons_object_t *lg_frame_limit;
+cons_object_t *g_frame_region_base;
+cons_object_t *g_frame_region_top;
+
+#define NUMBER_PAGE_SIZE (1 << 20)
 #define BYTES_PAGE_SIZE (1 << 21)
 #define STRINGS_PAGE_SIZE (1 << 14)
 #define SYMBOLS_PAGE_SIZE (1 << 14)
-#define CONS_PAGE_SIZE (1 << 20)
+#define CONS_PAGE_SIZE (3 << 20)
+#define COMPACT_LIST_PAGE_SIZE (1 << 20)
 #define LAMBDA_PAGE_SIZE (1 << 14)
 #define PRIMITIVE_PAGE_SIZE (1 << 14)
 #define DOUBLE_PAGE_SIZE (1 << 14)
+#define HASH_TABLE_PAGE_SIZE (1 << 14)
+#define RECORD_TYPE_PAGE_SIZE (1 << 14)
+#define RECORD_PROCEDURE_PAGE_SIZE (1 << 14)
+#define RECORD_PAGE_SIZE (1 << 20)
+#define FRAME_CHUNK_SIZE (1 << 20)
+#define ROPE_STACK_INLINE_COUNT 64
+#define SYMBOL_TABLE_CAPACITY_HINT (1 << 13)
+
+static frame_chunk_t *make_frame_chunk(frame_chunk_t *prev) {
+  frame_chunk_t *chunk = (frame_chunk_t*)malloc(FRAME_CHUNK_SIZE);
+  ASSERT_OR_ERROR(chunk != NULL, "Could not allocate frame region");
+  chunk->prev = prev;
+  chunk->next = NULL;
+  chunk->limit = chunk->cells + (FRAME_CHUNK_SIZE - sizeof(frame_chunk_t)) / sizeof(cons_object_t);
+  return chunk;
+}
+
+static void enter_frame_chunk(frame_chunk_t *chunk, cons_object_t *top) {
+  lg_frame_chunk = chunk;
+  lg_frame_limit = chunk->limit;
+  g_frame_region_base = chunk->cells;
+  g_frame_region_top = top;
+}
+
+static bool symbol_name_equal(const void *stored, const void *key) {
+  symbol_entry_t *entry = get_symbol_entry((object_t*)stored);
+  const symbol_probe_t *probe = (const symbol_probe_t*)key;
+  return entry->len == probe->len && memcmp(entry->sym, probe->text, probe->len) == 0;
+}
 
 int memory_init() {
-  g_scheme_null = (object_t*)malloc(sizeof(object_t));
-  g_scheme_null->type = SCHEME_NULL;
+  lg_scheme_null.header.type = SCHEME_EXTENDED;
+  lg_scheme_null.header.number_or_index = 0;
+  lg_scheme_null.type = SCHEME_NULL;
+  lg_scheme_null.flags = 0;
+  g_scheme_null = &lg_scheme_null.header;
 
-  lg_object_allocator = make_allocator(sizeof(object_t), OBJECT_PAGE_SIZE);
+  lg_the_numbers = make_allocator(sizeof(object_t), NUMBER_PAGE_SIZE);
   lg_byte_allocator = make_byte_allocator(BYTES_PAGE_SIZE);
-  lg_the_conses = make_allocator(sizeof(cons_entry_t), CONS_PAGE_SIZE);
-  lg_the_strings = make_allocator(sizeof(string_entry_t), STRINGS_PAGE_SIZE);
-  lg_the_symbols = make_allocator(sizeof(symbol_entry_t), SYMBOLS_PAGE_SIZE);
-  lg_the_lambdas = make_allocator(sizeof(lambda_entry_t), LAMBDA_PAGE_SIZE);
-  lg_the_primitives = make_allocator(sizeof(primitive_entry_t), PRIMITIVE_PAGE_SIZE);
-  lg_the_doubles = make_allocator(sizeof(double), DOUBLE_PAGE_SIZE);
-
-  lg_symbol_table = make_hash(1<<14);
+  lg_the_conses = make_allocator(sizeof(cons_object_t), CONS_PAGE_SIZE);
+  lg_the_compact_lists = make_byte_allocator(COMPACT_LIST_PAGE_SIZE);
+  lg_the_strings = make_allocator(sizeof(string_object_t), STRINGS_PAGE_SIZE);
+  lg_the_symbols = make_allocator(sizeof(symbol_object_t), SYMBOLS_PAGE_SIZE);
+  lg_the_lambdas = make_allocator(sizeof(lambda_object_t), LAMBDA_PAGE_SIZE);
+  lg_the_primitives = make_allocator(sizeof(primitive_object_t), PRIMITIVE_PAGE_SIZE);
+  lg_the_doubles = make_allocator(sizeof(double_object_t), DOUBLE_PAGE_SIZE);
+  lg_the_hash_tables = make_allocator(sizeof(hash_table_object_t), HASH_TABLE_PAGE_SIZE);
+  lg_the_record_types = make_allocator(sizeof(record_type_object_t), RECORD_TYPE_PAGE_SIZE);
+  lg_the_record_procedures = make_allocator(sizeof(record_procedure_object_t), RECORD_PROCEDURE_PAGE_SIZE);
+  lg_the_records = make_byte_allocator(RECORD_PAGE_SIZE);
+
+  frame_chunk_t *chunk = make_frame_chunk(NULL);
+  enter_frame_chunk(chunk, chunk->cells);
+
+  lg_symbol_table = make_hash_with_equal(SYMBOL_TABLE_CAPACITY_HINT, symbol_name_equal);
 
   g_false = symbol("#f");
   g_true = symbol("#t");
@@ -63,92 +136,197 @@ void add_did_install_primitive_hook(did_install_primitive_func hook) {
   lg_did_install_primitive_hooks = entry;
 }
 
-static inline object_t *allocate_object() {
-  object_t *object = (object_t*)allocator_allocate(lg_object_allocator, NULL);
+void memory_get_stats(memory_stats_t *outstats) {
+  outstats->objects = allocator_total_elements(lg_the_numbers)
+    + allocator_total_elements(lg_the_conses)
+    + lg_num_compact_cells
+    + allocator_total_elements(lg_the_strings)
+    + allocator_total_elements(lg_the_symbols)
+    + allocator_total_elements(lg_the_lambdas)
+    + allocator_total_elements(lg_the_primitives)
+    + allocator_total_elements(lg_the_doubles)
+    + allocator_total_elements(lg_the_hash_tables)
+    + allocator_total_elements(lg_the_record_types)
+    + allocator_total_elements(lg_the_record_procedures)
+    + lg_num_records;
+  outstats->conses = allocator_total_elements(lg_the_conses) + lg_num_compact_cells;
+  outstats->strings = allocator_total_elements(lg_the_strings);
+  outstats->symbols = allocator_total_elements(lg_the_symbols);
+  outstats->lambdas = allocator_total_elements(lg_the_lambdas);
+  outstats->primitives = allocator_total_elements(lg_the_primitives);
+  outstats->doubles = allocator_total_elements(lg_the_doubles);
+  outstats->bytes = byte_allocator_total_bytes(lg_byte_allocator);
+}
+
+// Allocates a record from pool and fills in its header with the record's index
+static inline void *allocate_record(allocator_t *pool, type_t type) {
+  uint64_t idx;
+  object_t *object = (object_t*)allocator_allocate(pool, &idx);
   ASSERT_OR_ERROR(object != NULL, "Could not allocate object");
+  ASSERT_OR_ERROR(idx <= SCHEME_INT_MAX, "index too big");
+  object->type = type;
+  object->number_or_index = (int64_t)idx;
 
   return object;
 }
 
 object_t *allocate_string(size_t len, string_entry_t **outentry) {
-  object_t *object = allocate_object();
-  object->type = SCHEME_STRING;
-  char *newstr = (char*)byte_allocator_allocate(lg_byte_allocator, len + 1);
-  uint64_t idx;
-  string_entry_t *entry = allocator_allocate(lg_the_strings, &idx);
-  entry->len = len;
-  entry->str = newstr;
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
+  string_object_t *record = allocate_record(lg_the_strings, SCHEME_STRING);
+  record->entry.len = len;
+  record->entry.str = (char*)byte_allocator_allocate(lg_byte_allocator, len + 1);
+  record->entry.chars = STRING_CHARS_UNKNOWN;
+  record->entry.index = NULL;
 
-  if (outentry != NULL) *outentry = entry;
+  if (outentry != NULL) *outentry = &record->entry;
 
-  return object;
+  return &record->header;
+}
+
+object_t *allocate_string_rope(object_t *left, object_t *right) {
+  string_entry_t *x = peek_string_entry(left);
+  string_entry_t *y = peek_string_entry(right);
+  ASSERT_OR_ERROR(x->chars != STRING_CHARS_UNKNOWN && y->chars != STRING_CHARS_UNKNOWN, "Rope of uncounted strings");
+  string_object_t *record = allocate_record(lg_the_strings, SCHEME_STRING);
+  record->entry.str = NULL;
+  record->entry.len = x->len + y->len;
+  record->entry.chars = x->chars + y->chars;
+  record->entry.rope.left = left;
+  record->entry.rope.right = right;
+
+  return &record->header;
+}
+
+object_t *allocate_string_slice(string_entry_t *base, size_t start, size_t len, size_t chars) {
+  ASSERT_OR_ERROR(base->str != NULL && start + len <= base->len, "Bad string slice");
+  string_object_t *record = allocate_record(lg_the_strings, SCHEME_STRING);
+  record->entry.str = &base->str[start];
+  record->entry.len = len;
+  record->entry.chars = chars;
+  record->entry.index = NULL;
+
+  return &record->header;
+}
+
+// Ropes built by repeated appends are deep on the left, so the walk keeps its own stack
+void copy_string_bytes(object_t *str, char *out) {
+  object_t *inline_stack[ROPE_STACK_INLINE_COUNT];
+  object_t **stack = inline_stack;
+  size_t capacity = ROPE_STACK_INLINE_COUNT;
+  size_t depth = 0;
+
+  stack[depth++] = str;
+  while (depth > 0) {
+    string_entry_t *entry = peek_string_entry(stack[--depth]);
+    if (entry->str != NULL) {
+      memcpy(out, entry->str, entry->len);
+      out += entry->len;
+      continue;
+    }
+    if (depth + 2 > capacity) {
+      capacity *= 2;
+      object_t **grown = (object_t**)malloc(capacity * sizeof(object_t*));
+      ASSERT_OR_ERROR(grown != NULL, "Could not allocate rope stack");
+      memcpy(grown, stack, depth * sizeof(object_t*));
+      if (stack != inline_stack) free(stack);
+      stack = grown;
+    }
+    stack[depth++] = entry->rope.right;
+    stack[depth++] = entry->rope.left;
+  }
+
+  if (stack != inline_stack) free(stack);
+}
+
+void flatten_string(object_t *str) {
+  string_entry_t *entry = peek_string_entry(str);
+  char *bytes = (char*)byte_allocator_allocate(lg_byte_allocator, entry->len + 1);
+  copy_string_bytes(str, bytes);
+  bytes[entry->len] = '\0';
+  entry->str = bytes;
+  entry->index = NULL;
 }
 
 object_t *allocate_symbol(size_t len, symbol_entry_t **outentry) {
-  object_t *object = allocate_object();
-  object->type = SCHEME_SYMBOL;
-  char *newstr = (char*)byte_allocator_allocate(lg_byte_allocator, len + 1);
-  uint64_t idx;
-  symbol_entry_t *entry = allocator_allocate(lg_the_symbols, &idx);
-  entry->len = len;
-  entry->sym = newstr;
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
+  symbol_object_t *record = allocate_record(lg_the_symbols, SCHEME_SYMBOL);
+  record->entry.len = len;
+  record->entry.sym = (char*)byte_allocator_allocate(lg_byte_allocator, len + 1);
+  record->entry.flags = 0;
+  record->entry.binding_version = 0;
+  record->entry.hash = 0;
 
-  if (outentry != NULL) *outentry = entry;
+  if (outentry != NULL) *outentry = &record->entry;
 
-  return object;
+  return &record->header;
+}
+
+static inline void set_cons_header(object_t *header, uint64_t cdr_code) {
+  ASSERT_OR_ERROR(lg_next_cons_index <= (SCHEME_INT_MAX >> CONS_CDR_BITS), "index too big");
+  header->type = SCHEME_CONS;
+  header->number_or_index = (int64_t)((lg_next_cons_index++ << CONS_CDR_BITS) | cdr_code);
 }
 
 object_t *allocate_cons(cons_entry_t **outentry) {
-  object_t *object = allocate_object();
-  object->type = SCHEME_CONS;
-  uint64_t idx;
-  cons_entry_t *entry = (cons_entry_t*)allocator_allocate(lg_the_conses, &idx);
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
+  cons_object_t *record = (cons_object_t*)allocator_allocate(lg_the_conses, NULL);
+  ASSERT_OR_ERROR(record != NULL, "Could not allocate object");
+  set_cons_header(&record->header, CONS_CDR_POINTER);
 
-  if (outentry != NULL) *outentry = entry;
+  if (outentry != NULL) *outentry = &record->entry;
 
-  return object;
+  return &record->header;
+}
+
+object_t *allocate_compact_list(object_t **items, size_t count) {
+  if (count == 0) return g_scheme_null;
+
+  // Runs are multiples of the cell size, so every cell stays aligned
+  compact_cell_t *cells = (compact_cell_t*)byte_allocator_allocate(lg_the_compact_lists, count * sizeof(compact_cell_t));
+  for (size_t i = 0; i < count; i++) {
+    set_cons_header(&cells[i].header, i + 1 < count ? CONS_CDR_NEXT : CONS_CDR_NIL);
+    cells[i].car = items[i];
+  }
+  lg_num_compact_cells += count;
+
+  return &cells[0].header;
+}
+
+cons_entry_t *forward_compact_cell(object_t *cell) {
+  compact_cell_t *compact = (compact_cell_t*)cell;
+  if (cons_cdr_code(cell) != CONS_CDR_FORWARD) {
+    object_t *full = cons(compact->car, cdr(cell));
+    compact->car = full;
+    cell->number_or_index = (int64_t)(((uint64_t)cell->number_or_index & ~(uint64_t)CONS_CDR_MASK) | CONS_CDR_FORWARD);
+  }
+  return &((cons_object_t*)compact->car)->entry;
 }
 
 object_t *allocate_lambda(lambda_entry_t **outentry) {
-  object_t *object = allocate_object();
-  object->type = SCHEME_LAMBDA;
-  uint64_t idx;
-  lambda_entry_t *entry = (lambda_entry_t*)allocator_allocate(lg_the_lambdas, &idx);
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
+  lambda_object_t *record = allocate_record(lg_the_lambdas, SCHEME_LAMBDA);
 
-  if (outentry != NULL) *outentry = entry;
+  if (outentry != NULL) *outentry = &record->entry;
 
-  return object;  
+  return &record->header;
 }
 
 object_t *allocate_primitive(const char *name, primitive_func func, primitive_entry_t **outentry) {
-  object_t *object = allocate_object();
-  object->type = SCHEME_PRIMITIVE;
-  uint64_t idx;
-  primitive_entry_t *entry = (primitive_entry_t*)allocator_allocate(lg_the_primitives, &idx);
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
-  entry->name = name;
-  entry->func = func;
-  if (outentry != NULL) *outentry = entry;
+  primitive_object_t *record = allocate_record(lg_the_primitives, SCHEME_PRIMITIVE);
+  record->entry.name = name;
+  record->entry.func = func;
+  record->entry.flags = 0;
+  record->entry.min_args = 0;
+  record->entry.max_args = PRIMITIVE_VARIADIC;
+  if (outentry != NULL) *outentry = &record->entry;
 
   for (did_install_primitive_hooks_t *hooks = lg_did_install_primitive_hooks; hooks != NULL; hooks = hooks->next) {
-    hooks->hook(object, entry);
+    hooks->hook(&record->header, &record->entry);
   }
 
-  return object;
+  return &record->header;
 }
 
 object_t *allocate_number(int64_t number) {
   ASSERT_OR_ERROR(number <= SCHEME_INT_MAX, "number too big");
-  object_t *object = allocate_object();
+  object_t *object = (object_t*)allocator_allocate(lg_the_numbers, NULL);
+  ASSERT_OR_ERROR(object != NULL, "Could not allocate object");
   object->type = SCHEME_NUMBER;
   object->number_or_index = number;
 
@@ -156,43 +334,65 @@ object_t *allocate_number(int64_t number) {
 }
 
 object_t *allocate_double(double number) {
-  object_t *object = allocate_object();
-  uint64_t idx;
-  double *addr = allocator_allocate(lg_the_doubles, &idx);
-  *addr = number;
-  object->type = SCHEME_DOUBLE;
-  ASSERT_OR_ERROR(idx <= INT64_MAX, "index too big");
-  object->number_or_index = (int64_t)idx;
-  return object;
+  double_object_t *record = allocate_record(lg_the_doubles, SCHEME_DOUBLE);
+  record->value = number;
+  return &record->header;
 }
 
-cons_entry_t *get_cons_entry(object_t *cons) {
-  ASSERT_OR_ERROR(cons->type == SCHEME_CONS, "Not a pair");
-  return allocator_get_item_at_index(lg_the_conses, (uint64_t)(cons->number_or_index));
-}
+object_t *allocate_hash_table(hash_table_entry_t **outentry) {
+  hash_table_object_t *record = allocate_record(lg_the_hash_tables, SCHEME_EXTENDED);
+  record->header.type = SCHEME_HASH_TABLE;
+  record->header.flags = 0;
+  record->entry.table = NULL;
+  record->entry.kind = 0;
+  record->entry.iterating = 0;
+  if (outentry != NULL) *outentry = &record->entry;
 
-string_entry_t *get_string_entry(object_t *str) {
-  ASSERT_OR_ERROR(str->type == SCHEME_STRING, "Not a string");
-  return allocator_get_item_at_index(lg_the_strings, (uint64_t)(str->number_or_index));
+  return &record->header.header;
 }
 
-symbol_entry_t *get_symbol_entry(object_t *sym) {
-  ASSERT_OR_ERROR(sym->type == SCHEME_SYMBOL, "Not a symbol");
-  return allocator_get_item_at_index(lg_the_symbols, (uint64_t)(sym->number_or_index));
-}
+object_t *allocate_record_type(record_type_entry_t **outentry) {
+  record_type_object_t *record = allocate_record(lg_the_record_types, SCHEME_EXTENDED);
+  record->header.type = SCHEME_RECORD_TYPE;
+  record->header.flags = 0;
+  record->entry.name = NULL;
+  record->entry.fields = g_scheme_null;
+  record->entry.num_fields = 0;
+  if (outentry != NULL) *outentry = &record->entry;
 
-lambda_entry_t *get_lambda_entry(object_t *lambda) {
-  ASSERT_OR_ERROR(lambda->type == SCHEME_LAMBDA, "Not a lambda");
-  return allocator_get_item_at_index(lg_the_lambdas, (uint64_t)(lambda->number_or_index));
+  return &record->header.header;
 }
 
-primitive_entry_t *get_primitive_entry(object_t *primitive) {
-  ASSERT_OR_ERROR(primitive->type == SCHEME_PRIMITIVE, "Not a primitive");
-  return allocator_get_item_at_index(lg_the_primitives, (uint64_t)(primitive->number_or_index));
+object_t *allocate_record_instance(object_t *type, object_t *value) {
+  record_type_entry_t *type_entry = get_record_type_entry(type);
+  ASSERT_OR_ERROR(lg_num_records <= SCHEME_INT_MAX, "index too big");
+  // The header and slots are all pointer-sized, so every record stays aligned
+  size_t size = sizeof(record_object_t) + type_entry->num_fields * sizeof(object_t*);
+  record_object_t *record = (record_object_t*)byte_allocator_allocate(lg_the_records, size);
+  ASSERT_OR_ERROR(record != NULL, "Could not allocate object");
+  record->header.header.type = SCHEME_EXTENDED;
+  record->header.header.number_or_index = (int64_t)lg_num_records++;
+  record->header.type = SCHEME_RECORD;
+  record->header.flags = 0;
+  record->type = type;
+  for (uint32_t i = 0; i < type_entry->num_fields; i++) {
+    record->slots[i] = value;
+  }
+
+  return &record->header.header;
 }
 
-double get_double(object_t *doub) {
-  return *(double*)allocator_get_item_at_index(lg_the_doubles, (uint64_t)(doub->number_or_index));
+object_t *allocate_record_procedure(record_procedure_entry_t **outentry) {
+  record_procedure_object_t *record = allocate_record(lg_the_record_procedures, SCHEME_EXTENDED);
+  record->header.type = SCHEME_RECORD_PROCEDURE;
+  record->header.flags = 0;
+  record->entry.type = NULL;
+  record->entry.kind = 0;
+  record->entry.slot = 0;
+  record->entry.arg_slots = NULL;
+  if (outentry != NULL) *outentry = &record->entry;
+
+  return &record->header.header;
 }
 
 object_t *cons(object_t *car, object_t *cdr) {
@@ -203,33 +403,88 @@ object_t *cons(object_t *car, object_t *cdr) {
   return object;
 }
 
+object_t *frame_cons(object_t *car, object_t *cdr) {
+  if (__builtin_expect(g_frame_region_top == lg_frame_limit, 0)) {
+    frame_chunk_t *next = lg_frame_chunk->next;
+    if (next == NULL) {
+      next = make_frame_chunk(lg_frame_chunk);
+      lg_frame_chunk->next = next;
+    }
+    enter_frame_chunk(next, next->cells);
+  }
+
+  cons_object_t *record = g_frame_region_top++;
+  set_cons_header(&record->header, CONS_CDR_POINTER);
+  record->entry.car = car;
+  record->entry.cdr = cdr;
+  return &record->header;
+}
+
+// The mark lies in an earlier chunk than the current one
+void frame_region_unwind(cons_object_t *mark) {
+  frame_chunk_t *chunk = lg_frame_chunk->prev;
+  while (chunk != NULL && !(mark >= chunk->cells && mark <= chunk->limit)) chunk = chunk->prev;
+  ASSERT_OR_ERROR(chunk != NULL, "Frame region mark not found");
+  enter_frame_chunk(chunk, mark);
+}
+
 object_t *symbol(const char *text) {
   size_t n = strlen(text);
   return symboln(text, n);
 }
 
 object_t *symboln(const char *text, size_t len) {
-  object_t *sym = (object_t*)hash_get(lg_symbol_table, text, len);
-  if (sym != NULL) {
-    return sym;
-  }
+  return symboln_hashed(text, len, hash_bytes(text, len));
+}
+
+object_t *symboln_hashed(const char *text, size_t len, uint64_t hash) {
+  symbol_probe_t probe = {text, len};
+  void **found = hash_find(lg_symbol_table, &probe, hash);
+  if (found != NULL) return (object_t*)*found;
 
   symbol_entry_t *entry;
-  sym = allocate_symbol(len, &entry);
-  entry->len = len;
+  object_t *sym = allocate_symbol(len, &entry);
   memcpy(entry->sym, text, len);
   entry->sym[len] = '\0';
+  entry->hash = hash;
 
-  hash_set(lg_symbol_table, text, len, sym);
+  hash_put(lg_symbol_table, sym, hash, sym);
 
   return sym;
 }
 
+/*
+ * A fresh symbol with the same name as base that is never entered in the
+ * symbol table, so it is distinct from every symbol the reader can produce.
+ */
+object_t *gensym(object_t *base) {
+  symbol_entry_t *base_entry = get_symbol_entry(base);
+  symbol_entry_t *entry;
+  object_t *sym = allocate_symbol(base_entry->len, &entry);
+  memcpy(entry->sym, base_entry->sym, base_entry->len);
+  entry->sym[base_entry->len] = '\0';
+  entry->hash = base_entry->hash;
+
+  return sym;
+}
+
+void note_local_binding(object_t *sym) {
+  symbol_entry_t *entry = get_symbol_entry(sym);
+  if ((entry->flags & SYMBOL_LOCALLY_BOUND) == 0) {
+    entry->flags |= SYMBOL_LOCALLY_BOUND;
+    entry->binding_version++;
+  }
+}
+
 object_t *lambda(object_t *parameters, object_t *body) {
   lambda_entry_t *entry;
   object_t *lambda = allocate_lambda(&entry);
   entry->parameters = parameters;
   entry->body = body;
+  entry->name = NULL;
+  entry->calls = 0;
+  entry->jit_state = 0;
+  entry->jit_code = NULL;
 
   return lambda;
 }
@@ -6,19 +6,54 @@ SCHEMIN_MEMORY_H
 #include "scheme_types.h"
 #include <stdbool.h>
 #include "primitives.h"
+#include "error.h"
 
 extern object_t *g_scheme_null;
 extern object_t *g_false;
 extern object_t *g_true;
 
+// string_entry_t.chars before the characters have been counted
+#define STRING_CHARS_UNKNOWN SIZE_MAX
+
+/*
+ * A string is flat, with its bytes at str, or a rope: the concatenation of two
+ * other strings, with str NULL until something needs the bytes and flattens it.
+ * get_string_entry always returns a flat string. str is not NUL-terminated for
+ * a slice, which shares the bytes of the string it was cut from.
+ */
 typedef struct string_entry_s {
   char *str;
+  // In bytes
   size_t len;
+  // In UTF-8 characters; equal to len for a pure-ASCII string, and always known for a rope
+  size_t chars;
+  union {
+    // Built on the first indexed access to a flat string that is not pure ASCII
+    struct string_index_s *index;
+    struct {
+      object_t *left;
+      object_t *right;
+    } rope;
+  };
 } string_entry_t;
 
+// Set once the symbol has been bound anywhere other than the global frame
+#define SYMBOL_LOCALLY_BOUND (1 << 0)
+// Set while the symbol names a syntax-rules macro
+#define SYMBOL_MACRO (1 << 1)
+// Set on the fresh symbols a macro expansion introduces in place of template identifiers
+#define SYMBOL_RENAMED (1 << 2)
+// Set once the symbol has a binding in the global frame
+#define SYMBOL_GLOBALLY_BOUND (1 << 3)
+
 typedef struct symbol_entry_s {
   char *sym;
   size_t len;
+  uint32_t flags;
+  // Bumped whenever a binding of this symbol is created or assigned
+  uint32_t binding_version;
+  // hash_bytes of the name, kept so the symbol table never rehashes it
+  uint64_t hash;
 } symbol_entry_t;
 
 typedef struct cons_entry_s {
@@ -29,58 +64,310 @@ typedef struct cons_entry_s {
 typedef struct lambda_entry_s {
   object_t *parameters;
   object_t *body;
+  object_t *name;
+  uint32_t calls;
+  uint32_t jit_state;
+  void *jit_code;
 } lambda_entry_t;
 
 typedef struct primitive_entry_s {
   const char *name;
   primitive_func func;
+  uint32_t flags;
+  // Checked by callers, so primitive bodies can assume argc is in range
+  int16_t min_args;
+  int16_t max_args;
 } primitive_entry_t;
 
+/*
+ * Each object is a single record: the header, then for extended types the
+ * extended header, then the payload. Nothing but memory.h should depend on
+ * these layouts.
+ */
+typedef struct extended_object_s {
+  object_t header;
+  // One of the types after SCHEME_EXTENDED
+  uint32_t type;
+  uint32_t flags;
+} extended_object_t;
+
+typedef struct cons_object_s {
+  object_t header;
+  cons_entry_t entry;
+} cons_object_t;
+
+/*
+ * Lists from the reader are cdr-coded: a run of cells holding only a car,
+ * laid out one after another. The low bits of a pair's index field say where
+ * its cdr is. Taking a compact cell's cons_entry_t for writing replaces it
+ * with a forward to an ordinary cons, which keeps the cell's identity.
+ */
+#define CONS_CDR_BITS 2
+#define CONS_CDR_MASK ((1 << CONS_CDR_BITS) - 1)
+// An ordinary cons: the cdr follows the car
+#define CONS_CDR_POINTER 0
+// The cdr is the cell right after this one
+#define CONS_CDR_NEXT 1
+// The cdr is the empty list
+#define CONS_CDR_NIL 2
+// The car slot holds the ordinary cons that now stands in for this cell
+#define CONS_CDR_FORWARD 3
+
+typedef struct compact_cell_s {
+  object_t header;
+  object_t *car;
+} compact_cell_t;
+
+typedef struct string_object_s {
+  object_t header;
+  string_entry_t entry;
+} string_object_t;
+
+typedef struct symbol_object_s {
+  object_t header;
+  symbol_entry_t entry;
+} symbol_object_t;
+
+typedef struct lambda_object_s {
+  object_t header;
+  lambda_entry_t entry;
+} lambda_object_t;
+
+typedef struct primitive_object_s {
+  object_t header;
+  primitive_entry_t entry;
+} primitive_object_t;
+
+typedef struct double_object_s {
+  object_t header;
+  double value;
+} double_object_t;
+
+typedef struct hash_table_entry_s {
+  struct hash_s *table;
+  // A hash_table_kind_t, which fixes how keys are hashed and compared
+  uint32_t kind;
+  // Folds and walks in progress, during which the table must not change
+  uint32_t iterating;
+} hash_table_entry_t;
+
+typedef struct hash_table_object_s {
+  extended_object_t header;
+  hash_table_entry_t entry;
+} hash_table_object_t;
+
+typedef struct record_type_entry_s {
+  object_t *name;
+  // Symbols, one per slot in slot order
+  object_t *fields;
+  uint32_t num_fields;
+} record_type_entry_t;
+
+typedef struct record_type_object_s {
+  extended_object_t header;
+  record_type_entry_t entry;
+} record_type_object_t;
+
+// A record of any type: the type, then one slot per field
+typedef struct record_object_s {
+  extended_object_t header;
+  object_t *type;
+  object_t *slots[];
+} record_object_t;
+
+// A constructor, predicate, accessor or modifier generated for a record type
+typedef struct record_procedure_entry_s {
+  object_t *type;
+  // A record_procedure_kind_t
+  uint32_t kind;
+  // The slot an accessor reads or a modifier writes, or how many arguments a constructor takes
+  uint32_t slot;
+  // The slot each constructor argument fills
+  uint32_t *arg_slots;
+} record_procedure_entry_t;
+
+typedef struct record_procedure_object_s {
+  extended_object_t header;
+  record_procedure_entry_t entry;
+} record_procedure_object_t;
+
+typedef struct memory_stats_s {
+  uint64_t objects;
+  uint64_t conses;
+  uint64_t strings;
+  uint64_t symbols;
+  uint64_t lambdas;
+  uint64_t primitives;
+  uint64_t doubles;
+  size_t bytes;
+} memory_stats_t;
+
+/*
+ * Environment frames, their bindings and argument lists live in a LIFO region
+ * rather than the heap. Nothing retains an environment once the evaluation
+ * that built it has returned, so the interpreter marks the region before each
+ * evaluation whose result is used in non-tail position and releases it after.
+ * A region cons is an ordinary pair, but it must never become a value.
+ */
+extern cons_object_t *g_frame_region_base;
+extern cons_object_t *g_frame_region_top;
+
 typedef void (*did_install_primitive_func)(object_t *primitive, primitive_entry_t *entry);
 
 int memory_init(void);
 void add_did_install_primitive_hook(did_install_primitive_func hook);
+void memory_get_stats(memory_stats_t *outstats);
 object_t *allocate_cons(cons_entry_t **outentry);
+// A proper list of the count items, cdr-coded; '() when count is zero
+object_t *allocate_compact_list(object_t **items, size_t count);
+cons_entry_t *forward_compact_cell(object_t *cell);
 object_t *allocate_symbol(size_t len, symbol_entry_t **outentry);
 object_t *allocate_string(size_t len, string_entry_t **outentry);
+// A rope of the two strings, which are not copied until it is flattened
+object_t *allocate_string_rope(object_t *left, object_t *right);
+// A string sharing len bytes of the flat string base from byte start
+object_t *allocate_string_slice(string_entry_t *base, size_t start, size_t len, size_t chars);
+// Copies the bytes of a flat string or rope to out, without flattening it
+void copy_string_bytes(object_t *str, char *out);
+void flatten_string(object_t *str);
 object_t *allocate_lambda(lambda_entry_t **outentry);
 object_t *allocate_primitive(const char *name, primitive_func func, primitive_entry_t **outentry);
 object_t *allocate_number(int64_t number);
 object_t *allocate_double(double number);
+object_t *allocate_hash_table(hash_table_entry_t **outentry);
+object_t *allocate_record_type(record_type_entry_t **outentry);
+// A record of the type with every slot set to value
+object_t *allocate_record_instance(object_t *type, object_t *value);
+object_t *allocate_record_procedure(record_procedure_entry_t **outentry);
+
 
-string_entry_t *get_string_entry(object_t *str);
-symbol_entry_t *get_symbol_entry(object_t *sym);
-cons_entry_t *get_cons_entry(object_t *cons);
-lambda_entry_t *get_lambda_entry(object_t *lambda);
-primitive_entry_t *get_primitive_entry(object_t *primitive);
-double get_double(object_t *doub);
+// Marks a symbol as bound outside the global frame, invalidating code compiled against its global binding
+void note_local_binding(object_t *sym);
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-function"
 
+static inline type_t object_type(object_t *obj) {
+  if (obj->type != SCHEME_EXTENDED) return (type_t)obj->type;
+  return (type_t)((extended_object_t*)obj)->type;
+}
+
+static inline uint64_t cons_cdr_code(object_t *cons) {
+  return (uint64_t)cons->number_or_index & CONS_CDR_MASK;
+}
+
+// Dense and unique across ordinary conses and compact cells, for side tables keyed by pair
+static inline uint64_t cons_index(object_t *cons) {
+  return (uint64_t)cons->number_or_index >> CONS_CDR_BITS;
+}
+
+// For writing; reads should go through car() and cdr(), which leave compact cells in place
+static inline cons_entry_t *get_cons_entry(object_t *cons) {
+  ASSERT_OR_ERROR(cons->type == SCHEME_CONS, "Not a pair");
+  if (__builtin_expect(cons_cdr_code(cons) == CONS_CDR_POINTER, 1)) return &((cons_object_t*)cons)->entry;
+  return forward_compact_cell(cons);
+}
+
+static inline string_entry_t *get_string_entry(object_t *str) {
+  ASSERT_OR_ERROR(str->type == SCHEME_STRING, "Not a string");
+  string_entry_t *entry = &((string_object_t*)str)->entry;
+  if (__builtin_expect(entry->str == NULL, 0)) flatten_string(str);
+  return entry;
+}
+
+// For the length and character count only; str is NULL while the string is a rope
+static inline string_entry_t *peek_string_entry(object_t *str) {
+  ASSERT_OR_ERROR(str->type == SCHEME_STRING, "Not a string");
+  return &((string_object_t*)str)->entry;
+}
+
+static inline symbol_entry_t *get_symbol_entry(object_t *sym) {
+  ASSERT_OR_ERROR(sym->type == SCHEME_SYMBOL, "Not a symbol");
+  return &((symbol_object_t*)sym)->entry;
+}
+
+static inline lambda_entry_t *get_lambda_entry(object_t *lambda) {
+  ASSERT_OR_ERROR(lambda->type == SCHEME_LAMBDA, "Not a lambda");
+  return &((lambda_object_t*)lambda)->entry;
+}
+
+static inline primitive_entry_t *get_primitive_entry(object_t *primitive) {
+  ASSERT_OR_ERROR(primitive->type == SCHEME_PRIMITIVE, "Not a primitive");
+  return &((primitive_object_t*)primitive)->entry;
+}
+
+static inline bool primitive_accepts(primitive_entry_t *entry, int argc) {
+  return argc >= entry->min_args && (entry->max_args == PRIMITIVE_VARIADIC || argc <= entry->max_args);
+}
+
+static inline double get_double(object_t *doub) {
+  return ((double_object_t*)doub)->value;
+}
+
+static inline hash_table_entry_t *get_hash_table_entry(object_t *table) {
+  ASSERT_OR_ERROR(object_type(table) == SCHEME_HASH_TABLE, "Not a hash table");
+  return &((hash_table_object_t*)table)->entry;
+}
+
+static inline record_type_entry_t *get_record_type_entry(object_t *type) {
+  ASSERT_OR_ERROR(object_type(type) == SCHEME_RECORD_TYPE, "Not a record type");
+  return &((record_type_object_t*)type)->entry;
+}
+
+static inline object_t *get_record_type(object_t *record) {
+  ASSERT_OR_ERROR(object_type(record) == SCHEME_RECORD, "Not a record");
+  return ((record_object_t*)record)->type;
+}
+
+// The record's slots if it is a record of the type, otherwise NULL
+static inline object_t **record_slots_of_type(object_t *record, object_t *type) {
+  if (object_type(record) != SCHEME_RECORD || ((record_object_t*)record)->type != type) return NULL;
+  return ((record_object_t*)record)->slots;
+}
+
+static inline record_procedure_entry_t *get_record_procedure_entry(object_t *procedure) {
+  ASSERT_OR_ERROR(object_type(procedure) == SCHEME_RECORD_PROCEDURE, "Not a record procedure");
+  return &((record_procedure_object_t*)procedure)->entry;
+}
+
 object_t *cons(object_t *car, object_t *cdr);
+object_t *frame_cons(object_t *car, object_t *cdr);
+void frame_region_unwind(cons_object_t *mark);
 object_t *symbol(const char *text);
 object_t *symboln(const char *text, size_t len);
+// symboln for a name whose hash_bytes is already known, such as one hashed off the main thread
+object_t *symboln_hashed(const char *text, size_t len, uint64_t hash);
+object_t *gensym(object_t *base);
 object_t *lambda(object_t *parameters, object_t *body);
 
 static inline object_t *car(object_t *cons) {
-  return get_cons_entry(cons)->car;
+  ASSERT_OR_ERROR(cons->type == SCHEME_CONS, "Not a pair");
+  if (__builtin_expect(cons_cdr_code(cons) == CONS_CDR_FORWARD, 0)) {
+    cons = ((compact_cell_t*)cons)->car;
+  }
+  // Both layouts keep the car right after the header
+  return ((compact_cell_t*)cons)->car;
 }
 
 static inline object_t *cdr(object_t *cons) {
-  return get_cons_entry(cons)->cdr;
+  ASSERT_OR_ERROR(cons->type == SCHEME_CONS, "Not a pair");
+  uint64_t code = cons_cdr_code(cons);
+  if (__builtin_expect(code == CONS_CDR_POINTER, 1)) return ((cons_object_t*)cons)->entry.cdr;
+  if (code == CONS_CDR_NEXT) return &((compact_cell_t*)cons + 1)->header;
+  if (code == CONS_CDR_NIL) return g_scheme_null;
+  return ((cons_object_t*)((compact_cell_t*)cons)->car)->entry.cdr;
 }
 
 static inline object_t *cadr(object_t *cons) {
-  return get_cons_entry(cdr(cons))->car;
+  return car(cdr(cons));
 }
 
 static inline object_t *cddr(object_t *cons) {
-  return get_cons_entry(cdr(cons))->cdr;
+  return cdr(cdr(cons));
 }
 
 static inline object_t *caddr(object_t *cons) {
-  return get_cons_entry(cddr(cons))->car;
+  return car(cddr(cons));
 }
 
 static inline object_t *cdddr(object_t *cons) {
@@ -91,6 +378,38 @@ static inline object_t *cadddr(object_t *cons) {
   return car(cdddr(cons));
 }
 
+// The number of elements of a proper list, or -1 for anything else
+static inline int list_length(object_t *list) {
+  int len = 0;
+  while (list->type == SCHEME_CONS) {
+    len++;
+    list = cdr(list);
+  }
+  return list == g_scheme_null ? len : -1;
+}
+
+// In-place rewrites store only what changed, so untouched compact lists stay compact
+static inline void update_car(object_t *cons, object_t *value) {
+  if (car(cons) != value) get_cons_entry(cons)->car = value;
+}
+
+static inline void update_cdr(object_t *cons, object_t *value) {
+  if (cdr(cons) != value) get_cons_entry(cons)->cdr = value;
+}
+
+static inline cons_object_t *frame_region_mark(void) {
+  return g_frame_region_top;
+}
+
+// Frees every region cons allocated since mark was taken
+static inline void frame_region_release(cons_object_t *mark) {
+  if (__builtin_expect(mark >= g_frame_region_base && mark <= g_frame_region_top, 1)) {
+    g_frame_region_top = mark;
+  } else {
+    frame_region_unwind(mark);
+  }
+}
+
 static inline bool is_eq(object_t *sym1, object_t *sym2) {
   return sym1 == sym2;
 }
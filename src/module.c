@@ -0,0 +1,33 @@
+#include "module.h"
+#include <dlfcn.h>
+#include <stdio.h>
+
+int module_load(const char *path) {
+  // Modules are never unloaded: their primitives stay bound for the life of the process
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return -1;
+  }
+
+  const int *abi = (const int*)dlsym(handle, SCHEMIN_MODULE_ABI_SYMBOL);
+  if (abi == NULL || *abi != SCHEMIN_MODULE_ABI_VERSION) {
+    fprintf(stderr, "%s: not a schemin module for ABI version %d\n", path, SCHEMIN_MODULE_ABI_VERSION);
+    dlclose(handle);
+    return -1;
+  }
+
+  module_init_func init;
+  *(void**)&init = dlsym(handle, SCHEMIN_MODULE_INIT_SYMBOL);
+  if (init == NULL) {
+    fprintf(stderr, "%s: missing %s\n", path, SCHEMIN_MODULE_INIT_SYMBOL);
+    dlclose(handle);
+    return -1;
+  }
+
+  if (init() != 0) {
+    fprintf(stderr, "%s: module init failed\n", path);
+    return -1;
+  }
+  return 0;
+}
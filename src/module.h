@@ -0,0 +1,20 @@
+#ifndef SCHEMIN_MODULE_H
+#define SCHEMIN_MODULE_H
+
+/*
+ * Loading of shared objects produced by schemin-compile. A module exports its
+ * ABI version and an init function, which registers the compiled functions as
+ * primitives and evaluates the rest of the source file in order.
+ */
+
+// Bumped whenever the object layout or the runtime API used by modules changes
+#define SCHEMIN_MODULE_ABI_VERSION 4
+#define SCHEMIN_MODULE_ABI_SYMBOL "schemin_module_abi"
+#define SCHEMIN_MODULE_INIT_SYMBOL "schemin_module_init"
+
+typedef int (*module_init_func)(void);
+
+// Returns 0 on success, or -1 after printing the reason to stderr
+int module_load(const char *path);
+
+#endif
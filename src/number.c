@@ -0,0 +1,200 @@
+#include "number.h"
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scheme_types.h"
+#include "error.h"
+
+// Significant decimal digits that always fit a uint64_t without overflow checks
+#define MANTISSA_DIGITS 19
+// Every power of ten up to this is exact in a double
+#define MAX_EXACT_POWER_OF_TEN 22
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+// Exponents beyond this are infinite or zero whatever the mantissa
+#define EXPONENT_CLAMP 100000
+#define FALLBACK_INLINE_SIZE 64
+
+static const double lg_powers_of_ten[MAX_EXACT_POWER_OF_TEN + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int digit_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 99;
+}
+
+static inline uint64_t fixnum_limit(bool negative) {
+  return negative ? (uint64_t)SCHEME_INT_MAX + 1 : (uint64_t)SCHEME_INT_MAX;
+}
+
+static number_kind_t read_radix_integer(const char *p, const char *end, int radix, bool negative, int64_t *outfixnum) {
+  if (p == end) return NUMBER_NONE;
+
+  uint64_t limit = fixnum_limit(negative);
+  uint64_t value = 0;
+  bool overflow = false;
+  for (; p < end; p++) {
+    int digit = digit_value(*p);
+    if (digit >= radix) return NUMBER_NONE;
+    if (value > (limit - (uint64_t)digit) / (uint64_t)radix) overflow = true;
+    value = value * (uint64_t)radix + (uint64_t)digit;
+  }
+  ASSERT_OR_ERROR(!overflow, "Integer out of range");
+
+  *outfixnum = negative ? -(int64_t)value : (int64_t)value;
+  return NUMBER_FIXNUM;
+}
+
+/*
+ * Correctly rounded conversion for the cases the fast path cannot do exactly.
+ * strtod follows LC_NUMERIC, so the token is copied with the locale's radix
+ * character in place of '.'.
+ */
+static double convert_slow(const char *start, const char *end) {
+  const char *point = localeconv()->decimal_point;
+  size_t point_len = strlen(point);
+  size_t len = (size_t)(end - start);
+  char inline_buf[FALLBACK_INLINE_SIZE];
+  size_t size = len * point_len + 1;
+  char *buf = size <= FALLBACK_INLINE_SIZE ? inline_buf : (char*)malloc(size);
+  ASSERT_OR_ERROR(buf != NULL, "Could not allocate number buffer");
+
+  size_t n = 0;
+  for (const char *p = start; p < end; p++) {
+    if (*p == '.') {
+      memcpy(&buf[n], point, point_len);
+      n += point_len;
+    } else {
+      buf[n++] = *p;
+    }
+  }
+  buf[n] = '\0';
+
+  errno = 0;
+  double value = strtod(buf, NULL);
+  ASSERT_OR_ERROR(errno != ERANGE, "double out of range");
+  if (buf != inline_buf) free(buf);
+  return value;
+}
+
+static number_kind_t read_decimal(const char *start, const char *end, int64_t *outfixnum, double *outflonum) {
+  const char *p = start;
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) negative = *p++ == '-';
+
+  // The first MANTISSA_DIGITS significant digits, scaled by 10^exponent
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int64_t exponent = 0;
+  bool truncated = false;
+  bool any_digits = false;
+  bool is_flonum = false;
+
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    any_digits = true;
+    int digit = *p - '0';
+    if (digits < MANTISSA_DIGITS) {
+      mantissa = mantissa * 10 + (uint64_t)digit;
+      if (mantissa != 0) digits++;
+    } else {
+      exponent++;
+      truncated = truncated || digit != 0;
+    }
+  }
+
+  if (p < end && *p == '.') {
+    is_flonum = true;
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      any_digits = true;
+      int digit = *p - '0';
+      if (digits < MANTISSA_DIGITS) {
+        mantissa = mantissa * 10 + (uint64_t)digit;
+        if (mantissa != 0) digits++;
+        exponent--;
+      } else {
+        truncated = truncated || digit != 0;
+      }
+    }
+  }
+  if (!any_digits) return NUMBER_NONE;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    is_flonum = true;
+    p++;
+    bool negative_exponent = false;
+    if (p < end && (*p == '+' || *p == '-')) negative_exponent = *p++ == '-';
+    if (p == end) return NUMBER_NONE;
+    int64_t explicit_exponent = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (explicit_exponent < EXPONENT_CLAMP) explicit_exponent = explicit_exponent * 10 + (*p - '0');
+    }
+    exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+  }
+  if (p != end) return NUMBER_NONE;
+
+  if (!is_flonum && exponent == 0 && mantissa <= fixnum_limit(negative)) {
+    *outfixnum = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+    return NUMBER_FIXNUM;
+  }
+
+  // Clinger's fast path: one exact operand and one correctly rounded operation
+  double value;
+  if (mantissa == 0) {
+    value = 0.0;
+  } else if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER_OF_TEN && exponent <= MAX_EXACT_POWER_OF_TEN) {
+    value = exponent >= 0 ? (double)mantissa * lg_powers_of_ten[exponent] : (double)mantissa / lg_powers_of_ten[-exponent];
+  } else {
+    value = convert_slow(negative ? start + 1 : start, end);
+  }
+
+  *outflonum = negative ? -value : value;
+  return NUMBER_FLONUM;
+}
+
+number_kind_t read_number(const char *text, size_t len, int64_t *outfixnum, double *outflonum) {
+  if (len == 0) return NUMBER_NONE;
+  char first = text[0];
+  // Most symbols are rejected on their first byte
+  if (!((first >= '0' && first <= '9') || first == '+' || first == '-' || first == '.' || first == '#')) {
+    return NUMBER_NONE;
+  }
+
+  const char *p = text;
+  const char *end = text + len;
+  int radix = 10;
+  if (first == '#') {
+    if (len < 3) return NUMBER_NONE;
+    switch (text[1]) {
+      case 'x': case 'X': radix = 16; break;
+      case 'o': case 'O': radix = 8; break;
+      case 'b': case 'B': radix = 2; break;
+      case 'd': case 'D': radix = 10; break;
+      default: return NUMBER_NONE;
+    }
+    p += 2;
+  }
+
+  if (radix != 10) {
+    bool negative = false;
+    if (*p == '+' || *p == '-') negative = *p++ == '-';
+    return read_radix_integer(p, end, radix, negative, outfixnum);
+  }
+
+  if ((size_t)(end - p) == 6 && (*p == '+' || *p == '-')) {
+    if (memcmp(p + 1, "inf.0", 5) == 0) {
+      *outflonum = *p == '-' ? -INFINITY : INFINITY;
+      return NUMBER_FLONUM;
+    }
+    if (memcmp(p + 1, "nan.0", 5) == 0) {
+      *outflonum = NAN;
+      return NUMBER_FLONUM;
+    }
+  }
+  return read_decimal(p, end, outfixnum, outflonum);
+}
@@ -0,0 +1,24 @@
+#ifndef SCHEMIN_NUMBER_H
+#define SCHEMIN_NUMBER_H
+SCHEMIN_NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum number_kind_e {
+  // The token is not a number and should be read as a symbol
+  NUMBER_NONE,
+  NUMBER_FIXNUM,
+  NUMBER_FLONUM
+} number_kind_t;
+
+/*
+ * Classifies and converts an atom in one pass over exactly len bytes:
+ * [#x|#o|#b|#d][+|-]digits for integers, and decimal digits with an optional
+ * fraction and exponent, or +inf.0, -inf.0 and +nan.0, for flonums. Decimal
+ * integers too large for a fixnum are read as flonums; radix integers that
+ * do not fit are an error.
+ */
+number_kind_t read_number(const char *text, size_t len, int64_t *outfixnum, double *outflonum);
+
+#endif
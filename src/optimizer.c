@@ -0,0 +1,394 @@
+#include "optimizer.h"
+#include <stdbool.h>
+#include "memory.h"
+#include "interpreter.h"
+#include "error.h"
+
+#define OPTIMIZER_MAX_BOUND 64
+#define OPTIMIZER_MAX_ARGS 32
+#define OPTIMIZER_SEQUENCE_REALLOC_COUNT 16
+// Folding only runs on fixnums small enough that no sum or product can overflow
+#define OPTIMIZER_FOLD_LIMIT (1LL << 59)
+
+typedef struct optimizer_s {
+  // Names defined, assigned or bound as parameters anywhere in the form
+  object_t *bound[OPTIMIZER_MAX_BOUND];
+  size_t num_bound;
+  bool bound_overflow;
+  // Parameters of the innermost enclosing lambda, which are always bound
+  object_t *parameters;
+  // Set inside lambda bodies, which may run under bindings made after the form
+  bool in_lambda;
+} optimizer_t;
+
+static object_t *lg_sym_quote;
+static object_t *lg_sym_if;
+static object_t *lg_sym_define;
+static object_t *lg_sym_set;
+static object_t *lg_sym_lambda;
+static object_t *lg_sym_begin;
+static object_t *lg_sym_let;
+static object_t *lg_sym_let_star;
+static object_t *lg_sym_letrec;
+static object_t *lg_sym_do;
+static object_t *lg_sym_cond;
+
+static object_t *optimize_expression(optimizer_t *opt, object_t *exp);
+
+static void note_bound(optimizer_t *opt, object_t *sym) {
+  if (sym->type != SCHEME_SYMBOL) return;
+  if (opt->num_bound == OPTIMIZER_MAX_BOUND) {
+    opt->bound_overflow = true;
+    return;
+  }
+  opt->bound[opt->num_bound++] = sym;
+}
+
+static bool is_bound_in_form(optimizer_t *opt, object_t *sym) {
+  if (opt->bound_overflow) return true;
+  for (size_t i = 0; i < opt->num_bound; i++) {
+    if (is_eq(opt->bound[i], sym)) return true;
+  }
+  return false;
+}
+
+static bool is_binding_form(object_t *head) {
+  return is_eq(head, lg_sym_let) || is_eq(head, lg_sym_let_star) || is_eq(head, lg_sym_letrec) || is_eq(head, lg_sym_do);
+}
+
+static inline bool is_named_let(object_t *exp) {
+  return is_eq(car(exp), lg_sym_let) && cdr(exp) != g_scheme_null && cadr(exp)->type == SCHEME_SYMBOL;
+}
+
+// The list of (var init [step]) specs of a let, let*, letrec, named let or do form
+static object_t *binding_specs(object_t *exp) {
+  object_t *rest = is_named_let(exp) ? cddr(exp) : cdr(exp);
+  return rest == g_scheme_null ? g_scheme_null : car(rest);
+}
+
+static void collect_bindings(optimizer_t *opt, object_t *exp) {
+  if (exp->type != SCHEME_CONS || list_length(exp) < 0) return;
+
+  object_t *head = car(exp);
+  if (is_eq(head, lg_sym_quote)) return;
+  if ((is_eq(head, lg_sym_define) || is_eq(head, lg_sym_set)) && cdr(exp) != g_scheme_null) {
+    note_bound(opt, cadr(exp));
+  }
+  if (is_eq(head, lg_sym_lambda) && cdr(exp) != g_scheme_null) {
+    for (object_t *p = cadr(exp); p->type == SCHEME_CONS; p = cdr(p)) {
+      note_bound(opt, car(p));
+    }
+  }
+  if (is_binding_form(head)) {
+    if (is_named_let(exp)) note_bound(opt, cadr(exp));
+    for (object_t *specs = binding_specs(exp); specs->type == SCHEME_CONS; specs = cdr(specs)) {
+      note_bound(opt, car(specs)->type == SCHEME_CONS ? car(car(specs)) : car(specs));
+    }
+  }
+
+  for (object_t *rest = exp; rest != g_scheme_null; rest = cdr(rest)) {
+    collect_bindings(opt, car(rest));
+  }
+}
+
+static bool is_constant(object_t *exp) {
+  switch (object_type(exp)) {
+    case SCHEME_NUMBER:
+    case SCHEME_STRING:
+    case SCHEME_NULL:
+    case SCHEME_DOUBLE: {
+      return true;
+    }
+    case SCHEME_CONS: {
+      return is_eq(car(exp), lg_sym_quote) && list_length(exp) == 2;
+    }
+    case SCHEME_SYMBOL:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      return false;
+    }
+  }
+  return false;
+}
+
+static object_t *constant_value(object_t *exp) {
+  return exp->type == SCHEME_CONS ? cadr(exp) : exp;
+}
+
+static object_t *make_constant(object_t *value) {
+  switch (object_type(value)) {
+    case SCHEME_NUMBER:
+    case SCHEME_STRING:
+    case SCHEME_NULL:
+    case SCHEME_DOUBLE: {
+      return value;
+    }
+    case SCHEME_SYMBOL:
+    case SCHEME_CONS:
+    case SCHEME_EXTENDED:
+    case SCHEME_HASH_TABLE:
+    case SCHEME_RECORD_TYPE:
+    case SCHEME_RECORD:
+    case SCHEME_RECORD_PROCEDURE:
+    case SCHEME_LAMBDA:
+    case SCHEME_PRIMITIVE: {
+      return cons(lg_sym_quote, cons(value, g_scheme_null));
+    }
+  }
+  return value;
+}
+
+static bool has_only_type(int argc, object_t **args, type_t type) {
+  for (int i = 0; i < argc; i++) {
+    if (args[i]->type != type) return false;
+  }
+  return true;
+}
+
+// Checks the arity and argument requirements from the primitives[] table so folding can never error
+static bool can_fold(primitive_entry_t *entry, int argc, object_t **args) {
+  uint32_t flags = entry->flags;
+  if ((flags & PRIMITIVE_PURE) == 0) return false;
+  if (!primitive_accepts(entry, argc)) return false;
+  if ((flags & PRIMITIVE_STRING_ARGS) && !has_only_type(argc, args, SCHEME_STRING)) return false;
+  if ((flags & PRIMITIVE_PAIR_ARGS) && !has_only_type(argc, args, SCHEME_CONS)) return false;
+
+  if (flags & PRIMITIVE_NUMBER_ARGS) {
+    if (argc < 1 || !has_only_type(argc, args, SCHEME_NUMBER)) return false;
+    int64_t sum = 0;
+    int64_t product = 1;
+    for (int i = 0; i < argc; i++) {
+      int64_t value = args[i]->number_or_index;
+      int64_t magnitude = value < 0 ? -value : value;
+      sum += magnitude;
+      if (__builtin_mul_overflow(product, magnitude > 1 ? magnitude : 1, &product)) return false;
+      if (sum >= OPTIMIZER_FOLD_LIMIT || product >= OPTIMIZER_FOLD_LIMIT) return false;
+    }
+  }
+
+  if ((flags & PRIMITIVE_NONZERO_DIVISOR) && args[1]->number_or_index == 0) return false;
+  return true;
+}
+
+/*
+ * Scope is dynamic, so a lambda body can be called from a frame that binds
+ * the operator; only code that runs as part of this form is folded.
+ */
+static object_t *fold_application(optimizer_t *opt, object_t *exp) {
+  if (opt->in_lambda) return exp;
+  object_t *head = car(exp);
+  if (head->type != SCHEME_SYMBOL) return exp;
+  if (get_symbol_entry(head)->flags & SYMBOL_LOCALLY_BOUND) return exp;
+  if (is_bound_in_form(opt, head)) return exp;
+
+  object_t *op = lookup_global(head);
+  if (op == NULL || op->type != SCHEME_PRIMITIVE) return exp;
+
+  object_t *args[OPTIMIZER_MAX_ARGS];
+  int argc = 0;
+  for (object_t *operands = cdr(exp); operands != g_scheme_null; operands = cdr(operands)) {
+    object_t *operand = car(operands);
+    if (argc == OPTIMIZER_MAX_ARGS || !is_constant(operand)) return exp;
+    args[argc++] = constant_value(operand);
+  }
+
+  primitive_entry_t *entry = get_primitive_entry(op);
+  if (!can_fold(entry, argc, args)) return exp;
+  return make_constant(entry->func(argc, args));
+}
+
+static bool is_begin_with_body(object_t *exp) {
+  return exp->type == SCHEME_CONS && is_eq(car(exp), lg_sym_begin) && list_length(exp) >= 2;
+}
+
+static bool is_parameter(optimizer_t *opt, object_t *sym) {
+  for (object_t *p = opt->parameters; p->type == SCHEME_CONS; p = cdr(p)) {
+    if (is_eq(car(p), sym)) return true;
+  }
+  return false;
+}
+
+// Non-final expressions whose evaluation can have no effect at all
+static bool is_discardable(optimizer_t *opt, object_t *exp) {
+  if (exp->type == SCHEME_SYMBOL) return is_parameter(opt, exp);
+  return is_constant(exp) || (exp->type == SCHEME_CONS && is_eq(car(exp), lg_sym_lambda));
+}
+
+static void append_expression(object_t ***exps, size_t *num, size_t *max, object_t *exp) {
+  if (*num == *max) {
+    *max += OPTIMIZER_SEQUENCE_REALLOC_COUNT;
+    *exps = (object_t**)realloc(*exps, *max * sizeof(object_t*));
+    ASSERT_OR_ERROR(*exps != NULL, "Could not grow optimizer sequence");
+  }
+  (*exps)[(*num)++] = exp;
+}
+
+/*
+ * Optimizes a body, splicing in the contents of nested begins and dropping
+ * discardable expressions before the last one. Returns seq itself when that
+ * changes nothing, and a new list otherwise.
+ */
+static object_t *optimize_sequence(optimizer_t *opt, object_t *seq) {
+  object_t **exps = NULL;
+  size_t num = 0;
+  size_t max = 0;
+  object_t *original = seq;
+
+  for (; seq != g_scheme_null; seq = cdr(seq)) {
+    object_t *exp = optimize_expression(opt, car(seq));
+    if (is_begin_with_body(exp)) {
+      // Already flattened when the inner begin was optimized
+      for (object_t *inner = cdr(exp); inner != g_scheme_null; inner = cdr(inner)) {
+        append_expression(&exps, &num, &max, car(inner));
+      }
+    } else {
+      append_expression(&exps, &num, &max, exp);
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < num; i++) {
+    if (i + 1 < num && is_discardable(opt, exps[i])) continue;
+    exps[kept++] = exps[i];
+  }
+
+  object_t *rest = original;
+  size_t same = 0;
+  for (; same < kept && rest != g_scheme_null && car(rest) == exps[same]; rest = cdr(rest)) same++;
+  if (same == kept && rest == g_scheme_null) {
+    free(exps);
+    return original;
+  }
+
+  object_t *result = g_scheme_null;
+  for (size_t i = kept; i > 0; i--) {
+    result = cons(exps[i - 1], result);
+  }
+
+  free(exps);
+  return result;
+}
+
+static object_t *optimize_if(optimizer_t *opt, object_t *exp, int len) {
+  for (object_t *rest = cdr(exp); rest != g_scheme_null; rest = cdr(rest)) {
+    update_car(rest, optimize_expression(opt, car(rest)));
+  }
+
+  object_t *predicate = cadr(exp);
+  if (!is_constant(predicate)) return exp;
+  if (!is_eq(constant_value(predicate), g_false)) return caddr(exp);
+  // A one-armed if with a false predicate is left for the evaluator to report
+  return len == 4 ? cadddr(exp) : exp;
+}
+
+static void optimize_each(optimizer_t *opt, object_t *list) {
+  for (; list->type == SCHEME_CONS; list = cdr(list)) {
+    update_car(list, optimize_expression(opt, car(list)));
+  }
+}
+
+static object_t *optimize_binding_form(optimizer_t *opt, object_t *exp) {
+  object_t *specs = binding_specs(exp);
+  if (list_length(specs) < 0) return exp;
+  for (; specs != g_scheme_null; specs = cdr(specs)) {
+    if (car(specs)->type == SCHEME_CONS) optimize_each(opt, cdr(car(specs)));
+  }
+
+  object_t *rest = is_named_let(exp) ? cddr(exp) : cdr(exp);
+  if (is_eq(car(exp), lg_sym_do)) {
+    object_t *exit_clause = cadr(rest);
+    if (list_length(exit_clause) > 0) optimize_each(opt, exit_clause);
+    optimize_each(opt, cddr(rest));
+    return exp;
+  }
+  if (cdr(rest) != g_scheme_null) update_cdr(rest, optimize_sequence(opt, cdr(rest)));
+  return exp;
+}
+
+static object_t *optimize_expression(optimizer_t *opt, object_t *exp) {
+  if (exp->type != SCHEME_CONS) return exp;
+  int len = list_length(exp);
+  if (len < 0) return exp;
+
+  object_t *head = car(exp);
+  if (is_eq(head, lg_sym_quote)) return exp;
+
+  if (is_eq(head, lg_sym_define) || is_eq(head, lg_sym_set)) {
+    if (len == 3) {
+      update_car(cddr(exp), optimize_expression(opt, caddr(exp)));
+    }
+    return exp;
+  }
+
+  if (is_eq(head, lg_sym_if)) {
+    if (len != 3 && len != 4) return exp;
+    return optimize_if(opt, exp, len);
+  }
+
+  if (is_eq(head, lg_sym_lambda)) {
+    if (len >= 3) {
+      object_t *enclosing = opt->parameters;
+      bool enclosing_in_lambda = opt->in_lambda;
+      opt->parameters = cadr(exp);
+      opt->in_lambda = true;
+      update_cdr(cdr(exp), optimize_sequence(opt, cddr(exp)));
+      opt->parameters = enclosing;
+      opt->in_lambda = enclosing_in_lambda;
+    }
+    return exp;
+  }
+
+  if (is_eq(head, lg_sym_begin)) {
+    if (len < 2) return exp;
+    object_t *body = optimize_sequence(opt, cdr(exp));
+    if (cdr(body) == g_scheme_null) return car(body);
+    update_cdr(exp, body);
+    return exp;
+  }
+
+  if (is_binding_form(head)) {
+    if (len < 3) return exp;
+    return optimize_binding_form(opt, exp);
+  }
+
+  if (is_eq(head, lg_sym_cond)) {
+    for (object_t *clauses = cdr(exp); clauses != g_scheme_null; clauses = cdr(clauses)) {
+      if (list_length(car(clauses)) > 0) optimize_each(opt, car(clauses));
+    }
+    return exp;
+  }
+
+  optimize_each(opt, exp);
+  return fold_application(opt, exp);
+}
+
+int optimizer_init(void) {
+  lg_sym_quote = symbol("quote");
+  lg_sym_if = symbol("if");
+  lg_sym_define = symbol("define");
+  lg_sym_set = symbol("set!");
+  lg_sym_lambda = symbol("lambda");
+  lg_sym_begin = symbol("begin");
+  lg_sym_let = symbol("let");
+  lg_sym_let_star = symbol("let*");
+  lg_sym_letrec = symbol("letrec");
+  lg_sym_do = symbol("do");
+  lg_sym_cond = symbol("cond");
+
+  return 0;
+}
+
+object_t *optimize(object_t *exp) {
+  optimizer_t opt;
+  opt.num_bound = 0;
+  opt.bound_overflow = false;
+  opt.parameters = g_scheme_null;
+  opt.in_lambda = false;
+  collect_bindings(&opt, exp);
+  return optimize_expression(&opt, exp);
+}
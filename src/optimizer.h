@@ -0,0 +1,18 @@
+#ifndef SCHEMIN_OPTIMIZER_H
+#define SCHEMIN_OPTIMIZER_H
+SCHEMIN_OPTIMIZER_H
+
+#include "scheme_types.h"
+
+/*
+ * Rewrites a parsed top-level form before evaluation: folds pure primitive
+ * calls on constants, prunes if branches with a constant predicate, flattens
+ * nested begins and drops constant non-final expressions from bodies.
+ *
+ * Builtins are resolved against the global environment at the time the form
+ * is optimized, so rebinding one afterwards does not affect folded code.
+ */
+int optimizer_init(void);
+object_t *optimize(object_t *exp);
+
+#endif
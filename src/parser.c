@@ -4,10 +4,16 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
-#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "minmax.h"
 #include "scheme_types.h"
 #include "memory.h"
+#include "hash.h"
+#include "intern.h"
+#include "number.h"
+#include "srcloc.h"
+#include "strindex.h"
 #include "error.h"
 
 typedef bool (*codepoint_predicate_func)(utf8proc_int32_t codepoint, void *data);
@@ -242,6 +248,30 @@ static size_t trim_whitespace(const char *utf8, size_t len, const char **dst) {
   return (size_t)(end - start);
 }
 
+#define LIST_ITEMS_INLINE_COUNT 16
+
+static object_t *items_into_list(object_t **items, size_t count) {
+  if (g_intern_enabled) intern_quotation(items, count);
+  return allocate_compact_list(items, count);
+}
+
+// The first pair gets where the list opens and each later pair where its item starts
+static void note_sexp_locations(object_t *list, const char *sexp, size_t subexp_size) {
+  if (list->type != SCHEME_CONS) return;
+  srcloc_note(list, sexp);
+
+  size_t remaining = subexp_size;
+  const char *tok;
+  size_t leading;
+  size_t toklen = utf8_tok_lisp(&sexp[1], remaining, &tok, &leading);
+  for (object_t *rest = list; tok != NULL && rest->type == SCHEME_CONS; rest = cdr(rest)) {
+    if (rest != list) srcloc_note(rest, tok);
+    remaining -= toklen + leading;
+    toklen = utf8_tok_lisp(tok + toklen, remaining, &tok, &leading);
+  }
+}
+
+// Source lists are read into cdr-coded runs; see compact_cell_t
 static object_t *valid_list_sexp_into_object(const char *sexp, size_t len) {
   if (len == 0)
     return NULL;
@@ -256,27 +286,31 @@ static object_t *valid_list_sexp_into_object(const char *sexp, size_t len) {
   if (tok == NULL)
     return NULL;
 
-  cons_entry_t *entry;
-  object_t *result = allocate_cons(&entry);
-  object_t *current = result;
-  while (true) {
-    object_t *obj = valid_exp_into_object(tok, toklen);
-    entry->car = obj;
+  object_t *inline_items[LIST_ITEMS_INLINE_COUNT];
+  object_t **items = inline_items;
+  size_t max_items = LIST_ITEMS_INLINE_COUNT;
+  size_t num_items = 0;
+  while (tok != NULL) {
+    if (num_items == max_items) {
+      max_items *= 2;
+      if (items == inline_items) {
+        items = (object_t**)malloc(max_items * sizeof(object_t*));
+        ASSERT_OR_ERROR(items != NULL, "Could not allocate list items");
+        memcpy(items, inline_items, sizeof(inline_items));
+      } else {
+        items = (object_t**)realloc(items, max_items * sizeof(object_t*));
+        ASSERT_OR_ERROR(items != NULL, "Could not grow list items");
+      }
+    }
+    items[num_items++] = valid_exp_into_object(tok, toklen);
 
     remaining -= toklen + leading;
     toklen = utf8_tok_lisp(tok + toklen, remaining, &tok, &leading);
-
-    if (tok == NULL) {
-      entry->cdr = g_scheme_null;
-      break;
-    }
-    cons_entry_t *next_entry;
-    object_t *next = allocate_cons(&next_entry);
-    entry->cdr = next;
-    entry = next_entry;
-    current = next;
   }
 
+  object_t *result = items_into_list(items, num_items);
+  if (items != inline_items) free(items);
+  if (g_srcloc_enabled) note_sexp_locations(result, sexp, subexp_size);
   return result;
 }
 
@@ -298,35 +332,40 @@ object_t* valid_exp_into_object(const char *exp, size_t len) {
     ssize_t result = scan_string(exp, len, NULL, 0, &newlen);
     ASSERT_OR_ERROR(result >= 0, "Bad string scan");
 
+    if (g_intern_enabled) {
+      char *text = (char*)malloc(newlen);
+      ASSERT_OR_ERROR(text != NULL, "Could not allocate string scan buffer");
+      result = scan_string(exp, len, &text, newlen, NULL);
+      ASSERT_OR_ERROR(result >= 0, "Bad string scan");
+      object_t *value = intern_string(text, newlen - 1);
+      free(text);
+      return value;
+    }
+
+    // newlen counts the terminating NUL, which allocate_string adds on its own
     string_entry_t *entry;
-    object_t *value = allocate_string(newlen, &entry);
+    object_t *value = allocate_string(newlen - 1, &entry);
     result = scan_string(exp, len, &entry->str, newlen, NULL);
     ASSERT_OR_ERROR(result >= 0, "Bad string scan");
-    entry->str[newlen] = '\0';
+    entry->str[entry->len] = '\0';
+    string_note_contents(entry);
 
     return value;
   }
 
-  {
-    char *tailptr;
-    errno = 0;
-    intmax_t number = strtoimax(exp, &tailptr, 0);
-    if ((size_t)(tailptr - exp) == len) {
-      ASSERT_OR_ERROR(errno != ERANGE, "Integer out of range");
-      ASSERT_OR_ERROR(number <= SCHEME_INT_MAX, "Too big for small integer");
-      ASSERT_OR_ERROR(number >= SCHEME_INT_MIN, "Too small for small integer");
-      object_t *value = allocate_number((int64_t)number);
-      return value;
+  int64_t number;
+  double dnumber;
+  switch (read_number(exp, len, &number, &dnumber)) {
+    case NUMBER_FIXNUM: {
+      if (g_intern_enabled) return intern_number(number);
+      return allocate_number(number);
     }
-  }
-  {
-    char *tailptr;
-    errno = 0;
-    double dnumber = strtod(exp, &tailptr);
-    if ((size_t)(tailptr - exp) == len) {
-      ASSERT_OR_ERROR(errno != ERANGE, "double out of range");
-      object_t *value = allocate_double(dnumber);
-      return value;
+    case NUMBER_FLONUM: {
+      if (g_intern_enabled) return intern_double(dnumber);
+      return allocate_double(dnumber);
+    }
+    case NUMBER_NONE: {
+      break;
     }
   }
 
@@ -336,3 +375,572 @@ object_t* valid_exp_into_object(const char *exp, size_t len) {
 bool quick_verify_scheme(const char *exp, size_t len) {
   return verify_matching_parens(exp, len, NULL);
 }
+
+#define READER_INITIAL_CAPACITY 16
+
+typedef enum reader_token_e {
+  READER_TOKEN_NONE,
+  READER_TOKEN_ATOM,
+  READER_TOKEN_STRING
+} reader_token_t;
+
+typedef struct reader_level_s {
+  object_t **items;
+  size_t count;
+  size_t capacity;
+  // Where the list and each item start, kept only while locations are recorded
+  const char *open;
+  const char **starts;
+  size_t starts_capacity;
+} reader_level_t;
+
+struct reader_s {
+  // Lists still open, innermost last; levels past depth keep their arrays for reuse
+  reader_level_t *levels;
+  size_t depth;
+  size_t num_levels;
+
+  // Bytes of the atom or string being read, which may span chunks
+  char *token;
+  size_t token_len;
+  size_t token_capacity;
+  reader_token_t token_kind;
+  bool escaped;
+
+  // A multibyte character split across chunks
+  utf8proc_uint8_t pending[4];
+  size_t pending_len;
+  size_t pending_need;
+
+  // Where the datum about to be emitted starts, when the caller has the whole source
+  const char *at;
+
+  // Complete top-level data not yet taken by reader_next
+  object_t **ready;
+  size_t ready_head;
+  size_t ready_count;
+  size_t ready_capacity;
+};
+
+static void *grow_array(void *array, size_t *capacity, size_t element_size) {
+  *capacity = *capacity == 0 ? READER_INITIAL_CAPACITY : *capacity * 2;
+  array = realloc(array, *capacity * element_size);
+  ASSERT_OR_ERROR(array != NULL, "Could not grow reader buffer");
+  return array;
+}
+
+reader_t *make_reader(void) {
+  reader_t *reader = (reader_t*)calloc(1, sizeof(reader_t));
+  ASSERT_OR_ERROR(reader != NULL, "Could not allocate reader");
+  return reader;
+}
+
+void destroy_reader(reader_t *reader) {
+  for (size_t i = 0; i < reader->num_levels; i++) {
+    free(reader->levels[i].items);
+    free(reader->levels[i].starts);
+  }
+  free(reader->levels);
+  free(reader->token);
+  free(reader->ready);
+  free(reader);
+}
+
+static void reader_emit(reader_t *reader, object_t *datum) {
+  if (reader->depth > 0) {
+    reader_level_t *level = &reader->levels[reader->depth - 1];
+    if (level->count == level->capacity) {
+      level->items = (object_t**)grow_array(level->items, &level->capacity, sizeof(object_t*));
+    }
+    if (g_srcloc_enabled) {
+      while (level->count >= level->starts_capacity) {
+        level->starts = (const char**)grow_array((void*)level->starts, &level->starts_capacity, sizeof(const char*));
+      }
+      level->starts[level->count] = reader->at;
+    }
+    level->items[level->count++] = datum;
+    return;
+  }
+
+  if (reader->ready_head + reader->ready_count == reader->ready_capacity) {
+    if (reader->ready_head > 0) {
+      memmove(reader->ready, &reader->ready[reader->ready_head], reader->ready_count * sizeof(object_t*));
+      reader->ready_head = 0;
+    } else {
+      reader->ready = (object_t**)grow_array(reader->ready, &reader->ready_capacity, sizeof(object_t*));
+    }
+  }
+  reader->ready[reader->ready_head + reader->ready_count++] = datum;
+}
+
+static void reader_append(reader_t *reader, const char *bytes, size_t len) {
+  while (reader->token_len + len > reader->token_capacity) {
+    reader->token = (char*)grow_array(reader->token, &reader->token_capacity, 1);
+  }
+  memcpy(&reader->token[reader->token_len], bytes, len);
+  reader->token_len += len;
+}
+
+static void reader_finish_token(reader_t *reader) {
+  reader_token_t kind = reader->token_kind;
+  reader->token_kind = READER_TOKEN_NONE;
+  if (kind == READER_TOKEN_NONE) return;
+  object_t *datum = valid_exp_into_object(reader->token, reader->token_len);
+  reader->token_len = 0;
+  reader_emit(reader, datum);
+}
+
+static void reader_open_list(reader_t *reader) {
+  if (reader->depth == reader->num_levels) {
+    size_t capacity = reader->num_levels;
+    reader->levels = (reader_level_t*)grow_array(reader->levels, &capacity, sizeof(reader_level_t));
+    memset(&reader->levels[reader->num_levels], 0, (capacity - reader->num_levels) * sizeof(reader_level_t));
+    reader->num_levels = capacity;
+  }
+  reader_level_t *level = &reader->levels[reader->depth++];
+  level->count = 0;
+  level->open = reader->at;
+}
+
+static void reader_close_list(reader_t *reader) {
+  ASSERT_OR_ERROR(reader->depth > 0, "Unbalanced )");
+  reader_level_t *level = &reader->levels[--reader->depth];
+  object_t *list = items_into_list(level->items, level->count);
+  if (g_srcloc_enabled && list->type == SCHEME_CONS) {
+    srcloc_note(list, level->open);
+    object_t *rest = cdr(list);
+    for (size_t i = 1; i < level->count; i++, rest = cdr(rest)) {
+      srcloc_note(rest, level->starts[i]);
+    }
+  }
+  reader->at = level->open;
+  reader_emit(reader, list);
+}
+
+// Outside strings, the reader's whitespace and line breaks separate tokens
+static bool reader_is_separator(utf8proc_int32_t codepoint) {
+  return codepoint == '\n' || codepoint == '\r' || codepoint == '\t' || is_whitespace(codepoint, NULL);
+}
+
+static void reader_character(reader_t *reader, const char *bytes, size_t len, utf8proc_int32_t codepoint) {
+  bool separator = codepoint == '(' || codepoint == ')' || codepoint == '"' || reader_is_separator(codepoint);
+  if (reader->token_kind == READER_TOKEN_ATOM && separator) reader_finish_token(reader);
+
+  if (codepoint == '(') {
+    reader_open_list(reader);
+  } else if (codepoint == ')') {
+    reader_close_list(reader);
+  } else if (codepoint == '"') {
+    reader->token_kind = READER_TOKEN_STRING;
+    reader->escaped = false;
+    reader_append(reader, bytes, len);
+  } else if (!separator) {
+    reader->token_kind = READER_TOKEN_ATOM;
+    reader_append(reader, bytes, len);
+  }
+}
+
+// Takes string bytes up to and including the closing quote and returns how many were used
+static size_t reader_string_bytes(reader_t *reader, const char *chunk, size_t len) {
+  bool closed = false;
+  size_t i = 0;
+  while (i < len && !closed) {
+    char c = chunk[i++];
+    if (reader->escaped) {
+      reader->escaped = false;
+    } else if (c == '\\') {
+      reader->escaped = true;
+    } else if (c == '"') {
+      closed = true;
+    }
+  }
+  reader_append(reader, chunk, i);
+  if (closed) reader_finish_token(reader);
+  return i;
+}
+
+// ASCII bytes that belong to an atom; in ASCII only space and form feed are whitespace
+static inline bool reader_is_atom_byte(utf8proc_uint8_t byte) {
+  return byte > ' ' && byte < 0x80 && byte != '(' && byte != ')' && byte != '"';
+}
+
+static void reader_multibyte(reader_t *reader, utf8proc_uint8_t byte) {
+  if (reader->pending_len == 0) {
+    reader->pending_need = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : byte >= 0xC0 ? 2 : 1;
+  }
+  reader->pending[reader->pending_len++] = byte;
+  if (reader->pending_len < reader->pending_need) return;
+
+  utf8proc_int32_t codepoint;
+  utf8proc_ssize_t n = utf8proc_iterate(reader->pending, (utf8proc_ssize_t)reader->pending_len, &codepoint);
+  ASSERT_OR_ERROR(n == (utf8proc_ssize_t)reader->pending_len, "Invalid UTF-8 in input");
+  reader->pending_len = 0;
+  reader_character(reader, (const char*)reader->pending, (size_t)n, codepoint);
+}
+
+void reader_feed(reader_t *reader, const char *chunk, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (reader->token_kind == READER_TOKEN_STRING) {
+      i += reader_string_bytes(reader, &chunk[i], len - i);
+      continue;
+    }
+
+    utf8proc_uint8_t byte = (utf8proc_uint8_t)chunk[i];
+    if (reader->pending_len == 0 && reader_is_atom_byte(byte)) {
+      // Copy a run of plain atom bytes at once
+      size_t start = i;
+      while (i < len && reader_is_atom_byte((utf8proc_uint8_t)chunk[i])) i++;
+      reader->token_kind = READER_TOKEN_ATOM;
+      reader_append(reader, &chunk[start], i - start);
+      continue;
+    }
+    if (byte >= 0x80 || reader->pending_len > 0) {
+      reader_multibyte(reader, byte);
+    } else {
+      reader_character(reader, &chunk[i], 1, byte);
+    }
+    i++;
+  }
+}
+
+object_t *reader_next(reader_t *reader) {
+  if (reader->ready_count == 0) return NULL;
+  object_t *datum = reader->ready[reader->ready_head++];
+  if (--reader->ready_count == 0) reader->ready_head = 0;
+  return datum;
+}
+
+bool reader_finish(reader_t *reader) {
+  ASSERT_OR_ERROR(reader->pending_len == 0, "Input ends inside a character");
+  if (reader->token_kind == READER_TOKEN_ATOM) reader_finish_token(reader);
+  return reader->depth == 0 && reader->token_kind == READER_TOKEN_NONE;
+}
+
+/*
+ * Parallel reading. The inputs are cut into segments at top-level form
+ * boundaries and worker threads lex each segment into a tape of its own:
+ * parentheses, numbers already converted, strings already unescaped and symbols
+ * already hashed. Objects are made from the tapes in segment order on the calling
+ * thread, since the heap and symbol table are not shared between threads.
+ */
+#define PARALLEL_SEGMENT_MIN_SIZE (1 << 16)
+#define PARALLEL_SEGMENTS_PER_THREAD 4
+#define PARALLEL_MAX_THREADS 64
+
+typedef enum tape_tag_e {
+  TAPE_OPEN,
+  TAPE_CLOSE,
+  TAPE_FIXNUM,
+  TAPE_FLONUM,
+  TAPE_STRING,
+  TAPE_SYMBOL,
+  // Where the next datum starts in its source, only while locations are recorded
+  TAPE_AT
+} tape_tag_t;
+
+typedef struct tape_s {
+  char *bytes;
+  size_t len;
+  size_t capacity;
+} tape_t;
+
+typedef struct read_segment_s {
+  size_t source;
+  const char *text;
+  size_t len;
+  tape_t tape;
+} read_segment_t;
+
+typedef struct read_job_s {
+  read_segment_t *segments;
+  size_t num_segments;
+  size_t next;
+} read_job_t;
+
+static char *tape_reserve(tape_t *tape, size_t size) {
+  while (tape->len + size > tape->capacity) {
+    tape->bytes = (char*)grow_array(tape->bytes, &tape->capacity, 1);
+  }
+  char *at = &tape->bytes[tape->len];
+  tape->len += size;
+  return at;
+}
+
+static void tape_put(tape_t *tape, tape_tag_t tag, const void *payload, size_t size) {
+  char *at = tape_reserve(tape, 1 + size);
+  at[0] = (char)tag;
+  if (size > 0) memcpy(at + 1, payload, size);
+}
+
+// Returns the end of the atom starting at i, using the push reader's separators
+static size_t lex_atom_end(const char *text, size_t i, size_t len) {
+  while (i < len) {
+    utf8proc_uint8_t byte = (utf8proc_uint8_t)text[i];
+    if (reader_is_atom_byte(byte)) {
+      i++;
+      continue;
+    }
+    if (byte == '(' || byte == ')' || byte == '"') break;
+    if (byte < 0x80) {
+      if (reader_is_separator(byte)) break;
+      i++;
+      continue;
+    }
+
+    utf8proc_int32_t codepoint;
+    utf8proc_ssize_t n = utf8proc_iterate((const utf8proc_uint8_t*)&text[i], (utf8proc_ssize_t)(len - i), &codepoint);
+    ASSERT_OR_ERROR(n > 0, "Invalid UTF-8 in input");
+    if (reader_is_separator(codepoint)) break;
+    i += (size_t)n;
+  }
+  return i;
+}
+
+static inline void tape_put_at(tape_t *tape, bool locate, const char *at) {
+  if (locate) tape_put(tape, TAPE_AT, &at, sizeof(at));
+}
+
+static void lex_segment(read_segment_t *segment) {
+  const char *text = segment->text;
+  size_t len = segment->len;
+  tape_t *tape = &segment->tape;
+  bool locate = g_srcloc_enabled;
+  size_t depth = 0;
+  size_t i = 0;
+  while (i < len) {
+    utf8proc_uint8_t byte = (utf8proc_uint8_t)text[i];
+    if (byte == '(') {
+      tape_put_at(tape, locate, &text[i]);
+      tape_put(tape, TAPE_OPEN, NULL, 0);
+      depth++;
+      i++;
+    } else if (byte == ')') {
+      ASSERT_OR_ERROR(depth > 0, "Unbalanced )");
+      tape_put(tape, TAPE_CLOSE, NULL, 0);
+      depth--;
+      i++;
+    } else if (byte == '"') {
+      size_t newlen;
+      ssize_t end = scan_string(&text[i], len - i, NULL, 0, &newlen);
+      ASSERT_OR_ERROR(end >= 0, "Bad string scan");
+      tape_put_at(tape, locate, &text[i]);
+      size_t size = newlen - 1;
+      char *at = tape_reserve(tape, 1 + sizeof(size) + newlen);
+      at[0] = (char)TAPE_STRING;
+      memcpy(at + 1, &size, sizeof(size));
+      char *dst = at + 1 + sizeof(size);
+      ASSERT_OR_ERROR(scan_string(&text[i], len - i, &dst, newlen, NULL) == end, "Bad string scan");
+      // The terminator is not kept on the tape
+      tape->len--;
+      i += (size_t)end;
+    } else if (byte < 0x80 && reader_is_separator(byte)) {
+      i++;
+    } else {
+      size_t end = lex_atom_end(text, i, len);
+      if (end == i) {
+        // A multibyte separator
+        utf8proc_int32_t codepoint;
+        i += (size_t)utf8proc_iterate((const utf8proc_uint8_t*)&text[i], (utf8proc_ssize_t)(len - i), &codepoint);
+        continue;
+      }
+
+      tape_put_at(tape, locate, &text[i]);
+      int64_t number;
+      double dnumber;
+      switch (read_number(&text[i], end - i, &number, &dnumber)) {
+        case NUMBER_FIXNUM: {
+          tape_put(tape, TAPE_FIXNUM, &number, sizeof(number));
+          break;
+        }
+        case NUMBER_FLONUM: {
+          tape_put(tape, TAPE_FLONUM, &dnumber, sizeof(dnumber));
+          break;
+        }
+        case NUMBER_NONE: {
+          // Hashed here so the main thread only probes the symbol table
+          size_t size = end - i;
+          uint64_t hash = hash_bytes(&text[i], size);
+          char *at = tape_reserve(tape, 1 + sizeof(size) + sizeof(hash) + size);
+          at[0] = (char)TAPE_SYMBOL;
+          memcpy(at + 1, &size, sizeof(size));
+          memcpy(at + 1 + sizeof(size), &hash, sizeof(hash));
+          memcpy(at + 1 + sizeof(size) + sizeof(hash), &text[i], size);
+          break;
+        }
+      }
+      i = end;
+    }
+  }
+  ASSERT_OR_ERROR(depth == 0, "Input ends inside a datum");
+}
+
+static void *read_worker(void *arg) {
+  read_job_t *job = (read_job_t*)arg;
+  for (;;) {
+    size_t idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (idx >= job->num_segments) break;
+    lex_segment(&job->segments[idx]);
+  }
+  return NULL;
+}
+
+// Makes the tape's objects, handing each complete top-level datum to the reader's ready queue
+static void replay_tape(reader_t *reader, tape_t *tape) {
+  size_t i = 0;
+  while (i < tape->len) {
+    tape_tag_t tag = (tape_tag_t)tape->bytes[i++];
+    switch (tag) {
+      case TAPE_OPEN: {
+        reader_open_list(reader);
+        break;
+      }
+      case TAPE_CLOSE: {
+        reader_close_list(reader);
+        break;
+      }
+      case TAPE_FIXNUM: {
+        int64_t number;
+        memcpy(&number, &tape->bytes[i], sizeof(number));
+        i += sizeof(number);
+        reader_emit(reader, g_intern_enabled ? intern_number(number) : allocate_number(number));
+        break;
+      }
+      case TAPE_FLONUM: {
+        double number;
+        memcpy(&number, &tape->bytes[i], sizeof(number));
+        i += sizeof(number);
+        reader_emit(reader, g_intern_enabled ? intern_double(number) : allocate_double(number));
+        break;
+      }
+      case TAPE_STRING: {
+        size_t size;
+        memcpy(&size, &tape->bytes[i], sizeof(size));
+        i += sizeof(size);
+        const char *text = &tape->bytes[i];
+        i += size;
+        if (g_intern_enabled) {
+          reader_emit(reader, intern_string(text, size));
+        } else {
+          string_entry_t *entry;
+          object_t *string = allocate_string(size, &entry);
+          memcpy(entry->str, text, size);
+          entry->str[size] = '\0';
+          string_note_contents(entry);
+          reader_emit(reader, string);
+        }
+        break;
+      }
+      case TAPE_SYMBOL: {
+        size_t size;
+        uint64_t hash;
+        memcpy(&size, &tape->bytes[i], sizeof(size));
+        i += sizeof(size);
+        memcpy(&hash, &tape->bytes[i], sizeof(hash));
+        i += sizeof(hash);
+        reader_emit(reader, symboln_hashed(&tape->bytes[i], size, hash));
+        i += size;
+        break;
+      }
+      case TAPE_AT: {
+        memcpy(&reader->at, &tape->bytes[i], sizeof(reader->at));
+        i += sizeof(reader->at);
+        break;
+      }
+    }
+  }
+}
+
+typedef struct segment_list_s {
+  read_segment_t *segments;
+  size_t count;
+  size_t capacity;
+} segment_list_t;
+
+static void add_segment(segment_list_t *list, size_t source, const char *text, size_t len) {
+  if (list->count == list->capacity) {
+    list->segments = (read_segment_t*)grow_array(list->segments, &list->capacity, sizeof(read_segment_t));
+  }
+  list->segments[list->count++] = (read_segment_t){source, text, len, {NULL, 0, 0}};
+}
+
+// Splits a source after top-level forms into segments of about target bytes
+static void segment_source(segment_list_t *list, size_t source, const char *text, size_t len, size_t target) {
+  size_t start = 0;
+  size_t depth = 0;
+  bool in_string = false;
+  bool escaped = false;
+  for (size_t i = 0; i < len; i++) {
+    char c = text[i];
+    if (in_string) {
+      if (escaped) escaped = false;
+      else if (c == '\\') escaped = true;
+      else if (c == '"') in_string = false;
+      continue;
+    }
+    if (c == '"') in_string = true;
+    else if (c == '(') depth++;
+    else if (c == ')' && depth > 0) depth--;
+
+    // An ASCII separator or a closing parenthesis at depth 0 always ends a token
+    bool boundary = depth == 0 && (c == ')' || c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f');
+    if (boundary && i + 1 - start >= target) {
+      add_segment(list, source, &text[start], i + 1 - start);
+      start = i + 1;
+    }
+  }
+  if (start < len) add_segment(list, source, &text[start], len - start);
+}
+
+object_t **read_sources_parallel(const read_source_t *sources, size_t num_sources, int num_threads, size_t *outcount) {
+  if (num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = MAX(1, MIN(num_threads, PARALLEL_MAX_THREADS));
+
+  size_t total = 0;
+  for (size_t i = 0; i < num_sources; i++) total += sources[i].len;
+  size_t target = MAX((size_t)PARALLEL_SEGMENT_MIN_SIZE, total / ((size_t)num_threads * PARALLEL_SEGMENTS_PER_THREAD));
+
+  segment_list_t list = {NULL, 0, 0};
+  for (size_t i = 0; i < num_sources; i++) {
+    segment_source(&list, i, sources[i].text, sources[i].len, target);
+  }
+  read_segment_t *segments = list.segments;
+  size_t num_segments = list.count;
+
+  read_job_t job = {segments, num_segments, 0};
+  // The calling thread lexes too, so it needs one fewer worker
+  size_t num_workers = num_segments == 0 ? 0 : MIN((size_t)num_threads, num_segments) - 1;
+  pthread_t workers[PARALLEL_MAX_THREADS];
+  for (size_t i = 0; i < num_workers; i++) {
+    ASSERT_OR_ERROR(pthread_create(&workers[i], NULL, &read_worker, &job) == 0, "Could not start reader thread");
+  }
+  read_worker(&job);
+  for (size_t i = 0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  reader_t *reader = make_reader();
+  for (size_t i = 0; i < num_segments; i++) {
+    const read_source_t *source = &sources[segments[i].source];
+    bool first = i == 0 || segments[i - 1].source != segments[i].source;
+    if (g_srcloc_enabled && first) {
+      if (source->name != NULL) srcloc_begin_source(source->name, source->text, source->len);
+      else srcloc_end_source();
+    }
+    replay_tape(reader, &segments[i].tape);
+    free(segments[i].tape.bytes);
+  }
+  if (g_srcloc_enabled) srcloc_end_source();
+  free(segments);
+
+  size_t count = reader->ready_count;
+  object_t **forms = (object_t**)malloc(MAX(count, 1) * sizeof(object_t*));
+  ASSERT_OR_ERROR(forms != NULL, "Could not allocate forms");
+  for (size_t i = 0; i < count; i++) {
+    forms[i] = reader_next(reader);
+  }
+  destroy_reader(reader);
+
+  *outcount = count;
+  return forms;
+}
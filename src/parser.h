@@ -9,4 +9,38 @@ SCHEMIN_PARSER_H
 object_t* valid_exp_into_object(const char *exp, size_t len);
 bool quick_verify_scheme(const char *exp, size_t len);
 
+/*
+ * Push reader: input is fed in chunks of any size and each top-level datum is
+ * available from reader_next as soon as its last byte has been fed. Open
+ * lists, partial tokens and split UTF-8 characters carry over between chunks,
+ * so only the token being read is buffered. A top-level atom is complete once
+ * a separator follows it or reader_finish is called. Line breaks and tabs
+ * separate tokens here, and parentheses and quotes end an atom.
+ */
+typedef struct reader_s reader_t;
+
+reader_t *make_reader(void);
+void destroy_reader(reader_t *reader);
+void reader_feed(reader_t *reader, const char *chunk, size_t len);
+// Returns the next complete datum, or NULL until more input is fed
+object_t *reader_next(reader_t *reader);
+// Ends the input; returns false if it stopped inside a datum
+bool reader_finish(reader_t *reader);
+
+typedef struct read_source_s {
+  const char *text;
+  size_t len;
+  // For source locations; may be NULL
+  const char *name;
+} read_source_t;
+
+/*
+ * Reads every top-level datum of the sources, in order, into a malloc'd array
+ * of *outcount forms. Sources are split at top-level forms and lexed on up to
+ * num_threads threads (0 for one per CPU); objects are still made on the
+ * calling thread. Tokens follow the push reader's rules, and each source must
+ * hold only complete data.
+ */
+object_t **read_sources_parallel(const read_source_t *sources, size_t num_sources, int num_threads, size_t *outcount);
+
 #endif
@@ -1,46 +1,29 @@
 #include "prettyprint.h"
 #include "memory.h"
+#include "srcloc.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static char *new_str_with_word_replaced(const char *s, const char *old,
-                                        const char *new) {
-  char *result;
-  size_t i, cnt = 0;
-  size_t newlen = strlen(new);
-  size_t oldlen = strlen(old);
+#define LOCATION_LEN 256
 
-  for (i = 0; s[i] != '\0'; i++) {
-    if (strstr(&s[i], old) == &s[i]) {
-      cnt++;
-
-      i += oldlen - 1;
-    }
+// Strings are not NUL-terminated when they are slices of another string
+static void print_escaped(const char *s, size_t len) {
+  size_t run = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] != '"') continue;
+    fwrite(&s[run], 1, i - run, stdout);
+    fputs("\\\"", stdout);
+    run = i + 1;
   }
-
-  result = (char *)malloc(i + cnt * (newlen - oldlen) + 1);
-
-  i = 0;
-  while (*s) {
-    if (strstr(s, old) == s) {
-      strcpy(&result[i], new);
-      i += newlen;
-      s += oldlen;
-    } else {
-      result[i++] = *s++;
-    }
-  }
-
-  result[i] = '\0';
-  return result;
+  fwrite(&s[run], 1, len - run, stdout);
 }
 
 static void print_cons(object_t *cons);
 
 void print_object(object_t *object) {
-  switch (object->type) {
+  switch (object_type(object)) {
     case SCHEME_CONS: {
       print_cons(object);
       break;
@@ -57,8 +40,9 @@ void print_object(object_t *object) {
     }
     case SCHEME_STRING: {
       string_entry_t *entry = get_string_entry(object);
-      const char *escaped = new_str_with_word_replaced(entry->str, "\"", "\\\"");
-      printf("\"%s\"", escaped);
+      putchar('"');
+      print_escaped(entry->str, entry->len);
+      putchar('"');
       break;
     }
     case SCHEME_LAMBDA: {
@@ -79,14 +63,62 @@ void print_object(object_t *object) {
       printf("%0.3f", number);
       break;
     }
+    case SCHEME_EXTENDED: {
+      printf("<object>");
+      break;
+    }
+    case SCHEME_HASH_TABLE: {
+      printf("<hash-table>");
+      break;
+    }
+    case SCHEME_RECORD_TYPE: {
+      symbol_entry_t *name = get_symbol_entry(get_record_type_entry(object)->name);
+      printf("<record-type %s>", name->sym);
+      break;
+    }
+    case SCHEME_RECORD: {
+      symbol_entry_t *name = get_symbol_entry(get_record_type_entry(get_record_type(object))->name);
+      printf("<record %s>", name->sym);
+      break;
+    }
+    case SCHEME_RECORD_PROCEDURE: {
+      symbol_entry_t *name = get_symbol_entry(get_record_type_entry(get_record_procedure_entry(object)->type)->name);
+      printf("<record-procedure %s>", name->sym);
+      break;
+    }
   }
 }
 
 static void print_cons(object_t *cons) {
-  cons_entry_t *entry = get_cons_entry(cons);
   printf("(");
-  print_object(entry->car);
+  print_object(car(cons));
   printf(" ");
-  print_object(entry->cdr);
+  print_object(cdr(cons));
   printf(")");
 }
+
+// Lambdas read from a located source are told apart by where their body starts
+static void append_location(object_t *body, char *buf, size_t len, int n) {
+  if (!g_srcloc_enabled || body->type != SCHEME_CONS || n < 0 || (size_t)n >= len) return;
+  char loc[LOCATION_LEN];
+  if (srcloc_format(body, loc, sizeof(loc)) == 0) return;
+  snprintf(&buf[n], len - (size_t)n, " (%s)", loc);
+}
+
+void format_lambda_name(object_t *lambda, char *buf, size_t len) {
+  if (lambda == NULL) {
+    snprintf(buf, len, "<toplevel>");
+    return;
+  }
+
+  lambda_entry_t *entry = get_lambda_entry(lambda);
+  if (entry->name == NULL) {
+    int n = snprintf(buf, len, "<lambda #%lld>", (long long)lambda->number_or_index);
+    append_location(entry->body, buf, len, n);
+    return;
+  }
+
+  symbol_entry_t *sym = get_symbol_entry(entry->name);
+  int n = snprintf(buf, len, "%.*s", (int)sym->len, sym->sym);
+  append_location(entry->body, buf, len, n);
+}
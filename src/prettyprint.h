@@ -2,8 +2,10 @@
 #define SCHEMIN_PRETTYPRINT_H
 SCHEMIN_PRETTYPRINT_H
 
+#include <stddef.h>
 #include "scheme_types.h"
 
 void print_object(object_t *object);
+void format_lambda_name(object_t *lambda, char *buf, size_t len);
 
 #endif
@@ -1,21 +1,23 @@
 #include "primitives.h"
 #include <assert.h>
+#include <utf8proc.h>
 #include "memory.h"
+#include "strindex.h"
 #include "error.h"
 
-typedef struct primitive_mapping_s {
-  const char *name;
-  primitive_func func;
-} primitive_mapping_t;
+// string-append copies results up to this many bytes rather than making a rope
+#define STRING_ROPE_MIN_LEN 256
+
+static object_t *lg_sym_ok;
 
 static object_t *car_primitive(int argc, object_t *argv[]) {
-  ASSERT_OR_ERROR(argc == 1, "Expected 1 arg");
+  (void)argc;
   ASSERT_OR_ERROR(argv[0]->type == SCHEME_CONS, "Expected cons");
   return car(argv[0]);
 }
 
 static object_t *equal_primitive(int argc, object_t *argv[]) {
-  ASSERT_OR_ERROR(argc == 2, "bad argc");
+  (void)argc;
   ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER, "not a number");
   ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
 
@@ -56,18 +58,255 @@ static object_t *mul_primitive(int argc, object_t *argv[]) {
   return result;
 }
 
-static primitive_mapping_t primitives[] = {
-  {"car", car_primitive},
-  {"=", equal_primitive},
-  {"-", sub_primitive},
-  {"*", mul_primitive}
+static object_t *add_primitive(int argc, object_t *argv[]) {
+  int64_t value = 0;
+  for (int i = 0; i < argc; i++) {
+    ASSERT_OR_ERROR(argv[i]->type == SCHEME_NUMBER, "not a number");
+    value += argv[i]->number_or_index;
+  }
+
+  return allocate_number(value);
+}
+
+static object_t *less_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
+
+  return argv[0]->number_or_index < argv[1]->number_or_index ? g_true : g_false;
+}
+
+static object_t *greater_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
+
+  return argv[0]->number_or_index > argv[1]->number_or_index ? g_true : g_false;
+}
+
+static object_t *quotient_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->number_or_index != 0, "division by zero");
+
+  return allocate_number(argv[0]->number_or_index / argv[1]->number_or_index);
+}
+
+static object_t *remainder_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
+  ASSERT_OR_ERROR(argv[1]->number_or_index != 0, "division by zero");
+
+  return allocate_number(argv[0]->number_or_index % argv[1]->number_or_index);
+}
+
+static object_t *cdr_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_CONS, "Expected cons");
+  return cdr(argv[0]);
+}
+
+static object_t *cons_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return cons(argv[0], argv[1]);
+}
+
+static object_t *set_car_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_CONS, "Expected cons");
+  get_cons_entry(argv[0])->car = argv[1];
+  return lg_sym_ok;
+}
+
+static object_t *set_cdr_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_CONS, "Expected cons");
+  get_cons_entry(argv[0])->cdr = argv[1];
+  return lg_sym_ok;
+}
+
+static object_t *is_null_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return argv[0] == g_scheme_null ? g_true : g_false;
+}
+
+static object_t *is_pair_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return argv[0]->type == SCHEME_CONS ? g_true : g_false;
+}
+
+static object_t *is_eq_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return is_eq(argv[0], argv[1]) ? g_true : g_false;
+}
+
+static object_t *string_length_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_STRING, "not a string");
+  return allocate_number((int64_t)string_char_length(peek_string_entry(argv[0])));
+}
+
+// There is no character type, so a character is its code point
+static object_t *string_ref_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_STRING, "not a string");
+  ASSERT_OR_ERROR(argv[1]->type == SCHEME_NUMBER, "not a number");
+  string_entry_t *entry = get_string_entry(argv[0]);
+  int64_t k = argv[1]->number_or_index;
+  ASSERT_OR_ERROR(k >= 0 && (size_t)k < string_char_length(entry), "String index out of range");
+
+  size_t byte = string_byte_offset(entry, (size_t)k);
+  utf8proc_int32_t codepoint;
+  utf8proc_iterate_unsafe((const utf8proc_uint8_t*)&entry->str[byte], &codepoint);
+  return allocate_number(codepoint);
+}
+
+// Shares the bytes of the string rather than copying them
+static object_t *substring_primitive(int argc, object_t *argv[]) {
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_STRING, "not a string");
+  string_entry_t *entry = get_string_entry(argv[0]);
+  size_t chars = string_char_length(entry);
+  for (int i = 1; i < argc; i++) {
+    ASSERT_OR_ERROR(argv[i]->type == SCHEME_NUMBER, "not a number");
+  }
+  int64_t start = argv[1]->number_or_index;
+  int64_t end = argc > 2 ? argv[2]->number_or_index : (int64_t)chars;
+  ASSERT_OR_ERROR(0 <= start && start <= end && (size_t)end <= chars, "Substring out of range");
+
+  size_t start_byte = string_byte_offset(entry, (size_t)start);
+  size_t end_byte = string_byte_offset(entry, (size_t)end);
+  return allocate_string_slice(entry, start_byte, end_byte - start_byte, (size_t)(end - start));
+}
+
+/*
+ * Short results are copied. Longer ones are ropes over the parts, so building a
+ * string by repeated appends costs one copy, when the result is first used.
+ */
+static object_t *string_append_primitive(int argc, object_t *argv[]) {
+  size_t len = 0;
+  for (int i = 0; i < argc; i++) {
+    ASSERT_OR_ERROR(argv[i]->type == SCHEME_STRING, "not a string");
+    len += peek_string_entry(argv[i])->len;
+  }
+
+  if (len <= STRING_ROPE_MIN_LEN) {
+    string_entry_t *entry;
+    object_t *result = allocate_string(len, &entry);
+    size_t offset = 0;
+    for (int i = 0; i < argc; i++) {
+      copy_string_bytes(argv[i], &entry->str[offset]);
+      offset += peek_string_entry(argv[i])->len;
+    }
+    entry->str[len] = '\0';
+    string_note_contents(entry);
+    return result;
+  }
+
+  object_t *result = NULL;
+  int parts = 0;
+  for (int i = 0; i < argc; i++) {
+    string_entry_t *part = peek_string_entry(argv[i]);
+    if (part->len == 0) continue;
+    string_char_length(part);
+    result = result == NULL ? argv[i] : allocate_string_rope(result, argv[i]);
+    parts++;
+  }
+  if (parts == 1) {
+    string_entry_t *entry = get_string_entry(result);
+    return allocate_string_slice(entry, 0, entry->len, entry->chars);
+  }
+  return result;
+}
+
+// (string-join list [delimiter]), with a space between parts by default
+static object_t *string_join_primitive(int argc, object_t *argv[]) {
+  const char *delimiter = " ";
+  size_t delimiter_len = 1;
+  size_t delimiter_chars = 1;
+  if (argc > 1) {
+    ASSERT_OR_ERROR(argv[1]->type == SCHEME_STRING, "not a string");
+    string_entry_t *entry = get_string_entry(argv[1]);
+    delimiter = entry->str;
+    delimiter_len = entry->len;
+    delimiter_chars = string_char_length(entry);
+  }
+
+  size_t len = 0;
+  size_t chars = 0;
+  size_t count = 0;
+  object_t *rest = argv[0];
+  for (; rest->type == SCHEME_CONS; rest = cdr(rest), count++) {
+    object_t *part = car(rest);
+    ASSERT_OR_ERROR(part->type == SCHEME_STRING, "not a string");
+    string_entry_t *entry = peek_string_entry(part);
+    len += entry->len;
+    chars += string_char_length(entry);
+  }
+  ASSERT_OR_ERROR(rest == g_scheme_null, "not a list");
+  if (count > 1) {
+    len += (count - 1) * delimiter_len;
+    chars += (count - 1) * delimiter_chars;
+  }
+
+  string_entry_t *entry;
+  object_t *result = allocate_string(len, &entry);
+  size_t offset = 0;
+  for (rest = argv[0]; rest != g_scheme_null; rest = cdr(rest)) {
+    if (rest != argv[0]) {
+      memcpy(&entry->str[offset], delimiter, delimiter_len);
+      offset += delimiter_len;
+    }
+    copy_string_bytes(car(rest), &entry->str[offset]);
+    offset += peek_string_entry(car(rest))->len;
+  }
+  entry->str[len] = '\0';
+  entry->chars = chars;
+
+  return result;
+}
+
+#define FOLD_NUMERIC (PRIMITIVE_PURE | PRIMITIVE_NUMBER_ARGS)
+
+static const primitive_mapping_t primitives[] = {
+  {"car", car_primitive, 1, 1, PRIMITIVE_PURE | PRIMITIVE_PAIR_ARGS},
+  {"cdr", cdr_primitive, 1, 1, PRIMITIVE_PURE | PRIMITIVE_PAIR_ARGS},
+  {"cons", cons_primitive, 2, 2, 0},
+  {"set-car!", set_car_primitive, 2, 2, 0},
+  {"set-cdr!", set_cdr_primitive, 2, 2, 0},
+  {"null?", is_null_primitive, 1, 1, PRIMITIVE_PURE},
+  {"pair?", is_pair_primitive, 1, 1, PRIMITIVE_PURE},
+  {"eq?", is_eq_primitive, 2, 2, PRIMITIVE_PURE},
+  {"=", equal_primitive, 2, 2, FOLD_NUMERIC},
+  {"<", less_primitive, 2, 2, FOLD_NUMERIC},
+  {">", greater_primitive, 2, 2, FOLD_NUMERIC},
+  {"+", add_primitive, 0, PRIMITIVE_VARIADIC, FOLD_NUMERIC},
+  {"-", sub_primitive, 1, PRIMITIVE_VARIADIC, FOLD_NUMERIC},
+  {"*", mul_primitive, 1, PRIMITIVE_VARIADIC, FOLD_NUMERIC},
+  {"quotient", quotient_primitive, 2, 2, FOLD_NUMERIC | PRIMITIVE_NONZERO_DIVISOR},
+  {"remainder", remainder_primitive, 2, 2, FOLD_NUMERIC | PRIMITIVE_NONZERO_DIVISOR},
+  {"string-length", string_length_primitive, 1, 1, PRIMITIVE_PURE | PRIMITIVE_STRING_ARGS},
+  {"string-append", string_append_primitive, 0, PRIMITIVE_VARIADIC, PRIMITIVE_PURE | PRIMITIVE_STRING_ARGS},
+  {"string-ref", string_ref_primitive, 2, 2, 0},
+  {"substring", substring_primitive, 2, 3, 0},
+  {"string-join", string_join_primitive, 1, 2, 0}
 };
 
-int primitives_init(void) {
-  for (uint64_t idx = 0; idx < sizeof(primitives) / sizeof(primitive_mapping_t); idx++) {
-    primitive_mapping_t *mapping = &primitives[idx];
-    allocate_primitive(mapping->name, mapping->func, NULL);
+void install_primitives(const primitive_mapping_t *mappings, size_t count) {
+  for (size_t idx = 0; idx < count; idx++) {
+    const primitive_mapping_t *mapping = &mappings[idx];
+    primitive_entry_t *entry;
+    allocate_primitive(mapping->name, mapping->func, &entry);
+    entry->flags = mapping->flags;
+    entry->min_args = mapping->min_args;
+    entry->max_args = mapping->max_args;
   }
+}
+
+int primitives_init(void) {
+  lg_sym_ok = symbol("ok");
+  install_primitives(primitives, sizeof(primitives) / sizeof(primitive_mapping_t));
 
   return 0;
 }
@@ -2,10 +2,36 @@
 #define SCHEMIN_PRIMITIVES_H
 SCHEMIN_PRIMITIVES_H
 
+#include <stddef.h>
 #include "scheme_types.h"
 
 int primitives_init(void);
 
 typedef object_t * (*primitive_func)(int argc, object_t *argv[]);
 
+typedef struct primitive_mapping_s {
+  const char *name;
+  primitive_func func;
+  int16_t min_args;
+  int16_t max_args;
+  uint32_t flags;
+} primitive_mapping_t;
+
+// Registers every primitive of a table such as primitives[]
+void install_primitives(const primitive_mapping_t *mappings, size_t count);
+
+/*
+ * Flags from the primitives[] table. A pure primitive has no side effects and
+ * may share its result between calls, so the optimizer can fold it once its
+ * arguments are constants that satisfy the remaining flags.
+ */
+#define PRIMITIVE_PURE (1 << 0)
+#define PRIMITIVE_NUMBER_ARGS (1 << 1)
+#define PRIMITIVE_STRING_ARGS (1 << 2)
+#define PRIMITIVE_PAIR_ARGS (1 << 3)
+#define PRIMITIVE_NONZERO_DIVISOR (1 << 4)
+
+// max_args of a primitive that takes any number of arguments from min_args up
+#define PRIMITIVE_VARIADIC -1
+
 #endif
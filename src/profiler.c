@@ -0,0 +1,231 @@
+#include "profiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "memory.h"
+#include "prettyprint.h"
+#include "error.h"
+
+#define PROFILER_MAX_SAMPLES (1 << 16)
+#define PROFILER_SAMPLE_DEPTH 64
+#define PROFILER_NAME_LEN 128
+#define PROFILER_FOLDED_LEN (PROFILER_SAMPLE_DEPTH * PROFILER_NAME_LEN)
+
+typedef struct profiler_sample_s {
+  object_t *frames[PROFILER_SAMPLE_DEPTH];
+  int depth;
+  bool truncated;
+} profiler_sample_t;
+
+typedef struct profiler_entry_s {
+  object_t *lambda;
+  uint64_t self;
+  uint64_t total;
+  uint64_t last_sample;
+} profiler_entry_t;
+
+volatile bool g_profiler_active = false;
+object_t *g_profiler_shadow_stack[PROFILER_MAX_SHADOW_DEPTH];
+volatile sig_atomic_t g_profiler_shadow_depth = 0;
+
+static profiler_sample_t *lg_samples = NULL;
+static volatile sig_atomic_t lg_num_samples = 0;
+static volatile sig_atomic_t lg_dropped_samples = 0;
+static struct sigaction lg_previous_action;
+
+/*
+ * Runs in signal context: only copies the innermost frames of the shadow
+ * stack into a preallocated slot. All aggregation happens at write time.
+ */
+static void profiler_handle_sigprof(int sig) {
+  (void)sig;
+  sig_atomic_t idx = lg_num_samples;
+  if (idx >= PROFILER_MAX_SAMPLES) {
+    lg_dropped_samples = lg_dropped_samples + 1;
+    return;
+  }
+
+  int depth = (int)g_profiler_shadow_depth;
+  if (depth > PROFILER_MAX_SHADOW_DEPTH) depth = PROFILER_MAX_SHADOW_DEPTH;
+  int start = depth > PROFILER_SAMPLE_DEPTH ? depth - PROFILER_SAMPLE_DEPTH : 0;
+
+  profiler_sample_t *sample = &lg_samples[idx];
+  sample->truncated = start > 0;
+  sample->depth = depth - start;
+  for (int i = start; i < depth; i++) {
+    sample->frames[i - start] = g_profiler_shadow_stack[i];
+  }
+  lg_num_samples = idx + 1;
+}
+
+int profiler_start(int hz) {
+  ASSERT_OR_ERROR(hz > 0 && hz <= PROFILER_MAX_HZ, "Profiler frequency must be between 1 and 1000000");
+  if (lg_samples == NULL) {
+    lg_samples = (profiler_sample_t*)malloc(sizeof(profiler_sample_t) * PROFILER_MAX_SAMPLES);
+    ASSERT_OR_ERROR(lg_samples != NULL, "Could not allocate profiler samples");
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &profiler_handle_sigprof;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &lg_previous_action) != 0) {
+    return -1;
+  }
+
+  g_profiler_active = true;
+
+  // ITIMER_PROF counts process CPU time, so an idle interpreter takes no samples
+  struct itimerval timer;
+  long interval_us = 1000000 / hz;
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    g_profiler_active = false;
+    sigaction(SIGPROF, &lg_previous_action, NULL);
+    return -1;
+  }
+
+  return 0;
+}
+
+void profiler_stop(void) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &lg_previous_action, NULL);
+  g_profiler_active = false;
+}
+
+void profiler_reset(void) {
+  lg_num_samples = 0;
+  lg_dropped_samples = 0;
+}
+
+static profiler_entry_t *find_entry(profiler_entry_t *entries, size_t *count, object_t *lambda) {
+  for (size_t i = 0; i < *count; i++) {
+    if (entries[i].lambda == lambda) return &entries[i];
+  }
+
+  profiler_entry_t *entry = &entries[(*count)++];
+  entry->lambda = lambda;
+  entry->self = 0;
+  entry->total = 0;
+  entry->last_sample = UINT64_MAX;
+  return entry;
+}
+
+static int compare_entries_by_self(const void *a, const void *b) {
+  const profiler_entry_t *x = (const profiler_entry_t*)a;
+  const profiler_entry_t *y = (const profiler_entry_t*)b;
+  if (x->self != y->self) return x->self < y->self ? 1 : -1;
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+void profiler_write_flat(FILE *out) {
+  uint64_t num_samples = (uint64_t)lg_num_samples;
+  memory_stats_t stats;
+  memory_get_stats(&stats);
+  // One entry per lambda ever allocated plus the toplevel
+  size_t capacity = (size_t)stats.lambdas + 1;
+  profiler_entry_t *entries = (profiler_entry_t*)malloc(sizeof(profiler_entry_t) * capacity);
+  size_t count = 0;
+
+  for (uint64_t i = 0; i < num_samples; i++) {
+    profiler_sample_t *sample = &lg_samples[i];
+    object_t *leaf = sample->depth > 0 ? sample->frames[sample->depth - 1] : NULL;
+    find_entry(entries, &count, leaf)->self++;
+
+    for (int f = 0; f < sample->depth; f++) {
+      profiler_entry_t *entry = find_entry(entries, &count, sample->frames[f]);
+      // Recursive frames count once towards the inclusive total
+      if (entry->last_sample != i) {
+        entry->total++;
+        entry->last_sample = i;
+      }
+    }
+  }
+
+  qsort(entries, count, sizeof(profiler_entry_t), compare_entries_by_self);
+
+  fprintf(out, "%llu samples", (unsigned long long)num_samples);
+  if (lg_dropped_samples > 0) {
+    fprintf(out, " (%llu dropped)", (unsigned long long)lg_dropped_samples);
+  }
+  fprintf(out, "\n%8s %7s %8s %7s  %s\n", "self", "self%", "total", "total%", "lambda");
+  for (size_t i = 0; i < count; i++) {
+    profiler_entry_t *entry = &entries[i];
+    char name[PROFILER_NAME_LEN];
+    format_lambda_name(entry->lambda, name, sizeof(name));
+    double denom = num_samples > 0 ? (double)num_samples : 1.0;
+    fprintf(out, "%8llu %6.2f%% %8llu %6.2f%%  %s\n",
+            (unsigned long long)entry->self, (double)entry->self * 100.0 / denom,
+            (unsigned long long)entry->total, (double)entry->total * 100.0 / denom, name);
+  }
+
+  free(entries);
+}
+
+static int compare_strings(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void profiler_write_folded(FILE *out) {
+  uint64_t num_samples = (uint64_t)lg_num_samples;
+  if (num_samples == 0) return;
+
+  char **stacks = (char**)malloc(sizeof(char*) * num_samples);
+  for (uint64_t i = 0; i < num_samples; i++) {
+    profiler_sample_t *sample = &lg_samples[i];
+    char buf[PROFILER_FOLDED_LEN];
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "%s", sample->truncated ? "<truncated>" : "<toplevel>");
+    for (int f = 0; f < sample->depth && len < sizeof(buf); f++) {
+      char name[PROFILER_NAME_LEN];
+      format_lambda_name(sample->frames[f], name, sizeof(name));
+      len += (size_t)snprintf(&buf[len], sizeof(buf) - len, ";%s", name);
+    }
+    stacks[i] = strdup(buf);
+  }
+
+  qsort(stacks, num_samples, sizeof(char*), compare_strings);
+
+  uint64_t run = 1;
+  for (uint64_t i = 1; i <= num_samples; i++) {
+    if (i < num_samples && strcmp(stacks[i], stacks[i - 1]) == 0) {
+      run++;
+      continue;
+    }
+    fprintf(out, "%s %llu\n", stacks[i - 1], (unsigned long long)run);
+    run = 1;
+  }
+
+  for (uint64_t i = 0; i < num_samples; i++) {
+    free(stacks[i]);
+  }
+  free(stacks);
+}
+
+int profiler_write_files(const char *prefix) {
+  size_t len = strlen(prefix) + sizeof(".folded");
+  char *path = (char*)malloc(len);
+
+  snprintf(path, len, "%s.txt", prefix);
+  FILE *flat = fopen(path, "w");
+  if (flat == NULL) {
+    free(path);
+    return -1;
+  }
+  profiler_write_flat(flat);
+  fclose(flat);
+
+  snprintf(path, len, "%s.folded", prefix);
+  FILE *folded = fopen(path, "w");
+  free(path);
+  if (folded == NULL) return -1;
+  profiler_write_folded(folded);
+  fclose(folded);
+
+  return 0;
+}
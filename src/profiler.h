@@ -0,0 +1,50 @@
+#ifndef SCHEMIN_PROFILER_H
+#define SCHEMIN_PROFILER_H
+SCHEMIN_PROFILER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <signal.h>
+#include "scheme_types.h"
+
+#define PROFILER_MAX_SHADOW_DEPTH 4096
+#define PROFILER_DEFAULT_HZ 997
+// setitimer counts in microseconds, so a faster rate would round the interval to zero
+#define PROFILER_MAX_HZ 1000000
+
+/*
+ * Shadow stack of lambda applications currently in progress. The evaluator
+ * only maintains it while g_profiler_active is set, so the cost with the
+ * profiler off is one predictable branch per lambda application.
+ */
+extern volatile bool g_profiler_active;
+extern object_t *g_profiler_shadow_stack[PROFILER_MAX_SHADOW_DEPTH];
+extern volatile sig_atomic_t g_profiler_shadow_depth;
+
+int profiler_start(int hz);
+void profiler_stop(void);
+void profiler_reset(void);
+void profiler_write_flat(FILE *out);
+void profiler_write_folded(FILE *out);
+int profiler_write_files(const char *prefix);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+
+static inline void profiler_push(object_t *lambda) {
+  sig_atomic_t depth = g_profiler_shadow_depth;
+  if (depth < PROFILER_MAX_SHADOW_DEPTH) {
+    g_profiler_shadow_stack[depth] = lambda;
+  }
+  // Publish the slot before the depth so a sample never sees a stale entry
+  __asm__ volatile("" ::: "memory");
+  g_profiler_shadow_depth = depth + 1;
+}
+
+static inline void profiler_pop(void) {
+  g_profiler_shadow_depth = g_profiler_shadow_depth - 1;
+}
+
+#pragma clang diagnostic pop
+
+#endif
@@ -0,0 +1,110 @@
+#include "quicken.h"
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+
+#define QUICKEN_PAGES_REALLOC_COUNT 16
+
+bool g_quicken_enabled = true;
+call_site_t **g_quicken_pages = NULL;
+uint64_t g_quicken_num_pages = 0;
+
+static quicken_stats_t lg_quicken_stats;
+
+int quicken_init(void) {
+  memset(&lg_quicken_stats, 0, sizeof(lg_quicken_stats));
+  return 0;
+}
+
+void quicken_set_enabled(bool enabled) {
+  g_quicken_enabled = enabled;
+}
+
+// Pages of sites are only created for the parts of the cons space that hold call forms
+call_site_t *quicken_allocate_site(uint64_t idx) {
+  uint64_t page = idx >> QUICKEN_PAGE_BITS;
+  if (page >= g_quicken_num_pages) {
+    uint64_t num_pages = page + QUICKEN_PAGES_REALLOC_COUNT;
+    g_quicken_pages = (call_site_t**)realloc(g_quicken_pages, num_pages * sizeof(call_site_t*));
+    ASSERT_OR_ERROR(g_quicken_pages != NULL, "Could not grow call site table");
+    memset(&g_quicken_pages[g_quicken_num_pages], 0, (num_pages - g_quicken_num_pages) * sizeof(call_site_t*));
+    g_quicken_num_pages = num_pages;
+  }
+
+  if (g_quicken_pages[page] == NULL) {
+    g_quicken_pages[page] = (call_site_t*)calloc(QUICKEN_PAGE_SIZE, sizeof(call_site_t));
+    ASSERT_OR_ERROR(g_quicken_pages[page] != NULL, "Could not allocate call site page");
+  }
+
+  return &g_quicken_pages[page][idx & (QUICKEN_PAGE_SIZE - 1)];
+}
+
+static int count_operands(object_t *exp) {
+  int argc = 0;
+  for (object_t *operands = cdr(exp); operands->type == SCHEME_CONS; operands = cdr(operands)) {
+    argc++;
+  }
+  return argc;
+}
+
+static quick_kind_t primitive_kind_for(primitive_entry_t *entry, int argc) {
+  if (argc != 2) return QUICK_PRIMITIVE;
+  if (strcmp(entry->name, "+") == 0) return QUICK_FIXNUM_ADD;
+  if (strcmp(entry->name, "-") == 0) return QUICK_FIXNUM_SUB;
+  if (strcmp(entry->name, "*") == 0) return QUICK_FIXNUM_MUL;
+  if (strcmp(entry->name, "=") == 0) return QUICK_FIXNUM_EQ;
+  if (strcmp(entry->name, "<") == 0) return QUICK_FIXNUM_LT;
+  if (strcmp(entry->name, ">") == 0) return QUICK_FIXNUM_GT;
+  return QUICK_PRIMITIVE;
+}
+
+/*
+ * Called after the generic path has evaluated the operator of exp to op. A
+ * symbol that was never bound outside the global frame can only resolve to
+ * its global binding, so op stays valid until that binding's version moves.
+ */
+void quicken_record(call_site_t *site, object_t *exp, object_t *op) {
+  object_t *head = car(exp);
+  if (head->type != SCHEME_SYMBOL) {
+    site->kind = QUICK_GENERIC;
+    return;
+  }
+
+  symbol_entry_t *entry = get_symbol_entry(head);
+  if (entry->flags & SYMBOL_LOCALLY_BOUND) {
+    site->kind = QUICK_GENERIC;
+    return;
+  }
+
+  site->op = op;
+  site->binding_version = &entry->binding_version;
+  site->version = entry->binding_version;
+  if (op->type == SCHEME_PRIMITIVE) {
+    site->kind = primitive_kind_for(get_primitive_entry(op), count_operands(exp));
+  } else {
+    site->kind = QUICK_GLOBAL;
+  }
+  lg_quicken_stats.quickened++;
+}
+
+void quicken_deoptimize(call_site_t *site) {
+  lg_quicken_stats.deoptimized++;
+  site->deoptimizations++;
+  site->kind = site->deoptimizations >= QUICKEN_MAX_DEOPTIMIZATIONS ? QUICK_GENERIC : QUICK_NONE;
+}
+
+void quicken_demote(call_site_t *site) {
+  lg_quicken_stats.demoted++;
+  site->kind = QUICK_PRIMITIVE;
+}
+
+void quicken_get_stats(quicken_stats_t *outstats) {
+  *outstats = lg_quicken_stats;
+}
+
+void quicken_write_report(FILE *out) {
+  fprintf(out, "call sites\n");
+  fprintf(out, "  %-16s %12llu\n", "quickened", (unsigned long long)lg_quicken_stats.quickened);
+  fprintf(out, "  %-16s %12llu\n", "deoptimized", (unsigned long long)lg_quicken_stats.deoptimized);
+  fprintf(out, "  %-16s %12llu\n", "demoted", (unsigned long long)lg_quicken_stats.demoted);
+}
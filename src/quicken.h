@@ -0,0 +1,125 @@
+#ifndef SCHEMIN_QUICKEN_H
+#define SCHEMIN_QUICKEN_H
+SCHEMIN_QUICKEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "scheme_types.h"
+#include "memory.h"
+
+/*
+ * Self-specialising call sites. The first time an application whose operator
+ * names a global binding runs, its site records the operator and the symbol's
+ * binding version, and picks a fixnum variant when the operator is one of the
+ * arithmetic or comparison primitives called with two arguments. Later runs
+ * skip the operator lookup for as long as the version still matches. A changed
+ * binding sends the site back to the generic path and a failed type guard
+ * demotes a fixnum variant to a plain primitive call.
+ *
+ * Sites live in a side table indexed by the cons index of the call form, so
+ * the code itself is never rewritten and every other pass still sees a plain
+ * application.
+ */
+
+#define QUICKEN_PAGE_BITS 12
+#define QUICKEN_PAGE_SIZE (1ULL << QUICKEN_PAGE_BITS)
+// Sites whose operator keeps being rebound stop being specialised
+#define QUICKEN_MAX_DEOPTIMIZATIONS 4
+
+typedef enum {
+  QUICK_NONE = 0,
+  // Operator is not a global variable, or is rebound too often; never retried
+  QUICK_GENERIC,
+  QUICK_GLOBAL,
+  QUICK_PRIMITIVE,
+  QUICK_FIXNUM_ADD,
+  QUICK_FIXNUM_SUB,
+  QUICK_FIXNUM_MUL,
+  QUICK_FIXNUM_EQ,
+  QUICK_FIXNUM_LT,
+  QUICK_FIXNUM_GT
+} quick_kind_t;
+
+typedef struct call_site_s {
+  object_t *op;
+  // The operator symbol's version word, which does not move once allocated
+  uint32_t *binding_version;
+  uint32_t version;
+  uint16_t kind;
+  uint16_t deoptimizations;
+} call_site_t;
+
+typedef struct quicken_stats_s {
+  uint64_t quickened;
+  uint64_t deoptimized;
+  uint64_t demoted;
+} quicken_stats_t;
+
+extern bool g_quicken_enabled;
+extern call_site_t **g_quicken_pages;
+extern uint64_t g_quicken_num_pages;
+
+int quicken_init(void);
+void quicken_set_enabled(bool enabled);
+call_site_t *quicken_allocate_site(uint64_t idx);
+void quicken_record(call_site_t *site, object_t *exp, object_t *op);
+void quicken_deoptimize(call_site_t *site);
+void quicken_demote(call_site_t *site);
+void quicken_get_stats(quicken_stats_t *outstats);
+void quicken_write_report(FILE *out);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+
+static inline call_site_t *quicken_site(object_t *exp) {
+  uint64_t idx = cons_index(exp);
+  uint64_t page = idx >> QUICKEN_PAGE_BITS;
+  if (__builtin_expect(page < g_quicken_num_pages && g_quicken_pages[page] != NULL, 1)) {
+    return &g_quicken_pages[page][idx & (QUICKEN_PAGE_SIZE - 1)];
+  }
+  return quicken_allocate_site(idx);
+}
+
+static inline bool quicken_fits(int64_t value) {
+  return value >= SCHEME_INT_MIN && value <= SCHEME_INT_MAX;
+}
+
+/*
+ * Fast path of a fixnum site. Returns NULL when an operand is not a fixnum or
+ * the result would not fit, leaving the primitive to produce the result.
+ */
+static inline object_t *quicken_fixnum(quick_kind_t kind, object_t *a, object_t *b) {
+  if (a->type != SCHEME_NUMBER || b->type != SCHEME_NUMBER) return NULL;
+  int64_t x = a->number_or_index;
+  int64_t y = b->number_or_index;
+  int64_t result;
+  switch (kind) {
+    case QUICK_FIXNUM_EQ: return x == y ? g_true : g_false;
+    case QUICK_FIXNUM_LT: return x < y ? g_true : g_false;
+    case QUICK_FIXNUM_GT: return x > y ? g_true : g_false;
+    case QUICK_FIXNUM_ADD: {
+      if (__builtin_add_overflow(x, y, &result) || !quicken_fits(result)) return NULL;
+      return allocate_number(result);
+    }
+    case QUICK_FIXNUM_SUB: {
+      if (__builtin_sub_overflow(x, y, &result) || !quicken_fits(result)) return NULL;
+      return allocate_number(result);
+    }
+    case QUICK_FIXNUM_MUL: {
+      if (__builtin_mul_overflow(x, y, &result) || !quicken_fits(result)) return NULL;
+      return allocate_number(result);
+    }
+    case QUICK_NONE:
+    case QUICK_GENERIC:
+    case QUICK_GLOBAL:
+    case QUICK_PRIMITIVE: {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+#pragma clang diagnostic pop
+
+#endif
@@ -0,0 +1,136 @@
+#include "records.h"
+#include <stdlib.h>
+#include "memory.h"
+#include "error.h"
+
+static object_t *lg_sym_ok;
+
+static uint32_t field_slot(record_type_entry_t *type, object_t *field) {
+  uint32_t slot = 0;
+  for (object_t *fields = type->fields; fields != g_scheme_null; fields = cdr(fields), slot++) {
+    if (is_eq(car(fields), field)) return slot;
+  }
+  error("No such record field");
+}
+
+object_t *apply_record_procedure(object_t *procedure, int argc, object_t *argv[]) {
+  record_procedure_entry_t *entry = get_record_procedure_entry(procedure);
+  switch ((record_procedure_kind_t)entry->kind) {
+    case RECORD_ACCESSOR: {
+      ASSERT_OR_ERROR(argc == 1, "Wrong number of arguments");
+      object_t **slots = record_slots_of_type(argv[0], entry->type);
+      ASSERT_OR_ERROR(slots != NULL, "Record of the wrong type");
+      return slots[entry->slot];
+    }
+    case RECORD_MODIFIER: {
+      ASSERT_OR_ERROR(argc == 2, "Wrong number of arguments");
+      object_t **slots = record_slots_of_type(argv[0], entry->type);
+      ASSERT_OR_ERROR(slots != NULL, "Record of the wrong type");
+      slots[entry->slot] = argv[1];
+      return lg_sym_ok;
+    }
+    case RECORD_PREDICATE: {
+      ASSERT_OR_ERROR(argc == 1, "Wrong number of arguments");
+      return record_slots_of_type(argv[0], entry->type) != NULL ? g_true : g_false;
+    }
+    case RECORD_CONSTRUCTOR: {
+      ASSERT_OR_ERROR((uint32_t)argc == entry->slot, "Wrong number of arguments");
+      // Fields the constructor does not take start out #f
+      object_t *record = allocate_record_instance(entry->type, g_false);
+      object_t **slots = record_slots_of_type(record, entry->type);
+      for (int i = 0; i < argc; i++) {
+        slots[entry->arg_slots[i]] = argv[i];
+      }
+      return record;
+    }
+  }
+  error("Unknown record procedure");
+}
+
+static object_t *make_procedure(object_t *type, record_procedure_kind_t kind, uint32_t slot, record_procedure_entry_t **outentry) {
+  record_procedure_entry_t *entry;
+  object_t *procedure = allocate_record_procedure(&entry);
+  entry->type = type;
+  entry->kind = kind;
+  entry->slot = slot;
+  if (outentry != NULL) *outentry = entry;
+  return procedure;
+}
+
+// (make-record-type name fields)
+static object_t *make_record_type_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  ASSERT_OR_ERROR(argv[0]->type == SCHEME_SYMBOL, "record type name must be a symbol");
+  int num_fields = list_length(argv[1]);
+  ASSERT_OR_ERROR(num_fields >= 0, "record fields must be a list");
+  for (object_t *fields = argv[1]; fields != g_scheme_null; fields = cdr(fields)) {
+    ASSERT_OR_ERROR(car(fields)->type == SCHEME_SYMBOL, "record field must be a symbol");
+    for (object_t *rest = cdr(fields); rest != g_scheme_null; rest = cdr(rest)) {
+      ASSERT_OR_ERROR(!is_eq(car(rest), car(fields)), "duplicate record field");
+    }
+  }
+
+  record_type_entry_t *entry;
+  object_t *type = allocate_record_type(&entry);
+  entry->name = argv[0];
+  entry->fields = argv[1];
+  entry->num_fields = (uint32_t)num_fields;
+  return type;
+}
+
+// (record-constructor type [fields]), taking every field in order by default
+static object_t *record_constructor_primitive(int argc, object_t *argv[]) {
+  record_type_entry_t *type = get_record_type_entry(argv[0]);
+  object_t *fields = argc > 1 ? argv[1] : type->fields;
+  int num_args = list_length(fields);
+  ASSERT_OR_ERROR(num_args >= 0, "record constructor fields must be a list");
+
+  record_procedure_entry_t *entry;
+  object_t *constructor = make_procedure(argv[0], RECORD_CONSTRUCTOR, (uint32_t)num_args, &entry);
+  if (num_args > 0) {
+    entry->arg_slots = (uint32_t*)malloc((size_t)num_args * sizeof(uint32_t));
+    ASSERT_OR_ERROR(entry->arg_slots != NULL, "Could not allocate record constructor");
+  }
+  for (int i = 0; i < num_args; i++, fields = cdr(fields)) {
+    entry->arg_slots[i] = field_slot(type, car(fields));
+  }
+  return constructor;
+}
+
+static object_t *record_predicate_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  get_record_type_entry(argv[0]);
+  return make_procedure(argv[0], RECORD_PREDICATE, 0, NULL);
+}
+
+static object_t *record_accessor_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  uint32_t slot = field_slot(get_record_type_entry(argv[0]), argv[1]);
+  return make_procedure(argv[0], RECORD_ACCESSOR, slot, NULL);
+}
+
+static object_t *record_modifier_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  uint32_t slot = field_slot(get_record_type_entry(argv[0]), argv[1]);
+  return make_procedure(argv[0], RECORD_MODIFIER, slot, NULL);
+}
+
+static object_t *is_record_primitive(int argc, object_t *argv[]) {
+  (void)argc;
+  return object_type(argv[0]) == SCHEME_RECORD ? g_true : g_false;
+}
+
+static const primitive_mapping_t primitives[] = {
+  {"make-record-type", make_record_type_primitive, 2, 2, 0},
+  {"record-constructor", record_constructor_primitive, 1, 2, 0},
+  {"record-predicate", record_predicate_primitive, 1, 1, 0},
+  {"record-accessor", record_accessor_primitive, 2, 2, 0},
+  {"record-modifier", record_modifier_primitive, 2, 2, 0},
+  {"record?", is_record_primitive, 1, 1, 0}
+};
+
+int records_init(void) {
+  lg_sym_ok = symbol("ok");
+  install_primitives(primitives, sizeof(primitives) / sizeof(primitive_mapping_t));
+  return 0;
+}
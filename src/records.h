@@ -0,0 +1,29 @@
+#ifndef SCHEMIN_RECORDS_H
+#define SCHEMIN_RECORDS_H
+SCHEMIN_RECORDS_H
+
+#include "scheme_types.h"
+
+/*
+ * Record types in the style of SRFI-9. A record keeps its type and its slots
+ * in one allocation, and the procedures generated for a type are objects that
+ * know the type and the slot they touch, so an accessor is one type check and
+ * one load at a fixed offset.
+ *
+ * (define-record-type <point> (make-point x y) point? (x point-x set-point-x!) ...)
+ * expands to calls of make-record-type, record-constructor, record-predicate,
+ * record-accessor and record-modifier.
+ */
+
+typedef enum record_procedure_kind_e {
+  RECORD_CONSTRUCTOR,
+  RECORD_PREDICATE,
+  RECORD_ACCESSOR,
+  RECORD_MODIFIER
+} record_procedure_kind_t;
+
+int records_init(void);
+// Applies a procedure generated for a record type
+object_t *apply_record_procedure(object_t *procedure, int argc, object_t *argv[]);
+
+#endif
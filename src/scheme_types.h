@@ -4,20 +4,36 @@ SCHEMIN_SCHEME_TYPES_H
 
 #include <stdint.h>
 
+/*
+ * The first eight types are tags that fit the header's type field. An object
+ * tagged SCHEME_EXTENDED carries its real type, one of those after it, in an
+ * extended header; see object_type() in memory.h.
+ */
 typedef enum {
   SCHEME_NUMBER,
   SCHEME_STRING,
   SCHEME_SYMBOL,
   SCHEME_CONS,
-  SCHEME_NULL,
+  SCHEME_EXTENDED,
   SCHEME_LAMBDA,
   SCHEME_PRIMITIVE,
-  SCHEME_DOUBLE
+  SCHEME_DOUBLE,
+  SCHEME_NULL,
+  SCHEME_HASH_TABLE,
+  SCHEME_RECORD_TYPE,
+  SCHEME_RECORD,
+  SCHEME_RECORD_PROCEDURE
 } type_t;
 
+/*
+ * Header of every object. Numbers keep their value here; every other object
+ * keeps its allocation index, and its payload follows the header in the same
+ * record.
+ */
 typedef struct object_s {
   int64_t number_or_index : 61;
-  type_t type : 3;
+  // A type_t, always one of the first eight
+  uint64_t type : 3;
 } object_t;
 
 #pragma clang diagnostic push
@@ -1,11 +1,25 @@
+#include <getopt.h>
 #include <locale.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "parser.h"
 #include "prettyprint.h"
 #include "system.h"
 #include "error.h"
 #include "interpreter.h"
+#include "profiler.h"
+#include "instrument.h"
+#include "jit.h"
+#include "quicken.h"
+#include "intern.h"
+#include "srcloc.h"
+#include "memo.h"
+#include "module.h"
+
+#define SCHEMIN_MAX_MODULES 64
+#define SCHEMIN_READ_CHUNK_SIZE 4096
 
 static const char *statements[] = {
   "-1152921504606846976",
@@ -35,22 +49,190 @@ static const char *statements[] = {
   "(quote (somesym1 somesym2 somesym1))"
 };
 
+static char *read_file(const char *path, size_t *outlen) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(1);
+  }
+  size_t capacity = SCHEMIN_READ_CHUNK_SIZE;
+  size_t len = 0;
+  char *text = (char*)malloc(capacity);
+  ASSERT_OR_ERROR(text != NULL, "Could not allocate file buffer");
+  size_t n;
+  while ((n = fread(&text[len], 1, capacity - len, file)) > 0) {
+    len += n;
+    if (len == capacity) {
+      capacity *= 2;
+      text = (char*)realloc(text, capacity);
+      ASSERT_OR_ERROR(text != NULL, "Could not grow file buffer");
+    }
+  }
+  ASSERT_OR_ERROR(!ferror(file), "Could not read file");
+  fclose(file);
+  *outlen = len;
+  return text;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--profile PREFIX] [--profile-hz N] [--stats]\n"
+          "          [--trace FILE] [--trace-threshold-us N] [--jit-threshold N] [--no-quicken]\n"
+          "          [--intern-constants] [--load MODULE.so]... [--read-threads N]\n"
+          "          [--source-locations] [--stdin | FILE...]\n", argv0);
+}
+
+static void eval_and_print(object_t *exp_object) {
+  object_t *result = eval(exp_object);
+  print_object(result);
+  printf("\n");
+}
+
+// Evaluates each datum on stdin as soon as it has been read, so input can be piped in interactively
+static void run_stdin(void) {
+  reader_t *reader = make_reader();
+  char chunk[SCHEMIN_READ_CHUNK_SIZE];
+  for (;;) {
+    // read(2) returns what is available instead of waiting for a full chunk
+    ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+    ASSERT_OR_ERROR(n >= 0, "Could not read stdin");
+    if (n == 0) break;
+    reader_feed(reader, chunk, (size_t)n);
+    for (object_t *exp_object = reader_next(reader); exp_object != NULL; exp_object = reader_next(reader)) {
+      eval_and_print(exp_object);
+    }
+    fflush(stdout);
+  }
+  ASSERT_OR_ERROR(reader_finish(reader), "Input ends inside a datum");
+  for (object_t *exp_object = reader_next(reader); exp_object != NULL; exp_object = reader_next(reader)) {
+    eval_and_print(exp_object);
+  }
+  destroy_reader(reader);
+}
+
+// Reads every file before evaluating any of them, so lexing can run on all cores at once
+static void run_files(char **paths, int num_paths, int read_threads) {
+  read_source_t *sources = (read_source_t*)malloc((size_t)num_paths * sizeof(read_source_t));
+  ASSERT_OR_ERROR(sources != NULL, "Could not allocate sources");
+  for (int i = 0; i < num_paths; i++) {
+    sources[i].text = read_file(paths[i], &sources[i].len);
+    sources[i].name = paths[i];
+  }
+
+  size_t count;
+  object_t **forms = read_sources_parallel(sources, (size_t)num_paths, read_threads, &count);
+  for (int i = 0; i < num_paths; i++) {
+    free((char*)sources[i].text);
+  }
+  free(sources);
+
+  for (size_t i = 0; i < count; i++) {
+    eval_and_print(forms[i]);
+  }
+  free(forms);
+}
+
 int main(int argc, char *argv[]) {
   setlocale(LC_ALL, "");
-  
+
+  const char *profile_prefix = NULL;
+  int profile_hz = PROFILER_DEFAULT_HZ;
+  bool stats = false;
+  const char *trace_path = NULL;
+  uint64_t trace_threshold_us = 0;
+  long jit_threshold = JIT_DEFAULT_THRESHOLD;
+  bool quicken = true;
+  bool intern_constants = false;
+  bool from_stdin = false;
+  int read_threads = 0;
+  bool source_locations = false;
+  const char *modules[SCHEMIN_MAX_MODULES];
+  int num_modules = 0;
+
+  static const struct option options[] = {
+    {"profile", required_argument, NULL, 'p'},
+    {"profile-hz", required_argument, NULL, 'z'},
+    {"stats", no_argument, NULL, 's'},
+    {"trace", required_argument, NULL, 't'},
+    {"trace-threshold-us", required_argument, NULL, 'u'},
+    {"jit-threshold", required_argument, NULL, 'j'},
+    {"no-quicken", no_argument, NULL, 'q'},
+    {"intern-constants", no_argument, NULL, 'i'},
+    {"load", required_argument, NULL, 'l'},
+    {"stdin", no_argument, NULL, 'r'},
+    {"read-threads", required_argument, NULL, 'e'},
+    {"source-locations", no_argument, NULL, 'c'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p:st:h", options, NULL)) != -1) {
+    switch (opt) {
+      case 'p': profile_prefix = optarg; break;
+      case 'z': profile_hz = atoi(optarg); break;
+      case 's': stats = true; break;
+      case 't': trace_path = optarg; break;
+      case 'u': trace_threshold_us = strtoull(optarg, NULL, 10); break;
+      case 'j': jit_threshold = atol(optarg); break;
+      case 'q': quicken = false; break;
+      case 'i': intern_constants = true; break;
+      case 'l':
+        ASSERT_OR_ERROR(num_modules < SCHEMIN_MAX_MODULES, "Too many --load modules");
+        modules[num_modules++] = optarg;
+        break;
+      case 'r': from_stdin = true; break;
+      case 'e': read_threads = atoi(optarg); break;
+      case 'c': source_locations = true; break;
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  ASSERT_OR_ERROR(jit_threshold >= 0 && jit_threshold <= UINT32_MAX, "--jit-threshold out of range");
   ASSERT_OR_ERROR(system_init() == 0, "Could not init system");
+  jit_set_threshold((uint32_t)jit_threshold);
+  quicken_set_enabled(quicken);
+  intern_set_enabled(intern_constants);
+  srcloc_set_enabled(source_locations);
+  for (int i = 0; i < num_modules; i++) {
+    if (module_load(modules[i]) != 0) return 1;
+  }
+  if (profile_prefix != NULL) {
+    ASSERT_OR_ERROR(profiler_start(profile_hz) == 0, "Could not start profiler");
+  }
+  if (stats) instrument_enable_counting();
+  if (trace_path != NULL) {
+    ASSERT_OR_ERROR(instrument_start_trace(trace_path, trace_threshold_us) == 0, "Could not open trace file");
+  }
+
+  if (from_stdin) {
+    run_stdin();
+  } else if (optind < argc) {
+    run_files(&argv[optind], argc - optind, read_threads);
+  } else {
+    for (uint64_t i = 0; i < sizeof(statements) / sizeof(char*); i++) {
+      const char *statement = statements[i];
+      size_t test_size = strlen(statement);
+      if (!quick_verify_scheme(statement, test_size)) {
+        error("Invalid scheme\n");
+      }
 
-  for (uint64_t i = 0; i < sizeof(statements) / sizeof(char*); i++) {
-    const char *statement = statements[i];
-    size_t test_size = strlen(statement);
-    if (!quick_verify_scheme(statement, test_size)) {
-      error("Invalid scheme\n");
+      eval_and_print(valid_exp_into_object(statement, strlen(statement)));
     }
+  }
 
-    object_t *exp_object = valid_exp_into_object(statement, strlen(statement));
-    object_t *result = eval(exp_object);
-    print_object(result);
-    printf("\n");
+  if (profile_prefix != NULL) {
+    profiler_stop();
+    ASSERT_OR_ERROR(profiler_write_files(profile_prefix) == 0, "Could not write profile");
+  }
+  if (trace_path != NULL) instrument_stop_trace();
+  if (stats) {
+    instrument_write_report(stderr);
+    jit_write_report(stderr);
+    quicken_write_report(stderr);
+    intern_write_report(stderr);
+    memo_write_report(stderr);
   }
   return 0;
 }
@@ -0,0 +1,98 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "system.h"
+#include "error.h"
+
+#ifndef SCHEMIN_INCLUDE_DIR
+#define SCHEMIN_INCLUDE_DIR "."
+#endif
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [-c] [-I DIR] -o OUTPUT INPUT.scm\n", argv0);
+}
+
+static char *read_file(const char *path, size_t *outlen) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) return NULL;
+
+  size_t cap = 4096;
+  size_t len = 0;
+  char *data = (char*)malloc(cap);
+  ASSERT_OR_ERROR(data != NULL, "Could not allocate source buffer");
+  size_t n;
+  while ((n = fread(data + len, 1, cap - len, in)) > 0) {
+    len += n;
+    if (len == cap) {
+      cap *= 2;
+      data = (char*)realloc(data, cap);
+      ASSERT_OR_ERROR(data != NULL, "Could not grow source buffer");
+    }
+  }
+  fclose(in);
+
+  *outlen = len;
+  return data;
+}
+
+int main(int argc, char *argv[]) {
+  bool c_only = false;
+  const char *include_dir = SCHEMIN_INCLUDE_DIR;
+  const char *output = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "cI:o:h")) != -1) {
+    switch (opt) {
+      case 'c': c_only = true; break;
+      case 'I': include_dir = optarg; break;
+      case 'o': output = optarg; break;
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (output == NULL || optind != argc - 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const char *input = argv[optind];
+  size_t len;
+  char *source = read_file(input, &len);
+  if (source == NULL) {
+    perror(input);
+    return 1;
+  }
+
+  ASSERT_OR_ERROR(system_init() == 0, "Could not init system");
+
+  // Without -c the C goes next to the shared object and is kept for inspection
+  size_t c_path_len = strlen(output) + 3;
+  char *c_path = (char*)malloc(c_path_len);
+  ASSERT_OR_ERROR(c_path != NULL, "Could not allocate output path");
+  snprintf(c_path, c_path_len, c_only ? "%s" : "%s.c", output);
+
+  FILE *out = fopen(c_path, "w");
+  if (out == NULL) {
+    perror(c_path);
+    return 1;
+  }
+  compiler_stats_t stats;
+  int result = compile_to_c(source, len, input, out, &stats);
+  if (fclose(out) != 0 || result != 0) {
+    fprintf(stderr, "%s: could not write %s\n", input, c_path);
+    return 1;
+  }
+  fprintf(stderr, "%s: %zu functions compiled, %zu left to the interpreter\n", input, stats.compiled, stats.interpreted);
+
+  if (!c_only && build_module(include_dir, c_path, output) != 0) {
+    fprintf(stderr, "%s: C compiler failed on %s\n", input, c_path);
+    return 1;
+  }
+
+  free(c_path);
+  free(source);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "srcloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "error.h"
+
+#define SRCLOC_PAGES_REALLOC_COUNT 16
+#define SRCLOC_MAX_FILES UINT16_MAX
+#define SRCLOC_MAX_COLUMN UINT16_MAX
+
+// File 0 means the pair has no location
+typedef struct srcloc_entry_s {
+  uint32_t line;
+  uint16_t column;
+  uint16_t file;
+} srcloc_entry_t;
+
+bool g_srcloc_enabled = false;
+
+static srcloc_entry_t **lg_pages = NULL;
+static uint64_t lg_num_pages = 0;
+
+static char **lg_files = NULL;
+static size_t lg_num_files = 0;
+static size_t lg_files_capacity = 0;
+
+// The source being read: its file and the offset at which each line starts
+static uint16_t lg_current_file = 0;
+static const char *lg_text = NULL;
+static size_t lg_text_len = 0;
+static size_t *lg_line_starts = NULL;
+static size_t lg_num_lines = 0;
+static size_t lg_line_starts_capacity = 0;
+
+static object_t *lg_current_form = NULL;
+
+static void write_error_context(FILE *out) {
+  if (lg_current_form == NULL || lg_current_form->type != SCHEME_CONS) return;
+  srcloc_t loc;
+  if (!srcloc_lookup(lg_current_form, &loc)) return;
+  fprintf(out, "  in the form at %s:%u:%u\n", loc.file, loc.line, loc.column);
+}
+
+int srcloc_init(void) {
+  return 0;
+}
+
+void srcloc_set_enabled(bool enabled) {
+  g_srcloc_enabled = enabled;
+  g_error_context_func = enabled ? &write_error_context : NULL;
+}
+
+void srcloc_begin_source(const char *file, const char *text, size_t len) {
+  if (lg_num_files == lg_files_capacity) {
+    lg_files_capacity = lg_files_capacity == 0 ? SRCLOC_PAGES_REALLOC_COUNT : lg_files_capacity * 2;
+    lg_files = (char**)realloc(lg_files, lg_files_capacity * sizeof(char*));
+    ASSERT_OR_ERROR(lg_files != NULL, "Could not grow source file table");
+  }
+  ASSERT_OR_ERROR(lg_num_files < SRCLOC_MAX_FILES, "Too many source files");
+  lg_files[lg_num_files] = strdup(file);
+  ASSERT_OR_ERROR(lg_files[lg_num_files] != NULL, "Could not copy source file name");
+  lg_current_file = (uint16_t)++lg_num_files;
+
+  lg_text = text;
+  lg_text_len = len;
+  lg_num_lines = 0;
+  const char *line = text;
+  const char *end = text + len;
+  while (line != NULL) {
+    if (lg_num_lines == lg_line_starts_capacity) {
+      lg_line_starts_capacity = lg_line_starts_capacity == 0 ? SRCLOC_PAGE_SIZE : lg_line_starts_capacity * 2;
+      lg_line_starts = (size_t*)realloc(lg_line_starts, lg_line_starts_capacity * sizeof(size_t));
+      ASSERT_OR_ERROR(lg_line_starts != NULL, "Could not grow line table");
+    }
+    lg_line_starts[lg_num_lines++] = (size_t)(line - text);
+    const char *newline = (const char*)memchr(line, '\n', (size_t)(end - line));
+    line = newline != NULL ? newline + 1 : NULL;
+  }
+}
+
+void srcloc_end_source(void) {
+  lg_current_file = 0;
+  lg_text = NULL;
+  lg_text_len = 0;
+  lg_num_lines = 0;
+}
+
+static srcloc_entry_t *find_entry(uint64_t idx, bool create) {
+  uint64_t page = idx >> SRCLOC_PAGE_BITS;
+  if (page >= lg_num_pages) {
+    if (!create) return NULL;
+    uint64_t num_pages = page + SRCLOC_PAGES_REALLOC_COUNT;
+    lg_pages = (srcloc_entry_t**)realloc(lg_pages, num_pages * sizeof(srcloc_entry_t*));
+    ASSERT_OR_ERROR(lg_pages != NULL, "Could not grow location table");
+    memset(&lg_pages[lg_num_pages], 0, (num_pages - lg_num_pages) * sizeof(srcloc_entry_t*));
+    lg_num_pages = num_pages;
+  }
+
+  if (lg_pages[page] == NULL) {
+    if (!create) return NULL;
+    lg_pages[page] = (srcloc_entry_t*)calloc(SRCLOC_PAGE_SIZE, sizeof(srcloc_entry_t));
+    ASSERT_OR_ERROR(lg_pages[page] != NULL, "Could not allocate location page");
+  }
+
+  return &lg_pages[page][idx & (SRCLOC_PAGE_SIZE - 1)];
+}
+
+void srcloc_note(object_t *cons, const char *at) {
+  if (lg_current_file == 0 || at == NULL || at < lg_text || at >= lg_text + lg_text_len) return;
+  srcloc_entry_t *entry = find_entry(cons_index(cons), true);
+  if (entry->file != 0) return;
+
+  size_t offset = (size_t)(at - lg_text);
+  size_t lo = 0;
+  size_t hi = lg_num_lines;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lg_line_starts[mid] <= offset) lo = mid;
+    else hi = mid;
+  }
+
+  size_t column = offset - lg_line_starts[lo] + 1;
+  entry->line = (uint32_t)(lo + 1);
+  entry->column = (uint16_t)(column < SRCLOC_MAX_COLUMN ? column : SRCLOC_MAX_COLUMN);
+  entry->file = lg_current_file;
+}
+
+bool srcloc_lookup(object_t *cons, srcloc_t *outloc) {
+  srcloc_entry_t *entry = find_entry(cons_index(cons), false);
+  if (entry == NULL || entry->file == 0) return false;
+  outloc->file = lg_files[entry->file - 1];
+  outloc->line = entry->line;
+  outloc->column = entry->column;
+  return true;
+}
+
+size_t srcloc_format(object_t *cons, char *buf, size_t len) {
+  srcloc_t loc;
+  if (len == 0 || !srcloc_lookup(cons, &loc)) return 0;
+  int n = snprintf(buf, len, "%s:%u", loc.file, loc.line);
+  return n < 0 ? 0 : (size_t)n < len ? (size_t)n : len - 1;
+}
+
+void srcloc_set_current_form(object_t *form) {
+  lg_current_form = form;
+}
@@ -0,0 +1,46 @@
+#ifndef SCHEMIN_SRCLOC_H
+#define SCHEMIN_SRCLOC_H
+SCHEMIN_SRCLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scheme_types.h"
+
+/*
+ * Optional source locations for the pairs the reader makes. While enabled,
+ * reading a source registered with srcloc_begin_source records, for each list,
+ * where it opens against its first pair and where each later element starts
+ * against the pair holding it. So a lambda's body, which is the tail of the
+ * lambda form, has the location of its first expression.
+ *
+ * Locations live in a paged side table indexed by cons index, like call sites,
+ * so pairs themselves are unchanged and nothing is allocated while disabled.
+ * Lines and columns count from 1; columns count bytes.
+ */
+
+#define SRCLOC_PAGE_BITS 12
+#define SRCLOC_PAGE_SIZE (1ULL << SRCLOC_PAGE_BITS)
+
+typedef struct srcloc_s {
+  const char *file;
+  uint32_t line;
+  uint32_t column;
+} srcloc_t;
+
+extern bool g_srcloc_enabled;
+
+int srcloc_init(void);
+void srcloc_set_enabled(bool enabled);
+// Pairs read from text until srcloc_end_source are located in file, which is copied
+void srcloc_begin_source(const char *file, const char *text, size_t len);
+void srcloc_end_source(void);
+// Records that the pair was read at the given position of the current source, unless it already has a location
+void srcloc_note(object_t *cons, const char *at);
+bool srcloc_lookup(object_t *cons, srcloc_t *outloc);
+// Writes "file:line" for the pair, or nothing when it has no location; returns the length written
+size_t srcloc_format(object_t *cons, char *buf, size_t len);
+// The top-level form being evaluated, reported if an error aborts it
+void srcloc_set_current_form(object_t *form);
+
+#endif
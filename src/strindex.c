@@ -0,0 +1,80 @@
+#include "strindex.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+static inline bool is_continuation(char byte) {
+  return ((uint8_t)byte & 0xC0) == 0x80;
+}
+
+// Continuation bytes are 10xxxxxx, so every other byte starts a character
+static size_t count_chars(const char *str, size_t len) {
+  size_t continuations = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, &str[i], sizeof(word));
+    if ((word & HIGH_BITS) == 0) continue;
+    continuations += (size_t)__builtin_popcountll(word & ~(word << 1) & HIGH_BITS);
+  }
+  for (; i < len; i++) continuations += is_continuation(str[i]);
+  return len - continuations;
+}
+
+void string_note_contents(string_entry_t *entry) {
+  entry->chars = count_chars(entry->str, entry->len);
+}
+
+size_t string_char_length(string_entry_t *entry) {
+  if (entry->chars == STRING_CHARS_UNKNOWN) string_note_contents(entry);
+  return entry->chars;
+}
+
+static inline size_t skip_chars(const char *str, size_t byte, size_t count) {
+  for (; count > 0; count--) {
+    byte++;
+    while (is_continuation(str[byte])) byte++;
+  }
+  return byte;
+}
+
+static string_index_t *build_index(string_entry_t *entry) {
+  string_index_t *index = (string_index_t*)malloc(sizeof(string_index_t));
+  ASSERT_OR_ERROR(index != NULL, "Could not allocate string index");
+  index->num_marks = entry->chars / STRINDEX_STRIDE + 1;
+  index->marks = (size_t*)malloc(index->num_marks * sizeof(size_t));
+  ASSERT_OR_ERROR(index->marks != NULL, "Could not allocate string index");
+
+  size_t byte = 0;
+  index->marks[0] = 0;
+  for (size_t i = 1; i < index->num_marks; i++) {
+    byte = skip_chars(entry->str, byte, STRINDEX_STRIDE);
+    index->marks[i] = byte;
+  }
+  index->cursor_char = 0;
+  index->cursor_byte = 0;
+  return index;
+}
+
+size_t string_byte_offset(string_entry_t *entry, size_t k) {
+  size_t chars = string_char_length(entry);
+  ASSERT_OR_ERROR(k <= chars, "String index out of range");
+  if (chars == entry->len) return k;
+
+  string_index_t *index = entry->index;
+  if (index == NULL) index = entry->index = build_index(entry);
+
+  size_t from_char = k / STRINDEX_STRIDE * STRINDEX_STRIDE;
+  size_t byte = index->marks[k / STRINDEX_STRIDE];
+  if (index->cursor_char <= k && index->cursor_char > from_char) {
+    from_char = index->cursor_char;
+    byte = index->cursor_byte;
+  }
+  byte = skip_chars(entry->str, byte, k - from_char);
+  index->cursor_char = k;
+  index->cursor_byte = byte;
+  return byte;
+}
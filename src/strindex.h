@@ -0,0 +1,34 @@
+#ifndef SCHEMIN_STRINDEX_H
+#define SCHEMIN_STRINDEX_H
+SCHEMIN_STRINDEX_H
+
+#include <stddef.h>
+#include "memory.h"
+
+/*
+ * Character positions in UTF-8 strings. A string's characters are counted once,
+ * when it is made or on first use, and a pure-ASCII string, whose characters
+ * are its bytes, needs nothing more. Any other string gets a sparse index on
+ * its first indexed access: the byte offset of every STRINDEX_STRIDE-th
+ * character, plus a cursor at the last position found. A lookup walks forward
+ * from whichever is closer, so both random and sequential access take a
+ * bounded number of steps.
+ */
+
+#define STRINDEX_STRIDE 32
+
+typedef struct string_index_s {
+  // marks[i] is the byte offset of character i * STRINDEX_STRIDE
+  size_t *marks;
+  size_t num_marks;
+  size_t cursor_char;
+  size_t cursor_byte;
+} string_index_t;
+
+// Counts the characters of a string whose bytes have just been written
+void string_note_contents(string_entry_t *entry);
+size_t string_char_length(string_entry_t *entry);
+// The byte offset of character k, where k may be the character length
+size_t string_byte_offset(string_entry_t *entry, size_t k);
+
+#endif
@@ -2,11 +2,32 @@
 #include "memory.h"
 #include "interpreter.h"
 #include "primitives.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "expander.h"
+#include "quicken.h"
+#include "intern.h"
+#include "srcloc.h"
+#include "memo.h"
+#include "hashtable.h"
+#include "records.h"
+#include "error.h"
+
+void (*g_error_context_func)(FILE *out) = NULL;
 
 int system_init(void) {
   memory_init();
   interpreter_init();
   primitives_init();
+  jit_init();
+  optimizer_init();
+  expander_init();
+  quicken_init();
+  intern_init();
+  srcloc_init();
+  memo_init();
+  hashtable_init();
+  records_init();
 
   return 0;
 }